@@ -20,6 +20,9 @@
 
 #include <stdint.h>
 #include <stddef.h>
+
+#include "fdb_errors.h"
+
 #ifndef _MSC_VER
 #include <stdbool.h>
 #else
@@ -116,6 +119,25 @@ enum {
     FDB_DRB_ODIRECT_ASYNC = 0x3
 };
 
+/**
+ * I/O backends for ForestDB files.
+ */
+typedef uint8_t fdb_io_backend_t;
+enum {
+    /**
+     * Synchronous system calls (pread, pwrite, and fsync).
+     */
+    FDB_IO_BACKEND_SYNC = 0,
+    /**
+     * Linux io_uring. Batched reads of prefetching and compaction, and
+     * write-backs of the buffer cache are submitted together so that
+     * multiple I/O requests are in flight, and a commit header write is
+     * linked with the following fsync. If io_uring is not supported by
+     * the platform or the kernel, the synchronous backend is used instead.
+     */
+    FDB_IO_BACKEND_IO_URING = 1
+};
+
 /**
  * Options for compaction mode.
  */
@@ -179,6 +201,15 @@ typedef struct {
      * ForestDB files.
      */
     uint64_t buffercache_size;
+    /**
+     * Percentage of the buffer cache used to share decoded B+-tree root and
+     * internal nodes among all handles, without copying them on every
+     * lookup. The rest of the buffer cache is used for file blocks. It
+     * should be less than 100, and setting it to zero (or disabling the
+     * buffer cache) disables the node sharing. It is set to 10% by default.
+     * This is a global config that is used across all ForestDB files.
+     */
+    uint8_t buffercache_node_ratio;
     /**
      * WAL index size threshold in memory (4096 entries by default).
      * This is a local config to each ForestDB file.
@@ -267,6 +298,95 @@ typedef struct {
      * prefetching is disabled. This is a local config to each ForestDB file.
      */
     uint64_t prefetch_duration;
+    /**
+     * Percentage of the buffer cache reserved for B+-tree index nodes.
+     * Document blocks cannot evict index nodes while index nodes occupy less
+     * than this share of the cache, so that upper levels of the index are
+     * kept in the cache under workloads with large documents. If it is set
+     * to zero, index nodes and document blocks share the cache without any
+     * reservation. It is set to 30% by default. This is a global config that
+     * is used across all ForestDB files.
+     */
+    uint8_t buffercache_index_ratio;
+    /**
+     * I/O backend used for all ForestDB files. It is set to
+     * FDB_IO_BACKEND_SYNC by default. This is a global config that is used
+     * across all ForestDB files.
+     */
+    fdb_io_backend_t io_backend;
+    /**
+     * Maximum number of I/O requests in flight per batch when the io_uring
+     * backend is used. It is set to 64 by default. This is a global config
+     * that is used across all ForestDB files.
+     */
+    uint16_t io_queue_depth;
+    /**
+     * Flag to enable group commit. If enabled, synchronous commits issued
+     * concurrently on the same file while an fsync is in flight are merged
+     * into the next batch, which is made durable by a single fsync. Each
+     * commit still returns only after its header becomes durable. This
+     * option is ignored if FDB_DRB_ASYNC is set. It is disabled by default.
+     */
+    bool group_commit;
+    /**
+     * Number of threads that read documents from the old file in parallel
+     * during compaction. The compaction thread appends the documents read by
+     * them to the new file, and another thread builds the index of the new
+     * file meanwhile. If it is set to zero, compaction is done by a single
+     * thread. It is set to 2 by default. This is a local config to each
+     * ForestDB file.
+     */
+    uint8_t compaction_num_threads;
+    /**
+     * Fill factor (in percent) of B+tree nodes in the main index of the new
+     * file during compaction. If it is set to a non-zero value, the main
+     * index is built bottom-up from the documents moved in key order, and
+     * each node is filled up to the given percentage, instead of inserting
+     * the documents into the index of the new file through its WAL. Setting
+     * it to zero disables the bulk loading. It is set to 90 by default.
+     * This is a local config to each ForestDB file.
+     */
+    uint8_t compaction_fill_factor;
+    /**
+     * Maximum size (in bytes) of memory used by the WAL entries (including
+     * their keys) of all ForestDB files. Once it is exceeded, the WAL
+     * entries of the files that use the most memory are flushed first by
+     * the WAL flusher thread (even if no writer updates those files), in
+     * the same way as the WAL threshold is reached. Writers of any file are
+     * stalled while the usage is far beyond the budget. Setting it to zero
+     * disables the budget. It is set to 256MB by default. This is a global
+     * config that is used across all ForestDB files.
+     */
+    uint64_t wal_memory_budget;
+    /**
+     * Soft limit (in bytes) of memory used by the WAL entries (including
+     * their keys) of a ForestDB file. Exceeding it has the same effect as
+     * reaching the WAL threshold. Setting it to zero disables the limit.
+     * It is set to 16MB by default. This is a local config to each
+     * ForestDB file.
+     */
+    uint64_t wal_memory_limit;
+    /**
+     * Number of threads that parse documents in parallel when the WAL is
+     * restored on open after an unclean shutdown. The blocks to be restored
+     * are read in large sequential units, and the opening thread inserts the
+     * documents parsed by them into the WAL in file order. If it is set to
+     * zero, the opening thread parses all the documents by itself. It is set
+     * to 2 by default. This is a local config to each ForestDB file.
+     */
+    uint8_t recovery_num_threads;
+    /**
+     * Number of bits per key of the Bloom filter of all keys in the main
+     * index, which lets fdb_get() and fdb_get_metaonly() return
+     * FDB_RESULT_KEY_NOT_FOUND for most missing keys without walking the
+     * index. The filter is maintained from the creation or the compaction
+     * of a file, and written along with the KV store header on commit, so
+     * the filter of an existing file is available only after it is
+     * compacted with a non-zero value. KV stores using custom key orders do
+     * not use the filter. Setting it to zero disables the filter. It is set
+     * to 0 by default. This is a local config to each ForestDB file.
+     */
+    uint8_t bloom_bits_per_key;
 } fdb_config;
 
 typedef struct {
@@ -341,6 +461,16 @@ typedef void (*fdb_log_callback)(int err_code, const char *err_msg, void *ctx_da
  */
 typedef struct _fdb_file_handle fdb_file_handle;
 
+/**
+ * Pointer type definition of a callback function invoked when a commit
+ * requested by fdb_commit_async() becomes durable. HEADER_REVNUM is the
+ * revision number of the DB header made durable by the commit.
+ */
+typedef void (*fdb_commit_callback)(fdb_file_handle *fhandle,
+                                    fdb_status status,
+                                    uint64_t header_revnum,
+                                    void *ctx_data);
+
 /**
  * Opaque reference to a ForestDB KV store handle, which is exposed in public APIs.
  */
@@ -465,6 +595,134 @@ typedef struct {
     fdb_file_handle* file;
 } fdb_kvs_info;
 
+/**
+ * Information about the global buffer cache
+ */
+typedef struct {
+    /**
+     * Total number of blocks in the buffer cache.
+     */
+    uint64_t num_blocks;
+    /**
+     * Number of free blocks.
+     */
+    uint64_t num_free_blocks;
+    /**
+     * Number of dirty blocks.
+     */
+    uint64_t num_dirty_blocks;
+    /**
+     * Number of clean B+-tree index node blocks.
+     */
+    uint64_t num_index_blocks;
+    /**
+     * Number of clean document blocks.
+     */
+    uint64_t num_data_blocks;
+    /**
+     * Number of blocks reserved for B+-tree index nodes.
+     */
+    uint64_t num_index_reserved_blocks;
+    /**
+     * Number of B+-tree index node blocks evicted from the cache.
+     */
+    uint64_t num_index_evictions;
+    /**
+     * Number of document blocks evicted from the cache.
+     */
+    uint64_t num_data_evictions;
+} fdb_buffer_cache_info;
+
+/**
+ * Group commit statistics of a ForestDB file.
+ */
+typedef struct {
+    /**
+     * Number of commits made durable by group commit.
+     */
+    uint64_t num_commits;
+    /**
+     * Number of fsyncs issued by group commit.
+     */
+    uint64_t num_syncs;
+    /**
+     * Number of commits made durable by the last fsync.
+     */
+    uint64_t last_batch_size;
+    /**
+     * Maximum number of commits made durable by a single fsync.
+     */
+    uint64_t max_batch_size;
+} fdb_group_commit_info;
+
+/**
+ * Statistics of WAL flushes before commit of a ForestDB file
+ * (in 'wal_flush_before_commit' or 'auto_commit' mode).
+ */
+typedef struct {
+    /**
+     * Number of WAL flushes done by the background flusher thread.
+     */
+    uint64_t num_bg_flushes;
+    /**
+     * Total time (in microseconds) spent on the background WAL flushes.
+     */
+    uint64_t bg_flush_time;
+    /**
+     * Number of WAL flushes done by writers themselves, because the number of
+     * WAL entries exceeded the hard limit.
+     */
+    uint64_t num_stalls;
+    /**
+     * Total time (in microseconds) writers were stalled by those flushes.
+     */
+    uint64_t stall_time;
+} fdb_wal_flush_info;
+
+/**
+ * Memory usage of WAL entries.
+ */
+typedef struct {
+    /**
+     * Bytes used by the WAL entries (including their keys) of a ForestDB file.
+     */
+    uint64_t mem_usage;
+    /**
+     * Bytes used by the WAL entries of all ForestDB files.
+     */
+    uint64_t global_mem_usage;
+    /**
+     * Global WAL memory budget in bytes (0 if unlimited).
+     */
+    uint64_t global_mem_budget;
+} fdb_wal_memory_info;
+
+/**
+ * Statistics of the Bloom filter of a ForestDB file.
+ */
+typedef struct {
+    /**
+     * Number of keys added to the filter.
+     */
+    uint64_t num_keys;
+    /**
+     * Bytes used by the filter.
+     */
+    uint64_t space_used;
+    /**
+     * Number of lookups that consulted the filter.
+     */
+    uint64_t num_lookups;
+    /**
+     * Number of lookups answered by the filter without walking the index.
+     */
+    uint64_t num_negatives;
+    /**
+     * Number of lookups that walked the index but did not find the key.
+     */
+    uint64_t num_false_positives;
+} fdb_bloom_filter_info;
+
 /**
  * List of ForestDB KV store names
  */
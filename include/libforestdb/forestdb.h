@@ -197,6 +197,30 @@ LIBFDB_API
 fdb_status fdb_get(fdb_kvs_handle *handle,
                    fdb_doc *doc);
 
+/**
+ * Retrieve the metadata and doc bodies for multiple keys at once.
+ * Keys are looked up in key order, and the docs are then read in the order
+ * of their offsets on disk, so that a batch of lookups shares index node
+ * visits and reads adjacent blocks together. This is faster than calling
+ * fdb_get for each key.
+ * Note that each FDB_DOC instance should be created by calling
+ * fdb_doc_create(doc, key, keylen, NULL, 0, NULL, 0) before using this API.
+ *
+ * @param handle Pointer to ForestDB KV store handle.
+ * @param docs Array of pointers to ForestDB doc instances whose metadata and
+ *        doc bodies are populated as a result of this API call.
+ * @param num_docs Number of doc instances in the array.
+ * @param statuses Array of num_docs statuses, where the result of each key is
+ *        returned in the same way as fdb_get (e.g., FDB_RESULT_SUCCESS or
+ *        FDB_RESULT_KEY_NOT_FOUND).
+ * @return FDB_RESULT_SUCCESS if the statuses are populated.
+ */
+LIBFDB_API
+fdb_status fdb_get_multi(fdb_kvs_handle *handle,
+                         fdb_doc **docs,
+                         size_t num_docs,
+                         fdb_status *statuses);
+
 /**
  * Retrieve the metadata for a given key.
  * Note that FDB_DOC instance should be created by calling
@@ -345,6 +369,28 @@ fdb_status fdb_del_kv(fdb_kvs_handle *handle,
 LIBFDB_API
 fdb_status fdb_commit(fdb_file_handle *fhandle, fdb_commit_opt_t opt);
 
+/**
+ * Commit all pending changes on a ForestDB file without waiting for fsync.
+ * The changes become visible to other handles immediately, and a background
+ * syncer thread makes them durable and then invokes the callback with the
+ * revision number of the durable DB header. The fsync is issued even if
+ * FDB_DRB_ASYNC is set. Callbacks are invoked in commit order, and
+ * fdb_close() waits until all pending callbacks on the file are invoked, so
+ * the callback should not close the file.
+ * Note that this API should be invoked with a ForestDB file handle.
+ *
+ * @param fhandle Pointer to ForestDB file handle.
+ * @param opt Commit option.
+ * @param callback Callback function invoked when the commit becomes durable.
+ * @param ctx_data Pointer to the context data passed to the callback.
+ * @return FDB_RESULT_SUCCESS if the commit is made visible, in which case
+ *         the callback is always invoked. Otherwise the callback is not
+ *         invoked.
+ */
+LIBFDB_API
+fdb_status fdb_commit_async(fdb_file_handle *fhandle, fdb_commit_opt_t opt,
+                            fdb_commit_callback callback, void *ctx_data);
+
 /**
  * Create a snapshot of a KV store.
  *
@@ -610,6 +656,64 @@ fdb_status fdb_get_file_info(fdb_file_handle *fhandle, fdb_file_info *info);
 LIBFDB_API
 fdb_status fdb_get_kvs_info(fdb_kvs_handle *handle, fdb_kvs_info *info);
 
+/**
+ * Return the information about the global buffer cache.
+ *
+ * @param info Pointer to Buffer Cache Info instance.
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_get_buffer_cache_info(fdb_buffer_cache_info *info);
+
+/**
+ * Return the group commit statistics of a ForestDB file.
+ *
+ * @param fhandle Pointer to ForestDB file handle.
+ * @param info Pointer to Group Commit Info instance.
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_get_group_commit_info(fdb_file_handle *fhandle,
+                                     fdb_group_commit_info *info);
+
+/**
+ * Return the statistics of WAL flushes before commit of a ForestDB file,
+ * i.e., time spent by the background flusher thread versus time writers
+ * were stalled by flushing WAL entries by themselves.
+ *
+ * @param fhandle Pointer to ForestDB file handle.
+ * @param info Pointer to WAL Flush Info instance.
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_get_wal_flush_info(fdb_file_handle *fhandle,
+                                  fdb_wal_flush_info *info);
+
+/**
+ * Return the memory usage of WAL entries of a ForestDB file, and that of
+ * all ForestDB files.
+ *
+ * @param fhandle Pointer to ForestDB file handle.
+ * @param info Pointer to WAL Memory Info instance.
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_get_wal_memory_info(fdb_file_handle *fhandle,
+                                   fdb_wal_memory_info *info);
+
+/**
+ * Return the statistics of the Bloom filter of a ForestDB file.
+ * All values are zero if the filter is not maintained for the file
+ * (see bloom_bits_per_key in fdb_config).
+ *
+ * @param fhandle Pointer to ForestDB file handle.
+ * @param info Pointer to Bloom Filter Info instance.
+ * @return FDB_RESULT_SUCCESS on success.
+ */
+LIBFDB_API
+fdb_status fdb_get_bloom_filter_info(fdb_file_handle *fhandle,
+                                     fdb_bloom_filter_info *info);
+
 /**
  * Get the current sequence number of a ForestDB KV store instance.
  *
@@ -58,11 +58,32 @@
 #define FDB_BLOCKSIZE (4096)
 // MUST BE a power of 2
 #define FDB_WAL_NBUCKET (4*1024)
+// number of lock partitions of the WAL index per file,
+// MUST BE a power of 2 (and not greater than FDB_WAL_NBUCKET)
+#define FDB_WAL_NSHARDS (16)
+// size of a chunk that WAL entries are allocated from, MUST BE a power of 2
+#define FDB_WAL_ARENA_CHUNKSIZE (16384)
 #define FDB_MAX_FILENAME_LEN (1024)
 #define FDB_MAX_KVINS_NAME_LEN (65536)
 #define FDB_WAL_THRESHOLD (4*1024)
+// flush WAL entries before commit in a background thread once the number of
+// flushable entries exceeds the WAL threshold, instead of in the writer that
+// crosses it (for 'wal_flush_before_commit' or 'auto_commit' mode)
+#define __FDB_WAL_FLUSHER
+// writers flush WAL entries by themselves (i.e., are stalled) when the number
+// of flushable entries exceeds this multiple of the WAL threshold
+#define FDB_WAL_FLUSHER_HARD_LIMIT (4)
+// max # WAL entries that are sorted by key and applied to the main index
+// (HB+trie and sequence tree) in a single batch
+#define FDB_WAL_FLUSH_BATCHSIZE (1024)
 #define FDB_COMP_BUF_MAXSIZE (4*1024*1024)
 #define FDB_COMPACTION_BATCHSIZE (128)
+#define FDB_COMPACTION_MAX_THREADS (64)
+// crash recovery reads the blocks to be restored into WAL in this unit
+#define FDB_RECOVERY_READ_UNIT (4194304) // 4MB
+// number of docs that a recovery thread parses at once
+#define FDB_RECOVERY_PARSE_BATCH (256)
+#define FDB_RECOVERY_MAX_THREADS (64)
 #define FDB_COMPACTOR_SLEEP_DURATION (15)
 #define FDB_DEFAULT_COMPACTION_THRESHOLD (30)
 
@@ -70,13 +91,35 @@
 //#define BCACHE_NBUCKET (1024*1024)
 #define BCACHE_NBUCKET (4096)
 #define BCACHE_NDICBUCKET (4096)
+// number of lock partitions per file, MUST BE a power of 2
+#define BCACHE_NSHARDS (16)
 #define BCACHE_FLUSH_UNIT (1048576) // 1MB
 #define BCACHE_EVICT_UNIT (1)
 #define BCACHE_RANDOM_VICTIM_UNIT (2)
+// max percentage of cache blocks that can be pinned at the same time
+#define BCACHE_PIN_RATIO (50)
 #define __BCACHE_SECOND_CHANCE
 #define __BCACHE_RANDOM_VICTIM
+// use scan-resistant 2Q replacement policy instead of second-chance LRU
+#define __BCACHE_2Q
+// 2Q: max size of the FIFO queue for newly cached blocks (A1in),
+//     and the number of remembered blocks evicted from A1in (A1out)
+//     (percentage of cache size)
+#define BCACHE_2Q_A1IN_RATIO (25)
+#define BCACHE_2Q_A1OUT_RATIO (50)
+// write back dirty blocks in a background thread
+#define __BCACHE_FLUSHER
+// the flusher writes back dirty blocks when the number of free and clean
+// blocks falls below this watermark (percentage of cache size)
+#define BCACHE_FLUSHER_LOW_WATERMARK (20)
+// writers write back dirty blocks by themselves (i.e., are throttled) when
+// the number of dirty blocks exceeds this watermark (percentage of cache size)
+#define BCACHE_FLUSHER_HIGH_WATERMARK (90)
+// max sleep time of the flusher (in milliseconds)
+#define BCACHE_FLUSHER_SLEEP_MS (100)
 
 #define FILEMGR_PREFETCH_UNIT (4194304) // 4MB
+#define FILEMGR_PREFETCH_BATCH (64) // number of blocks read at once
 #define __FILEMGR_MUTEX_LOCK
 #define __FILEMGR_DATA_PARTIAL_LOCK
 //#define __FILEMGR_DATA_MUTEX_LOCK
@@ -84,13 +127,30 @@
 #define __BTREEBLK_BLOCKPOOL
 #define __BTREEBLK_SUBBLOCK
 //#define __BTREEBLK_READ_TREE // not used now, for future use
+// read committed index nodes from pinned cache blocks without copying
+#define __BTREEBLK_PINNED_READ
+// share decoded root and internal nodes of committed B+trees among all
+// handles through a process-wide node cache (requires __BTREEBLK_PINNED_READ);
+// its size is taken out of the buffer cache (see 'buffercache_node_ratio')
+#define __BTREEBLK_NODECACHE
 #define BTREEBLK_AGE_LIMIT (10)
+// max # blocks in the read list of a btreeblk handle
+// (least recently used clean blocks are evicted)
+#define BTREEBLK_READ_LIST_LIMIT (1024)
 #define BTREEBLK_MIN_SUBBLOCK (128)
 //#define __BTREEBLK_CACHE
 #ifdef __BTREEBLK_CACHE
     #define BTREEBLK_CACHE_LIMIT (8)
 #endif
 
+// find 8-byte binary keys in B+tree nodes without get_kv() and cmp() calls:
+// the binary search stops once the range is narrowed down to this many
+// entries, and then all keys in the range are compared at once
+#define BTREE_SEARCH_SCAN_RANGE (16)
+// compare the keys in the range with SSE4.2 or AVX2 instructions
+// (if the CPU supports them)
+#define __BTREE_SIMD_SEARCH
+
 //#define __UTREE
 #ifdef __UTREE
     #define __UTREE_HEADER_SIZE (16)
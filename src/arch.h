@@ -272,6 +272,12 @@
         (addr = (void*)_aligned_malloc((size), (align)))
     #define free_align(addr) _aligned_free(addr)
 
+    // for vectored I/O
+    struct iovec {
+        void *iov_base;
+        size_t iov_len;
+    };
+
     #ifndef spin_t
         // spinlock
         #define spin_t CRITICAL_SECTION
@@ -0,0 +1,150 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "arena.h"
+#include "arch.h"
+
+#include "memleak.h"
+
+struct arena_chunk {
+    // # objects allocated from this chunk and not freed yet
+    size_t nlive;
+    // offset of the next object
+    size_t offset;
+    struct list_elem le;
+};
+
+// every object is aligned to 8 bytes
+#define _ARENA_ALIGN(size) (((size) + 7) & ~((size_t)7))
+#define _ARENA_CHUNK_HEADER _ARENA_ALIGN(sizeof(struct arena_chunk))
+
+INLINE struct arena_chunk * _arena_get_chunk(struct arena *arena, void *ptr)
+{
+    return (struct arena_chunk *)((size_t)ptr & ~(arena->chunksize - 1));
+}
+
+static struct arena_chunk * _arena_chunk_alloc(struct arena *arena)
+{
+    void *addr = NULL;
+    struct arena_chunk *chunk;
+
+    malloc_align(addr, arena->chunksize, arena->chunksize);
+    if (addr == NULL) {
+        return NULL;
+    }
+    chunk = (struct arena_chunk *)addr;
+    chunk->nlive = 0;
+    chunk->offset = _ARENA_CHUNK_HEADER;
+    arena->nchunks++;
+    return chunk;
+}
+
+static void _arena_chunk_free(struct arena *arena, struct arena_chunk *chunk)
+{
+    arena->nchunks--;
+    free_align(chunk);
+}
+
+void arena_init(struct arena *arena, size_t chunksize)
+{
+    arena->chunksize = chunksize;
+    // objects bigger than a quarter of a chunk are malloc'ed,
+    // so that the tail of a chunk is not wasted too much
+    arena->max_alloc = (chunksize - _ARENA_CHUNK_HEADER) / 4;
+    arena->cur = NULL;
+    list_init(&arena->chunks);
+    arena->nchunks = 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    void *ptr;
+    struct arena_chunk *chunk = arena->cur;
+
+    if (size > arena->max_alloc) {
+        return malloc(size);
+    }
+
+    size = _ARENA_ALIGN(size);
+    if (chunk == NULL || chunk->offset + size > arena->chunksize) {
+        if (chunk) {
+            // the current chunk is full .. retire it
+            // (it has at least one live object, otherwise its offset
+            //  would have been reset by arena_free())
+            list_push_back(&arena->chunks, &chunk->le);
+        }
+        chunk = arena->cur = _arena_chunk_alloc(arena);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+
+    ptr = (uint8_t *)chunk + chunk->offset;
+    chunk->offset += size;
+    chunk->nlive++;
+    return ptr;
+}
+
+void arena_free(struct arena *arena, void *ptr, size_t size)
+{
+    struct arena_chunk *chunk;
+
+    if (size > arena->max_alloc) {
+        free(ptr);
+        return;
+    }
+
+    chunk = _arena_get_chunk(arena, ptr);
+    assert(chunk->nlive > 0);
+    if (--chunk->nlive > 0) {
+        return;
+    }
+
+    if (chunk == arena->cur) {
+        // reuse the current chunk from the beginning
+        chunk->offset = _ARENA_CHUNK_HEADER;
+    } else {
+        // all objects in the retired chunk are freed
+        list_remove(&arena->chunks, &chunk->le);
+        _arena_chunk_free(arena, chunk);
+    }
+}
+
+void arena_free_all(struct arena *arena)
+{
+    struct list_elem *e;
+    struct arena_chunk *chunk;
+
+    e = list_begin(&arena->chunks);
+    while (e) {
+        chunk = _get_entry(e, struct arena_chunk, le);
+        e = list_remove(&arena->chunks, e);
+        _arena_chunk_free(arena, chunk);
+    }
+    if (arena->cur) {
+        _arena_chunk_free(arena, arena->cur);
+        arena->cur = NULL;
+    }
+}
+
+size_t arena_get_num_chunks(struct arena *arena)
+{
+    return arena->nchunks;
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef _JSAHN_ARENA_H
+#define _JSAHN_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "list.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bump allocator for small objects that are usually freed in the order they
+// were allocated (e.g., WAL entries freed by flushing).
+//
+// Memory is carved out of chunks aligned to their size, so that the chunk
+// of an object is found by masking its address. Each chunk counts its live
+// objects, and is returned to the system as a whole once all of them are
+// freed. Objects larger than 'max_alloc' bypass the arena and use malloc().
+//
+// The arena is not thread-safe; the caller should serialize all calls.
+struct arena_chunk;
+struct arena {
+    size_t chunksize;
+    size_t max_alloc;
+    // chunk that objects are currently bump-allocated from
+    struct arena_chunk *cur;
+    // other chunks that still have live objects
+    struct list chunks;
+    size_t nchunks;
+};
+
+// 'chunksize' MUST BE a power of 2
+void arena_init(struct arena *arena, size_t chunksize);
+void *arena_alloc(struct arena *arena, size_t size);
+// 'size' should be the same as the one given to arena_alloc()
+void arena_free(struct arena *arena, void *ptr, size_t size);
+// release all chunks at once, regardless of live objects in them
+// (objects bigger than 'max_alloc' should be freed by the caller)
+void arena_free_all(struct arena *arena);
+size_t arena_get_num_chunks(struct arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,6 +25,8 @@
 #include "list.h"
 #include "blockcache.h"
 #include "avltree.h"
+#include "atomic.h"
+#include "time_utils.h"
 
 #include "memleak.h"
 
@@ -39,21 +41,95 @@
 #endif
 #endif
 
-// global lock
+// global lock (only for creating/removing file entries)
 static spin_t bcache_lock;
-static size_t fnames;
+// number of BCACHE_LOCK acquisitions (protected by BCACHE_LOCK)
+static uint64_t bcache_lock_count;
 
 // hash table for filename
 static struct hash fnamedic;
+// ID of the next file entry (never reused, unlike the entry's address)
+static uint64_t fnamedic_next_id;
+
+// max number of queues that a replacement policy can use
+#define BCACHE_MAX_QUEUES (2)
+#define BCACHE_NO_QUEUE (0xff)
+
+// classes of clean blocks, classified by block marker
+#define BCACHE_CLASS_DATA (0)
+#define BCACHE_CLASS_INDEX (1)
+#define BCACHE_NCLASSES (2)
+
+struct bcache_partition;
+
+// clean blocks of the same class in a partition
+// (each class has its own queues of the replacement policy)
+struct bcache_pool {
+    // queues of clean blocks (used by the replacement policy)
+    struct list queue[BCACHE_MAX_QUEUES];
+    size_t nqueue[BCACHE_MAX_QUEUES];
+    // number of blocks in the queues
+    size_t nitems;
+    // expected max number of blocks of this class
+    size_t capacity;
+    // number of evicted blocks
+    uint64_t nevict;
+    // policy-specific data
+    void *aux;
+    struct bcache_partition *part;
+};
 
-// free block list
-static size_t freelist_count=0;
-static struct list freelist;
-static spin_t freelist_lock;
-
-// file structure list
-static struct list file_lru, file_empty;
+// global partitions of the cache (one partition per shard index);
+// clean blocks of all files are managed by the replacement policy
+// together, so victims are chosen globally instead of file-by-file.
+// lock order: SHARD_LOCK -> item lock -> partition lock
+struct bcache_partition {
+    // free block list
+    struct list freelist;
+    struct bcache_pool pool[BCACHE_NCLASSES];
+    // number of blocks that belong to this partition
+    size_t capacity;
+    // number of index blocks that cannot be evicted by data blocks
+    size_t index_reserved;
+    spin_t lock;
+};
+static struct bcache_partition *partitions;
+// percentage of the cache reserved for index blocks
+// (0: index and data blocks are not distinguished)
+static int bcache_index_ratio;
+static atomic_val_t freelist_count;
+
+// array of file structures (used for victim selection)
+static struct fnamedic_item **file_list;
+static size_t num_files, file_list_capacity;
 static spin_t filelist_lock;
+// number of FILELIST_LOCK acquisitions (protected by FILELIST_LOCK)
+static uint64_t filelist_lock_count;
+
+// logical clock for approximated file LRU
+// (advanced on every eviction round)
+static atomic_val_t bcache_clock;
+
+// number of pinned blocks, and its upper bound
+static atomic_val_t bcache_npinned;
+static uint64_t bcache_pin_limit;
+
+// number of dirty blocks
+static atomic_val_t bcache_ndirty;
+// the flusher writes back dirty blocks while the number of dirty blocks
+// exceeds FLUSHER_START, and writers are throttled while it exceeds
+// THROTTLE_START
+static uint64_t bcache_flusher_start;
+static uint64_t bcache_throttle_start;
+
+#ifdef __BCACHE_FLUSHER
+// background writeback thread
+static thread_t bcache_flusher_tid;
+static mutex_t bcache_flusher_lock;
+static thread_cond_t bcache_flusher_cond;
+static volatile uint8_t bcache_flusher_sleeping;
+static volatile uint8_t bcache_flusher_terminate;
+#endif
 
 //static struct list cleanlist, dirtylist;
 //static uint64_t nfree, nclean, ndirty;
@@ -61,39 +137,56 @@ static uint64_t bcache_nblock;
 
 static int bcache_blocksize;
 static size_t bcache_flush_unit;
+static size_t bcache_nshards;
+
+struct bcache_shard {
+    // list for clean blocks
+    struct list cleanlist;
+    // tree for normal dirty blocks
+    struct avl_tree tree;
+    // tree for index nodes
+    struct avl_tree tree_idx;
+    // hash table for block lookup
+    struct hash hashtable;
+    spin_t lock;
+};
 
 struct fnamedic_item {
     char *filename;
     uint16_t filename_len;
     uint32_t hash;
+    // unique ID of the entry
+    uint64_t id;
 
     // current opened filemgr instance
     // (can be changed on-the-fly when file is closed and re-opened)
     struct filemgr *curfile;
 
-    // list for clean blocks
-    struct list cleanlist;
-    // tree for normal dirty blocks
-    struct avl_tree tree;
-    // tree for index nodes
-    struct avl_tree tree_idx;
-    // hash table for block lookup
-    struct hash hashtable;
+    // block partitions, chosen by hash of BID
+    struct bcache_shard *shards;
+    size_t num_shards;
 
-    // list elem for FILE_LRU
-    struct list_elem le;
-    // current list poitner (FILE_LRU or FILE_EMPTY)
-    struct list *curlist;
+    // index in FILE_LIST
+    size_t list_idx;
     // hash elem for FNAMEDIC
     struct hash_elem hash_elem;
 
-    spin_t lock;
-    uint64_t nvictim;
-    uint64_t nitems;
+    // last access time (in BCACHE_CLOCK) for approximated LRU
+    atomic_val_t access_timestamp;
+    // number of evictors currently referring to this file
+    atomic_val_t ref_count;
+    atomic_val_t nvictim;
+    atomic_val_t nitems;
+    atomic_val_t npinned;
+    atomic_val_t ndirty;
 };
 
 #define BCACHE_DIRTY (0x1)
 #define BCACHE_FREE (0x4)
+// the PREPARE callback of bcache_pin() has been called for the block
+#define BCACHE_PREPARED (0x8)
+// the block was read with BCACHE_HINT_ONCE, and not accessed again yet
+#define BCACHE_ONCE (0x10)
 
 struct bcache_item {
     // BID
@@ -105,10 +198,22 @@ struct bcache_item {
     struct hash_elem hash_elem;
     // list elem for {free, clean, dirty} lists
     struct list_elem list_elem;
+    // list elem for the queues of replacement policy
+    struct list_elem queue_elem;
+    // queue that the item currently belongs to (BCACHE_NO_QUEUE if none)
+    uint8_t queue;
+    // reference bit for the replacement policy
+    // (set on cache hit without grabbing the partition lock)
+    uint8_t ref;
+    // class of the block (BCACHE_CLASS_DATA or BCACHE_CLASS_INDEX)
+    uint8_t cls;
     // flag
     uint8_t flag;
     // score
     uint8_t score;
+    // number of bcache_pin() callers referring to this block
+    // (pinned blocks are detached from the clean list)
+    uint32_t pin_count;
     // spin lock
     spin_t lock;
 
@@ -165,7 +270,9 @@ INLINE int _fname_cmp(struct hash_elem *a, struct hash_elem *b)
 INLINE uint32_t _bcache_hash(struct hash *hash, struct hash_elem *e)
 {
     struct bcache_item *item = _get_entry(e, struct bcache_item, hash_elem);
-    return (item->bid) & ((uint32_t)BCACHE_NBUCKET-1);
+    // BIDs in the same shard share the same remainder,
+    // so use the quotient for the bucket index
+    return (item->bid / bcache_nshards) & ((uint32_t)hash->nbuckets-1);
 }
 
 INLINE int _bcache_cmp(struct hash_elem *a, struct hash_elem *b)
@@ -187,364 +294,1010 @@ INLINE int _bcache_cmp(struct hash_elem *a, struct hash_elem *b)
     #endif
 }
 
-static void _bcache_move_fname_list(struct fnamedic_item *fname, struct list *list)
+INLINE size_t _bcache_shard_idx(struct fnamedic_item *fname, bid_t bid)
 {
-    file_status_t fs;
+    return (bid + fname->hash) % fname->num_shards;
+}
 
-    spin_lock(&filelist_lock);
+INLINE struct bcache_shard * _bcache_get_shard(struct fnamedic_item *fname,
+                                               bid_t bid)
+{
+    return &fname->shards[_bcache_shard_idx(fname, bid)];
+}
 
-    if (fname->curlist != list) {
-        if (list == &file_lru) {
-            fnames++;
-        } else {
-            fnames--;
+// update the access timestamp of the file lazily;
+// the shared cache line is written only once per eviction round.
+INLINE void _bcache_touch_file(struct fnamedic_item *fname,
+                               struct filemgr *file)
+{
+    uint64_t clock = bcache_clock.value.val_64;
+    if (fname->access_timestamp.value.val_64 != clock) {
+        atomic_val_store_64(&fname->access_timestamp, clock);
+    }
+    if (fname->curfile != file) {
+        fname->curfile = file;
+    }
+}
+
+INLINE void _bcache_lock_all_shards(struct fnamedic_item *fname)
+{
+    size_t i;
+    for (i=0;i<fname->num_shards;++i) {
+        spin_lock(&fname->shards[i].lock);
+    }
+}
+
+INLINE void _bcache_unlock_all_shards(struct fnamedic_item *fname)
+{
+    size_t i;
+    for (i=0;i<fname->num_shards;++i) {
+        spin_unlock(&fname->shards[i].lock);
+    }
+}
+
+#define _list_empty(list) (((list).head) == NULL)
+#define _tree_empty(tree) (((tree).root) == NULL)
+
+#define _shard_empty(shard) \
+    ( _list_empty((shard)->cleanlist) && \
+      _tree_empty((shard)->tree)      && \
+      _tree_empty((shard)->tree_idx) )
+
+#define _shard_has_dirty(shard) \
+    ( !_tree_empty((shard)->tree) || \
+      !_tree_empty((shard)->tree_idx) )
+
+#define _file_empty(fname) ((fname)->nitems.value.val_64 == 0)
+#define _file_evictable(fname) \
+    ((fname)->nitems.value.val_64 > (fname)->npinned.value.val_64)
+
+/*
+ * Replacement policy
+ *
+ * All callbacks are invoked while holding the partition lock (and the
+ * SHARD_LOCK and item lock of the block, except for VICTIM and SKIP),
+ * except for ACCESS that is called on every cache hit; it only sets the
+ * reference bit of the block, and grabs the partition lock by itself
+ * when the block has to be moved to another position.
+ * Only clean blocks (including pinned ones) are managed by the policy.
+ * LRU is approximated by CLOCK (reference bit) to avoid contention on
+ * the partition lock.
+ */
+struct bcache_policy {
+    const char *name;
+    void (*init)(struct bcache_pool *pool);
+    void (*free)(struct bcache_pool *pool);
+    // a clean block is newly cached
+    void (*insert)(struct bcache_pool *pool, struct bcache_item *item,
+                   bcache_hint_t hint);
+    // a cached clean block is accessed
+    void (*access)(struct bcache_pool *pool, struct bcache_item *item,
+                   bcache_hint_t hint);
+    // the block leaves the policy (EVICTED is true if it is evicted,
+    // false if it becomes dirty or is invalidated)
+    void (*remove)(struct bcache_pool *pool, struct bcache_item *item,
+                   bool evicted);
+    // choose the next victim (the victim is not removed)
+    struct bcache_item *(*victim)(struct bcache_pool *pool);
+    // the victim cannot be evicted now (e.g., pinned) .. move it away
+    void (*skip)(struct bcache_pool *pool, struct bcache_item *item);
+};
+static struct bcache_policy *bcache_policy;
+
+INLINE void _bcache_queue_push(struct bcache_pool *pool, uint8_t queue,
+                               struct bcache_item *item, bool front)
+{
+    if (front) {
+        list_push_front(&pool->queue[queue], &item->queue_elem);
+    } else {
+        list_push_back(&pool->queue[queue], &item->queue_elem);
+    }
+    pool->nqueue[queue]++;
+    pool->nitems++;
+    item->queue = queue;
+    item->ref = 0;
+}
+
+INLINE void _bcache_queue_remove(struct bcache_pool *pool,
+                                 struct bcache_item *item)
+{
+    list_remove(&pool->queue[item->queue], &item->queue_elem);
+    pool->nqueue[item->queue]--;
+    pool->nitems--;
+    item->queue = BCACHE_NO_QUEUE;
+}
+
+INLINE struct bcache_item *_bcache_queue_tail(struct bcache_pool *pool,
+                                              uint8_t queue)
+{
+    struct list_elem *e = list_end(&pool->queue[queue]);
+    if (e) {
+        return _get_entry(e, struct bcache_item, queue_elem);
+    }
+    return NULL;
+}
+
+// move the item to the head of its queue
+// (ITEM->QUEUE is not changed so that it can be read without lock)
+INLINE void _bcache_queue_touch(struct bcache_pool *pool,
+                                struct bcache_item *item)
+{
+    list_remove(&pool->queue[item->queue], &item->queue_elem);
+    list_push_front(&pool->queue[item->queue], &item->queue_elem);
+}
+
+// pick the tail of the queue; recently referenced items are moved to
+// the head instead (CLOCK)
+INLINE struct bcache_item *_bcache_queue_clock(struct bcache_pool *pool,
+                                               uint8_t queue)
+{
+    struct bcache_item *item;
+
+    while ((item = _bcache_queue_tail(pool, queue))) {
+        if (item->ref) {
+            item->ref = 0;
+            _bcache_queue_touch(pool, item);
+            continue;
         }
+        break;
     }
+    return item;
+}
+
+#ifndef __BCACHE_2Q
+
+/*
+ * (second-chance) LRU: the original policy of ForestDB.
+ * Index nodes get one more chance before being evicted.
+ */
+
+static void _lru_init(struct bcache_pool *pool)
+{
+    pool->aux = NULL;
+}
+
+static void _lru_free(struct bcache_pool *pool)
+{
+    (void)pool;
+}
 
-    if (fname->curlist) {
-        list_remove(fname->curlist, &fname->le);
+static void _lru_insert(struct bcache_pool *pool,
+                        struct bcache_item *item, bcache_hint_t hint)
+{
+    // use-once blocks are placed at the tail so that they are evicted first
+    _bcache_queue_push(pool, 0, item, (hint != BCACHE_HINT_ONCE));
+}
+
+static void _lru_access(struct bcache_pool *pool,
+                        struct bcache_item *item, bcache_hint_t hint)
+{
+    (void)pool;
+    if (hint != BCACHE_HINT_ONCE) {
+        item->ref = 1;
     }
-    if (list) {
-        fs = filemgr_get_file_status(fname->curfile);
+}
 
-        if (list == &file_lru && fs == FILE_COMPACT_OLD) {
-            // insert compact old file always at the tail of LRU
-            list_push_back(list, &fname->le);
-        }else{
-            list_push_front(list, &fname->le);
+static void _lru_remove(struct bcache_pool *pool,
+                        struct bcache_item *item, bool evicted)
+{
+    (void)evicted;
+    _bcache_queue_remove(pool, item);
+}
+
+static struct bcache_item *_lru_victim(struct bcache_pool *pool)
+{
+    struct bcache_item *item;
+
+    while ((item = _bcache_queue_clock(pool, 0))) {
+#ifdef __BCACHE_SECOND_CHANCE
+        if (item->score > 0) {
+            // give second chance to the item
+            item->score--;
+            _bcache_queue_touch(pool, item);
+            continue;
         }
+#endif
+        break;
     }
-    fname->curlist = list;
+    return item;
+}
 
-    spin_unlock(&filelist_lock);
+static void _lru_skip(struct bcache_pool *pool,
+                      struct bcache_item *item)
+{
+    _bcache_queue_touch(pool, item);
 }
 
-#define _list_empty(list) (((list).head) == NULL)
-#define _tree_empty(tree) (((tree).root) == NULL)
+static struct bcache_policy bcache_policy_lru = {
+    "lru",
+    _lru_init,
+    _lru_free,
+    _lru_insert,
+    _lru_access,
+    _lru_remove,
+    _lru_victim,
+    _lru_skip
+};
+
+#endif // __BCACHE_2Q
+
+#ifdef __BCACHE_2Q
+
+/*
+ * 2Q (T. Johnson and D. Shasha, VLDB '94)
+ *
+ * Newly cached blocks enter the FIFO queue A1in, and the identifiers of
+ * blocks evicted from A1in are remembered in A1out. Only blocks that are
+ * referenced again while they are in A1out are promoted to the LRU queue
+ * Am, so that a single scan (e.g., full iteration or compaction) cannot
+ * flush out frequently used blocks.
+ */
+
+#define BCACHE_2Q_A1IN (0)
+#define BCACHE_2Q_AM (1)
+
+struct bcache_2q_ghost {
+    // ID of the file entry (ghosts of the removed files are not purged,
+    // but just age out, so the entry's address cannot be used)
+    uint64_t fid;
+    bid_t bid;
+    struct hash_elem hash_elem;
+    struct list_elem list_elem;
+};
+
+struct bcache_2q_aux {
+    // max size of A1in
+    size_t kin;
+    // A1out (most recently evicted one first)
+    struct list ghost_list;
+    struct list ghost_free;
+    struct hash ghost_hash;
+    struct bcache_2q_ghost *ghosts;
+};
 
-#define _file_empty(fname) \
-    ( _list_empty((fname)->cleanlist) && \
-      _tree_empty((fname)->tree)      && \
-      _tree_empty((fname)->tree_idx) )
+INLINE uint32_t _2q_ghost_hash(struct hash *hash, struct hash_elem *e)
+{
+    struct bcache_2q_ghost *ghost;
+    ghost = _get_entry(e, struct bcache_2q_ghost, hash_elem);
+    return (uint32_t)((ghost->bid / bcache_nshards) +
+                      ghost->fid) % hash->nbuckets;
+}
 
-struct fnamedic_item *_bcache_get_victim()
+INLINE int _2q_ghost_cmp(struct hash_elem *a, struct hash_elem *b)
 {
-    struct list_elem *e = NULL, *prev;
+    struct bcache_2q_ghost *aa, *bb;
+    aa = _get_entry(a, struct bcache_2q_ghost, hash_elem);
+    bb = _get_entry(b, struct bcache_2q_ghost, hash_elem);
 
-    spin_lock(&filelist_lock);
+    if (aa->fid != bb->fid) {
+        return (aa->fid < bb->fid)?(-1):(1);
+    }
+    if (aa->bid == bb->bid) return 0;
+    else if (aa->bid < bb->bid) return -1;
+    else return 1;
+}
 
-#ifdef __BCACHE_RANDOM_VICTIM
-    size_t i, r;
+static void _2q_init(struct bcache_pool *pool)
+{
+    size_t i, kout;
+    struct bcache_2q_aux *aux;
+
+    aux = (struct bcache_2q_aux *)malloc(sizeof(struct bcache_2q_aux));
+    aux->kin = MAX(pool->capacity * BCACHE_2Q_A1IN_RATIO / 100, 1);
+    kout = MAX(pool->capacity * BCACHE_2Q_A1OUT_RATIO / 100, 1);
+
+    list_init(&aux->ghost_list);
+    list_init(&aux->ghost_free);
+    hash_init(&aux->ghost_hash, kout, _2q_ghost_hash, _2q_ghost_cmp);
+    aux->ghosts = (struct bcache_2q_ghost *)
+                  malloc(sizeof(struct bcache_2q_ghost) * kout);
+    for (i=0;i<kout;++i) {
+        list_push_back(&aux->ghost_free, &aux->ghosts[i].list_elem);
+    }
+    pool->aux = aux;
+}
 
-    if (fnames > BCACHE_RANDOM_VICTIM_UNIT){
-        r = rand() % BCACHE_RANDOM_VICTIM_UNIT;
-    }else{
-        r = 0;
+static void _2q_free(struct bcache_pool *pool)
+{
+    struct bcache_2q_aux *aux = (struct bcache_2q_aux *)pool->aux;
+
+    hash_free(&aux->ghost_hash);
+    free(aux->ghosts);
+    free(aux);
+    pool->aux = NULL;
+}
+
+static void _2q_insert(struct bcache_pool *pool,
+                       struct bcache_item *item, bcache_hint_t hint)
+{
+    struct bcache_2q_aux *aux = (struct bcache_2q_aux *)pool->aux;
+    struct bcache_2q_ghost query, *ghost;
+    struct hash_elem *h;
+
+    if (hint == BCACHE_HINT_ONCE) {
+        // use-once blocks are evicted first, and not remembered in A1out
+        item->flag |= BCACHE_ONCE;
+        _bcache_queue_push(pool, BCACHE_2Q_A1IN, item, false);
+        return;
     }
-    e = prev = list_end(&file_lru);
 
-    for (i=0;i<r;++i){
+    query.fid = item->fname->id;
+    query.bid = item->bid;
+    h = hash_find(&aux->ghost_hash, &query.hash_elem);
+    if (h) {
+        // referenced again after eviction from A1in .. promote to Am
+        ghost = _get_entry(h, struct bcache_2q_ghost, hash_elem);
+        hash_remove(&aux->ghost_hash, &ghost->hash_elem);
+        list_remove(&aux->ghost_list, &ghost->list_elem);
+        list_push_front(&aux->ghost_free, &ghost->list_elem);
+        _bcache_queue_push(pool, BCACHE_2Q_AM, item, true);
+    } else {
+        _bcache_queue_push(pool, BCACHE_2Q_A1IN, item, true);
+    }
+}
+
+static void _2q_access(struct bcache_pool *pool,
+                       struct bcache_item *item, bcache_hint_t hint)
+{
+    if (hint == BCACHE_HINT_ONCE) {
+        return;
+    }
+
+    if (item->flag & BCACHE_ONCE) {
+        // the first normal access to a use-once (e.g., prefetched) block
+        spin_lock(&pool->part->lock);
+        item->flag &= ~BCACHE_ONCE;
+        _bcache_queue_touch(pool, item);
+        spin_unlock(&pool->part->lock);
+    } else if (item->queue == BCACHE_2Q_AM) {
+        item->ref = 1;
+    }
+    // otherwise, correlated reference in A1in .. ignore
+}
+
+static void _2q_remove(struct bcache_pool *pool,
+                       struct bcache_item *item, bool evicted)
+{
+    struct bcache_2q_aux *aux = (struct bcache_2q_aux *)pool->aux;
+    struct bcache_2q_ghost *ghost;
+    struct list_elem *e;
+
+    if (evicted && item->queue == BCACHE_2Q_A1IN &&
+        !(item->flag & BCACHE_ONCE)) {
+        // remember the block in A1out
+        e = list_pop_front(&aux->ghost_free);
         if (e == NULL) {
-            e = prev;
-            break;
+            // forget the oldest one
+            e = list_pop_back(&aux->ghost_list);
+            ghost = _get_entry(e, struct bcache_2q_ghost, list_elem);
+            hash_remove(&aux->ghost_hash, &ghost->hash_elem);
         }
-        prev = e;
-        e = list_prev(e);
+        ghost = _get_entry(e, struct bcache_2q_ghost, list_elem);
+        ghost->fid = item->fname->id;
+        ghost->bid = item->bid;
+        hash_insert(&aux->ghost_hash, &ghost->hash_elem);
+        list_push_front(&aux->ghost_list, &ghost->list_elem);
+    }
+    item->flag &= ~BCACHE_ONCE;
+    _bcache_queue_remove(pool, item);
+}
+
+static struct bcache_item *_2q_victim(struct bcache_pool *pool)
+{
+    struct bcache_2q_aux *aux = (struct bcache_2q_aux *)pool->aux;
+    struct bcache_item *a1, *am;
+
+    a1 = _bcache_queue_tail(pool, BCACHE_2Q_A1IN);
+    if (a1 && ((a1->flag & BCACHE_ONCE) ||
+               pool->nqueue[BCACHE_2Q_A1IN] > aux->kin ||
+               pool->nqueue[BCACHE_2Q_AM] == 0)) {
+        return a1;
+    }
+    am = _bcache_queue_clock(pool, BCACHE_2Q_AM);
+    return (am)?(am):(a1);
+}
+
+static void _2q_skip(struct bcache_pool *pool,
+                     struct bcache_item *item)
+{
+    _bcache_queue_touch(pool, item);
+}
+
+static struct bcache_policy bcache_policy_2q = {
+    "2q",
+    _2q_init,
+    _2q_free,
+    _2q_insert,
+    _2q_access,
+    _2q_remove,
+    _2q_victim,
+    _2q_skip
+};
+
+#endif // __BCACHE_2Q
+
+INLINE struct bcache_partition *_bcache_get_partition(
+                                    struct fnamedic_item *fname, bid_t bid)
+{
+    return &partitions[_bcache_shard_idx(fname, bid)];
+}
+
+INLINE struct bcache_pool *_bcache_get_pool(struct bcache_item *item)
+{
+    return &_bcache_get_partition(item->fname, item->bid)->pool[item->cls];
+}
+
+// the following functions MUST be called while holding the SHARD_LOCK
+// and item lock of the block
+
+INLINE void _bcache_policy_insert(struct bcache_item *item, uint8_t marker,
+                                  bcache_hint_t hint)
+{
+    struct bcache_partition *part;
+    part = _bcache_get_partition(item->fname, item->bid);
+    // index nodes are managed separately only when
+    // a part of the cache is reserved for them
+    if (bcache_index_ratio > 0 && marker == BLK_MARKER_BNODE) {
+        item->cls = BCACHE_CLASS_INDEX;
+    } else {
+        item->cls = BCACHE_CLASS_DATA;
+    }
+    spin_lock(&part->lock);
+    bcache_policy->insert(&part->pool[item->cls], item, hint);
+    spin_unlock(&part->lock);
+}
+
+INLINE void _bcache_policy_access(struct bcache_item *item,
+                                  bcache_hint_t hint)
+{
+    bcache_policy->access(_bcache_get_pool(item), item, hint);
+}
+
+INLINE void _bcache_policy_remove(struct bcache_item *item)
+{
+    struct bcache_partition *part;
+    part = _bcache_get_partition(item->fname, item->bid);
+    spin_lock(&part->lock);
+    bcache_policy->remove(&part->pool[item->cls], item, false);
+    spin_unlock(&part->lock);
+}
+
+// choose a victim in the partition, and return the pool of the victim
+//2 partition lock is already acquired by caller
+static struct bcache_item *_bcache_partition_victim(
+                               struct bcache_partition *part,
+                               struct bcache_pool **pool_out)
+{
+    struct bcache_pool *data = &part->pool[BCACHE_CLASS_DATA];
+    struct bcache_pool *idx = &part->pool[BCACHE_CLASS_INDEX];
+    struct bcache_pool *first, *second;
+    struct bcache_item *item;
+
+    // index blocks are evicted first only when they occupy more than
+    // the reserved share; otherwise data blocks are evicted first
+    if (idx->nitems > part->index_reserved) {
+        first = idx;
+        second = data;
+    } else {
+        first = data;
+        second = idx;
+    }
+
+    item = bcache_policy->victim(first);
+    if (item) {
+        *pool_out = first;
+        return item;
     }
+    item = bcache_policy->victim(second);
+    *pool_out = second;
+    return item;
+}
 
+// select a victim file and increase its reference count
+// (the caller should decrease the count after eviction)
+static struct fnamedic_item *_bcache_get_victim()
+{
+    struct fnamedic_item *fname, *victim = NULL;
+    uint64_t ts, min_ts = (uint64_t)-1;
+    size_t i, start, nsample;
+
+    spin_lock(&filelist_lock);
+    filelist_lock_count++;
+
+    if (num_files == 0) {
+        spin_unlock(&filelist_lock);
+        return NULL;
+    }
+
+#ifdef __BCACHE_RANDOM_VICTIM
+    // sample a few files and choose the least recently used one
+    nsample = MIN(num_files, (size_t)BCACHE_RANDOM_VICTIM_UNIT);
+    start = rand() % num_files;
 #else
-    e = list_end(&file_lru);
+    nsample = num_files;
+    start = 0;
 #endif
 
-    if (e==NULL) {
-        e = list_begin(&file_empty);
+    for (i=0;i<nsample;++i) {
+        fname = file_list[(start + i) % num_files];
+        if (!_file_evictable(fname)) {
+            continue;
+        }
+        ts = fname->access_timestamp.value.val_64;
+        if (filemgr_get_file_status(fname->curfile) == FILE_COMPACT_OLD) {
+            // evict compact old file first
+            ts = 0;
+        }
+        if (victim == NULL || ts < min_ts) {
+            victim = fname;
+            min_ts = ts;
+        }
+    }
 
-        while (e) {
-            struct fnamedic_item *fname;
-            fname = _get_entry(e, struct fnamedic_item, le);
-            if (!_file_empty(fname)) {
+    if (victim == NULL) {
+        // all sampled files are empty (or pinned) ..
+        // find any file that has an evictable block
+        for (i=0;i<num_files;++i) {
+            if (_file_evictable(file_list[i])) {
+                victim = file_list[i];
                 break;
             }
-            e = list_next(e);
         }
     }
 
+    if (victim) {
+        atomic_val_incr_64(&victim->ref_count);
+    }
+
     spin_unlock(&filelist_lock);
 
-    if (e) {
-        return _get_entry(e, struct fnamedic_item, le);
-    }
-    return NULL;
+    return victim;
 }
 
-static struct bcache_item *_bcache_alloc_freeblock()
+static struct bcache_item *_bcache_alloc_freeblock(size_t idx)
 {
     struct list_elem *e = NULL;
     struct bcache_item *item;
-
-    spin_lock(&freelist_lock);
-    e = list_pop_front(&freelist);
-    if (e) freelist_count--;
-    spin_unlock(&freelist_lock);
+    size_t i;
+
+    // try the partition corresponding to the shard first,
+    // and then steal from the other partitions
+    for (i=0;i<bcache_nshards && !e;++i) {
+        struct bcache_partition *part = &partitions[(idx + i) % bcache_nshards];
+        if (_list_empty(part->freelist)) {
+            continue;
+        }
+        spin_lock(&part->lock);
+        e = list_pop_front(&part->freelist);
+        spin_unlock(&part->lock);
+    }
 
     if (e) {
+        atomic_val_decr_64(&freelist_count);
         item = _get_entry(e, struct bcache_item, list_elem);
         return item;
     }
     return NULL;
 }
 
-static void _bcache_release_freeblock(struct bcache_item *item)
+static void _bcache_release_freeblock(struct bcache_item *item, size_t idx)
 {
-    spin_lock(&freelist_lock);
+    struct bcache_partition *part = &partitions[idx % bcache_nshards];
+
+    assert(item->pin_count == 0);
+    assert(item->queue == BCACHE_NO_QUEUE);
+    spin_lock(&part->lock);
     item->flag = BCACHE_FREE;
     item->score = 0;
-    list_push_front(&freelist, &item->list_elem);
-    freelist_count++;
-    spin_unlock(&freelist_lock);
+    list_push_front(&part->freelist, &item->list_elem);
+    spin_unlock(&part->lock);
+    atomic_val_incr_64(&freelist_count);
+}
+
+// return the dirty node that has the smallest BID among all shards
+INLINE struct avl_node *_bcache_min_dirty(struct avl_node **cursor,
+                                          size_t num_shards,
+                                          size_t *shard_idx)
+{
+    size_t i;
+    struct avl_node *ret = NULL;
+    struct dirty_item *ditem, *min = NULL;
+
+    for (i=0;i<num_shards;++i) {
+        if (cursor[i] == NULL) {
+            continue;
+        }
+        ditem = _get_entry(cursor[i], struct dirty_item, avl);
+        if (min == NULL || ditem->item->bid < min->item->bid) {
+            min = ditem;
+            ret = cursor[i];
+            *shard_idx = i;
+        }
+    }
+    return ret;
+}
+
+// move a written-back (or discarded) dirty block to the clean list
+//2 all SHARD_LOCKs of the file are already acquired by caller
+INLINE void _bcache_dirty_to_clean(struct fnamedic_item *fname_item,
+                                   struct bcache_shard *shard,
+                                   struct dirty_item *ditem,
+                                   bool idx_tree)
+{
+    struct list_elem *prevhead;
+    uint8_t marker;
+
+    spin_lock(&ditem->item->lock);
+    marker = *((uint8_t*)(ditem->item->addr) + bcache_blocksize-1);
+    ditem->item->flag &= ~(BCACHE_DIRTY);
+
+    // remove from rb-tree
+    avl_remove((idx_tree)?(&shard->tree_idx):(&shard->tree), &ditem->avl);
+    atomic_val_decr_64(&fname_item->ndirty);
+    atomic_val_decr_64(&bcache_ndirty);
+    // move to clean list
+    prevhead = shard->cleanlist.head;
+    (void)prevhead;
+    list_push_front(&shard->cleanlist, &ditem->item->list_elem);
+    _bcache_policy_insert(ditem->item, marker, BCACHE_HINT_NORMAL);
+
+    assert(!(ditem->item->flag & BCACHE_FREE));
+    assert(ditem->item->list_elem.prev == NULL &&
+           prevhead == ditem->item->list_elem.next);
+    spin_unlock(&ditem->item->lock);
+
+    mempool_free(ditem);
 }
 
 // flush a bunch of dirty blocks (BCACHE_FLUSH_UNIT) & make then as clean
-//2 FNAME_LOCK is already acquired by caller (of the caller)
+// (if SYNC is not set, all dirty blocks are discarded without writing)
+//2 all SHARD_LOCKs of the file are already acquired by caller
 static fdb_status _bcache_evict_dirty(struct fnamedic_item *fname_item, int sync)
 {
     // get oldest dirty block
-    void *buf = NULL;
-    struct list_elem *prevhead;
-    struct avl_tree *cur_tree;
+    struct avl_node **cursor;
     struct avl_node *a;
     struct dirty_item *ditem;
-    uint64_t count;
+    struct dirty_item **ditems = NULL;
+    struct iovec *iov = NULL;
+    size_t *shard_idxs = NULL;
+    size_t count, max_count;
     ssize_t ret;
     bid_t start_bid, prev_bid;
-    void *ptr = NULL;
-    uint8_t marker = 0x0;
+    size_t i, shard_idx = 0;
+    bool idx_tree = false;
     fdb_status status = FDB_RESULT_SUCCESS;
-    bool o_direct = false;
 
-    if (fname_item->curfile->config->flag & _ARCH_O_DIRECT) {
-        o_direct = true;
+    // consecutive dirty blocks are written by a single pwritev() call
+    // directly from the cache frames (aligned to FDB_SECTOR_SIZE, so
+    // O_DIRECT does not need a staging buffer either)
+    max_count = bcache_flush_unit / bcache_blocksize;
+    if (max_count == 0) {
+        max_count = 1;
     }
-
-    // scan and write back dirty blocks sequentially
-    if (sync && o_direct) {
-        malloc_align(buf, FDB_SECTOR_SIZE, bcache_flush_unit);
+    if (sync) {
+        iov = alca(struct iovec, max_count);
+        ditems = alca(struct dirty_item *, max_count);
+        shard_idxs = alca(size_t, max_count);
     }
 
     prev_bid = start_bid = BLK_NOT_FOUND;
     count = 0;
 
     // evict normal dirty block first
-    cur_tree = &fname_item->tree;
-    a = avl_first(cur_tree);
+    cursor = alca(struct avl_node *, fname_item->num_shards);
+    for (i=0;i<fname_item->num_shards;++i) {
+        cursor[i] = avl_first(&fname_item->shards[i].tree);
+    }
+    a = _bcache_min_dirty(cursor, fname_item->num_shards, &shard_idx);
     if (!a) {
         // if there is no normal dirty block,
         // evict index nodes next
-        cur_tree = &fname_item->tree_idx;
-        a = avl_first(cur_tree);
+        idx_tree = true;
+        for (i=0;i<fname_item->num_shards;++i) {
+            cursor[i] = avl_first(&fname_item->shards[i].tree_idx);
+        }
+        a = _bcache_min_dirty(cursor, fname_item->num_shards, &shard_idx);
     }
 
-    // traverse tree in a sequential order
+    // traverse trees of all shards in a sequential order (merge by BID)
     while(a) {
         ditem = _get_entry(a, struct dirty_item, avl);
+        cursor[shard_idx] = avl_next(a);
+
+        if (!sync) {
+            // discard the dirty block
+            _bcache_dirty_to_clean(fname_item, &fname_item->shards[shard_idx],
+                                   ditem, idx_tree);
+            a = _bcache_min_dirty(cursor, fname_item->num_shards, &shard_idx);
+            continue;
+        }
 
         // if BID of next dirty block is not consecutive .. stop
         if (ditem->item->bid != prev_bid + 1 &&
-            prev_bid != BLK_NOT_FOUND &&
-            sync) break;
+            prev_bid != BLK_NOT_FOUND) break;
         // set START_BID if this is the first loop
         if (start_bid == BLK_NOT_FOUND) start_bid = ditem->item->bid;
-
         // set PREV_BID and go to next block
         prev_bid = ditem->item->bid;
-        a = avl_next(a);
 
+#ifdef __CRC32
         spin_lock(&ditem->item->lock);
-        // set PTR and get block MARKER
-        ptr = ditem->item->addr;
-        marker = *((uint8_t*)(ptr) + bcache_blocksize-1);
+        void *ptr = ditem->item->addr;
+        uint8_t marker = *((uint8_t*)(ptr) + bcache_blocksize-1);
+        if (marker == BLK_MARKER_BNODE ) {
+            // b-tree node .. calculate crc32 and put it into the block
+            memset((uint8_t *)(ptr) + BTREE_CRC_OFFSET,
+                   0xff, BTREE_CRC_FIELD_LEN);
+            uint32_t crc = chksum(ptr, bcache_blocksize);
+            crc = _endian_encode(crc);
+            memcpy((uint8_t *)(ptr) + BTREE_CRC_OFFSET, &crc, sizeof(crc));
+        }
+        spin_unlock(&ditem->item->lock);
+#endif
 
-        ditem->item->flag &= ~(BCACHE_DIRTY);
-        if (sync) {
-            // copy to buffer
-#ifdef __CRC32
-            if (marker == BLK_MARKER_BNODE ) {
-                // b-tree node .. calculate crc32 and put it into the block
-                memset((uint8_t *)(ptr) + BTREE_CRC_OFFSET,
-                       0xff, BTREE_CRC_FIELD_LEN);
-                uint32_t crc = chksum(ptr, bcache_blocksize);
-                crc = _endian_encode(crc);
-                memcpy((uint8_t *)(ptr) + BTREE_CRC_OFFSET, &crc, sizeof(crc));
+        iov[count].iov_base = ditem->item->addr;
+        iov[count].iov_len = bcache_blocksize;
+        ditems[count] = ditem;
+        shard_idxs[count] = shard_idx;
+
+        // stop if the size of dirty blocks exceeds the BCACHE_FLUSH_UNIT
+        count++;
+        if (count >= max_count) {
+            break;
+        }
+
+        a = _bcache_min_dirty(cursor, fname_item->num_shards, &shard_idx);
+    }
+
+    // synchronize
+    if (sync && count > 0) {
+        ret = fname_item->curfile->ops->pwritev(fname_item->curfile->fd,
+                                                iov, count,
+                                                start_bid * bcache_blocksize);
+        if (ret != (ssize_t)(count * bcache_blocksize)) {
+            // all blocks remain dirty
+            return FDB_RESULT_WRITE_FAIL;
+        }
+        for (i=0;i<count;++i) {
+            _bcache_dirty_to_clean(fname_item,
+                                   &fname_item->shards[shard_idxs[i]],
+                                   ditems[i], idx_tree);
+        }
+    }
+    return status;
+}
+
+INLINE size_t _bcache_partition_size(struct bcache_partition *part)
+{
+    size_t i, n = 0;
+    for (i=0;i<BCACHE_NCLASSES;++i) {
+        n += part->pool[i].nitems;
+    }
+    return n;
+}
+
+// evict up to N_EVICT clean blocks chosen by the replacement policy,
+// starting from the partition IDX; return the number of evicted blocks
+static size_t _bcache_evict_clean(size_t idx, size_t n_evict)
+{
+    size_t i, part_idx, nscan, count = 0;
+    struct bcache_partition *part;
+    struct bcache_pool *pool;
+    struct bcache_item *item;
+    struct bcache_shard *shard;
+    struct fnamedic_item *fname;
+    bid_t bid;
+
+    for (i=0;i<bcache_nshards && count < n_evict;++i) {
+        part_idx = (idx + i) % bcache_nshards;
+        part = &partitions[part_idx];
+        nscan = 0;
+
+        while (count < n_evict) {
+            spin_lock(&part->lock);
+            item = _bcache_partition_victim(part, &pool);
+            if (item == NULL || nscan++ > _bcache_partition_size(part)) {
+                // no evictable block in this partition
+                spin_unlock(&part->lock);
+                break;
+            }
+            if (item->pin_count > 0) {
+                // pinned block cannot be evicted
+                bcache_policy->skip(pool, item);
+                spin_unlock(&part->lock);
+                continue;
             }
-#endif
 
-            if (o_direct) {
-                memcpy((uint8_t *)(buf) + count*bcache_blocksize,
-                       ditem->item->addr,
-                       bcache_blocksize);
+            // the file is not freed while the victim is in the queue
+            // (_fname_free() removes its blocks before waiting for the
+            // references), and we hold the reference until we are done
+            fname = item->fname;
+            bid = item->bid;
+            atomic_val_incr_64(&fname->ref_count);
+            spin_unlock(&part->lock);
+
+            // re-acquire locks in order and check whether the victim
+            // has not been changed in the meantime
+            shard = _bcache_get_shard(fname, bid);
+            spin_lock(&shard->lock);
+            spin_lock(&item->lock);
+            spin_lock(&part->lock);
+            if (item->fname == fname && item->bid == bid &&
+                item->queue != BCACHE_NO_QUEUE && item->pin_count == 0) {
+                pool = &part->pool[item->cls];
+                bcache_policy->remove(pool, item, true);
+                pool->nevict++;
+                spin_unlock(&part->lock);
+
+                // remove from clean list and hash, and insert into freelist
+                list_remove(&shard->cleanlist, &item->list_elem);
+                hash_remove(&shard->hashtable, &item->hash_elem);
+                atomic_val_decr_64(&fname->nitems);
+                atomic_val_incr_64(&fname->nvictim);
+                _bcache_release_freeblock(item, part_idx);
+                count++;
             } else {
-                ret = fname_item->curfile->ops->pwrite(
-                          fname_item->curfile->fd,
-                          ditem->item->addr,
-                          bcache_blocksize,
-                          ditem->item->bid * bcache_blocksize);
-                if (ret != bcache_blocksize) {
-                    spin_unlock(&ditem->item->lock);
-                    status = FDB_RESULT_WRITE_FAIL;
-                    break;
-                }
+                spin_unlock(&part->lock);
             }
-        }
+            spin_unlock(&item->lock);
+            spin_unlock(&shard->lock);
 
-        // remove from rb-tree
-        avl_remove(cur_tree, &ditem->avl);
-        // move to clean list
-        prevhead = fname_item->cleanlist.head;
-        (void)prevhead;
-        list_push_front(&fname_item->cleanlist, &ditem->item->list_elem);
+            atomic_val_decr_64(&fname->ref_count);
+        }
+    }
 
-        assert(!(ditem->item->flag & BCACHE_FREE));
-        assert(ditem->item->list_elem.prev == NULL &&
-               prevhead == ditem->item->list_elem.next);
-        spin_unlock(&ditem->item->lock);
+    return count;
+}
 
-        mempool_free(ditem);
+// write back a batch (BCACHE_FLUSH_UNIT) of dirty blocks of the file
+// in BID order, and release the reference count of the file
+static fdb_status _bcache_writeback(struct fnamedic_item *fname)
+{
+    size_t i;
+    bool has_dirty = false;
+    fdb_status status = FDB_RESULT_SUCCESS;
 
-        // if we have to sync the dirty block, and
-        // the size of dirty blocks exceeds the BCACHE_FLUSH_UNIT
-        count++;
-        if (count*bcache_blocksize >= bcache_flush_unit && sync) {
+    _bcache_lock_all_shards(fname);
+    // the file may be closed and its dirty blocks may be discarded
+    // in the meantime .. check again
+    for (i=0;i<fname->num_shards;++i) {
+        if (_shard_has_dirty(&fname->shards[i])) {
+            has_dirty = true;
             break;
         }
     }
-
-    // synchronize
-    if (sync && count > 0 && o_direct) {
-        ret = fname_item->curfile->ops->pwrite(
-                  fname_item->curfile->fd, buf,
-                  count * bcache_blocksize,
-                  start_bid * bcache_blocksize);
-
-        if (ret != count * bcache_blocksize) {
-            status = FDB_RESULT_WRITE_FAIL;
-        }
-        free_align(buf);
+    if (has_dirty) {
+        status = _bcache_evict_dirty(fname, 1);
     }
+    _bcache_unlock_all_shards(fname);
+
+    atomic_val_decr_64(&fname->ref_count);
     return status;
 }
 
-// perform eviction
-static struct list_elem * _bcache_evict(struct fnamedic_item *curfile)
+// select the file that has the largest number of dirty blocks and
+// increase its reference count
+static struct fnamedic_item *_bcache_get_dirty_victim()
 {
-    size_t n_evict;
-    struct list_elem *e = NULL;
-    struct bcache_item *item;
-    struct fnamedic_item *victim = NULL;
-
-    spin_lock(&bcache_lock);
-
-    while(victim == NULL) {
-        // select victim file (the tail of FILE_LRU)
-        victim = _bcache_get_victim();
-        while(victim) {
-            spin_lock(&victim->lock);
+    struct fnamedic_item *fname, *victim = NULL;
+    size_t i;
 
-            // check whether this file has at least one block to be evictied
-            if (!_file_empty(victim)) {
-                // select this file as victim
-                break;
-            }else{
-                // empty file
-                // move this file to empty list (it is ok that
-                // this was already moved to empty list by other thread)
-                _bcache_move_fname_list(victim, &file_empty);
-                spin_unlock(&victim->lock);
-
-                victim = NULL;
-            }
+    spin_lock(&filelist_lock);
+    filelist_lock_count++;
+    for (i=0;i<num_files;++i) {
+        fname = file_list[i];
+        if (fname->ndirty.value.val_64 > 0 &&
+            (victim == NULL ||
+             fname->ndirty.value.val_64 > victim->ndirty.value.val_64)) {
+            victim = fname;
         }
     }
-    assert(victim);
-    spin_unlock(&bcache_lock);
-
-    victim->nvictim++;
+    if (victim) {
+        atomic_val_incr_64(&victim->ref_count);
+    }
+    spin_unlock(&filelist_lock);
 
-    // select victim clean block of the victim file
-    n_evict = 0;
-    while(n_evict < BCACHE_EVICT_UNIT) {
+    return victim;
+}
 
-#ifdef __BCACHE_SECOND_CHANCE
-        while(1) {
-            // repeat until zero-score item is found
-            e = list_pop_back(&victim->cleanlist);
-            while (e == NULL) {
-                // when the victim file has no clean block .. evict dirty block
-                if (_bcache_evict_dirty(victim, 1) != FDB_RESULT_SUCCESS) {
-                    spin_unlock(&victim->lock);
-                    return NULL;
-                }
+INLINE void _bcache_wakeup_flusher()
+{
+#ifdef __BCACHE_FLUSHER
+    if (bcache_flusher_sleeping &&
+        bcache_ndirty.value.val_64 > bcache_flusher_start) {
+        mutex_lock(&bcache_flusher_lock);
+        thread_cond_signal(&bcache_flusher_cond);
+        mutex_unlock(&bcache_flusher_lock);
+    }
+#endif
+}
 
-                // pop back from cleanlist
-                e = list_pop_back(&victim->cleanlist);
-            }
+// writers are throttled when there are too many dirty blocks;
+// they write back dirty blocks by themselves instead of waiting for
+// the flusher
+INLINE void _bcache_throttle_writer()
+{
+    struct fnamedic_item *victim;
 
-            item = _get_entry(e, struct bcache_item, list_elem);
-            if (item->score == 0) {
-                break;
-            } else {
-                // give second chance to the item
-                item->score--;
-                list_push_front(&victim->cleanlist, &item->list_elem);
-            }
+    while (bcache_ndirty.value.val_64 > bcache_throttle_start) {
+        victim = _bcache_get_dirty_victim();
+        if (victim == NULL) {
+            break;
         }
-#else
-        e = list_pop_back(&victim->cleanlist);
-        while (e == NULL) {
-            // when the victim file has no clean block .. evict dirty block
-            if (_bcache_evict_dirty(victim, 1) != FDB_RESULT_SUCCESS) {
-                spin_unlock(&victim->lock);
-                return NULL;
-            }
-
-            // pop back from cleanlist
-            e = list_pop_back(&victim->cleanlist);
+        if (_bcache_writeback(victim) != FDB_RESULT_SUCCESS) {
+            break;
         }
-        item = _get_entry(e, struct bcache_item, list_elem);
-#endif
-
-        victim->nitems--;
+    }
+}
 
-        spin_lock(&item->lock);
+// perform eviction
+static void _bcache_evict(size_t idx)
+{
+    struct fnamedic_item *victim = NULL;
 
-        // remove from hash and insert into freelist
-        hash_remove(&victim->hashtable, &item->hash_elem);
+    // advance logical clock for file LRU
+    atomic_val_incr_64(&bcache_clock);
 
-        // add to freelist
-        _bcache_release_freeblock(item);
-        n_evict++;
+    // evict clean blocks globally across all files
+    if (_bcache_evict_clean(idx, BCACHE_EVICT_UNIT) > 0) {
+        return;
+    }
 
-        spin_unlock(&item->lock);
+    // there is no evictable clean block (the flusher could not keep up) ..
+    // write back dirty blocks of the least recently used file
+    _bcache_wakeup_flusher();
+    victim = _bcache_get_victim();
+    if (victim == NULL) {
+        return;
+    }
+    _bcache_writeback(victim);
+}
 
-        if (victim->nitems == 0) {
+#ifdef __BCACHE_FLUSHER
+// background thread that keeps the number of free and clean blocks
+// above the low watermark, so that readers rarely have to write back
+// dirty blocks to get a free block
+static void *_bcache_flusher_thread(void *voidargs)
+{
+    struct fnamedic_item *victim;
+
+    while (1) {
+        mutex_lock(&bcache_flusher_lock);
+        if (!bcache_flusher_terminate &&
+            bcache_ndirty.value.val_64 <= bcache_flusher_start) {
+            bcache_flusher_sleeping = 1;
+            thread_cond_timedwait(&bcache_flusher_cond, &bcache_flusher_lock,
+                                  BCACHE_FLUSHER_SLEEP_MS);
+            bcache_flusher_sleeping = 0;
+        }
+        if (bcache_flusher_terminate) {
+            mutex_unlock(&bcache_flusher_lock);
             break;
         }
-    }
+        mutex_unlock(&bcache_flusher_lock);
 
-    // check whether the victim file has no cached block
-    if (_file_empty(victim)) {
-        // remove from FILE_LRU and insert into FILE_EMPTY
-        _bcache_move_fname_list(victim, &file_empty);
+        while (!bcache_flusher_terminate &&
+               bcache_ndirty.value.val_64 > bcache_flusher_start) {
+            victim = _bcache_get_dirty_victim();
+            if (victim == NULL) {
+                break;
+            }
+            if (_bcache_writeback(victim) != FDB_RESULT_SUCCESS) {
+                // try again later
+                break;
+            }
+        }
     }
-
-    spin_unlock(&victim->lock);
-
-    return &item->list_elem;
+    return NULL;
 }
+#endif
 
 static struct fnamedic_item * _fname_create(struct filemgr *file) {
     // TODO: we MUST NOT directly read file sturcture
 
     struct fnamedic_item *fname_new;
+    size_t i;
     fname_new = (struct fnamedic_item *)malloc(sizeof(struct fnamedic_item));
 
     fname_new->filename_len = strlen(file->filename);
@@ -556,41 +1309,106 @@ static struct fnamedic_item * _fname_create(struct filemgr *file) {
     // calculate hash value
     fname_new->hash = chksum((void *)fname_new->filename,
                              fname_new->filename_len);
-    spin_init(&fname_new->lock);
-    fname_new->curlist = NULL;
     fname_new->curfile = file;
-    fname_new->nvictim = 0;
-    fname_new->nitems = 0;
-
-    // initialize tree
-    avl_init(&fname_new->tree, NULL);
-    avl_init(&fname_new->tree_idx, NULL);
-    // initialize clean list
-    list_init(&fname_new->cleanlist);
-    // initialize hash table
-    hash_init(&fname_new->hashtable, BCACHE_NBUCKET,
-              _bcache_hash, _bcache_cmp);
+    // bcache_lock is grabbed by the caller
+    fname_new->id = fnamedic_next_id++;
+    atomic_val_init_64(&fname_new->access_timestamp,
+                       bcache_clock.value.val_64);
+    atomic_val_init_64(&fname_new->ref_count, 0);
+    atomic_val_init_64(&fname_new->nvictim, 0);
+    atomic_val_init_64(&fname_new->nitems, 0);
+    atomic_val_init_64(&fname_new->npinned, 0);
+    atomic_val_init_64(&fname_new->ndirty, 0);
+
+    // initialize shards
+    fname_new->num_shards = bcache_nshards;
+    fname_new->shards = (struct bcache_shard *)
+                        malloc(sizeof(struct bcache_shard) * bcache_nshards);
+    for (i=0;i<bcache_nshards;++i) {
+        struct bcache_shard *shard = &fname_new->shards[i];
+        spin_init(&shard->lock);
+        // initialize tree
+        avl_init(&shard->tree, NULL);
+        avl_init(&shard->tree_idx, NULL);
+        // initialize clean list
+        list_init(&shard->cleanlist);
+        // initialize hash table
+        hash_init(&shard->hashtable,
+                  MAX(BCACHE_NBUCKET / bcache_nshards, 1),
+                  _bcache_hash, _bcache_cmp);
+    }
 
     // insert into fname dictionary
     hash_insert(&fnamedic, &fname_new->hash_elem);
+
+    // insert into file list
+    spin_lock(&filelist_lock);
+    filelist_lock_count++;
+    if (num_files == file_list_capacity) {
+        file_list_capacity = (file_list_capacity)?(file_list_capacity*2):(16);
+        file_list = (struct fnamedic_item **)
+                    realloc(file_list, sizeof(struct fnamedic_item *) *
+                                       file_list_capacity);
+    }
+    fname_new->list_idx = num_files;
+    file_list[num_files++] = fname_new;
+    spin_unlock(&filelist_lock);
+
+    // publish to lock-free readers after initialization is done
+    fdb_sync_synchronize();
     file->bcache = fname_new;
 
     return fname_new;
 }
 
+static void _bcache_remove_dirty_blocks(struct fnamedic_item *fname_item);
+static void _bcache_remove_clean_blocks(struct fnamedic_item *fname_item);
+
 static void _fname_free(struct fnamedic_item *fname)
 {
-    // remove from corresponding list
-    _bcache_move_fname_list(fname, NULL);
+    size_t i;
+    unsigned int sleep_time = 10; // 10 us.
 
-    // file must be empty
+    // remove from file list
+    spin_lock(&filelist_lock);
+    filelist_lock_count++;
+    file_list[fname->list_idx] = file_list[--num_files];
+    file_list[fname->list_idx]->list_idx = fname->list_idx;
+    spin_unlock(&filelist_lock);
+
+    // pinned blocks are not in the clean list, so they cannot be removed
+    // until the readers release them
+    while (fname->npinned.value.val_64 > 0) {
+        decaying_usleep(&sleep_time, 10000);
+    }
+
+    // remove the blocks left (e.g., unpinned just now) from the partition
+    // queues, so that no evictor can pick them any more
+    _bcache_remove_dirty_blocks(fname);
+    _bcache_remove_clean_blocks(fname);
     assert(_file_empty(fname));
 
-    // free hash
-    hash_free(&fname->hashtable);
+    // wait until all evictors that picked a block of this file before
+    // the removal are done
+    while (fname->ref_count.value.val_64 > 0) {
+        _bcache_lock_all_shards(fname);
+        _bcache_unlock_all_shards(fname);
+    }
+
+    for (i=0;i<fname->num_shards;++i) {
+        // free hash
+        hash_free(&fname->shards[i].hashtable);
+        spin_destroy(&fname->shards[i].lock);
+    }
+    free(fname->shards);
 
     free(fname->filename);
-    spin_destroy(&fname->lock);
+    atomic_val_destroy(&fname->access_timestamp);
+    atomic_val_destroy(&fname->ref_count);
+    atomic_val_destroy(&fname->nvictim);
+    atomic_val_destroy(&fname->nitems);
+    atomic_val_destroy(&fname->npinned);
+    atomic_val_destroy(&fname->ndirty);
 }
 
 INLINE void _bcache_set_score(struct bcache_item *item)
@@ -609,32 +1427,34 @@ INLINE void _bcache_set_score(struct bcache_item *item)
 #endif
 }
 
-int bcache_read(struct filemgr *file, bid_t bid, void *buf)
+int bcache_read(struct filemgr *file, bid_t bid, void *buf,
+                bcache_hint_t hint)
 {
     struct hash_elem *h;
     struct bcache_item *item;
     struct bcache_item query;
     struct fnamedic_item *fname;
+    struct bcache_shard *shard;
 
-    spin_lock(&bcache_lock);
+    // note that FILE->BCACHE is set only once, so we don't need to
+    // grab the global lock here
     fname = file->bcache;
-    spin_unlock(&bcache_lock);
 
     if (fname) {
         // file exists
         // set query
         query.bid = bid;
         query.fname = fname;
-        query.fname->curfile = file;
 
-        // relay lock
-        spin_lock(&fname->lock);
+        // update file's access time (for approximated FILE LRU)
+        _bcache_touch_file(fname, file);
 
-        // move the file to the head of FILE_LRU
-        _bcache_move_fname_list(fname, &file_lru);
+        // relay lock
+        shard = _bcache_get_shard(fname, bid);
+        spin_lock(&shard->lock);
 
         // search BHASH
-        h = hash_find(&fname->hashtable, &query.hash_elem);
+        h = hash_find(&shard->hashtable, &query.hash_elem);
         if (h) {
             // cache hit
             item = _get_entry(h, struct bcache_item, hash_elem);
@@ -643,15 +1463,14 @@ int bcache_read(struct filemgr *file, bid_t bid, void *buf)
 
             assert(!(item->flag & BCACHE_FREE));
 
-            // move the item to the head of list if the block is clean
+            // notify the replacement policy if the block is clean
             // (don't care if the block is dirty)
             if (!(item->flag & BCACHE_DIRTY)) {
-                list_remove(&item->fname->cleanlist, &item->list_elem);
-                list_push_front(&item->fname->cleanlist, &item->list_elem);
+                _bcache_policy_access(item, hint);
             }
 
             // relay lock
-            spin_unlock(&fname->lock);
+            spin_unlock(&shard->lock);
 
             memcpy(buf, item->addr, bcache_blocksize);
             _bcache_set_score(item);
@@ -661,7 +1480,7 @@ int bcache_read(struct filemgr *file, bid_t bid, void *buf)
             return bcache_blocksize;
         }else {
             // cache miss
-            spin_unlock(&fname->lock);
+            spin_unlock(&shard->lock);
         }
     }
 
@@ -675,6 +1494,7 @@ void bcache_invalidate_block(struct filemgr *file, bid_t bid)
     struct bcache_item *item;
     struct bcache_item query;
     struct fnamedic_item *fname;
+    struct bcache_shard *shard;
 
     fname = file->bcache;
     if (fname) {
@@ -682,16 +1502,15 @@ void bcache_invalidate_block(struct filemgr *file, bid_t bid)
         // set query
         query.bid = bid;
         query.fname = fname;
-        query.fname->curfile = file;
 
-        // relay lock
-        spin_lock(&fname->lock);
+        _bcache_touch_file(fname, file);
 
-        // move the file to the head of FILE_LRU
-        _bcache_move_fname_list(fname, &file_lru);
+        // relay lock
+        shard = _bcache_get_shard(fname, bid);
+        spin_lock(&shard->lock);
 
         // search BHASH
-        h = hash_find(&fname->hashtable, &query.hash_elem);
+        h = hash_find(&shard->hashtable, &query.hash_elem);
         if (h) {
             // cache hit
             item = _get_entry(h, struct bcache_item, hash_elem);
@@ -700,92 +1519,109 @@ void bcache_invalidate_block(struct filemgr *file, bid_t bid)
 
             assert(!(item->flag & BCACHE_FREE));
 
-            fname->nitems--;
-
-            if (!(item->flag & BCACHE_DIRTY)) {
-                // only for clean blocks
+            if (!(item->flag & BCACHE_DIRTY) && item->pin_count == 0) {
+                // only for clean blocks that are not pinned
+                // (pinned blocks are evicted later after unpinned)
+                atomic_val_decr_64(&fname->nitems);
                 // remove from hash and insert into freelist
-                hash_remove(&fname->hashtable, &item->hash_elem);
+                hash_remove(&shard->hashtable, &item->hash_elem);
                 // remove from clean list
-                list_remove(&item->fname->cleanlist, &item->list_elem);
+                list_remove(&shard->cleanlist, &item->list_elem);
+                _bcache_policy_remove(item);
 
                 // add to freelist
-                _bcache_release_freeblock(item);
-
-                // check whether the victim file has no cached block
-                if (_file_empty(fname)) {
-                    // remove from FILE_LRU and insert into FILE_EMPTY
-                    _bcache_move_fname_list(fname, &file_empty);
-                }
+                _bcache_release_freeblock(item,
+                                          _bcache_shard_idx(fname, bid));
             }
 
             spin_unlock(&item->lock);
-            spin_unlock(&fname->lock);
+            spin_unlock(&shard->lock);
         }else {
             // cache miss
-            spin_unlock(&fname->lock);
+            spin_unlock(&shard->lock);
         }
     }
 
     // does not exist .. cache miss
 }
 
+INLINE struct fnamedic_item * _bcache_get_or_create_fname(struct filemgr *file)
+{
+    struct fnamedic_item *fname = file->bcache;
+    if (fname == NULL) {
+        spin_lock(&bcache_lock);
+        bcache_lock_count++;
+        fname = file->bcache;
+        if (fname == NULL) {
+            // filename doesn't exist in filename dictionary .. create
+            fname = _fname_create(file);
+        }
+        spin_unlock(&bcache_lock);
+    }
+    return fname;
+}
+
+// return the number of bytes written into the cache
+// (0 if the block is pinned so that it cannot be modified)
 int bcache_write(struct filemgr *file,
                  bid_t bid,
                  void *buf,
-                 bcache_dirty_t dirty)
+                 bcache_dirty_t dirty,
+                 bcache_hint_t hint)
 {
     struct hash_elem *h = NULL;
     struct bcache_item *item;
     struct bcache_item query;
     struct fnamedic_item *fname_new;
+    struct bcache_shard *shard;
+    size_t shard_idx;
+    bool was_clean;
 
-    spin_lock(&bcache_lock);
-    fname_new = file->bcache;
-    if (fname_new == NULL) {
-        // filename doesn't exist in filename dictionary .. create
-        fname_new = _fname_create(file);
+    if (dirty == BCACHE_REQ_DIRTY) {
+        _bcache_throttle_writer();
     }
-    spin_unlock(&bcache_lock);
 
-    // acquire lock
-    spin_lock(&fname_new->lock);
+    fname_new = _bcache_get_or_create_fname(file);
+
+    // update file's access time (for approximated FILE LRU)
+    _bcache_touch_file(fname_new, file);
 
-    // move to the head of FILE_LRU
-    _bcache_move_fname_list(fname_new, &file_lru);
+    // acquire lock
+    shard_idx = _bcache_shard_idx(fname_new, bid);
+    shard = &fname_new->shards[shard_idx];
+    spin_lock(&shard->lock);
 
     // set query
     query.bid = bid;
     query.fname = fname_new;
-    query.fname->curfile = file;
 
     // search hash table
-    h = hash_find(&fname_new->hashtable, &query.hash_elem);
+    h = hash_find(&shard->hashtable, &query.hash_elem);
     if (h == NULL) {
         // cache miss
         // get a free block
-        while ((item = _bcache_alloc_freeblock()) == NULL) {
+        while ((item = _bcache_alloc_freeblock(shard_idx)) == NULL) {
             // no free block .. perform eviction
-            spin_unlock(&fname_new->lock);
+            spin_unlock(&shard->lock);
 
-            _bcache_evict(fname_new);
+            _bcache_evict(shard_idx);
 
-            spin_lock(&fname_new->lock);
+            spin_lock(&shard->lock);
         }
 
         // re-search hash table
-        h = hash_find(&fname_new->hashtable, &query.hash_elem);
+        h = hash_find(&shard->hashtable, &query.hash_elem);
         if (h == NULL) {
             // insert into hash table
             item->bid = bid;
             item->fname = fname_new;
             item->flag = BCACHE_FREE;
-            hash_insert(&fname_new->hashtable, &item->hash_elem);
+            hash_insert(&shard->hashtable, &item->hash_elem);
             h = &item->hash_elem;
             spin_lock(&item->lock);
         }else{
             // insert into freelist again
-            _bcache_release_freeblock(item);
+            _bcache_release_freeblock(item, shard_idx);
             item = _get_entry(h, struct bcache_item, hash_elem);
             spin_lock(&item->lock);
         }
@@ -796,15 +1632,33 @@ int bcache_write(struct filemgr *file,
 
     assert(h);
 
+    if (item->pin_count > 0) {
+        // pinned block is immutable; only the same (clean) image
+        // can be written again, and the frame is kept as it is
+        // since readers are using it in place
+        spin_unlock(&shard->lock);
+        spin_unlock(&item->lock);
+        if (dirty == BCACHE_REQ_DIRTY) {
+            // committed blocks are never modified .. refuse the write
+            // rather than losing it
+            return 0;
+        }
+        return bcache_blocksize;
+    }
+
     if (item->flag & BCACHE_FREE) {
-        fname_new->nitems++;
+        atomic_val_incr_64(&fname_new->nitems);
     }
 
     // remove from the list if the block is in clean list
-    if (!(item->flag & BCACHE_DIRTY) && !(item->flag & BCACHE_FREE)) {
-        list_remove(&fname_new->cleanlist, &item->list_elem);
+    was_clean = !(item->flag & BCACHE_DIRTY) && !(item->flag & BCACHE_FREE);
+    if (was_clean) {
+        list_remove(&shard->cleanlist, &item->list_elem);
+        if (dirty == BCACHE_REQ_DIRTY) {
+            _bcache_policy_remove(item);
+        }
     }
-    item->flag &= ~BCACHE_FREE;
+    item->flag &= ~(BCACHE_FREE | BCACHE_PREPARED);
 
     if (dirty == BCACHE_REQ_DIRTY) {
         // DIRTY request
@@ -818,13 +1672,15 @@ int bcache_write(struct filemgr *file,
             ditem = (struct dirty_item *)
                     mempool_alloc(sizeof(struct dirty_item));
             ditem->item = item;
+            atomic_val_incr_64(&fname_new->ndirty);
+            atomic_val_incr_64(&bcache_ndirty);
 
             marker = *((uint8_t*)buf + bcache_blocksize-1);
             if (marker == BLK_MARKER_BNODE ) {
                 // b-tree node
-                avl_insert(&item->fname->tree_idx, &ditem->avl, _dirty_cmp);
+                avl_insert(&shard->tree_idx, &ditem->avl, _dirty_cmp);
             } else {
-                avl_insert(&item->fname->tree, &ditem->avl, _dirty_cmp);
+                avl_insert(&shard->tree, &ditem->avl, _dirty_cmp);
             }
         }
         item->flag |= BCACHE_DIRTY;
@@ -832,18 +1688,28 @@ int bcache_write(struct filemgr *file,
         // CLEAN request
         // insert into clean list only when it was originally clean
         if (!(item->flag & BCACHE_DIRTY)) {
-            list_push_front(&item->fname->cleanlist, &item->list_elem);
+            list_push_front(&shard->cleanlist, &item->list_elem);
             item->flag &= ~(BCACHE_DIRTY);
+            if (was_clean) {
+                _bcache_policy_access(item, hint);
+            } else {
+                _bcache_policy_insert(item,
+                    *((uint8_t*)buf + bcache_blocksize-1), hint);
+            }
         }
     }
 
-    spin_unlock(&fname_new->lock);
+    spin_unlock(&shard->lock);
 
     memcpy(item->addr, buf, bcache_blocksize);
     _bcache_set_score(item);
 
     spin_unlock(&item->lock);
 
+    if (dirty == BCACHE_REQ_DIRTY) {
+        _bcache_wakeup_flusher();
+    }
+
     return bcache_blocksize;
 }
 
@@ -857,28 +1723,28 @@ int bcache_write_partial(struct filemgr *file,
     struct bcache_item *item;
     struct bcache_item query;
     struct fnamedic_item *fname_new;
+    struct bcache_shard *shard;
 
-    spin_lock(&bcache_lock);
-    fname_new = file->bcache;
-    if (fname_new == NULL) {
-        // filename doesn't exist in filename dictionary .. create
-        fname_new = _fname_create(file);
-    }
-    spin_unlock(&bcache_lock);
+    _bcache_throttle_writer();
+
+    fname_new = _bcache_get_or_create_fname(file);
+
+    // update file's access time (for approximated FILE LRU)
+    _bcache_touch_file(fname_new, file);
 
     // relay lock
-    spin_lock(&fname_new->lock);
+    shard = _bcache_get_shard(fname_new, bid);
+    spin_lock(&shard->lock);
 
     // set query
     query.bid = bid;
     query.fname = fname_new;
-    query.fname->curfile = file;
 
     // search hash table
-    h = hash_find(&fname_new->hashtable, &query.hash_elem);
+    h = hash_find(&shard->hashtable, &query.hash_elem);
     if (h == NULL) {
         // cache miss .. partial write fail .. return 0
-        spin_unlock(&fname_new->lock);
+        spin_unlock(&shard->lock);
         return 0;
 
     }else{
@@ -886,12 +1752,17 @@ int bcache_write_partial(struct filemgr *file,
         item = _get_entry(h, struct bcache_item, hash_elem);
     }
 
-    // move to the head of FILE_LRU
-    _bcache_move_fname_list(fname_new, &file_lru);
-
     spin_lock(&item->lock);
 
     assert(!(item->flag & BCACHE_FREE));
+    if (item->pin_count > 0) {
+        // pinned block is immutable .. the caller then writes the whole
+        // block, which is refused by bcache_write()
+        spin_unlock(&item->lock);
+        spin_unlock(&shard->lock);
+        return 0;
+    }
+    item->flag &= ~BCACHE_PREPARED;
 
     // check whether this is dirty block
     // to avoid re-insert already existing item into tree
@@ -901,103 +1772,223 @@ int bcache_write_partial(struct filemgr *file,
         struct dirty_item *ditem;
 
         // remove from clean list
-        list_remove(&item->fname->cleanlist, &item->list_elem);
+        list_remove(&shard->cleanlist, &item->list_elem);
+        _bcache_policy_remove(item);
 
         ditem = (struct dirty_item *)mempool_alloc(sizeof(struct dirty_item));
         ditem->item = item;
+        atomic_val_incr_64(&fname_new->ndirty);
+        atomic_val_incr_64(&bcache_ndirty);
 
         // insert into tree
         marker = *((uint8_t*)item->addr + bcache_blocksize-1);
         if (marker == BLK_MARKER_BNODE ) {
             // b-tree node
-            avl_insert(&item->fname->tree_idx, &ditem->avl, _dirty_cmp);
+            avl_insert(&shard->tree_idx, &ditem->avl, _dirty_cmp);
         } else {
-            avl_insert(&item->fname->tree, &ditem->avl, _dirty_cmp);
+            avl_insert(&shard->tree, &ditem->avl, _dirty_cmp);
         }
     }
 
     // always set this block as dirty
     item->flag |= BCACHE_DIRTY;
 
-    spin_unlock(&fname_new->lock);
+    spin_unlock(&shard->lock);
 
     memcpy((uint8_t *)(item->addr) + offset, buf, len);
     _bcache_set_score(item);
 
     spin_unlock(&item->lock);
 
+    _bcache_wakeup_flusher();
+
     return len;
 }
 
-// remove all dirty blocks of the FILE
-// (they are only discarded and not written back)
-void bcache_remove_dirty_blocks(struct filemgr *file)
+// pin a clean block and return its address
+// (return NULL if the block is not cached, dirty, declined by PREPARE,
+//  or too many blocks are already pinned)
+void *bcache_pin(struct filemgr *file, bid_t bid,
+                 filemgr_pin_prepare_func *prepare, void *ctx)
 {
-    struct fnamedic_item *fname_item;
+    struct hash_elem *h;
+    struct bcache_item *item;
+    struct bcache_item query;
+    struct fnamedic_item *fname;
+    struct bcache_shard *shard;
+    void *addr = NULL;
 
-    fname_item = file->bcache;
+    fname = file->bcache;
+    if (fname == NULL) {
+        return NULL;
+    }
 
-    if (fname_item) {
-        // acquire lock
-        spin_lock(&fname_item->lock);
+    query.bid = bid;
+    query.fname = fname;
 
-        // remove all dirty block
-        while(!_tree_empty(fname_item->tree) ||
-              !_tree_empty(fname_item->tree_idx)) {
-            _bcache_evict_dirty(fname_item, 0);
+    _bcache_touch_file(fname, file);
+
+    shard = _bcache_get_shard(fname, bid);
+    spin_lock(&shard->lock);
+
+    h = hash_find(&shard->hashtable, &query.hash_elem);
+    if (h) {
+        item = _get_entry(h, struct bcache_item, hash_elem);
+        assert(item->fname == fname);
+        assert(!(item->flag & BCACHE_FREE));
+
+        if (item->flag & BCACHE_DIRTY) {
+            // dirty block can be modified by writers
+            spin_unlock(&shard->lock);
+            return NULL;
+        }
+
+        if (item->pin_count == 0 &&
+            bcache_npinned.value.val_64 >= bcache_pin_limit) {
+            // too many pinned blocks
+            spin_unlock(&shard->lock);
+            return NULL;
         }
 
-        // check whether the victim file is empty
-        if (_file_empty(fname_item)) {
-            // remove from FILE_LRU and insert into FILE_EMPTY
-            _bcache_move_fname_list(fname_item, &file_empty);
+        if (prepare && !(item->flag & BCACHE_PREPARED)) {
+            // wait for on-going bcache_read() of the block
+            spin_lock(&item->lock);
+            if (!prepare(item->addr, ctx)) {
+                spin_unlock(&item->lock);
+                spin_unlock(&shard->lock);
+                return NULL;
+            }
+            item->flag |= BCACHE_PREPARED;
+            spin_unlock(&item->lock);
         }
 
-        spin_unlock(&fname_item->lock);
+        if (item->pin_count == 0) {
+            // detach from clean list so that it will not be evicted
+            list_remove(&shard->cleanlist, &item->list_elem);
+            atomic_val_incr_64(&bcache_npinned);
+            atomic_val_incr_64(&fname->npinned);
+        }
+        item->pin_count++;
+        addr = item->addr;
     }
+    spin_unlock(&shard->lock);
+
+    return addr;
 }
 
-// remove all clean blocks of the FILE
-void bcache_remove_clean_blocks(struct filemgr *file)
+void bcache_unpin(struct filemgr *file, bid_t bid)
 {
-    struct list_elem *e;
+    struct hash_elem *h;
     struct bcache_item *item;
-    struct fnamedic_item *fname_item;
+    struct bcache_item query;
+    struct fnamedic_item *fname;
+    struct bcache_shard *shard;
 
-    fname_item = file->bcache;
+    fname = file->bcache;
+    assert(fname);
 
-    if (fname_item) {
+    query.bid = bid;
+    query.fname = fname;
+
+    shard = _bcache_get_shard(fname, bid);
+    spin_lock(&shard->lock);
+
+    h = hash_find(&shard->hashtable, &query.hash_elem);
+    assert(h);
+    item = _get_entry(h, struct bcache_item, hash_elem);
+    assert(item->pin_count > 0);
+
+    item->pin_count--;
+    if (item->pin_count == 0) {
+        // put back into the clean list as the most recently used block
+        list_push_front(&shard->cleanlist, &item->list_elem);
+        atomic_val_decr_64(&fname->npinned);
+        atomic_val_decr_64(&bcache_npinned);
+    }
+    spin_unlock(&shard->lock);
+}
+
+// remove all dirty blocks of the file
+// (they are only discarded and not written back)
+static void _bcache_remove_dirty_blocks(struct fnamedic_item *fname_item)
+{
+    size_t i;
+    bool dirty;
+
+    // acquire lock
+    _bcache_lock_all_shards(fname_item);
+
+    // remove all dirty block
+    do {
+        dirty = false;
+        for (i=0;i<fname_item->num_shards;++i) {
+            if (_shard_has_dirty(&fname_item->shards[i])) {
+                dirty = true;
+                break;
+            }
+        }
+        if (dirty) {
+            _bcache_evict_dirty(fname_item, 0);
+        }
+    } while (dirty);
+
+    _bcache_unlock_all_shards(fname_item);
+}
+
+// remove all clean blocks of the file (except for pinned ones)
+static void _bcache_remove_clean_blocks(struct fnamedic_item *fname_item)
+{
+    struct list_elem *e;
+    struct bcache_item *item;
+    struct bcache_shard *shard;
+    size_t i;
+
+    for (i=0;i<fname_item->num_shards;++i) {
         // acquire lock
-        spin_lock(&fname_item->lock);
+        shard = &fname_item->shards[i];
+        spin_lock(&shard->lock);
 
         // remove all clean blocks
-        e = list_begin(&fname_item->cleanlist);
+        e = list_begin(&shard->cleanlist);
         while(e){
             item = _get_entry(e, struct bcache_item, list_elem);
             spin_lock(&item->lock);
 
             // remove from clean list
-            e = list_remove(&fname_item->cleanlist, e);
+            e = list_remove(&shard->cleanlist, e);
+            _bcache_policy_remove(item);
             // remove from hash table
-            hash_remove(&fname_item->hashtable, &item->hash_elem);
+            hash_remove(&shard->hashtable, &item->hash_elem);
+            atomic_val_decr_64(&fname_item->nitems);
             // insert into free list
-            _bcache_release_freeblock(item);
+            _bcache_release_freeblock(item, i);
             spin_unlock(&item->lock);
         }
 
-        // check whether the victim file is empty
-        if (_file_empty(fname_item)) {
-            // remove from FILE_LRU and insert into FILE_EMPTY
-            _bcache_move_fname_list(fname_item, &file_empty);
-        }
+        spin_unlock(&shard->lock);
+    }
+}
+
+// remove all dirty blocks of the FILE
+// (they are only discarded and not written back)
+void bcache_remove_dirty_blocks(struct filemgr *file)
+{
+    if (file->bcache) {
+        _bcache_remove_dirty_blocks(file->bcache);
+    }
+}
 
-        spin_unlock(&fname_item->lock);
+// remove all clean blocks of the FILE
+void bcache_remove_clean_blocks(struct filemgr *file)
+{
+    if (file->bcache) {
+        _bcache_remove_clean_blocks(file->bcache);
     }
 }
 
 // remove file from filename dictionary
-// MUST sure that there is no dirty block belongs to this FILE
-// (or memory leak occurs)
+// (dirty blocks left are discarded, and blocks pinned by readers are
+//  waited for)
 void bcache_remove_file(struct filemgr *file)
 {
     struct fnamedic_item *fname_item;
@@ -1007,18 +1998,13 @@ void bcache_remove_file(struct filemgr *file)
     if (fname_item) {
         // acquire lock
         spin_lock(&bcache_lock);
-        spin_lock(&fname_item->lock);
-        // file must be empty
-        assert(_file_empty(fname_item));
-
+        bcache_lock_count++;
         // remove from fname dictionary hash table
         hash_remove(&fnamedic, &fname_item->hash_elem);
         spin_unlock(&bcache_lock);
 
         _fname_free(fname_item);
 
-        spin_unlock(&fname_item->lock);
-
         free(fname_item);
     }
 }
@@ -1029,45 +2015,102 @@ fdb_status bcache_flush(struct filemgr *file)
 {
     struct fnamedic_item *fname_item;
     fdb_status status = FDB_RESULT_SUCCESS;
+    size_t i;
+    bool dirty;
 
     fname_item = file->bcache;
 
     if (fname_item) {
         // acquire lock
-        spin_lock(&fname_item->lock);
+        _bcache_lock_all_shards(fname_item);
 
-        while(!_tree_empty(fname_item->tree) ||
-              !_tree_empty(fname_item->tree_idx)) {
-            status = _bcache_evict_dirty(fname_item, 1);
-            if (status != FDB_RESULT_SUCCESS) {
-                break;
+        do {
+            dirty = false;
+            for (i=0;i<fname_item->num_shards;++i) {
+                if (_shard_has_dirty(&fname_item->shards[i])) {
+                    dirty = true;
+                    break;
+                }
             }
-        }
+            if (dirty) {
+                status = _bcache_evict_dirty(fname_item, 1);
+                if (status != FDB_RESULT_SUCCESS) {
+                    break;
+                }
+            }
+        } while (dirty);
 
-        spin_unlock(&fname_item->lock);
+        _bcache_unlock_all_shards(fname_item);
     }
     return status;
 }
 
-void bcache_init(int nblock, int blocksize)
+void bcache_init(int nblock, int blocksize, int index_ratio)
 {
     int i;
     struct bcache_item *item;
     struct list_elem *e;
+    struct bcache_partition *part;
+    struct bcache_pool *pool;
+    size_t j, k;
+
+    bcache_nshards = BCACHE_NSHARDS;
+    bcache_index_ratio = index_ratio;
+#ifdef __BCACHE_2Q
+    bcache_policy = &bcache_policy_2q;
+#else
+    bcache_policy = &bcache_policy_lru;
+#endif
+    partitions = (struct bcache_partition *)
+                 malloc(sizeof(struct bcache_partition) * bcache_nshards);
+    for (i=0;i<(int)bcache_nshards;++i) {
+        part = &partitions[i];
+        list_init(&part->freelist);
+        part->capacity = MAX(nblock / bcache_nshards, 1);
+        part->index_reserved = part->capacity * index_ratio / 100;
+        for (j=0;j<BCACHE_NCLASSES;++j) {
+            pool = &part->pool[j];
+            for (k=0;k<BCACHE_MAX_QUEUES;++k) {
+                list_init(&pool->queue[k]);
+                pool->nqueue[k] = 0;
+            }
+            pool->nitems = 0;
+            pool->nevict = 0;
+            pool->part = part;
+            // if the cache is shared by both classes, each class can
+            // occupy the entire partition
+            if (index_ratio > 0) {
+                pool->capacity = (j == BCACHE_CLASS_INDEX)?
+                                 (part->index_reserved):
+                                 (part->capacity - part->index_reserved);
+                pool->capacity = MAX(pool->capacity, 1);
+            } else {
+                pool->capacity = part->capacity;
+            }
+            bcache_policy->init(pool);
+        }
+        spin_init(&part->lock);
+    }
 
-    list_init(&freelist);
-    list_init(&file_lru);
-    list_init(&file_empty);
+    file_list = NULL;
+    num_files = file_list_capacity = 0;
 
     hash_init(&fnamedic, BCACHE_NDICBUCKET, _fname_hash, _fname_cmp);
 
     bcache_blocksize = blocksize;
     bcache_flush_unit = BCACHE_FLUSH_UNIT;
     bcache_nblock = nblock;
+    bcache_pin_limit = (uint64_t)nblock * BCACHE_PIN_RATIO / 100;
     spin_init(&bcache_lock);
-    spin_init(&freelist_lock);
     spin_init(&filelist_lock);
-    fnames = 0;
+    atomic_val_init_64(&freelist_count, 0);
+    atomic_val_init_64(&bcache_clock, 0);
+    atomic_val_init_64(&bcache_npinned, 0);
+    atomic_val_init_64(&bcache_ndirty, 0);
+    bcache_flusher_start = (uint64_t)nblock *
+                           (100 - BCACHE_FLUSHER_LOW_WATERMARK) / 100;
+    bcache_throttle_start = (uint64_t)nblock *
+                            BCACHE_FLUSHER_HIGH_WATERMARK / 100;
 
     for (i=0;i<nblock;++i){
         item = (struct bcache_item *)malloc(sizeof(struct bcache_item));
@@ -1077,115 +2120,174 @@ void bcache_init(int nblock, int blocksize)
         item->flag = 0x0 | BCACHE_FREE;
         spin_init(&item->lock);
         item->score = 0;
-
-        list_push_front(&freelist, &item->list_elem);
-        freelist_count++;
+        item->pin_count = 0;
+        item->queue = BCACHE_NO_QUEUE;
+        item->ref = 0;
+        item->cls = BCACHE_CLASS_DATA;
+
+        // distribute free blocks evenly over partitions
+        part = &partitions[i % bcache_nshards];
+        list_push_front(&part->freelist, &item->list_elem);
+        atomic_val_incr_64(&freelist_count);
         //hash_insert(&bhash, &item->hash_elem);
     }
-    e = list_begin(&freelist);
-    while(e){
-        item = _get_entry(e, struct bcache_item, list_elem);
-        item->addr = (void *)malloc(bcache_blocksize);
-        e = list_next(e);
+    for (i=0;i<(int)bcache_nshards;++i) {
+        e = list_begin(&partitions[i].freelist);
+        while(e){
+            item = _get_entry(e, struct bcache_item, list_elem);
+            // aligned for O_DIRECT writes from the cache frames
+            malloc_align(item->addr, FDB_SECTOR_SIZE, bcache_blocksize);
+            e = list_next(e);
+        }
     }
 
+#ifdef __BCACHE_FLUSHER
+    // start the background flusher
+    bcache_flusher_sleeping = 0;
+    bcache_flusher_terminate = 0;
+    mutex_init(&bcache_flusher_lock);
+    thread_cond_init(&bcache_flusher_cond);
+    thread_create(&bcache_flusher_tid, _bcache_flusher_thread, NULL);
+#endif
 }
 
 uint64_t bcache_get_num_free_blocks()
 {
-    return freelist_count;
+    return freelist_count.value.val_64;
+}
+
+void bcache_get_stats(struct bcache_stats *stats)
+{
+    size_t i;
+    uint64_t nclean;
+    struct bcache_partition *part;
+
+    memset(stats, 0x0, sizeof(struct bcache_stats));
+    if (partitions == NULL) {
+        return;
+    }
+
+    stats->nblock = bcache_nblock;
+    stats->nfree = freelist_count.value.val_64;
+    stats->index_ratio = bcache_index_ratio;
+    for (i=0;i<bcache_nshards;++i) {
+        part = &partitions[i];
+        spin_lock(&part->lock);
+        stats->nindex_reserved += part->index_reserved;
+        stats->nindex += part->pool[BCACHE_CLASS_INDEX].nitems;
+        stats->ndata += part->pool[BCACHE_CLASS_DATA].nitems;
+        stats->nindex_evict += part->pool[BCACHE_CLASS_INDEX].nevict;
+        stats->ndata_evict += part->pool[BCACHE_CLASS_DATA].nevict;
+        spin_unlock(&part->lock);
+    }
+    spin_lock(&bcache_lock);
+    stats->nglobal_lock += bcache_lock_count;
+    spin_unlock(&bcache_lock);
+    spin_lock(&filelist_lock);
+    stats->nglobal_lock += filelist_lock_count;
+    spin_unlock(&filelist_lock);
+    // the rest of the blocks are dirty
+    // (counters are not consistent snapshot)
+    nclean = stats->nindex + stats->ndata;
+    if (stats->nblock > stats->nfree + nclean) {
+        stats->ndirty = stats->nblock - stats->nfree - nclean;
+    }
 }
 
 // LCOV_EXCL_START
 void bcache_print_items()
 {
     int n=1;
-    size_t sw=0;
-    size_t nfiles, nitems, nfileitems, nclean, ndirty;
-    size_t scores[100], i, scores_local[100];
+    size_t nfiles, nitems, nclean, ndirty;
+    size_t scores[100], i, j, scores_local[100];
     size_t docs, bnodes;
     size_t docs_local, bnodes_local;
     uint8_t *ptr;
 
-    nfiles = nitems = nfileitems = nclean = ndirty = 0;
+    nfiles = nitems = nclean = ndirty = 0;
     docs = bnodes = 0;
     memset(scores, 0, sizeof(size_t)*100);
 
     struct fnamedic_item *fname;
+    struct bcache_shard *shard;
     struct bcache_item *item;
     struct dirty_item *dirty;
-    struct list_elem *e, *ee;
+    struct list_elem *ee;
     struct avl_node *a;
 
-    e = list_begin(&file_lru);
     printf(" === Block cache statistics summary ===\n");
     printf("%3s %20s (%6s)(%6s)(c%6s d%6s)",
         "No", "Filename", "#Pages", "#Evict", "Clean", "Dirty");
 #ifdef __CRC32
     printf("%6s%6s", "Doc", "Node");
 #endif
-    for (i=0;i<=n;++i) {
+    for (i=0;i<=(size_t)n;++i) {
         printf("   [%d] ", (int)i);
     }
     printf("\n");
 
-scan:
-    while(e){
-        fname = _get_entry(e, struct fnamedic_item, le);
-        ee = list_begin(&fname->cleanlist);
-        a = avl_first(&fname->tree);
+    spin_lock(&filelist_lock);
+    for (j=0;j<num_files;++j) {
+        fname = file_list[j];
         memset(scores_local, 0, sizeof(size_t)*100);
-        nfileitems = nclean = ndirty = 0;
+        nclean = ndirty = 0;
         docs_local = bnodes_local = 0;
 
-        while(ee){
-            item = _get_entry(ee, struct bcache_item, list_elem);
-            scores[item->score]++;
-            scores_local[item->score]++;
-            nitems++;
-            nfileitems++;
-            nclean++;
+        for (i=0;i<fname->num_shards;++i) {
+            shard = &fname->shards[i];
+            spin_lock(&shard->lock);
+            ee = list_begin(&shard->cleanlist);
+            a = avl_first(&shard->tree);
+
+            while(ee){
+                item = _get_entry(ee, struct bcache_item, list_elem);
+                scores[item->score]++;
+                scores_local[item->score]++;
+                nitems++;
+                nclean++;
 #ifdef __CRC32
-            ptr = (uint8_t*)item->addr + bcache_blocksize - 1;
-            switch (*ptr) {
-                case BLK_MARKER_BNODE:
-                    bnodes_local++;
-                    break;
-                case BLK_MARKER_DOC:
-                    docs_local++;
-                    break;
-            }
+                ptr = (uint8_t*)item->addr + bcache_blocksize - 1;
+                switch (*ptr) {
+                    case BLK_MARKER_BNODE:
+                        bnodes_local++;
+                        break;
+                    case BLK_MARKER_DOC:
+                        docs_local++;
+                        break;
+                }
 #endif
-            ee = list_next(ee);
-        }
-        while(a){
-            dirty = _get_entry(a, struct dirty_item, avl);
-            item = dirty->item;
-            scores[item->score]++;
-            scores_local[item->score]++;
-            nitems++;
-            nfileitems++;
-            ndirty++;
-#ifdef __CRC32
-            ptr = (uint8_t*)item->addr + bcache_blocksize - 1;
-            switch (*ptr) {
-                case BLK_MARKER_BNODE:
-                    bnodes_local++;
-                    break;
-                case BLK_MARKER_DOC:
-                    docs_local++;
-                    break;
+                ee = list_next(ee);
             }
+            while(a){
+                dirty = _get_entry(a, struct dirty_item, avl);
+                item = dirty->item;
+                scores[item->score]++;
+                scores_local[item->score]++;
+                nitems++;
+                ndirty++;
+#ifdef __CRC32
+                ptr = (uint8_t*)item->addr + bcache_blocksize - 1;
+                switch (*ptr) {
+                    case BLK_MARKER_BNODE:
+                        bnodes_local++;
+                        break;
+                    case BLK_MARKER_DOC:
+                        docs_local++;
+                        break;
+                }
 #endif
-            a = avl_next(a);
+                a = avl_next(a);
+            }
+            spin_unlock(&shard->lock);
         }
 
         printf("%3d %20s (%6d)(%6d)(c%6d d%6d)",
                (int)nfiles+1, fname->filename,
-               (int)fname->nitems, (int)fname->nvictim,
+               (int)fname->nitems.value.val_64,
+               (int)fname->nvictim.value.val_64,
                (int)nclean, (int)ndirty);
         printf("%6d%6d", (int)docs_local, (int)bnodes_local);
-        for (i=0;i<=n;++i){
+        for (i=0;i<=(size_t)n;++i){
             printf("%6d ", (int)scores_local[i]);
         }
         printf("\n");
@@ -1194,17 +2296,12 @@ scan:
         bnodes += bnodes_local;
 
         nfiles++;
-        e = list_next(e);
     }
+    spin_unlock(&filelist_lock);
     printf(" ===\n");
-    if (sw == 0){
-        e = list_begin(&file_empty);
-        sw=1;
-        goto scan;
-    }
 
     printf("%d files %d items\n", (int)nfiles, (int)nitems);
-    for (i=0;i<=n;++i){
+    for (i=0;i<=(size_t)n;++i){
         printf("[%d]: %d\n", (int)i, (int)scores[i]);
     }
     printf("Documents: %d blocks\n", (int)docs);
@@ -1216,7 +2313,7 @@ scan:
 INLINE void _bcache_free_bcache_item(struct hash_elem *h)
 {
     struct bcache_item *item = _get_entry(h, struct bcache_item, hash_elem);
-    free(item->addr);
+    free_align(item->addr);
     spin_destroy(&item->lock);
     free(item);
 }
@@ -1226,10 +2323,14 @@ INLINE void _bcache_free_bcache_item(struct hash_elem *h)
 INLINE void _bcache_free_fnamedic(struct hash_elem *h)
 {
     struct fnamedic_item *item;
+    size_t i;
     item = _get_entry(h, struct fnamedic_item, hash_elem);
-    hash_free_active(&item->hashtable, _bcache_free_bcache_item);
-
-    _bcache_move_fname_list(item, NULL);
+    for (i=0;i<item->num_shards;++i) {
+        hash_free_active(&item->shards[i].hashtable,
+                         _bcache_free_bcache_item);
+        spin_destroy(&item->shards[i].lock);
+    }
+    free(item->shards);
 
     free(item->filename);
     free(item);
@@ -1240,22 +2341,52 @@ void bcache_shutdown()
 {
     struct bcache_item *item;
     struct list_elem *e;
+    size_t i, j;
+
+#ifdef __BCACHE_FLUSHER
+    void *ret;
+
+    // stop the background flusher
+    mutex_lock(&bcache_flusher_lock);
+    bcache_flusher_terminate = 1;
+    thread_cond_signal(&bcache_flusher_cond);
+    mutex_unlock(&bcache_flusher_lock);
+    thread_join(bcache_flusher_tid, &ret);
+    mutex_destroy(&bcache_flusher_lock);
+    thread_cond_destroy(&bcache_flusher_cond);
+#endif
 
-    e = list_begin(&freelist);
-    while(e) {
-        item = _get_entry(e, struct bcache_item, list_elem);
-        e = list_remove(&freelist, e);
-        free(item->addr);
-        spin_destroy(&item->lock);
-        free(item);
+    for (i=0;i<bcache_nshards;++i) {
+        e = list_begin(&partitions[i].freelist);
+        while(e) {
+            item = _get_entry(e, struct bcache_item, list_elem);
+            e = list_remove(&partitions[i].freelist, e);
+            free_align(item->addr);
+            spin_destroy(&item->lock);
+            free(item);
+        }
+        for (j=0;j<BCACHE_NCLASSES;++j) {
+            bcache_policy->free(&partitions[i].pool[j]);
+        }
+        spin_destroy(&partitions[i].lock);
     }
+    free(partitions);
+    partitions = NULL;
 
     spin_lock(&bcache_lock);
     hash_free_active(&fnamedic, _bcache_free_fnamedic);
     spin_unlock(&bcache_lock);
 
+    spin_lock(&filelist_lock);
+    free(file_list);
+    file_list = NULL;
+    num_files = file_list_capacity = 0;
+    spin_unlock(&filelist_lock);
+
+    atomic_val_destroy(&freelist_count);
+    atomic_val_destroy(&bcache_clock);
+    atomic_val_destroy(&bcache_npinned);
+    atomic_val_destroy(&bcache_ndirty);
     spin_destroy(&bcache_lock);
-    spin_destroy(&freelist_lock);
     spin_destroy(&filelist_lock);
 }
-
@@ -29,17 +29,50 @@ typedef enum {
     BCACHE_REQ_DIRTY
 } bcache_dirty_t;
 
-void bcache_init(int nblock, int blocksize);
-int bcache_read(struct filemgr *file, bid_t bid, void *buf);
+// hint for the replacement policy
+typedef enum {
+    BCACHE_HINT_NORMAL,
+    // the block is read only once (e.g., by compaction or prefetch),
+    // so it should not push frequently used blocks out of the cache
+    BCACHE_HINT_ONCE
+} bcache_hint_t;
+
+struct bcache_stats {
+    // total number of blocks
+    uint64_t nblock;
+    uint64_t nfree;
+    // number of clean index (B+tree node) and data blocks
+    uint64_t nindex;
+    uint64_t ndata;
+    uint64_t ndirty;
+    // percentage and number of blocks reserved for index blocks
+    int index_ratio;
+    uint64_t nindex_reserved;
+    // number of evicted index and data blocks
+    uint64_t nindex_evict;
+    uint64_t ndata_evict;
+    // number of times the global locks were acquired
+    // (cache hits never take them)
+    uint64_t nglobal_lock;
+};
+
+void bcache_init(int nblock, int blocksize, int index_ratio);
+int bcache_read(struct filemgr *file, bid_t bid, void *buf,
+                bcache_hint_t hint);
 void bcache_invalidate_block(struct filemgr *file, bid_t bid);
-int bcache_write(struct filemgr *file, bid_t bid, void *buf, bcache_dirty_t dirty);
+int bcache_write(struct filemgr *file, bid_t bid, void *buf,
+                 bcache_dirty_t dirty, bcache_hint_t hint);
 int bcache_write_partial(struct filemgr *file, bid_t bid, void *buf, size_t offset, size_t len);
+void *bcache_pin(struct filemgr *file, bid_t bid,
+                 filemgr_pin_prepare_func *prepare, void *ctx);
+void bcache_unpin(struct filemgr *file, bid_t bid);
 void bcache_remove_dirty_blocks(struct filemgr *file);
 void bcache_remove_clean_blocks(struct filemgr *file);
 void bcache_remove_file(struct filemgr *file);
 fdb_status bcache_flush(struct filemgr *file);
 void bcache_shutdown();
 uint64_t bcache_get_num_free_blocks();
+void bcache_get_stats(struct bcache_stats *stats);
 void bcache_print_items();
 void bcache_update_file_status(struct filemgr *file, file_status_t status);
 
@@ -0,0 +1,540 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bloomfilter.h"
+
+#include "memleak.h"
+
+// all bits for a key are set in a block of the size of a cache line
+#define BLOOMFILTER_BLOCK_SIZE (64)
+#define BLOOMFILTER_BLOCK_BITS (BLOOMFILTER_BLOCK_SIZE * 8)
+// capacity of the first slice if the number of keys is unknown
+#define BLOOMFILTER_MIN_CAPACITY (1024)
+// capacity of each slice over that of the previous slice
+#define BLOOMFILTER_GROWTH (4)
+#define BLOOMFILTER_LOG_MIN_SIZE (256)
+
+INLINE uint64_t _bloomfilter_hash(void *key, size_t keylen)
+{
+    // 64-bit FNV-1a, followed by the finalizer of MurmurHash3
+    // (hash values are persisted, so this should never be changed)
+    uint8_t *p = (uint8_t *)key;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i=0;i<keylen;++i){
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// the upper half of a hash value selects the block, and the lower half
+// generates the bits in the block (by double hashing)
+INLINE uint8_t *_bloomfilter_block(struct bloomfilter_slice *slice,
+                                   uint64_t hash)
+{
+    return slice->bits +
+           ((hash >> 32) % slice->nblocks) * BLOOMFILTER_BLOCK_SIZE;
+}
+
+INLINE void _bloomfilter_set(struct bloomfilter *bf,
+                             struct bloomfilter_slice *slice, uint64_t hash)
+{
+    uint8_t *block = _bloomfilter_block(slice, hash);
+    uint32_t a = (uint32_t)hash;
+    uint32_t b = ((a >> 17) | (a << 15)) | 1;
+    uint32_t bit;
+    int i;
+
+    for (i=0;i<bf->nhashes;++i){
+        bit = a % BLOOMFILTER_BLOCK_BITS;
+        block[bit >> 3] |= (uint8_t)1 << (bit & 0x7);
+        a += b;
+    }
+}
+
+INLINE bool _bloomfilter_test(struct bloomfilter *bf,
+                              struct bloomfilter_slice *slice, uint64_t hash)
+{
+    uint8_t *block = _bloomfilter_block(slice, hash);
+    uint32_t a = (uint32_t)hash;
+    uint32_t b = ((a >> 17) | (a << 15)) | 1;
+    uint32_t bit;
+    int i;
+
+    for (i=0;i<bf->nhashes;++i){
+        bit = a % BLOOMFILTER_BLOCK_BITS;
+        if (!(block[bit >> 3] & ((uint8_t)1 << (bit & 0x7)))) {
+            return false;
+        }
+        a += b;
+    }
+    return true;
+}
+
+static struct bloomfilter *_bloomfilter_alloc(uint8_t bits_per_key)
+{
+    struct bloomfilter *bf;
+
+    bf = (struct bloomfilter *)calloc(1, sizeof(struct bloomfilter));
+    bf->bits_per_key = bits_per_key;
+    // k = (m/n) * ln2 minimizes the false positive rate
+    bf->nhashes = (bits_per_key * 69 + 50) / 100;
+    if (bf->nhashes < 1) {
+        bf->nhashes = 1;
+    }
+    if (bf->nhashes > 16) {
+        bf->nhashes = 16;
+    }
+    bf->nslices = 0;
+    bf->log = NULL;
+    bf->log_count = bf->log_size = 0;
+    bf->base_offset = BLK_NOT_FOUND;
+    bf->nruns = 0;
+    mutex_init(&bf->lock);
+    atomic_val_init_64(&bf->nlookups, 0);
+    atomic_val_init_64(&bf->nnegatives, 0);
+    atomic_val_init_64(&bf->nfalse_positives, 0);
+    return bf;
+}
+
+// append a new slice (BF->LOCK should be held);
+// returns NULL if the bits cannot be allocated
+static struct bloomfilter_slice *_bloomfilter_add_slice(
+                                            struct bloomfilter *bf,
+                                            uint64_t capacity,
+                                            uint64_t nblocks)
+{
+    struct bloomfilter_slice *slice = &bf->slices[bf->nslices];
+    void *bits = NULL;
+
+    if (nblocks == 0) {
+        nblocks = (capacity * bf->bits_per_key + BLOOMFILTER_BLOCK_BITS - 1) /
+                  BLOOMFILTER_BLOCK_BITS;
+    }
+    if (nblocks == 0) {
+        nblocks = 1;
+    }
+    malloc_align(bits, BLOOMFILTER_BLOCK_SIZE,
+                 nblocks * BLOOMFILTER_BLOCK_SIZE);
+    if (bits == NULL) {
+        return NULL;
+    }
+    memset(bits, 0x0, nblocks * BLOOMFILTER_BLOCK_SIZE);
+
+    slice->capacity = capacity;
+    slice->nkeys = 0;
+    slice->nblocks = nblocks;
+    slice->bits = (uint8_t *)bits;
+    // the slice should be initialized before readers can see it
+    fdb_sync_synchronize();
+    bf->nslices++;
+    return slice;
+}
+
+struct bloomfilter *bloomfilter_create(uint8_t bits_per_key,
+                                       uint64_t capacity)
+{
+    struct bloomfilter *bf = _bloomfilter_alloc(bits_per_key);
+
+    if (capacity < BLOOMFILTER_MIN_CAPACITY) {
+        capacity = BLOOMFILTER_MIN_CAPACITY;
+    }
+    if (!_bloomfilter_add_slice(bf, capacity, 0)) {
+        bloomfilter_free(bf);
+        return NULL;
+    }
+    return bf;
+}
+
+void bloomfilter_free(struct bloomfilter *bf)
+{
+    int i;
+
+    for (i=0;i<bf->nslices;++i){
+        free_align(bf->slices[i].bits);
+    }
+    free(bf->log);
+    mutex_destroy(&bf->lock);
+    atomic_val_destroy(&bf->nlookups);
+    atomic_val_destroy(&bf->nnegatives);
+    atomic_val_destroy(&bf->nfalse_positives);
+    free(bf);
+}
+
+uint64_t bloomfilter_get_space_used(struct bloomfilter *bf)
+{
+    uint64_t size = 0;
+    int i;
+
+    for (i=0;i<bf->nslices;++i){
+        size += bf->slices[i].nblocks * BLOOMFILTER_BLOCK_SIZE;
+    }
+    return size;
+}
+
+uint64_t bloomfilter_get_num_keys(struct bloomfilter *bf)
+{
+    uint64_t nkeys = 0;
+    int i;
+
+    for (i=0;i<bf->nslices;++i){
+        nkeys += bf->slices[i].nkeys;
+    }
+    return nkeys;
+}
+
+// (BF->LOCK should be held)
+static void _bloomfilter_add_hash(struct bloomfilter *bf, uint64_t hash)
+{
+    struct bloomfilter_slice *slice = &bf->slices[bf->nslices - 1];
+    struct bloomfilter_slice *new_slice;
+
+    if (slice->nkeys >= slice->capacity &&
+        bf->nslices < BLOOMFILTER_MAX_SLICES) {
+        // the last slice is full .. keep adding to it once there is no room
+        // (or memory) for a new slice
+        new_slice = _bloomfilter_add_slice(bf,
+                                           slice->capacity * BLOOMFILTER_GROWTH,
+                                           0);
+        if (new_slice) {
+            slice = new_slice;
+        }
+    }
+    _bloomfilter_set(bf, slice, hash);
+    slice->nkeys++;
+
+    if (bf->log == NULL) {
+        return;
+    }
+    if (bf->log_count * sizeof(uint64_t) * 2 >
+        bloomfilter_get_space_used(bf)) {
+        // writing the whole filter is cheaper than writing the log
+        free(bf->log);
+        bf->log = NULL;
+        bf->log_count = bf->log_size = 0;
+        return;
+    }
+    if (bf->log_count == bf->log_size) {
+        bf->log_size *= 2;
+        bf->log = (uint64_t *)realloc(bf->log,
+                                      bf->log_size * sizeof(uint64_t));
+    }
+    bf->log[bf->log_count++] = hash;
+}
+
+// (BF->LOCK should be held)
+static void _bloomfilter_reset_log(struct bloomfilter *bf, uint64_t offset)
+{
+    bf->base_offset = offset;
+    bf->nruns = 0;
+    bf->log_count = 0;
+    if (bf->log == NULL) {
+        bf->log_size = BLOOMFILTER_LOG_MIN_SIZE;
+        bf->log = (uint64_t *)malloc(bf->log_size * sizeof(uint64_t));
+    }
+}
+
+void bloomfilter_add(struct bloomfilter *bf, void *key, size_t keylen)
+{
+    uint64_t hash = _bloomfilter_hash(key, keylen);
+
+    mutex_lock(&bf->lock);
+    _bloomfilter_add_hash(bf, hash);
+    mutex_unlock(&bf->lock);
+}
+
+bool bloomfilter_may_contain(struct bloomfilter *bf,
+                             void *key, size_t keylen)
+{
+    uint64_t hash = _bloomfilter_hash(key, keylen);
+    int i, nslices = bf->nslices;
+
+    atomic_val_incr_64(&bf->nlookups);
+    for (i=0;i<nslices;++i){
+        if (_bloomfilter_test(bf, &bf->slices[i], hash)) {
+            return true;
+        }
+    }
+    atomic_val_incr_64(&bf->nnegatives);
+    return false;
+}
+
+void bloomfilter_false_positive(struct bloomfilter *bf)
+{
+    atomic_val_incr_64(&bf->nfalse_positives);
+}
+
+INLINE void _bloomfilter_put64(uint8_t *buf, size_t *offset, uint64_t val)
+{
+    uint64_t _val = _endian_encode(val);
+    memcpy(buf + *offset, &_val, sizeof(_val));
+    *offset += sizeof(_val);
+}
+
+INLINE uint64_t _bloomfilter_get64(uint8_t *buf, size_t *offset)
+{
+    uint64_t _val;
+    memcpy(&_val, buf + *offset, sizeof(_val));
+    *offset += sizeof(_val);
+    return _endian_decode(_val);
+}
+
+/* << image of the whole filter >>
+ * [BLK_NOT_FOUND]:         8 bytes
+ * [bits per key]:          8 bytes
+ * [# slices]:              8 bytes
+ * ---
+ * [capacity]:              8 bytes
+ * [# keys]:                8 bytes
+ * [# blocks]:              8 bytes
+ * [bits]:                  (# blocks * 64) bytes
+ * ...
+ *
+ * << image of keys added after the previous image >>
+ * [previous image offset]: 8 bytes
+ * [# hash values]:         8 bytes
+ * [hash values]:           (# hash values * 8) bytes
+ */
+
+// (BF->LOCK should be held)
+static uint64_t _bloomfilter_write_full(struct bloomfilter *bf,
+                                        bloomfilter_write_func *write_func,
+                                        void *ctx)
+{
+    struct bloomfilter_slice *slice;
+    uint8_t *buf;
+    size_t len, offset = 0;
+    uint64_t image_offset;
+    int i;
+
+    len = sizeof(uint64_t) * 3 +
+          sizeof(uint64_t) * 3 * bf->nslices +
+          bloomfilter_get_space_used(bf);
+    buf = (uint8_t *)malloc(len);
+
+    _bloomfilter_put64(buf, &offset, BLK_NOT_FOUND);
+    _bloomfilter_put64(buf, &offset, bf->bits_per_key);
+    _bloomfilter_put64(buf, &offset, bf->nslices);
+    for (i=0;i<bf->nslices;++i){
+        slice = &bf->slices[i];
+        _bloomfilter_put64(buf, &offset, slice->capacity);
+        _bloomfilter_put64(buf, &offset, slice->nkeys);
+        _bloomfilter_put64(buf, &offset, slice->nblocks);
+        memcpy(buf + offset, slice->bits,
+               slice->nblocks * BLOOMFILTER_BLOCK_SIZE);
+        offset += slice->nblocks * BLOOMFILTER_BLOCK_SIZE;
+    }
+
+    image_offset = write_func(ctx, buf, len);
+    free(buf);
+    return image_offset;
+}
+
+uint64_t bloomfilter_persist(struct bloomfilter *bf,
+                             bloomfilter_write_func *write_func, void *ctx)
+{
+    uint8_t *buf;
+    size_t len, offset = 0;
+    uint64_t i, begin, count, prev, image_offset;
+    int nruns;
+
+    mutex_lock(&bf->lock);
+
+    if (bf->base_offset == BLK_NOT_FOUND || bf->log == NULL) {
+        image_offset = _bloomfilter_write_full(bf, write_func, ctx);
+        if (image_offset != BLK_NOT_FOUND) {
+            _bloomfilter_reset_log(bf, image_offset);
+        }
+        mutex_unlock(&bf->lock);
+        return image_offset;
+    }
+
+    begin = 0;
+    for (nruns=0;nruns<bf->nruns;++nruns){
+        begin += bf->runs[nruns].count;
+    }
+    count = bf->log_count - begin;
+    if (count == 0) {
+        // nothing has been added since the last image
+        image_offset = (bf->nruns)?(bf->runs[bf->nruns-1].offset)
+                                  :(bf->base_offset);
+        mutex_unlock(&bf->lock);
+        return image_offset;
+    }
+
+    // merge the latest images as long as they are not much larger than
+    // the new one, so that the number of images to be read on loading,
+    // and the number of times each key is written, are logarithmic
+    nruns = bf->nruns;
+    while (nruns && bf->runs[nruns-1].count <= count * 2) {
+        nruns--;
+        begin -= bf->runs[nruns].count;
+        count += bf->runs[nruns].count;
+    }
+    if (nruns == BLOOMFILTER_MAX_RUNS) {
+        image_offset = _bloomfilter_write_full(bf, write_func, ctx);
+        if (image_offset != BLK_NOT_FOUND) {
+            _bloomfilter_reset_log(bf, image_offset);
+        }
+        mutex_unlock(&bf->lock);
+        return image_offset;
+    }
+    prev = (nruns)?(bf->runs[nruns-1].offset):(bf->base_offset);
+
+    len = sizeof(uint64_t) * (2 + count);
+    buf = (uint8_t *)malloc(len);
+    _bloomfilter_put64(buf, &offset, prev);
+    _bloomfilter_put64(buf, &offset, count);
+    for (i=0;i<count;++i){
+        _bloomfilter_put64(buf, &offset, bf->log[begin + i]);
+    }
+    image_offset = write_func(ctx, buf, len);
+    free(buf);
+
+    if (image_offset != BLK_NOT_FOUND) {
+        bf->runs[nruns].offset = image_offset;
+        bf->runs[nruns].count = count;
+        bf->nruns = nruns + 1;
+    }
+    mutex_unlock(&bf->lock);
+    return image_offset;
+}
+
+static struct bloomfilter *_bloomfilter_import_full(uint8_t *buf, size_t len)
+{
+    struct bloomfilter *bf;
+    struct bloomfilter_slice *slice;
+    size_t offset = sizeof(uint64_t); // skip BLK_NOT_FOUND
+    uint64_t bits_per_key, nslices, capacity, nkeys, nblocks;
+    uint64_t i;
+
+    if (len < sizeof(uint64_t) * 3) {
+        return NULL;
+    }
+    bits_per_key = _bloomfilter_get64(buf, &offset);
+    nslices = _bloomfilter_get64(buf, &offset);
+    if (bits_per_key == 0 || bits_per_key > 255 ||
+        nslices == 0 || nslices > BLOOMFILTER_MAX_SLICES) {
+        return NULL;
+    }
+
+    bf = _bloomfilter_alloc(bits_per_key);
+    for (i=0;i<nslices;++i){
+        if (offset + sizeof(uint64_t) * 3 > len) {
+            break;
+        }
+        capacity = _bloomfilter_get64(buf, &offset);
+        nkeys = _bloomfilter_get64(buf, &offset);
+        nblocks = _bloomfilter_get64(buf, &offset);
+        if (nblocks == 0 ||
+            nblocks > (len - offset) / BLOOMFILTER_BLOCK_SIZE) {
+            break;
+        }
+        slice = _bloomfilter_add_slice(bf, capacity, nblocks);
+        if (!slice) {
+            break;
+        }
+        slice->nkeys = nkeys;
+        memcpy(slice->bits, buf + offset, nblocks * BLOOMFILTER_BLOCK_SIZE);
+        offset += nblocks * BLOOMFILTER_BLOCK_SIZE;
+    }
+    if (i < nslices) {
+        bloomfilter_free(bf);
+        return NULL;
+    }
+    return bf;
+}
+
+struct bloomfilter *bloomfilter_load(bloomfilter_read_func *read_func,
+                                     void *ctx, uint64_t offset)
+{
+    struct bloomfilter *bf = NULL;
+    // images added after the full image, from the latest one
+    void *bufs[BLOOMFILTER_MAX_RUNS];
+    size_t lens[BLOOMFILTER_MAX_RUNS];
+    uint64_t offsets[BLOOMFILTER_MAX_RUNS];
+    uint64_t prev, count, j;
+    void *buf;
+    size_t len, pos;
+    int i, n = 0;
+
+    while (1) {
+        if (read_func(ctx, offset, &buf, &len) != 0) {
+            goto out;
+        }
+        if (len < sizeof(uint64_t) * 2) {
+            free(buf);
+            goto out;
+        }
+        pos = 0;
+        prev = _bloomfilter_get64((uint8_t *)buf, &pos);
+        if (prev == BLK_NOT_FOUND) {
+            break;
+        }
+        if (n == BLOOMFILTER_MAX_RUNS) {
+            free(buf);
+            goto out;
+        }
+        bufs[n] = buf;
+        lens[n] = len;
+        offsets[n] = offset;
+        n++;
+        offset = prev;
+    }
+
+    bf = _bloomfilter_import_full((uint8_t *)buf, len);
+    free(buf);
+    if (bf == NULL) {
+        goto out;
+    }
+    _bloomfilter_reset_log(bf, offset);
+
+    // replay the other images from the oldest one
+    for (i=n-1;i>=0;--i){
+        pos = sizeof(uint64_t);
+        count = _bloomfilter_get64((uint8_t *)bufs[i], &pos);
+        if (count != (lens[i] - pos) / sizeof(uint64_t)) {
+            bloomfilter_free(bf);
+            bf = NULL;
+            goto out;
+        }
+        for (j=0;j<count;++j){
+            _bloomfilter_add_hash(bf, _bloomfilter_get64((uint8_t *)bufs[i],
+                                                         &pos));
+        }
+        bf->runs[bf->nruns].offset = offsets[i];
+        bf->runs[bf->nruns].count = count;
+        bf->nruns++;
+    }
+
+out:
+    for (i=0;i<n;++i){
+        free(bufs[i]);
+    }
+    return bf;
+}
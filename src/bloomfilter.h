@@ -0,0 +1,115 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef _JSAHN_BLOOMFILTER_H
+#define _JSAHN_BLOOMFILTER_H
+
+#include <stdint.h>
+#include "common.h"
+#include "atomic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bloom filter of the keys indexed in a file, used to answer lookups of
+// missing keys without walking the index.
+//
+// Keys are never removed, so the filter has no false negative as long as
+// every key is added before it is inserted into the index. The filter
+// consists of slices whose capacities grow geometrically, so that the
+// number of keys does not need to be known in advance, and each slice is
+// split into cache-line sized blocks so that a lookup touches only one
+// cache line per slice.
+//
+// Readers do not grab any lock, while writers are serialized by LOCK.
+
+#define BLOOMFILTER_MAX_SLICES (16)
+#define BLOOMFILTER_MAX_RUNS (64)
+
+struct bloomfilter_slice {
+    uint64_t capacity;
+    uint64_t nkeys;
+    uint64_t nblocks;
+    uint8_t *bits;
+};
+
+// a persisted image of keys added since the last full image
+struct bloomfilter_run {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct bloomfilter {
+    uint8_t bits_per_key;
+    uint8_t nhashes;
+    volatile uint8_t nslices;
+    struct bloomfilter_slice slices[BLOOMFILTER_MAX_SLICES];
+
+    // hash values of the keys added since the last full image was written
+    // (NULL if the next image should be a full one)
+    uint64_t *log;
+    uint64_t log_count;
+    uint64_t log_size;
+    // offset of the last full image, and the images written after that
+    uint64_t base_offset;
+    struct bloomfilter_run runs[BLOOMFILTER_MAX_RUNS];
+    int nruns;
+    mutex_t lock;
+
+    atomic_val_t nlookups;
+    atomic_val_t nnegatives;
+    atomic_val_t nfalse_positives;
+};
+
+// write an image and return its offset (BLK_NOT_FOUND on failure)
+typedef uint64_t bloomfilter_write_func(void *ctx, void *buf, size_t len);
+// read the image at OFFSET into a buffer allocated by malloc()
+// (return 0 on success)
+typedef int bloomfilter_read_func(void *ctx, uint64_t offset,
+                                  void **buf, size_t *len);
+
+// CAPACITY is the expected number of keys (0 if unknown)
+struct bloomfilter *bloomfilter_create(uint8_t bits_per_key,
+                                       uint64_t capacity);
+void bloomfilter_free(struct bloomfilter *bf);
+
+void bloomfilter_add(struct bloomfilter *bf, void *key, size_t keylen);
+// return false if the key was never added
+bool bloomfilter_may_contain(struct bloomfilter *bf,
+                             void *key, size_t keylen);
+// called when the key was not found after bloomfilter_may_contain()
+// returned true
+void bloomfilter_false_positive(struct bloomfilter *bf);
+
+// write the keys added since the last call (or the whole filter if needed),
+// and return the offset of the latest image
+uint64_t bloomfilter_persist(struct bloomfilter *bf,
+                             bloomfilter_write_func *write_func, void *ctx);
+// rebuild the filter from the latest image at OFFSET
+// (return NULL if any image is corrupted)
+struct bloomfilter *bloomfilter_load(bloomfilter_read_func *read_func,
+                                     void *ctx, uint64_t offset);
+
+uint64_t bloomfilter_get_num_keys(struct bloomfilter *bf);
+uint64_t bloomfilter_get_space_used(struct bloomfilter *bf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
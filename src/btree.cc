@@ -45,23 +45,38 @@ INLINE int is_subblock(bid_t subbid)
 INLINE struct bnode *_fetch_bnode(struct btree *btree, void *addr, uint16_t level)
 {
     struct bnode *node = NULL;
+    void *data;
 
     node = (struct bnode *)addr;
 
     if (!(node->flag & BNODE_MASK_METADATA)) {
         // no metadata
-        node->data = (uint8_t *)addr + sizeof(struct bnode);
+        data = (uint8_t *)addr + sizeof(struct bnode);
     } else {
         // metadata
         metasize_t metasize;
         memcpy(&metasize, (uint8_t *)addr + sizeof(struct bnode), sizeof(metasize_t));
         metasize = _endian_decode(metasize);
-        node->data = (uint8_t *)addr + sizeof(struct bnode) + sizeof(metasize_t) +
-                     _metasize_align(metasize);
+        data = (uint8_t *)addr + sizeof(struct bnode) + sizeof(metasize_t) +
+               _metasize_align(metasize);
+    }
+    if (node->data != data) {
+        // don't write to the nodes shared read-only by other handles
+        // (they are already fetched when they are loaded)
+        node->data = data;
     }
     return node;
 }
 
+// read a node that will not be modified by the caller
+INLINE void *_btree_read_readonly(struct btree *btree, bid_t bid)
+{
+    if (btree->blk_ops->blk_read_readonly) {
+        return btree->blk_ops->blk_read_readonly(btree->blk_handle, bid);
+    }
+    return btree->blk_ops->blk_read(btree->blk_handle, bid);
+}
+
 #ifdef _BTREE_HAS_MULTIPLE_BNODES
 struct bnode ** btree_get_bnode_array(void *addr, size_t *nnode_out)
 {
@@ -159,25 +174,18 @@ INLINE int _bnode_size_check(
     }
 
     if (nitem > 1) {
-        int i;
-        void *key_arr, *value_arr;
-
-        key_arr = (void*)malloc(btree->ksize * nitem);
-        value_arr = (void*)malloc(btree->vsize * nitem);
-
-        i = 0;
+        size_t datasize;
+        // sum up the size of each key-value pair one by one, as the layout
+        // of a key array (for variable-length keys) depends on the kv_ops
+        cursize = _bnode_size(btree, node, new_minkey, NULL, NULL, 0);
+        datasize = btree->kv_ops->get_data_size(node, NULL, NULL, NULL, 0);
         e = list_begin(kv_ins_list);
         while(e){
             item = _get_entry(e, struct kv_ins_item, le);
-            memcpy((uint8_t *)key_arr + btree->ksize * i, item->key, btree->ksize);
-            memcpy((uint8_t *)value_arr + btree->ksize * i, item->value, btree->ksize);
-            i++;
+            cursize += btree->kv_ops->get_data_size(node, NULL, item->key,
+                                                    item->value, 1) - datasize;
             e = list_next(e);
         }
-        cursize = _bnode_size(btree, node, new_minkey, key_arr, value_arr, nitem);
-
-        free(key_arr);
-        free(value_arr);
     }else if (nitem == 1) {
         e = list_begin(kv_ins_list);
         item = _get_entry(e, struct kv_ins_item, le);
@@ -254,7 +262,7 @@ metasize_t btree_read_meta(struct btree *btree, void *buf)
     metasize_t size;
     struct bnode *node;
 
-    addr = btree->blk_ops->blk_read(btree->blk_handle, btree->root_bid);
+    addr = _btree_read_readonly(btree, btree->root_bid);
     node = _fetch_bnode(btree, addr, btree->height);
     if (node->flag & BNODE_MASK_METADATA) {
         ptr = ((uint8_t *)node) + sizeof(struct bnode);
@@ -349,12 +357,13 @@ btree_result btree_init_from_bid(struct btree *btree, void *blk_handle,
     btree->blksize = nodesize;
     btree->root_bid = root_bid;
 
-    addr = btree->blk_ops->blk_read(btree->blk_handle, btree->root_bid);
+    addr = _btree_read_readonly(btree, btree->root_bid);
     root = _fetch_bnode(btree, addr, 0);
 
     btree->root_flag = root->flag;
     btree->height = root->level;
     _get_kvsize(root->kvsize, btree->ksize, btree->vsize);
+    btree_set_kv_ops(btree, kv_ops);
 
     return BTREE_RESULT_SUCCESS;
 }
@@ -376,6 +385,7 @@ btree_result btree_init(
     btree->blksize = nodesize;
     btree->ksize = ksize;
     btree->vsize = vsize;
+    btree_set_kv_ops(btree, kv_ops);
     if (meta) {
         btree->root_flag |= BNODE_MASK_METADATA;
         min_nodesize = sizeof(struct bnode) + _metasize_align(meta->size) +
@@ -422,7 +432,8 @@ key: 5
 largest key equal or smaller than KEY: 4
 return: 1 (index# of the key '4')
 */
-static idx_t _btree_find_entry(struct btree *btree, struct bnode *node, void *key)
+static idx_t _btree_find_entry_generic(struct btree *btree,
+                                       struct bnode *node, void *key)
 {
     idx_t start, end, middle, temp;
     uint8_t *k = alca(uint8_t, btree->ksize);
@@ -432,6 +443,10 @@ static idx_t _btree_find_entry(struct btree *btree, struct bnode *node, void *ke
         idx_t *_map2[3] = {&temp, &end, &temp};
     #endif
 
+    if (btree->kv_ops->find_idx) {
+        return btree->kv_ops->find_idx(node, key);
+    }
+
     if (btree->kv_ops->init_kv_var) btree->kv_ops->init_kv_var(btree, k, NULL);
 
     start = middle = 0;
@@ -483,7 +498,8 @@ static idx_t _btree_find_entry(struct btree *btree, struct bnode *node, void *ke
     return BTREE_IDX_NOT_FOUND;
 }
 
-static idx_t _btree_add_entry(struct btree *btree, struct bnode *node, void *key, void *value)
+static idx_t _btree_add_entry_generic(struct btree *btree, struct bnode *node,
+                                      void *key, void *value)
 {
     idx_t idx, idx_insert;
     uint8_t *k = alca(uint8_t, btree->ksize);
@@ -491,7 +507,7 @@ static idx_t _btree_add_entry(struct btree *btree, struct bnode *node, void *key
     if (btree->kv_ops->init_kv_var) btree->kv_ops->init_kv_var(btree, k, NULL);
 
     if (node->nentry > 0) {
-        idx = _btree_find_entry(btree, node, key);
+        idx = _btree_find_entry_generic(btree, node, key);
 
         if (idx == BTREE_IDX_NOT_FOUND) idx_insert = 0;
         else {
@@ -533,12 +549,13 @@ static idx_t _btree_add_entry(struct btree *btree, struct bnode *node, void *key
     return idx_insert;
 }
 
-static idx_t _btree_remove_entry(struct btree *btree, struct bnode *node, void *key)
+static idx_t _btree_remove_entry_generic(struct btree *btree,
+                                         struct bnode *node, void *key)
 {
     idx_t idx;
 
     if (node->nentry > 0) {
-        idx = _btree_find_entry(btree, node, key);
+        idx = _btree_find_entry_generic(btree, node, key);
 
         if (idx == BTREE_IDX_NOT_FOUND) return idx;
 
@@ -560,6 +577,204 @@ static idx_t _btree_remove_entry(struct btree *btree, struct bnode *node, void *
     }
 }
 
+struct btree_entry_ops {
+    // same as _btree_find_entry_generic()
+    idx_t (*find_entry)(struct btree *btree, struct bnode *node, void *key);
+    // same as _btree_add_entry_generic()
+    idx_t (*add_entry)(struct btree *btree, struct bnode *node,
+                       void *key, void *value);
+    // same as _btree_remove_entry_generic()
+    idx_t (*remove_entry)(struct btree *btree, struct bnode *node, void *key);
+};
+
+static struct btree_entry_ops btree_generic_entry_ops = {
+    _btree_find_entry_generic,
+    _btree_add_entry_generic,
+    _btree_remove_entry_generic
+};
+
+// comparison of KSIZE-byte binary keys in memcmp() order
+template <size_t KSIZE>
+struct btree_fixed_key {
+    static inline int cmp(void *key1, void *key2) {
+        return memcmp(key1, key2, KSIZE);
+    }
+};
+
+template <>
+struct btree_fixed_key<4> {
+    static inline int cmp(void *key1, void *key2) {
+        uint32_t a, b;
+        memcpy(&a, key1, sizeof(a));
+        memcpy(&b, key2, sizeof(b));
+        a = _endian_encode(a);
+        b = _endian_encode(b);
+        return _CMP_U32(a, b);
+    }
+};
+
+template <>
+struct btree_fixed_key<8> {
+    static inline int cmp(void *key1, void *key2) {
+        uint64_t a, b;
+        memcpy(&a, key1, sizeof(a));
+        memcpy(&b, key2, sizeof(b));
+        a = _endian_encode(a);
+        b = _endian_encode(b);
+        return _CMP_U64(a, b);
+    }
+};
+
+// entry operations specialized for KSIZE-byte binary keys and VSIZE-byte
+// values (i.e., 'fixed_kv' in btree_kv_ops), which access the node data and
+// compare the keys directly instead of calling kv_ops for every entry.
+template <size_t KSIZE, size_t VSIZE>
+struct btree_fixed_kv {
+    static inline uint8_t * entry(struct bnode *node, idx_t idx) {
+        return (uint8_t *)node->data + idx * (KSIZE + VSIZE);
+    }
+
+    static idx_t find_entry(struct btree *btree, struct bnode *node, void *key)
+    {
+        idx_t start, end, middle;
+        int cmp;
+
+        if (btree->kv_ops->find_idx) {
+            return btree->kv_ops->find_idx(node, key);
+        }
+
+        start = 0;
+        end = node->nentry;
+        if (end == 0 || btree_fixed_key<KSIZE>::cmp(key, entry(node, 0)) < 0) {
+            return BTREE_IDX_NOT_FOUND;
+        }
+        if (btree_fixed_key<KSIZE>::cmp(key, entry(node, end-1)) >= 0) {
+            return end-1;
+        }
+
+        // binary search
+        while (start+1 < end) {
+            middle = (start + end) >> 1;
+            cmp = btree_fixed_key<KSIZE>::cmp(key, entry(node, middle));
+            if (cmp < 0) end = middle;
+            else if (cmp > 0) start = middle;
+            else return middle;
+        }
+        return start;
+    }
+
+    static idx_t add_entry(struct btree *btree, struct bnode *node,
+                           void *key, void *value)
+    {
+        idx_t idx, idx_insert = 0;
+        uint8_t *ptr;
+
+        if (node->nentry > 0) {
+            idx = find_entry(btree, node, key);
+            if (idx != BTREE_IDX_NOT_FOUND) {
+                ptr = entry(node, idx);
+                if (!btree_fixed_key<KSIZE>::cmp(key, ptr)) {
+                    // if same key already exists -> update its value
+                    memcpy(ptr + KSIZE, value, VSIZE);
+                    return idx;
+                }
+                idx_insert = idx+1;
+            }
+        }
+
+        // shift [idx_insert, nentry) key-value pairs to right
+        ptr = entry(node, idx_insert);
+        if (idx_insert < node->nentry) {
+            memmove(ptr + (KSIZE + VSIZE), ptr,
+                    (node->nentry - idx_insert) * (KSIZE + VSIZE));
+        }
+        memcpy(ptr, key, KSIZE);
+        memcpy(ptr + KSIZE, value, VSIZE);
+        node->nentry++;
+
+        return idx_insert;
+    }
+
+    static idx_t remove_entry(struct btree *btree, struct bnode *node,
+                              void *key)
+    {
+        idx_t idx;
+        uint8_t *ptr;
+
+        if (node->nentry == 0) {
+            return BTREE_IDX_NOT_FOUND;
+        }
+        idx = find_entry(btree, node, key);
+        if (idx == BTREE_IDX_NOT_FOUND) {
+            return idx;
+        }
+
+        // shift [idx+1, nentry) key-value pairs to left
+        ptr = entry(node, idx);
+        memmove(ptr, ptr + (KSIZE + VSIZE),
+                (node->nentry - (idx+1)) * (KSIZE + VSIZE));
+        node->nentry--;
+
+        return idx;
+    }
+
+    static struct btree_entry_ops ops;
+};
+
+template <size_t KSIZE, size_t VSIZE>
+struct btree_entry_ops btree_fixed_kv<KSIZE, VSIZE>::ops = {
+    btree_fixed_kv<KSIZE, VSIZE>::find_entry,
+    btree_fixed_kv<KSIZE, VSIZE>::add_entry,
+    btree_fixed_kv<KSIZE, VSIZE>::remove_entry
+};
+
+// choose the entry operations for the given layout once, so that the
+// specialized code is used for the key sizes of the seq-tree and of
+// HB+trie with 4, 8, 16, and 32-byte chunks (and bid values)
+static struct btree_entry_ops * _btree_get_entry_ops(
+    struct btree_kv_ops *kv_ops, uint8_t ksize, uint8_t vsize)
+{
+    if (!kv_ops->fixed_kv || vsize != sizeof(bid_t)) {
+        return &btree_generic_entry_ops;
+    }
+    switch (ksize) {
+    case 4:
+        return &btree_fixed_kv<4, sizeof(bid_t)>::ops;
+    case 8:
+        return &btree_fixed_kv<8, sizeof(bid_t)>::ops;
+    case 16:
+        return &btree_fixed_kv<16, sizeof(bid_t)>::ops;
+    case 32:
+        return &btree_fixed_kv<32, sizeof(bid_t)>::ops;
+    default:
+        return &btree_generic_entry_ops;
+    }
+}
+
+void btree_set_kv_ops(struct btree *btree, struct btree_kv_ops *kv_ops)
+{
+    btree->kv_ops = kv_ops;
+    btree->entry_ops = _btree_get_entry_ops(kv_ops, btree->ksize, btree->vsize);
+}
+
+INLINE idx_t _btree_find_entry(struct btree *btree, struct bnode *node,
+                               void *key)
+{
+    return btree->entry_ops->find_entry(btree, node, key);
+}
+
+INLINE idx_t _btree_add_entry(struct btree *btree, struct bnode *node,
+                              void *key, void *value)
+{
+    return btree->entry_ops->add_entry(btree, node, key, value);
+}
+
+INLINE idx_t _btree_remove_entry(struct btree *btree, struct bnode *node,
+                                 void *key)
+{
+    return btree->entry_ops->remove_entry(btree, node, key);
+}
+
 static void _btree_print_node(struct btree *btree, int depth,
                               bid_t bid, btree_print_func func)
 {
@@ -572,7 +787,7 @@ static void _btree_print_node(struct btree *btree, int depth,
 
     if (btree->kv_ops->init_kv_var) btree->kv_ops->init_kv_var(btree, k, v);
 
-    addr = btree->blk_ops->blk_read(btree->blk_handle, bid);
+    addr = _btree_read_readonly(btree, bid);
     node = _fetch_bnode(btree, addr, depth);
 
     fprintf(stderr, "[d:%d n:%d f:%x b:%" _F64 " ", node->level, node->nentry, node->flag, bid);
@@ -621,7 +836,7 @@ btree_result btree_get_key_range(
     _den = (uint64_t)den * resolution;
 
     // get root node
-    addr = btree->blk_ops->blk_read(btree->blk_handle, btree->root_bid);
+    addr = _btree_read_readonly(btree, btree->root_bid);
     root = _fetch_bnode(btree, addr, btree->height);
     _nentry = (uint64_t)root->nentry * resolution;
 
@@ -640,7 +855,7 @@ btree_result btree_get_key_range(
         btree->kv_ops->get_kv(root, idx_begin, k, v);
         bid = btree->kv_ops->value2bid(v);
         bid = _endian_decode(bid);
-        addr = btree->blk_ops->blk_read(btree->blk_handle, bid);
+        addr = _btree_read_readonly(btree, bid);
         node = _fetch_bnode(btree, addr, btree->height-1);
 
         idx = ((_idx_begin & mask) * (node->nentry-1) / (resolution-1));
@@ -651,7 +866,7 @@ btree_result btree_get_key_range(
             btree->kv_ops->get_kv(root, idx_end, k, v);
             bid = btree->kv_ops->value2bid(v);
             bid = _endian_decode(bid);
-            addr = btree->blk_ops->blk_read(btree->blk_handle, bid);
+            addr = _btree_read_readonly(btree, bid);
             node = _fetch_bnode(btree, addr, btree->height-1);
         }
 
@@ -680,7 +895,7 @@ btree_result btree_find(struct btree *btree, void *key, void *value_buf)
 
     for (i=btree->height-1; i>=0; --i) {
         // read block using bid
-        addr = btree->blk_ops->blk_read(btree->blk_handle, bid[i]);
+        addr = _btree_read_readonly(btree, bid[i]);
         // fetch node structure from block
         node[i] = _fetch_bnode(btree, addr, i+1);
 
@@ -897,9 +1112,13 @@ static int _btree_move_modified_node(
     return 0;
 }
 
-btree_result btree_insert(struct btree *btree, void *key, void *value)
+// insert KEYS[0] and the following keys that belong to the same leaf node,
+// and return the number of keys processed through NRUN_OUT.
+static btree_result _btree_insert(struct btree *btree, void **keys,
+                                  void **values, size_t n, size_t *nrun_out)
 {
     void *addr;
+    void *key = keys[0];
     size_t nsplitnode = 1;
     uint8_t *k = alca(uint8_t, btree->ksize);
     uint8_t *v = alca(uint8_t, btree->vsize);
@@ -923,6 +1142,11 @@ btree_result btree_insert(struct btree *btree, void *key, void *value)
     idx_t *idx_ins = alca(idx_t, btree->height);
     struct bnode **node = alca(struct bnode *, btree->height);
     int i, j, _is_update = 0;
+    // upper bound of the key range of the leaf node
+    uint8_t *bound = alca(uint8_t, btree->ksize);
+    int has_bound = 0;
+    size_t nrun, ninsert, nodesize_cur, nodesize_max, datasize, kvsize;
+    idx_t idx_leaf;
 
     // initialize flags
     for (i=0;i<btree->height;++i) {
@@ -933,17 +1157,12 @@ btree_result btree_insert(struct btree *btree, void *key, void *value)
     // initialize temporary variables
     if (btree->kv_ops->init_kv_var) {
         btree->kv_ops->init_kv_var(btree, k, v);
+        btree->kv_ops->init_kv_var(btree, bound, NULL);
         for (i=0;i<btree->height;++i){
             list_init(&kv_ins_list[i]);
         }
     }
 
-    // copy key-value pair to be inserted into leaf node
-    kv_item = _kv_ins_item_create(btree, key, value);
-    list_push_back(&kv_ins_list[0], &kv_item->le);
-
-    ins[0] = 1;
-
     // set root node
     bid[btree->height-1] = btree->root_bid;
 
@@ -964,6 +1183,13 @@ btree_result btree_insert(struct btree *btree, void *key, void *value)
                 // just follow the smallest key
                 idx[i] = 0;
 
+            if (n > 1 && idx[i]+1 < node[i]->nentry) {
+                // the next key in the index node bounds the key range
+                // of the child node (the lowest level is the tightest)
+                btree->kv_ops->get_kv(node[i], idx[i]+1, bound, NULL);
+                has_bound = 1;
+            }
+
             // get bid of child node from value
             btree->kv_ops->get_kv(node[i], idx[i], k, v);
             bid[i-1] = btree->kv_ops->value2bid(v);
@@ -973,6 +1199,61 @@ btree_result btree_insert(struct btree *btree, void *key, void *value)
         }
     }
 
+    // gather the keys that go into the leaf node: a key that already exists
+    // is updated in place, and the others are reserved to be inserted as long
+    // as they fit in the leaf node, so that the leaf node and its ancestors
+    // are modified (and moved) only once for all of them.
+    nodesize_max = btree->blk_ops->blk_get_size(btree->blk_handle, bid[0]);
+#ifdef __CRC32
+    nodesize_max -= BLK_MARKER_SIZE;
+#endif
+    nodesize_cur = _bnode_size(btree, node[0], NULL, NULL, NULL, 0);
+    datasize = btree->kv_ops->get_data_size(node[0], NULL, NULL, NULL, 0);
+    nrun = ninsert = 0;
+    while (nrun < n) {
+        if (nrun > 0) {
+            // stop at the first key that is out of order or out of the leaf
+            if (btree->kv_ops->cmp(keys[nrun], keys[nrun-1], btree->aux) <= 0 ||
+                (has_bound &&
+                 btree->kv_ops->cmp(keys[nrun], bound, btree->aux) >= 0)) {
+                break;
+            }
+        }
+
+        idx_leaf = _btree_find_entry(btree, node[0], keys[nrun]);
+        if (idx_leaf != BTREE_IDX_NOT_FOUND) {
+            btree->kv_ops->get_kv(node[0], idx_leaf, k, NULL);
+            if (!btree->kv_ops->cmp(keys[nrun], k, btree->aux)) {
+                // same key already exists -> update its value
+                _btree_add_entry(btree, node[0], keys[nrun], values[nrun]);
+                modified[0] = 1;
+                if (nrun == 0) {
+                    _is_update = 1;
+                }
+                nrun++;
+                continue;
+            }
+        }
+
+        kvsize = btree->kv_ops->get_data_size(node[0], NULL, keys[nrun],
+                                              values[nrun], 1) - datasize;
+        if (nodesize_cur + kvsize > nodesize_max && ninsert > 0) {
+            // not enough space .. leave the rest to the next round
+            break;
+        }
+        kv_item = _kv_ins_item_create(btree, keys[nrun], values[nrun]);
+        list_push_back(&kv_ins_list[0], &kv_item->le);
+        ins[0] = 1;
+        ninsert++;
+        nrun++;
+        if (nodesize_cur + kvsize > nodesize_max) {
+            // the leaf node will be enlarged or split for this key
+            break;
+        }
+        nodesize_cur += kvsize;
+    }
+    *nrun_out = nrun;
+
     // cascaded insert from leaf to root
     for (i=0;i<btree->height;++i){
 
@@ -1002,24 +1283,16 @@ btree_result btree_insert(struct btree *btree, void *key, void *value)
             // node check whether btree node space is enough to add new
             // key-value pair or not, OR action is not insertion but update
             // (key_ins exists in current node)
-            _is_update = 0;
+            // (updates of existing keys in the leaf node are already done)
             size_t nodesize;
             void *new_minkey = (minkey_replace[i])?(key):(NULL);
 
-            if (i==0) {
-                e = list_begin(&kv_ins_list[i]);
-                kv_item = _get_entry(e, struct kv_ins_item, le);
-                _is_update =
-                    (idx[i] != BTREE_IDX_NOT_FOUND &&
-                     !btree->kv_ops->cmp(kv_item->key, k, btree->aux));
-            }
-
         check_node:;
             int _size_check =
                 _bnode_size_check(btree, bid[i], node[i], new_minkey,
                                   &kv_ins_list[i], &nodesize);
 
-            if (_size_check || _is_update ) {
+            if (_size_check) {
                 //2 enough space
                 if (ins[i]) {
                     // insert key/value pair(s)
@@ -1099,7 +1372,10 @@ btree_result btree_insert(struct btree *btree, void *key, void *value)
     if (btree->blk_ops->blk_operation_end) {
         btree->blk_ops->blk_operation_end(btree->blk_handle);
     }
-    if (btree->kv_ops->free_kv_var) btree->kv_ops->free_kv_var(btree, k, v);
+    if (btree->kv_ops->free_kv_var) {
+        btree->kv_ops->free_kv_var(btree, k, v);
+        btree->kv_ops->free_kv_var(btree, bound, NULL);
+    }
 
     for (j=0; j < ((height_growup)?(btree->height-1):(btree->height)); ++j){
         e = list_begin(&kv_ins_list[j]);
@@ -1121,6 +1397,30 @@ btree_result btree_insert(struct btree *btree, void *key, void *value)
     }
 }
 
+btree_result btree_insert(struct btree *btree, void *key, void *value)
+{
+    size_t nrun;
+    return _btree_insert(btree, &key, &value, 1, &nrun);
+}
+
+btree_result btree_insert_batch(struct btree *btree, void **keys,
+                                void **values, size_t n)
+{
+    size_t nrun;
+    btree_result br;
+
+    while (n > 0) {
+        br = _btree_insert(btree, keys, values, n, &nrun);
+        if (br == BTREE_RESULT_FAIL) {
+            return br;
+        }
+        keys += nrun;
+        values += nrun;
+        n -= nrun;
+    }
+    return BTREE_RESULT_SUCCESS;
+}
+
 btree_result btree_remove(struct btree *btree, void *key)
 {
     void *addr;
@@ -1359,7 +1659,7 @@ static btree_result _btree_prev(struct btree_iterator *it, void *key_buf,
 
     if (it->node[depth] == NULL){
         size_t blksize;
-        addr = btree->blk_ops->blk_read(btree->blk_handle, it->bid[depth]);
+        addr = _btree_read_readonly(btree, it->bid[depth]);
         it->addr[depth] = (void *)mempool_alloc(btree->blksize);
         blksize = btree->blk_ops->blk_get_size(btree->blk_handle,
                                                it->bid[depth]);
@@ -1508,7 +1808,7 @@ static btree_result _btree_next(struct btree_iterator *it, void *key_buf,
 
     if (it->node[depth] == NULL){
         size_t blksize;
-        addr = btree->blk_ops->blk_read(btree->blk_handle, it->bid[depth]);
+        addr = _btree_read_readonly(btree, it->bid[depth]);
         it->addr[depth] = (void *)mempool_alloc(btree->blksize);
         blksize = btree->blk_ops->blk_get_size(btree->blk_handle,
                                                it->bid[depth]);
@@ -1634,3 +1934,238 @@ btree_result btree_next(struct btree_iterator *it, void *key_buf,
     return br;
 }
 
+
+btree_result btree_bulk_init(
+        struct btree_bulk *bulk, struct btree *btree, void *blk_handle,
+        struct btree_blk_ops *blk_ops, struct btree_kv_ops *kv_ops,
+        uint32_t nodesize, uint8_t ksize, uint8_t vsize,
+        bnode_flag_t flag, uint8_t fill_factor)
+{
+    btree->root_flag = BNODE_MASK_ROOT | flag;
+    btree->blk_ops = blk_ops;
+    btree->blk_handle = blk_handle;
+    btree->kv_ops = kv_ops;
+    btree->height = 0;
+    btree->blksize = nodesize;
+    btree->ksize = ksize;
+    btree->vsize = vsize;
+    btree_set_kv_ops(btree, kv_ops);
+    // the root node is allocated when the bulk loading is finished
+    btree->root_bid = BLK_NOT_FOUND;
+
+    if (fill_factor == 0 || fill_factor > 100) {
+        fill_factor = 100;
+    }
+    bulk->btree = btree;
+    bulk->capacity = nodesize;
+#ifdef __CRC32
+    bulk->capacity -= BLK_MARKER_SIZE;
+#endif
+    bulk->fill_size = bulk->capacity * fill_factor / 100;
+    bulk->nlevels = bulk->max_levels = 0;
+    bulk->nodes = NULL;
+    bulk->nentry = 0;
+    bulk->last_key = (void *)malloc(ksize);
+    if (kv_ops->init_kv_var) {
+        kv_ops->init_kv_var(btree, bulk->last_key, NULL);
+    }
+
+    return BTREE_RESULT_SUCCESS;
+}
+
+INLINE struct bnode * _btree_bulk_reset_node(struct btree_bulk *bulk,
+                                             uint16_t level)
+{
+    return _btree_init_node(bulk->btree, BLK_NOT_FOUND, bulk->nodes[level],
+                            0x0, level+1, NULL);
+}
+
+// write the staged node into a newly allocated block
+static bid_t _btree_bulk_write_node(struct btree_bulk *bulk,
+                                    struct bnode *src, bnode_flag_t flag,
+                                    struct btree_meta *meta)
+{
+    void *addr;
+    bid_t bid;
+    size_t size;
+    struct bnode *node;
+    struct btree *btree = bulk->btree;
+
+    if (flag & BNODE_MASK_ROOT) {
+        // the root node can be small (e.g., a sub-tree of HB+trie),
+        // so put it into a sub-block as btree_init() does
+        size = _bnode_size(btree, src, NULL, NULL, NULL, 0) + BLK_MARKER_SIZE;
+        if (meta) {
+            size += _metasize_align(meta->size) + sizeof(metasize_t);
+        }
+        if (btree->blk_ops->blk_alloc_sub && btree->blk_ops->blk_enlarge_node) {
+            addr = btree->blk_ops->blk_alloc_sub(btree->blk_handle, &bid);
+            if (btree->blk_ops->blk_get_size(btree->blk_handle, bid) < size) {
+                addr = btree->blk_ops->blk_enlarge_node(btree->blk_handle,
+                                                        bid, size, &bid);
+            }
+        } else {
+            addr = btree->blk_ops->blk_alloc(btree->blk_handle, &bid);
+        }
+    } else {
+        addr = btree->blk_ops->blk_alloc(btree->blk_handle, &bid);
+    }
+
+    node = _btree_init_node(btree, bid, addr, flag, src->level, meta);
+    btree->kv_ops->copy_kv(node, src, 0, 0, src->nentry);
+    node->nentry = src->nentry;
+    if (flag & BNODE_MASK_ROOT) {
+        // the sub-block may have been moved into an existing block
+        btree->blk_ops->blk_set_dirty(btree->blk_handle, bid);
+    }
+
+    return bid;
+}
+
+static void _btree_bulk_add_level(struct btree_bulk *bulk)
+{
+    if (bulk->nlevels == bulk->max_levels) {
+        bulk->max_levels = (bulk->max_levels)?(bulk->max_levels * 2):(4);
+        bulk->nodes = (void **)realloc(bulk->nodes,
+                                       sizeof(void *) * bulk->max_levels);
+    }
+    bulk->nodes[bulk->nlevels] = (void *)malloc(bulk->btree->blksize);
+    _btree_bulk_reset_node(bulk, bulk->nlevels);
+    bulk->nlevels++;
+}
+
+static void _btree_bulk_append(struct btree_bulk *bulk, uint16_t level,
+                               void *key, void *value);
+
+// write the rightmost node of LEVEL and add a pointer to it into its parent
+static void _btree_bulk_flush_node(struct btree_bulk *bulk, uint16_t level)
+{
+    bid_t bid, _bid;
+    struct btree *btree = bulk->btree;
+    struct bnode *node = (struct bnode *)bulk->nodes[level];
+    uint8_t *k = alca(uint8_t, btree->ksize);
+
+    if (btree->kv_ops->init_kv_var) btree->kv_ops->init_kv_var(btree, k, NULL);
+
+    bid = _btree_bulk_write_node(bulk, node, 0x0, NULL);
+    btree->kv_ops->get_kv(node, 0, k, NULL);
+    _btree_bulk_reset_node(bulk, level);
+
+    _bid = _endian_encode(bid);
+    _btree_bulk_append(bulk, level+1, k, btree->kv_ops->bid2value(&_bid));
+
+    if (btree->kv_ops->free_kv_var) btree->kv_ops->free_kv_var(btree, k, NULL);
+}
+
+static void _btree_bulk_append(struct btree_bulk *bulk, uint16_t level,
+                               void *key, void *value)
+{
+    size_t size;
+    struct bnode *node;
+    struct btree *btree = bulk->btree;
+
+    if (level == bulk->nlevels) {
+        // new level .. height grows up
+        _btree_bulk_add_level(bulk);
+    }
+
+    node = (struct bnode *)bulk->nodes[level];
+    if (node->nentry > 0) {
+        size = _bnode_size(btree, node, NULL, key, value, 1);
+        // keep at least two entries in each node so that the number of nodes
+        // always shrinks toward the root, whatever the fill factor is
+        if ((size > bulk->fill_size && node->nentry > 1) ||
+            size > bulk->capacity) {
+            _btree_bulk_flush_node(bulk, level);
+        }
+    }
+
+    btree->kv_ops->set_kv(node, node->nentry, key, value);
+    node->nentry++;
+}
+
+btree_result btree_bulk_add(struct btree_bulk *bulk, void *key, void *value)
+{
+    struct btree *btree = bulk->btree;
+
+    // keys should be given in ascending order without duplicates
+    if (bulk->nentry &&
+        btree->kv_ops->cmp(key, bulk->last_key, btree->aux) <= 0) {
+        return BTREE_RESULT_FAIL;
+    }
+    btree->kv_ops->set_key(btree, bulk->last_key, key);
+    bulk->nentry++;
+
+    _btree_bulk_append(bulk, 0, key, value);
+    return BTREE_RESULT_SUCCESS;
+}
+
+btree_result btree_bulk_finish(struct btree_bulk *bulk, struct btree_meta *meta)
+{
+    uint16_t level;
+    size_t size;
+    struct bnode *node;
+    struct btree *btree = bulk->btree;
+
+    if (meta) {
+        btree->root_flag |= BNODE_MASK_METADATA;
+    } else {
+        btree->root_flag &= ~BNODE_MASK_METADATA;
+    }
+    if (meta && sizeof(struct bnode) + _metasize_align(meta->size) +
+                sizeof(metasize_t) > bulk->capacity) {
+        // too large metadata
+        btree_bulk_free(bulk);
+        return BTREE_RESULT_FAIL;
+    }
+
+    if (bulk->nlevels == 0) {
+        // empty tree .. create an empty root node
+        _btree_bulk_add_level(bulk);
+    }
+
+    // flush the rightmost nodes from leaf to root
+    // (the number of levels can grow while flushing)
+    for (level = 0; level < bulk->nlevels; ++level) {
+        node = (struct bnode *)bulk->nodes[level];
+        if (level+1 == bulk->nlevels) {
+            // the topmost node becomes the root if it fits with metadata
+            size = _bnode_size(btree, node, NULL, NULL, NULL, 0);
+            if (meta) {
+                size += _metasize_align(meta->size) + sizeof(metasize_t);
+            }
+            if (size <= bulk->capacity) {
+                btree->root_bid = _btree_bulk_write_node(bulk, node,
+                                                         btree->root_flag,
+                                                         meta);
+                btree->height = level+1;
+                break;
+            }
+        }
+        _btree_bulk_flush_node(bulk, level);
+    }
+
+    btree_bulk_free(bulk);
+    return BTREE_RESULT_SUCCESS;
+}
+
+void btree_bulk_free(struct btree_bulk *bulk)
+{
+    uint16_t level;
+    struct btree *btree = bulk->btree;
+
+    for (level = 0; level < bulk->nlevels; ++level) {
+        free(bulk->nodes[level]);
+    }
+    free(bulk->nodes);
+    bulk->nodes = NULL;
+    bulk->nlevels = bulk->max_levels = 0;
+
+    if (bulk->last_key) {
+        if (btree->kv_ops->free_kv_var) {
+            btree->kv_ops->free_kv_var(btree, bulk->last_key, NULL);
+        }
+        free(bulk->last_key);
+        bulk->last_key = NULL;
+    }
+}
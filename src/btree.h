@@ -58,6 +58,10 @@ struct bnode{
 #define BNODE_MASK_ROOT 0x1
 #define BNODE_MASK_METADATA 0x2
 #define BNODE_MASK_SEQTREE 0x4
+// the node header is stored in little-endian byte order
+// (nodes without this flag have big-endian headers, where the first byte of
+//  'flag' is always zero)
+#define BNODE_MASK_LE 0x80
 
 typedef uint16_t metasize_t;
 struct btree_meta{
@@ -68,6 +72,8 @@ struct btree_meta{
 typedef void* voidref;
 typedef struct bnode* bnoderef;
 
+struct btree_entry_ops;
+
 struct btree_blk_ops {
     voidref (*blk_alloc)(void *handle, bid_t *bid);
     voidref (*blk_alloc_sub)(void *handle, bid_t *bid);
@@ -80,6 +86,8 @@ struct btree_blk_ops {
     size_t (*blk_get_size)(void *handle, bid_t bid);
     void (*blk_set_dirty)(void *handle, bid_t bid);
     void (*blk_operation_end)(void *handle); // optional
+    // same as blk_read, but the returned node MUST NOT be modified
+    voidref (*blk_read_readonly)(void *handle, bid_t bid); // optional
 };
 
 struct btree {
@@ -91,6 +99,9 @@ struct btree {
     void *blk_handle;
     struct btree_blk_ops *blk_ops;
     struct btree_kv_ops *kv_ops;
+    // entry search/insert/remove functions for KV_OPS, KSIZE, and VSIZE
+    // (use btree_set_kv_ops() to replace KV_OPS)
+    struct btree_entry_ops *entry_ops;
     bnode_flag_t root_flag;
     void *aux;
 
@@ -128,6 +139,17 @@ struct btree_kv_ops {
     int (*cmp)(void *key1, void *key2, void* aux);
     bid_t (*value2bid)(void *value);
     voidref (*bid2value)(bid_t *bid);
+
+    // (optional) return the index of the largest key equal to or smaller
+    // than KEY in NODE (or BTREE_IDX_NOT_FOUND) in the same order as 'cmp',
+    // without calling get_kv() and cmp() for each key
+    idx_t (*find_idx)(struct bnode *node, void *key);
+
+    // non-zero if each entry is a fixed-size key in memcmp() order followed
+    // by a fixed-size value ([k1][v1][k2][v2]...), so that btree.cc can use
+    // the code specialized for the key and value sizes instead of the
+    // function pointers above
+    uint8_t fixed_kv;
 };
 
 struct btree_iterator {
@@ -182,6 +204,10 @@ btree_result btree_init(
         uint32_t nodesize, uint8_t ksize, uint8_t vsize,
         bnode_flag_t flag, struct btree_meta *meta);
 
+// replace the key-value operations of BTREE (e.g., for leaf b-trees whose
+// nodes have a different layout)
+void btree_set_kv_ops(struct btree *btree, struct btree_kv_ops *kv_ops);
+
 btree_result btree_iterator_init(struct btree *btree, struct btree_iterator *it, void *initial_key);
 btree_result btree_iterator_free(struct btree_iterator *it);
 btree_result btree_next(struct btree_iterator *it, void *key_buf, void *value_buf);
@@ -192,9 +218,41 @@ btree_result btree_get_key_range(
 
 btree_result btree_find(struct btree *btree, void *key, void *value_buf);
 btree_result btree_insert(struct btree *btree, void *key, void *value);
+// insert N key-value pairs at once. Keys sorted in the order of the b+tree
+// are grouped by the leaf node they belong to, and each group is applied to
+// the leaf node in one pass, so that the path from the root to the leaf is
+// traversed and modified only once per group. Unsorted keys are also
+// inserted correctly, but each of them is handled as a separate group.
+btree_result btree_insert_batch(struct btree *btree, void **keys,
+                                void **values, size_t n);
 btree_result btree_remove(struct btree *btree, void *key);
 btree_result btree_operation_end(struct btree *btree);
 
+// bottom-up bulk loading of a new b+tree from a sorted stream of key-value
+// pairs: each level keeps its rightmost node in a staging buffer, and a node
+// is written to a block only once, when it is packed up to the fill factor.
+struct btree_bulk {
+    struct btree *btree;
+    // # bytes of each node to be filled, and the max size of a node
+    size_t fill_size;
+    size_t capacity;
+    uint16_t nlevels;
+    uint16_t max_levels;
+    // staging buffer of the rightmost node for each level
+    void **nodes;
+    void *last_key;
+    uint64_t nentry;
+};
+
+btree_result btree_bulk_init(
+        struct btree_bulk *bulk, struct btree *btree, void *blk_handle,
+        struct btree_blk_ops *blk_ops, struct btree_kv_ops *kv_ops,
+        uint32_t nodesize, uint8_t ksize, uint8_t vsize,
+        bnode_flag_t flag, uint8_t fill_factor);
+btree_result btree_bulk_add(struct btree_bulk *bulk, void *key, void *value);
+btree_result btree_bulk_finish(struct btree_bulk *bulk, struct btree_meta *meta);
+void btree_bulk_free(struct btree_bulk *bulk);
+
 #ifdef __cplusplus
 }
 #endif
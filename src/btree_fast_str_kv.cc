@@ -348,16 +348,20 @@ static size_t _get_fast_str_data_size(
 
     ptr = node->data;
 
-    if (node->nentry == 0) return 0;
-
-    // get offset array
-    _offset_arr = (key_len_t*)ptr;
+    if (node->nentry == 0) {
+        // empty node .. only the last offset is added
+        // if there are KV pairs to be inserted
+        size = (key_arr && value_arr && len > 0)?(sizeof(key_len_t)):(0);
+    } else {
+        // get offset array
+        _offset_arr = (key_len_t*)ptr;
 
-    // get size from the last offset
-    size = _endian_decode(_offset_arr[node->nentry]);
+        // get size from the last offset
+        size = _endian_decode(_offset_arr[node->nentry]);
+    }
 
     // if new_minkey exists
-    if (new_minkey) {
+    if (new_minkey && node->nentry > 0) {
         // subtract the length of the smallest key-value pair
         size -= _endian_decode(_offset_arr[1]) - _endian_decode(_offset_arr[0]);
         // get the length of 'new_minkey'
@@ -602,6 +606,8 @@ struct btree_kv_ops * btree_fast_str_kv_get_kb64_vb64(struct btree_kv_ops *kv_op
 
     btree_kv_ops->bid2value = _fast_str_bid_to_value_64;
     btree_kv_ops->value2bid = _fast_str_value_to_bid_64;
+    btree_kv_ops->find_idx = NULL;
+    btree_kv_ops->fixed_kv = 0;
 
     return btree_kv_ops;
 }
@@ -20,6 +20,13 @@
 
 #include "btree.h"
 #include "btree_kv.h"
+
+#if defined(__BTREE_SIMD_SEARCH) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define _BTREE_KV_SIMD
+#endif
+
 #include "memleak.h"
 
 INLINE void _get_kv(struct bnode *node, idx_t idx, void *key, void *value)
@@ -220,16 +227,166 @@ INLINE int _cmp_binary_general(void *key1, void *key2, void *aux)
     return memcmp(key1, key2, args->chunksize);
 }
 
+// 8-byte binary keys are compared by memcmp(), that is, in the same order as
+// big-endian unsigned integers.
+INLINE uint64_t _kb64_key(uint8_t *ptr)
+{
+    uint64_t key;
+    memcpy(&key, ptr, sizeof(key));
+    return _endian_decode(key);
+}
+
+// narrow down the range of entries that the largest key equal to or smaller
+// than KEY can be in, to [*start, *end) with at most BTREE_SEARCH_SCAN_RANGE
+// entries (all keys before the range are equal to or smaller than KEY)
+INLINE void _kb64_narrow(uint8_t *data, size_t kvsize, uint64_t key,
+                         idx_t *start, idx_t *end)
+{
+    idx_t middle;
+    while (*end - *start > BTREE_SEARCH_SCAN_RANGE) {
+        middle = (*start + *end) >> 1;
+        if (_kb64_key(data + middle * kvsize) <= key) {
+            *start = middle + 1;
+        } else {
+            *end = middle;
+        }
+    }
+}
+
+// count the keys equal to or smaller than KEY in [start, end)
+INLINE idx_t _kb64_count(uint8_t *data, size_t kvsize, uint64_t key,
+                         idx_t start, idx_t end)
+{
+    idx_t i, count = 0;
+    for (i=start; i<end; ++i){
+        count += (_kb64_key(data + i * kvsize) <= key);
+    }
+    return count;
+}
+
+INLINE idx_t _kb64_count_to_idx(idx_t start, idx_t count)
+{
+    return (start + count)?(start + count - 1):(BTREE_IDX_NOT_FOUND);
+}
+
+static idx_t _find_idx_kb64(struct bnode *node, void *key)
+{
+    int ksize, vsize;
+    idx_t start = 0, end = node->nentry;
+    uint8_t *data = (uint8_t *)node->data;
+    uint64_t k = _kb64_key((uint8_t *)key);
+
+    _get_kvsize(node->kvsize, ksize, vsize);
+    _kb64_narrow(data, ksize + vsize, k, &start, &end);
+    return _kb64_count_to_idx(start,
+                              _kb64_count(data, ksize + vsize, k, start, end));
+}
+
+#ifdef _BTREE_KV_SIMD
+
+// keys are loaded with their values (i.e., 16 bytes per entry), converted
+// into host byte order, and flipped in their sign bits so that they can be
+// compared by signed 64-bit comparison.
+#define _KB64_SIGN ((long long)0x8000000000000000ULL)
+
+__attribute__((target("sse4.2")))
+static idx_t _find_idx_kb64_sse42(struct bnode *node, void *key)
+{
+    int ksize, vsize;
+    idx_t i, start = 0, end = node->nentry, count = 0;
+    uint8_t *data = (uint8_t *)node->data;
+    uint64_t k = _kb64_key((uint8_t *)key);
+    __m128i a, b, keys, gt;
+
+    _get_kvsize(node->kvsize, ksize, vsize);
+    if (ksize + vsize != 16) {
+        return _find_idx_kb64(node, key);
+    }
+    _kb64_narrow(data, 16, k, &start, &end);
+
+    const __m128i bswap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                                        15, 14, 13, 12, 11, 10, 9, 8);
+    const __m128i sign = _mm_set1_epi64x(_KB64_SIGN);
+    const __m128i kk = _mm_set1_epi64x((long long)k ^ _KB64_SIGN);
+    for (i=start; i+2<=end; i+=2){
+        a = _mm_loadu_si128((__m128i *)(data + i * 16));
+        b = _mm_loadu_si128((__m128i *)(data + (i+1) * 16));
+        keys = _mm_unpacklo_epi64(a, b);
+        keys = _mm_xor_si128(_mm_shuffle_epi8(keys, bswap), sign);
+        gt = _mm_cmpgt_epi64(keys, kk);
+        count += 2 - __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(gt)));
+    }
+    count += _kb64_count(data, 16, k, i, end);
+    return _kb64_count_to_idx(start, count);
+}
+
+__attribute__((target("avx2")))
+static idx_t _find_idx_kb64_avx2(struct bnode *node, void *key)
+{
+    int ksize, vsize;
+    idx_t i, start = 0, end = node->nentry, count = 0;
+    uint8_t *data = (uint8_t *)node->data;
+    uint64_t k = _kb64_key((uint8_t *)key);
+    __m256i a, b, keys, gt;
+
+    _get_kvsize(node->kvsize, ksize, vsize);
+    if (ksize + vsize != 16) {
+        return _find_idx_kb64(node, key);
+    }
+    _kb64_narrow(data, 16, k, &start, &end);
+
+    const __m256i bswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                                           15, 14, 13, 12, 11, 10, 9, 8,
+                                           7, 6, 5, 4, 3, 2, 1, 0,
+                                           15, 14, 13, 12, 11, 10, 9, 8);
+    const __m256i sign = _mm256_set1_epi64x(_KB64_SIGN);
+    const __m256i kk = _mm256_set1_epi64x((long long)k ^ _KB64_SIGN);
+    for (i=start; i+4<=end; i+=4){
+        // (key0, value0, key1, value1) and (key2, value2, key3, value3)
+        a = _mm256_loadu_si256((__m256i *)(data + i * 16));
+        b = _mm256_loadu_si256((__m256i *)(data + (i+2) * 16));
+        // (key0, key2, key1, key3)
+        keys = _mm256_unpacklo_epi64(a, b);
+        keys = _mm256_xor_si256(_mm256_shuffle_epi8(keys, bswap), sign);
+        gt = _mm256_cmpgt_epi64(keys, kk);
+        count += 4 - __builtin_popcount(
+                         _mm256_movemask_pd(_mm256_castsi256_pd(gt)));
+    }
+    count += _kb64_count(data, 16, k, i, end);
+    return _kb64_count_to_idx(start, count);
+}
+
+#endif
+
+// choose the fastest search path that the CPU supports
+static idx_t (*_get_find_idx_kb64())(struct bnode *, void *)
+{
+#ifdef _BTREE_KV_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return _find_idx_kb64_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return _find_idx_kb64_sse42;
+    }
+#endif
+    return _find_idx_kb64;
+}
+
 // key: uint64_t, value: uint64_t
 static struct btree_kv_ops kv_ops_ku64_vu64 = {
     _get_kv, _set_kv, _ins_kv, _copy_kv, _get_data_size, _get_kv_size, _init_kv_var, NULL,
     _set_key, _set_value, _get_nth_idx, _get_nth_splitter,
-    _cmp_uint64_t, _value_to_bid_64, _bid_to_value_64};
+    _cmp_uint64_t, _value_to_bid_64, _bid_to_value_64,
+    // no specialized search (integer keys are not in memcmp() order)
+    NULL, 0};
 
 static struct btree_kv_ops kv_ops_ku32_vu64 = {
     _get_kv, _set_kv, _ins_kv, _copy_kv, _get_data_size, _get_kv_size, _init_kv_var, NULL,
     _set_key, _set_value, _get_nth_idx, _get_nth_splitter,
-    _cmp_uint32_t, _value_to_bid_64, _bid_to_value_64};
+    _cmp_uint32_t, _value_to_bid_64, _bid_to_value_64,
+    // no specialized search (integer keys are not in memcmp() order)
+    NULL, 0};
 
 struct btree_kv_ops * btree_kv_get_ku64_vu64()
 {
@@ -268,6 +425,8 @@ struct btree_kv_ops * btree_kv_get_kb64_vb64(struct btree_kv_ops *kv_ops)
 
     btree_kv_ops->bid2value = _bid_to_value_64;
     btree_kv_ops->value2bid = _value_to_bid_64;
+    btree_kv_ops->find_idx = _get_find_idx_kb64();
+    btree_kv_ops->fixed_kv = 1;
 
     return btree_kv_ops;
 }
@@ -299,6 +458,8 @@ struct btree_kv_ops * btree_kv_get_kb32_vb64(struct btree_kv_ops *kv_ops)
 
     btree_kv_ops->bid2value = _bid_to_value_64;
     btree_kv_ops->value2bid = _value_to_bid_64;
+    btree_kv_ops->find_idx = NULL;
+    btree_kv_ops->fixed_kv = 1;
 
     return btree_kv_ops;
 }
@@ -330,6 +491,8 @@ struct btree_kv_ops * btree_kv_get_kbn_vb64(struct btree_kv_ops *kv_ops)
 
     btree_kv_ops->bid2value = _bid_to_value_64;
     btree_kv_ops->value2bid = _value_to_bid_64;
+    btree_kv_ops->find_idx = NULL;
+    btree_kv_ops->fixed_kv = 1;
 
     return btree_kv_ops;
 }
@@ -515,6 +515,8 @@ struct btree_kv_ops * btree_str_kv_get_kb64_vb64(struct btree_kv_ops *kv_ops)
 
     btree_kv_ops->bid2value = _str_bid_to_value_64;
     btree_kv_ops->value2bid = _str_value_to_bid_64;
+    btree_kv_ops->find_idx = NULL;
+    btree_kv_ops->fixed_kv = 0;
 
     return btree_kv_ops;
 }
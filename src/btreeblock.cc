@@ -46,6 +46,12 @@ struct btreeblk_block {
     uint32_t pos;
     uint8_t dirty;
     uint8_t age;
+    // the block is in alc_list (otherwise in read_list)
+    uint8_t alc;
+    // ADDR is shared with other handles (not a private copy)
+    // BTREEBLK_PIN_BCACHE: pinned block cache frame
+    // BTREEBLK_PIN_NODECACHE: block in the node cache
+    uint8_t pinned;
     void *addr;
     struct list_elem le;
     struct avl_node avl;
@@ -142,6 +148,115 @@ INLINE void subbid2bid(bid_t subbid, size_t *subblock_no, size_t *idx, bid_t *bi
     *bid = ((bid_t)(subbid << 16)) >> 16;
 }
 
+struct btreeblk_slot {
+    bid_t bid;
+    struct btreeblk_block *block;
+};
+
+#define BTREEBLK_INDEX_MIN_SIZE (64)
+
+INLINE uint32_t _btreeblk_index_hash(struct btreeblk_handle *handle, bid_t bid)
+{
+    // multiplicative hashing (the table size is a power of 2)
+    return (uint32_t)((bid * 0x9e3779b97f4a7c15ULL) >> 32) &
+           (handle->index_size - 1);
+}
+
+static void _btreeblk_index_resize(struct btreeblk_handle *handle,
+                                   uint32_t size)
+{
+    uint32_t i, pos;
+    uint32_t old_size = handle->index_size;
+    struct btreeblk_slot *old = handle->index;
+
+    handle->index = (struct btreeblk_slot *)
+                    calloc(size, sizeof(struct btreeblk_slot));
+    handle->index_size = size;
+    for (i=0;i<old_size;++i){
+        if (old[i].block == NULL) {
+            continue;
+        }
+        pos = _btreeblk_index_hash(handle, old[i].bid);
+        while (handle->index[pos].block) {
+            pos = (pos + 1) & (size - 1);
+        }
+        handle->index[pos] = old[i];
+    }
+    free(old);
+}
+
+INLINE struct btreeblk_block * _btreeblk_index_find(
+    struct btreeblk_handle *handle, bid_t filebid)
+{
+    uint32_t pos;
+
+    if (handle->index_count == 0) {
+        return NULL;
+    }
+    pos = _btreeblk_index_hash(handle, filebid);
+    while (handle->index[pos].block) {
+        if (handle->index[pos].bid == filebid) {
+            return handle->index[pos].block;
+        }
+        pos = (pos + 1) & (handle->index_size - 1);
+    }
+    return NULL;
+}
+
+// the caller should guarantee that BLOCK->BID is not in the index
+static void _btreeblk_index_insert(struct btreeblk_handle *handle,
+                                   struct btreeblk_block *block)
+{
+    uint32_t pos;
+
+    if ((handle->index_count + 1) * 2 > handle->index_size) {
+        // keep the load factor under 0.5
+        _btreeblk_index_resize(handle, (handle->index_size)?
+                                       (handle->index_size * 2):
+                                       (BTREEBLK_INDEX_MIN_SIZE));
+    }
+    pos = _btreeblk_index_hash(handle, block->bid);
+    while (handle->index[pos].block) {
+        pos = (pos + 1) & (handle->index_size - 1);
+    }
+    handle->index[pos].bid = block->bid;
+    handle->index[pos].block = block;
+    handle->index_count++;
+}
+
+static void _btreeblk_index_remove(struct btreeblk_handle *handle,
+                                   struct btreeblk_block *block)
+{
+    uint32_t pos, next, home;
+    uint32_t mask = handle->index_size - 1;
+
+    if (handle->index_count == 0) {
+        return;
+    }
+    pos = _btreeblk_index_hash(handle, block->bid);
+    while (handle->index[pos].block != block) {
+        if (handle->index[pos].block == NULL) {
+            // not indexed
+            return;
+        }
+        pos = (pos + 1) & mask;
+    }
+    handle->index_count--;
+
+    // shift the following slots in the same cluster backward
+    // so that lookups do not need tombstones
+    next = (pos + 1) & mask;
+    while (handle->index[next].block) {
+        home = _btreeblk_index_hash(handle, handle->index[next].bid);
+        if (((next - home) & mask) >= ((next - pos) & mask)) {
+            handle->index[pos] = handle->index[next];
+            pos = next;
+        }
+        next = (next + 1) & mask;
+    }
+    handle->index[pos].block = NULL;
+}
+
 INLINE void * _btreeblk_alloc(void *voidhandle, bid_t *bid, int sb_no)
 {
     struct btreeblk_handle *handle = (struct btreeblk_handle *)voidhandle;
@@ -170,6 +285,8 @@ INLINE void * _btreeblk_alloc(void *voidhandle, bid_t *bid, int sb_no)
     block->bid = filemgr_alloc(handle->file, handle->log_callback);
     block->dirty = 1;
     block->age = 0;
+    block->alc = 1;
+    block->pinned = 0;
 
 #ifdef __CRC32
     memset((uint8_t *)block->addr + handle->nodesize - BLK_MARKER_SIZE,
@@ -179,6 +296,7 @@ INLINE void * _btreeblk_alloc(void *voidhandle, bid_t *bid, int sb_no)
     // btree bid differs to filemgr bid
     *bid = block->bid * handle->nnodeperblock;
     list_push_back(&handle->alc_list, &block->le);
+    _btreeblk_index_insert(handle, block);
 
     handle->nlivenodes++;
 
@@ -190,12 +308,45 @@ void * btreeblk_alloc(void *voidhandle, bid_t *bid) {
 
 
 #ifdef __ENDIAN_SAFE
+// node headers are written in little-endian byte order (BNODE_MASK_LE),
+// so that they are used in place without any conversion on little-endian
+// machines. Nodes written in the former big-endian format are converted
+// when they are read.
+INLINE int _btreeblk_node_is_le(struct bnode *node)
+{
+    // the first byte of 'flag' (always zero in big-endian headers)
+    return *(uint8_t *)&node->flag & BNODE_MASK_LE;
+}
+
+INLINE void _btreeblk_encode_node(struct bnode *node)
+{
+    node->flag |= BNODE_MASK_LE;
+    node->kvsize = _endian_encode_le(node->kvsize);
+    node->flag = _endian_encode_le(node->flag);
+    node->level = _endian_encode_le(node->level);
+    node->nentry = _endian_encode_le(node->nentry);
+}
+
+INLINE void _btreeblk_decode_node(struct bnode *node)
+{
+    if (_btreeblk_node_is_le(node)) {
+        node->kvsize = _endian_decode_le(node->kvsize);
+        node->flag = _endian_decode_le(node->flag);
+        node->level = _endian_decode_le(node->level);
+        node->nentry = _endian_decode_le(node->nentry);
+    } else {
+        node->kvsize = _endian_decode(node->kvsize);
+        node->flag = _endian_decode(node->flag);
+        node->level = _endian_decode(node->level);
+        node->nentry = _endian_decode(node->nentry);
+    }
+}
+
 INLINE void _btreeblk_encode(struct btreeblk_handle *handle,
                              struct btreeblk_block *block)
 {
     size_t i, nsb, sb_size, offset;
     void *addr;
-    struct bnode *node;
 
     for (offset=0; offset<handle->nnodeperblock; ++offset) {
         if (block->sb_no > -1) {
@@ -215,19 +366,11 @@ INLINE void _btreeblk_encode(struct btreeblk_handle *handle,
             struct bnode **node_arr;
             node_arr = btree_get_bnode_array(addr, &n);
             for (j=0;j<n;++j){
-                node = node_arr[j];
-                node->kvsize = _endian_encode(node->kvsize);
-                node->flag = _endian_encode(node->flag);
-                node->level = _endian_encode(node->level);
-                node->nentry = _endian_encode(node->nentry);
+                _btreeblk_encode_node(node_arr[j]);
             }
             free(node_arr);
 #else
-            node = btree_get_bnode(addr);
-            node->kvsize = _endian_encode(node->kvsize);
-            node->flag = _endian_encode(node->flag);
-            node->level = _endian_encode(node->level);
-            node->nentry = _endian_encode(node->nentry);
+            _btreeblk_encode_node((struct bnode *)addr);
 #endif
         }
     }
@@ -237,7 +380,6 @@ INLINE void _btreeblk_decode(struct btreeblk_handle *handle,
 {
     size_t i, nsb, sb_size, offset;
     void *addr;
-    struct bnode *node;
 
     for (offset=0; offset<handle->nnodeperblock; ++offset) {
         if (block->sb_no > -1) {
@@ -257,39 +399,239 @@ INLINE void _btreeblk_decode(struct btreeblk_handle *handle,
             struct bnode **node_arr;
             node_arr = btree_get_bnode_array(addr, &n);
             for (j=0;j<n;++j){
-                node = node_arr[j];
-                node->kvsize = _endian_decode(node->kvsize);
-                node->flag = _endian_decode(node->flag);
-                node->level = _endian_decode(node->level);
-                node->nentry = _endian_decode(node->nentry);
+                _btreeblk_decode_node(node_arr[j]);
             }
             free(node_arr);
 #else
-            node = btree_get_bnode(addr);
-            node->kvsize = _endian_decode(node->kvsize);
-            node->flag = _endian_decode(node->flag);
-            node->level = _endian_decode(node->level);
-            node->nentry = _endian_decode(node->nentry);
+            _btreeblk_decode_node((struct bnode *)addr);
+            // set the data pointer of the decoded node
+            btree_get_bnode(addr);
 #endif
         }
     }
 }
+
+// return true if the node can be used without any conversion
+INLINE bool _btreeblk_node_in_place(struct bnode *node)
+{
+#ifdef _LITTLE_ENDIAN
+    return _btreeblk_node_is_le(node);
+#else
+    return false;
+#endif
+}
 #else
 #define _btreeblk_encode(a,b)
 #define _btreeblk_decode(a,b)
+#define _btreeblk_node_in_place(a) (true)
+#endif
+
+#ifdef __BTREEBLK_PINNED_READ
+#define BTREEBLK_PIN_BCACHE (1)
+#define BTREEBLK_PIN_NODECACHE (2)
+
+struct btreeblk_pin_args {
+    struct btreeblk_handle *handle;
+    int sb_no;
+};
+
+// use the nodes in a block cache frame in place (called by block cache
+// when the frame is pinned for the first time). Only the data pointers of
+// the nodes are set, which readers copying the frame set again anyway, so
+// the frame is still readable by others. Blocks that contain any node to
+// be converted are not used in place.
+static bool _btreeblk_prepare_pinned(void *addr, void *voidargs)
+{
+    struct btreeblk_pin_args *args = (struct btreeblk_pin_args *)voidargs;
+#ifdef _BTREE_HAS_MULTIPLE_BNODES
+    // node positions depend on the headers .. always use private copies
+    (void)args;
+    (void)addr;
+    return false;
+#else
+    struct btreeblk_handle *handle = args->handle;
+    size_t i, nsb, sb_size, offset;
+    int pass;
+    void *node_addr;
+
+    if (args->sb_no > -1) {
+        nsb = handle->sb[args->sb_no].nblocks;
+        sb_size = handle->sb[args->sb_no].sb_size;
+    } else {
+        nsb = 1;
+        sb_size = 0;
+    }
+
+    // check all nodes first, so that nothing is written if declined
+    for (pass=0; pass<2; ++pass) {
+        for (offset=0; offset<handle->nnodeperblock; ++offset) {
+            for (i=0;i<nsb;++i) {
+                node_addr = (uint8_t*)addr + handle->nodesize * offset +
+                            sb_size * i;
+                if (pass == 0) {
+                    if (!_btreeblk_node_in_place((struct bnode *)node_addr)) {
+                        return false;
+                    }
+                } else {
+                    btree_get_bnode(node_addr);
+                }
+            }
+        }
+    }
+    return true;
+#endif
+}
+
+#ifdef __BTREEBLK_NODECACHE
+// set the data pointers of the nodes in a new node cache block
+// (the block is copied from a decoded block of the handle)
+static void _btreeblk_prepare_shared(void *addr, void *voidhandle)
+{
+    struct btreeblk_handle *handle = (struct btreeblk_handle *)voidhandle;
+    size_t offset;
+
+    for (offset=0; offset<handle->nnodeperblock; ++offset) {
+#ifdef _BTREE_HAS_MULTIPLE_BNODES
+        struct bnode **node_arr;
+        size_t n;
+        node_arr = btree_get_bnode_array((uint8_t *)addr +
+                                         handle->nodesize * offset, &n);
+        free(node_arr);
+#else
+        btree_get_bnode((uint8_t *)addr + handle->nodesize * offset);
+#endif
+    }
+}
+
+// move root and internal nodes into the node cache, so that other handles
+// share them (leaf nodes are not worth being cached twice)
+INLINE void _btreeblk_share_block(struct btreeblk_handle *handle,
+                                  struct btreeblk_block *block)
+{
+    void *addr;
+    struct bnode *node = (struct bnode *)block->addr;
+
+    if (block->sb_no > -1 || block->pinned == BTREEBLK_PIN_NODECACHE ||
+        !(node->level > 1 || (node->flag & BNODE_MASK_ROOT))) {
+        return;
+    }
+
+    addr = nodecache_insert(&handle->reader, handle->file, block->bid,
+                            block->addr, _btreeblk_prepare_shared, handle);
+    if (addr == NULL) {
+        return;
+    }
+    if (block->pinned == BTREEBLK_PIN_BCACHE) {
+        filemgr_unpin(handle->file, block->bid);
+    } else {
+        _btreeblk_free_aligned_block(handle, block);
+    }
+    block->addr = addr;
+    block->pinned = BTREEBLK_PIN_NODECACHE;
+}
+#endif
+
+// share the cached block instead of using a private copy
+INLINE int _btreeblk_pin_block(struct btreeblk_handle *handle,
+                               struct btreeblk_block *block)
+{
+    void *addr;
+    struct btreeblk_pin_args args;
+
+#ifdef __BTREEBLK_NODECACHE
+    if (block->addr == NULL) {
+        addr = nodecache_get(&handle->reader, handle->file, block->bid);
+        if (addr) {
+            block->addr = addr;
+            block->pinned = BTREEBLK_PIN_NODECACHE;
+            return 1;
+        }
+    }
+#endif
+
+    args.handle = handle;
+    args.sb_no = block->sb_no;
+    addr = filemgr_pin(handle->file, block->bid,
+                       _btreeblk_prepare_pinned, &args);
+    if (addr == NULL) {
+        return 0;
+    }
+
+    if (block->addr) {
+        // release the private copy
+        _btreeblk_free_aligned_block(handle, block);
+    }
+    block->addr = addr;
+    block->pinned = BTREEBLK_PIN_BCACHE;
+#ifdef __BTREEBLK_NODECACHE
+    _btreeblk_share_block(handle, block);
+#endif
+    return 1;
+}
+
+// replace the pinned block with a private copy
+// so that the caller can modify it
+INLINE void _btreeblk_unpin_block(struct btreeblk_handle *handle,
+                                  struct btreeblk_block *block)
+{
+    void *addr;
+
+    if (!block->pinned) {
+        return;
+    }
+    addr = block->addr;
+    _btreeblk_get_aligned_block(handle, block);
+    // nodes in the pinned block are already decoded
+    memcpy(block->addr, addr, handle->file->blocksize);
+    if (block->pinned == BTREEBLK_PIN_BCACHE) {
+        filemgr_unpin(handle->file, block->bid);
+    }
+    block->pinned = 0;
+}
+#else
+#define _btreeblk_unpin_block(a,b)
 #endif
 
 INLINE void _btreeblk_free_dirty_block(struct btreeblk_handle *handle,
                                        struct btreeblk_block *block);
 
-INLINE void * _btreeblk_read(void *voidhandle, bid_t bid, int sb_no)
+// free the least recently used clean blocks in the read list
+// until the list fits in BTREEBLK_READ_LIST_LIMIT
+// (dirty blocks are kept until they are written back, and the most
+//  recently used block is never evicted as the caller may be using it)
+INLINE void _btreeblk_evict_blocks(struct btreeblk_handle *handle)
+{
+    struct list_elem *e;
+    struct btreeblk_block *block;
+
+    e = list_end(&handle->read_list);
+    while (e && e != list_begin(&handle->read_list) &&
+           handle->nreadblocks > BTREEBLK_READ_LIST_LIMIT) {
+        block = _get_entry(e, struct btreeblk_block, le);
+        e = list_prev(e);
+        if (block->dirty) {
+            continue;
+        }
+
+        list_remove(&handle->read_list, &block->le);
+#ifdef __BTREEBLK_READ_TREE
+        avl_remove(&handle->read_tree, &block->avl);
+#endif
+        _btreeblk_index_remove(handle, block);
+        handle->nreadblocks--;
+        _btreeblk_free_dirty_block(handle, block);
+    }
+}
+
+INLINE void * _btreeblk_read(void *voidhandle, bid_t bid, int sb_no,
+                             int readonly)
 {
-    struct list_elem *elm = NULL;
     struct btreeblk_block *block = NULL;
     struct btreeblk_handle *handle = (struct btreeblk_handle *)voidhandle;
     bid_t _bid, filebid;
     int subblock;
     int offset;
+    int indexed;
     size_t sb, idx;
 
     sb = idx = 0;
@@ -304,12 +646,16 @@ INLINE void * _btreeblk_read(void *voidhandle, bid_t bid, int sb_no)
     // AVL-tree
     // check first 3 elements in the list first,
     // and then retrieve AVL-tree
+    struct list_elem *elm = NULL;
     size_t count = 0;
     for (elm = list_begin(&handle->read_list);
          (elm && count < 3); elm = list_next(elm)) {
         block = _get_entry(elm, struct btreeblk_block, le);
         if (block->bid == filebid) {
             block->age = 0;
+            if (!readonly) {
+                _btreeblk_unpin_block(handle, block);
+            }
             // move the elements to the front
             list_remove(&handle->read_list, &block->le);
             list_push_front(&handle->read_list, &block->le);
@@ -332,6 +678,9 @@ INLINE void * _btreeblk_read(void *voidhandle, bid_t bid, int sb_no)
     if (a) { // cache hit
         block = _get_entry(a, struct btreeblk_block, avl);
         block->age = 0;
+        if (!readonly) {
+            _btreeblk_unpin_block(handle, block);
+        }
         // move the elements to the front
         list_remove(&handle->read_list, &block->le);
         list_push_front(&handle->read_list, &block->le);
@@ -344,38 +693,39 @@ INLINE void * _btreeblk_read(void *voidhandle, bid_t bid, int sb_no)
                    (handle->nodesize) * offset;
         }
     }
-#else
-    // list
-    for (elm = list_begin(&handle->read_list); elm; elm = list_next(elm)) {
-        block = _get_entry(elm, struct btreeblk_block, le);
-        if (block->bid == filebid) {
-            block->age = 0;
-            if (subblock) {
-                return (uint8_t *)block->addr +
-                       (handle->nodesize) * offset +
-                       handle->sb[sb].sb_size * idx;
-            } else {
-                return (uint8_t *)block->addr +
-                       (handle->nodesize) * offset;
-            }
-        }
-    }
 #endif
 
-    // allocation list (dirty)
-    for (elm = list_begin(&handle->alc_list); elm; elm = list_next(elm)) {
-        block = _get_entry(elm, struct btreeblk_block, le);
-        if (block->bid == filebid &&
-            block->pos >= (handle->nodesize) * offset) {
-            block->age = 0;
-            if (subblock) {
-                return (uint8_t *)block->addr +
-                       (handle->nodesize) * offset +
-                       handle->sb[sb].sb_size * idx;
-            } else {
-                return (uint8_t *)block->addr +
-                       (handle->nodesize) * offset;
-            }
+    // hash index over both lists
+    block = _btreeblk_index_find(handle, filebid);
+    indexed = (block != NULL);
+    if (block && !block->alc) {
+        // read list (clean or dirty)
+        block->age = 0;
+        if (!readonly) {
+            _btreeblk_unpin_block(handle, block);
+        }
+        // move the element to the front (LRU order)
+        list_remove(&handle->read_list, &block->le);
+        list_push_front(&handle->read_list, &block->le);
+        if (subblock) {
+            return (uint8_t *)block->addr +
+                   (handle->nodesize) * offset +
+                   handle->sb[sb].sb_size * idx;
+        } else {
+            return (uint8_t *)block->addr +
+                   (handle->nodesize) * offset;
+        }
+    }
+    if (block && block->pos >= (handle->nodesize) * offset) {
+        // allocation list (dirty)
+        block->age = 0;
+        if (subblock) {
+            return (uint8_t *)block->addr +
+                   (handle->nodesize) * offset +
+                   handle->sb[sb].sb_size * idx;
+        } else {
+            return (uint8_t *)block->addr +
+                   (handle->nodesize) * offset;
         }
     }
 
@@ -387,20 +737,47 @@ INLINE void * _btreeblk_read(void *voidhandle, bid_t bid, int sb_no)
     block->bid = filebid;
     block->dirty = 0;
     block->age = 0;
-
-    _btreeblk_get_aligned_block(handle, block);
-    if (filemgr_read(handle->file, block->bid, block->addr,
-                     handle->log_callback) != FDB_RESULT_SUCCESS) {
-        _btreeblk_free_aligned_block(handle, block);
-        mempool_free(block);
-        return NULL;
+    block->alc = 0;
+    block->pinned = 0;
+    block->addr = NULL;
+
+#ifdef __BTREEBLK_PINNED_READ
+    // committed blocks are immutable, so read-only accesses
+    // can directly use the block in the cache
+    int pin = readonly && !filemgr_is_writable(handle->file, filebid);
+    if (!pin || !_btreeblk_pin_block(handle, block)) {
+#endif
+        _btreeblk_get_aligned_block(handle, block);
+        if (filemgr_read(handle->file, block->bid, block->addr,
+                         handle->log_callback) != FDB_RESULT_SUCCESS) {
+            _btreeblk_free_aligned_block(handle, block);
+            mempool_free(block);
+            return NULL;
+        }
+#ifdef __BTREEBLK_PINNED_READ
+        // now the block is cached .. try again
+        if (!pin || !_btreeblk_pin_block(handle, block)) {
+            _btreeblk_decode(handle, block);
+#ifdef __BTREEBLK_NODECACHE
+            if (pin) {
+                _btreeblk_share_block(handle, block);
+            }
+#endif
+        }
     }
-    _btreeblk_decode(handle, block);
+#else
+        _btreeblk_decode(handle, block);
+#endif
 
     list_push_front(&handle->read_list, &block->le);
 #ifdef __BTREEBLK_READ_TREE
     avl_insert(&handle->read_tree, &block->avl, _btreeblk_bid_cmp);
 #endif
+    if (!indexed) {
+        _btreeblk_index_insert(handle, block);
+    }
+    handle->nreadblocks++;
+    _btreeblk_evict_blocks(handle);
 
     if (subblock) {
         return (uint8_t *)block->addr +
@@ -413,7 +790,12 @@ INLINE void * _btreeblk_read(void *voidhandle, bid_t bid, int sb_no)
 
 void * btreeblk_read(void *voidhandle, bid_t bid)
 {
-    return _btreeblk_read(voidhandle, bid, -1);
+    return _btreeblk_read(voidhandle, bid, -1, 0);
+}
+
+void * btreeblk_read_readonly(void *voidhandle, bid_t bid)
+{
+    return _btreeblk_read(voidhandle, bid, -1, 1);
 }
 
 void btreeblk_set_dirty(void *voidhandle, bid_t bid);
@@ -432,7 +814,8 @@ void * btreeblk_move(void *voidhandle, bid_t bid, bid_t *new_bid)
 
     if (!subblock) {
         // normal block
-        old_addr = btreeblk_read(voidhandle, bid);
+        // (the old node is only copied, so it doesn't need to be private)
+        old_addr = btreeblk_read_readonly(voidhandle, bid);
         new_addr = btreeblk_alloc(voidhandle, new_bid);
         handle->nlivenodes--;
 
@@ -447,7 +830,7 @@ void * btreeblk_move(void *voidhandle, bid_t bid, bid_t *new_bid)
             //2 case 1
             // current subblock set is not writable
             // move all of them
-            old_addr = _btreeblk_read(voidhandle, _bid, sb);
+            old_addr = _btreeblk_read(voidhandle, _bid, sb, 0);
             new_addr = _btreeblk_alloc(voidhandle, &_new_bid, sb);
             handle->nlivenodes--;
             handle->sb[sb].bid = _new_bid;
@@ -462,7 +845,7 @@ void * btreeblk_move(void *voidhandle, bid_t bid, bid_t *new_bid)
             //2 case 2
             // move only the target subblock
             // into current subblock set (no allocation is required)
-            old_addr = _btreeblk_read(voidhandle, _bid, sb);
+            old_addr = _btreeblk_read(voidhandle, _bid, sb, 0);
 
             new_idx = handle->sb[sb].nblocks;
             for (i=0;i<handle->sb[sb].nblocks;++i){
@@ -484,7 +867,7 @@ void * btreeblk_move(void *voidhandle, bid_t bid, bid_t *new_bid)
             } else {
                 // case 2-2
                 // append to the current block
-                new_addr = _btreeblk_read(voidhandle, handle->sb[sb].bid, sb);
+                new_addr = _btreeblk_read(voidhandle, handle->sb[sb].bid, sb, 0);
                 btreeblk_set_dirty(voidhandle, handle->sb[sb].bid);
             }
 
@@ -556,7 +939,6 @@ int btreeblk_is_writable(void *voidhandle, bid_t bid)
 void btreeblk_set_dirty(void *voidhandle, bid_t bid)
 {
     struct btreeblk_handle *handle = (struct btreeblk_handle *)voidhandle;
-    struct list_elem *e;
     struct btreeblk_block *block;
     bid_t _bid;
     bid_t filebid;
@@ -577,15 +959,9 @@ void btreeblk_set_dirty(void *voidhandle, bid_t bid)
         block->dirty = 1;
     }
 #else
-    // list
-    e = list_begin(&handle->read_list);
-    while(e){
-        block = _get_entry(e, struct btreeblk_block, le);
-        if (block->bid == filebid) {
-            block->dirty = 1;
-            break;
-        }
-        e = list_next(e);
+    block = _btreeblk_index_find(handle, filebid);
+    if (block && !block->alc) {
+        block->dirty = 1;
     }
 #endif
 }
@@ -593,7 +969,6 @@ void btreeblk_set_dirty(void *voidhandle, bid_t bid)
 static void _btreeblk_set_sb_no(void *voidhandle, bid_t bid, int sb_no)
 {
     struct btreeblk_handle *handle = (struct btreeblk_handle *)voidhandle;
-    struct list_elem *e;
     struct btreeblk_block *block;
     bid_t _bid;
     bid_t filebid;
@@ -603,38 +978,11 @@ static void _btreeblk_set_sb_no(void *voidhandle, bid_t bid, int sb_no)
     subbid2bid(bid, &sb, &idx, &_bid);
     filebid = _bid / handle->nnodeperblock;
 
-    e = list_begin(&handle->alc_list);
-    while(e){
-        block = _get_entry(e, struct btreeblk_block, le);
-        if (block->bid == filebid) {
-            block->sb_no = sb_no;
-            return;
-        }
-        e = list_next(e);
-    }
-
-#ifdef __BTREEBLK_READ_TREE
-    // AVL-tree
-    struct btreeblk_block query;
-    query.bid = filebid;
-    struct avl_node *a;
-    a = avl_search(&handle->read_tree, &query.avl, _btreeblk_bid_cmp);
-    if (a) {
-        block = _get_entry(a, struct btreeblk_block, avl);
+    // blocks in both alc_list and read_list are indexed
+    block = _btreeblk_index_find(handle, filebid);
+    if (block) {
         block->sb_no = sb_no;
     }
-#else
-    // list
-    e = list_begin(&handle->read_list);
-    while(e){
-        block = _get_entry(e, struct btreeblk_block, le);
-        if (block->bid == filebid) {
-            block->sb_no = sb_no;
-            return;
-        }
-        e = list_next(e);
-    }
-#endif
 }
 
 size_t btreeblk_get_size(void *voidhandle, bid_t bid)
@@ -670,7 +1018,7 @@ void * btreeblk_alloc_sub(void *voidhandle, bid_t *bid)
                     // return subblock
                     handle->sb[0].bitmap[i] = 1;
                     bid2subbid(handle->sb[0].bid, 0, i, bid);
-                    addr = _btreeblk_read(voidhandle, handle->sb[0].bid, 0);
+                    addr = _btreeblk_read(voidhandle, handle->sb[0].bid, 0, 0);
                     btreeblk_set_dirty(voidhandle, handle->sb[0].bid);
                     return (void*)
                            ((uint8_t*)addr +
@@ -742,7 +1090,7 @@ void * btreeblk_enlarge_node(void *voidhandle,
             //2 case 1
             // if there's only one subblock in the source block,
             // then switch source block to destination block
-            src_addr = _btreeblk_read(voidhandle, bid, src_sb);
+            src_addr = _btreeblk_read(voidhandle, bid, src_sb, 0);
             if (filemgr_is_writable(handle->file, bid) &&
                 bid == handle->sb[src_sb].bid) {
                 // case 1-1
@@ -789,7 +1137,7 @@ void * btreeblk_enlarge_node(void *voidhandle,
             //2 case 2
             // if there are more than one slubblocks in the source block,
             // then allocate destination block and move the target subblock
-            src_addr = _btreeblk_read(voidhandle, bid, src_sb);
+            src_addr = _btreeblk_read(voidhandle, bid, src_sb, 0);
 
             if (dst_sb > 0) {
                 // case 2-1
@@ -812,11 +1160,11 @@ void * btreeblk_enlarge_node(void *voidhandle,
     } else {
         //2 case 3
         // destination block exists (always happens when subblock)
-        src_addr = _btreeblk_read(voidhandle, bid, src_sb);
+        src_addr = _btreeblk_read(voidhandle, bid, src_sb, 0);
         if (filemgr_is_writable(handle->file, handle->sb[dst_sb].bid) &&
             dst_idx != handle->sb[dst_sb].nblocks) {
             // case 3-1
-            dst_addr = _btreeblk_read(voidhandle, handle->sb[dst_sb].bid, dst_sb);
+            dst_addr = _btreeblk_read(voidhandle, handle->sb[dst_sb].bid, dst_sb, 0);
         } else {
             // case 3-2: allocate new destination block
             dst_addr = _btreeblk_alloc(voidhandle, &handle->sb[dst_sb].bid, dst_sb);
@@ -846,6 +1194,15 @@ void * btreeblk_enlarge_node(void *voidhandle,
 INLINE void _btreeblk_free_dirty_block(struct btreeblk_handle *handle,
                                        struct btreeblk_block *block)
 {
+#ifdef __BTREEBLK_PINNED_READ
+    if (block->pinned) {
+        if (block->pinned == BTREEBLK_PIN_BCACHE) {
+            filemgr_unpin(handle->file, block->bid);
+        }
+        mempool_free(block);
+        return;
+    }
+#endif
     _btreeblk_free_aligned_block(handle, block);
     mempool_free(block);
 }
@@ -856,6 +1213,7 @@ INLINE fdb_status _btreeblk_write_dirty_block(struct btreeblk_handle *handle,
     fdb_status status;
     //2 MUST BE modified to support multiple nodes in a block
 
+    assert(!block->pinned);
     _btreeblk_encode(handle, block);
     status = filemgr_write(handle->file, block->bid, block->addr,
                            handle->log_callback);
@@ -890,7 +1248,9 @@ fdb_status btreeblk_operation_end(void *voidhandle)
             // remove from alc_list and insert into read list
             e = list_remove(&handle->alc_list, &block->le);
             block->dirty = 0;
+            block->alc = 0;
             list_push_front(&handle->read_list, &block->le);
+            handle->nreadblocks++;
 #ifdef __BTREEBLK_READ_TREE
             avl_insert(&handle->read_tree, &block->avl, _btreeblk_bid_cmp);
 #endif
@@ -921,6 +1281,8 @@ fdb_status btreeblk_operation_end(void *voidhandle)
         if (block->age >= BTREEBLK_AGE_LIMIT) {
             list_remove(&handle->read_list, &block->le);
             avl_remove(&handle->read_tree, &block->avl);
+            _btreeblk_index_remove(handle, block);
+            handle->nreadblocks--;
             _btreeblk_free_dirty_block(handle, block);
         } else {
             block->age++;
@@ -943,6 +1305,8 @@ fdb_status btreeblk_operation_end(void *voidhandle)
 
         if (block->age >= BTREEBLK_AGE_LIMIT) {
             e = list_remove(&handle->read_list, &block->le);
+            _btreeblk_index_remove(handle, block);
+            handle->nreadblocks--;
             _btreeblk_free_dirty_block(handle, block);
         } else {
             block->age++;
@@ -970,6 +1334,7 @@ void btreeblk_discard_blocks(struct btreeblk_handle *handle)
 
         list_remove(&handle->read_list, &block->le);
         avl_remove(&handle->read_tree, &block->avl);
+        _btreeblk_index_remove(handle, block);
         _btreeblk_free_dirty_block(handle, block);
     }
 #else
@@ -980,8 +1345,13 @@ void btreeblk_discard_blocks(struct btreeblk_handle *handle)
         e = list_next(&block->le);
 
         list_remove(&handle->read_list, &block->le);
+        _btreeblk_index_remove(handle, block);
         _btreeblk_free_dirty_block(handle, block);
     }
+#endif
+    handle->nreadblocks = 0;
+#ifdef __BTREEBLK_NODECACHE
+    nodecache_read_end(&handle->reader);
 #endif
 }
 
@@ -996,7 +1366,8 @@ struct btree_blk_ops btreeblk_ops = {
     btreeblk_is_writable,
     btreeblk_get_size,
     btreeblk_set_dirty,
-    NULL
+    NULL,
+    btreeblk_read_readonly
 };
 #else
 struct btree_blk_ops btreeblk_ops = {
@@ -1009,7 +1380,8 @@ struct btree_blk_ops btreeblk_ops = {
     btreeblk_is_writable,
     btreeblk_get_size,
     btreeblk_set_dirty,
-    NULL
+    NULL,
+    btreeblk_read_readonly
 };
 #endif
 
@@ -1033,6 +1405,13 @@ void btreeblk_init(struct btreeblk_handle *handle, struct filemgr *file, int nod
 #ifdef __BTREEBLK_READ_TREE
     avl_init(&handle->read_tree, NULL);
 #endif
+    handle->index = NULL;
+    handle->index_size = 0;
+    handle->index_count = 0;
+    handle->nreadblocks = 0;
+#ifdef __BTREEBLK_NODECACHE
+    nodecache_reader_register(&handle->reader);
+#endif
 
 #ifdef __BTREEBLK_BLOCKPOOL
     list_init(&handle->blockpool);
@@ -1099,6 +1478,14 @@ void btreeblk_free(struct btreeblk_handle *handle)
     }
 #endif
 
+    free(handle->index);
+    handle->index = NULL;
+    handle->index_size = handle->index_count = 0;
+    handle->nreadblocks = 0;
+#ifdef __BTREEBLK_NODECACHE
+    nodecache_reader_unregister(&handle->reader);
+#endif
+
 #ifdef __BTREEBLK_BLOCKPOOL
     // free all blocks in the block pool
     struct btreeblk_addr *item;
@@ -1134,6 +1521,30 @@ fdb_status btreeblk_end(struct btreeblk_handle *handle)
         return status;
     }
 
+#ifdef __BTREEBLK_PINNED_READ
+    // release all pinned blocks
+    // (the file may be closed before this handle is freed)
+    e = list_begin(&handle->read_list);
+    while(e) {
+        block = _get_entry(e, struct btreeblk_block, le);
+        if (block->pinned) {
+            e = list_remove(&handle->read_list, &block->le);
+#ifdef __BTREEBLK_READ_TREE
+            avl_remove(&handle->read_tree, &block->avl);
+#endif
+            _btreeblk_index_remove(handle, block);
+            handle->nreadblocks--;
+            _btreeblk_free_dirty_block(handle, block);
+        } else {
+            e = list_next(e);
+        }
+    }
+#ifdef __BTREEBLK_NODECACHE
+    // no shared node is referred to by this handle now
+    nodecache_read_end(&handle->reader);
+#endif
+#endif
+
     // remove all items in lists
     e = list_begin(&handle->alc_list);
     while(e) {
@@ -1141,10 +1552,20 @@ fdb_status btreeblk_end(struct btreeblk_handle *handle)
         e = list_remove(&handle->alc_list, &block->le);
 
         block->dirty = 0;
+        block->alc = 0;
         list_push_front(&handle->read_list, &block->le);
+        handle->nreadblocks++;
 #ifdef __BTREEBLK_READ_TREE
         avl_insert(&handle->read_tree, &block->avl, _btreeblk_bid_cmp);
 #endif
     }
+
+    // blocks written by a large batch are moved into the read list at once
+    _btreeblk_evict_blocks(handle);
+    if (handle->index_size > BTREEBLK_INDEX_MIN_SIZE &&
+        handle->index_count * 8 < handle->index_size) {
+        // shrink the index
+        _btreeblk_index_resize(handle, handle->index_size / 2);
+    }
     return status;
 }
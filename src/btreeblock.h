@@ -22,6 +22,7 @@
 #include "list.h"
 #include "avltree.h"
 #include "btree.h"
+#include "nodecache.h"
 #include "libforestdb/fdb_errors.h"
 
 #ifdef __cplusplus
@@ -29,6 +30,7 @@ extern "C" {
 #endif
 
 struct btreeblk_block;
+struct btreeblk_slot;
 
 struct btreeblk_subblocks{
     bid_t bid;
@@ -49,9 +51,19 @@ struct btreeblk_handle{
 #ifdef __BTREEBLK_READ_TREE
     struct avl_tree read_tree;
 #endif
+    // hash table indexing the blocks in both lists by their BIDs
+    struct btreeblk_slot *index;
+    uint32_t index_size;
+    uint32_t index_count;
+    // # blocks in read list
+    uint32_t nreadblocks;
+
 #ifdef __BTREEBLK_BLOCKPOOL
     struct list blockpool;
 #endif
+#ifdef __BTREEBLK_NODECACHE
+    struct nodecache_reader reader;
+#endif
 
 #ifdef __BTREEBLK_CACHE
     uint16_t bin_size;
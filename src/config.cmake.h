@@ -2,6 +2,7 @@
 
 /* Header files */
 #cmakedefine HAVE_ATOMIC_H ${HAVE_ATOMIC_H}
+#cmakedefine HAVE_LINUX_IO_URING_H ${HAVE_LINUX_IO_URING_H}
 
 #ifdef __GNUC__
 #define HAVE_GCC_ATOMICS 1
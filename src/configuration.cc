@@ -30,6 +30,8 @@ fdb_config get_default_config(void) {
     fconfig.blocksize = FDB_BLOCKSIZE;
     // 128MB by default.
     fconfig.buffercache_size = 134217728;
+    // 10% of the buffer cache is used for shared index nodes by default
+    fconfig.buffercache_node_ratio = 10;
     // 4096 WAL entries by default.
     fconfig.wal_threshold = 4096;
     fconfig.wal_flush_before_commit = true;
@@ -58,6 +60,25 @@ fdb_config get_default_config(void) {
     fconfig.multi_kv_instances = true;
     // 30 seconds by default
     fconfig.prefetch_duration = 30;
+    // 30% of the buffer cache is reserved for index nodes by default
+    fconfig.buffercache_index_ratio = 30;
+    // Synchronous I/O by default
+    fconfig.io_backend = FDB_IO_BACKEND_SYNC;
+    fconfig.io_queue_depth = 64;
+    // Disable group commit by default
+    fconfig.group_commit = false;
+    // 2 reader threads for compaction by default
+    fconfig.compaction_num_threads = 2;
+    // Build the index of the new file bottom-up with 90% full nodes
+    fconfig.compaction_fill_factor = 90;
+    // 256MB of WAL entries across all files by default
+    fconfig.wal_memory_budget = 268435456;
+    // 16MB of WAL entries per file by default
+    fconfig.wal_memory_limit = 16777216;
+    // 2 parser threads for crash recovery by default
+    fconfig.recovery_num_threads = 2;
+    // No Bloom filter by default
+    fconfig.bloom_bits_per_key = 0;
 
     return fconfig;
 }
@@ -110,6 +131,31 @@ bool validate_fdb_config(fdb_config *fconfig) {
         // Sleep duration should be larger than zero
         return false;
     }
+    if (fconfig->buffercache_node_ratio >= 100) {
+        // Node cache ratio should be less than 100 (%).
+        return false;
+    }
+    if (fconfig->buffercache_index_ratio > 100) {
+        // Index ratio should be equal or less than 100 (%).
+        return false;
+    }
+    if (fconfig->io_backend != FDB_IO_BACKEND_SYNC &&
+        fconfig->io_backend != FDB_IO_BACKEND_IO_URING) {
+        return false;
+    }
+    if (fconfig->io_queue_depth < 1 || fconfig->io_queue_depth > 4096) {
+        // Queue depth should be set between 1 and 4096.
+        return false;
+    }
+    if (fconfig->compaction_num_threads > FDB_COMPACTION_MAX_THREADS) {
+        return false;
+    }
+    if (fconfig->compaction_fill_factor > 100) {
+        return false;
+    }
+    if (fconfig->recovery_num_threads > FDB_RECOVERY_MAX_THREADS) {
+        return false;
+    }
 
     return true;
 }
@@ -37,6 +37,7 @@ void docio_init(struct docio_handle *handle,
     handle->curpos = 0;
     handle->lastbid = BLK_NOT_FOUND;
     handle->compress_document_body = compress_document_body;
+    handle->read_once = false;
     malloc_align(handle->readbuffer, FDB_SECTOR_SIZE, file->blocksize);
 }
 
@@ -425,8 +426,13 @@ INLINE fdb_status _docio_read_through_buffer(struct docio_handle *handle,
     fdb_status status = FDB_RESULT_SUCCESS;
     // to reduce the overhead from memcpy the same block
     if (handle->lastbid != bid) {
-        status = filemgr_read(handle->file, bid, handle->readbuffer,
-                              log_callback);
+        if (handle->read_once) {
+            status = filemgr_read_once(handle->file, bid, handle->readbuffer,
+                                       log_callback);
+        } else {
+            status = filemgr_read(handle->file, bid, handle->readbuffer,
+                                  log_callback);
+        }
         if (status != FDB_RESULT_SUCCESS) {
             return status;
         }
@@ -947,6 +953,242 @@ uint64_t docio_read_doc(struct docio_handle *handle, uint64_t offset,
     return _offset;
 }
 
+// return the offset right after 'len' bytes at 'offset'
+// (skipping the block markers between them)
+INLINE uint64_t _docio_next_offset(struct docio_handle *handle,
+                                   uint64_t offset,
+                                   uint64_t len)
+{
+    size_t blocksize = handle->file->blocksize;
+    size_t real_blocksize = blocksize;
+#ifdef __CRC32
+    blocksize -= BLK_MARKER_SIZE;
+#endif
+    bid_t bid = offset / real_blocksize;
+    uint64_t pos = offset % real_blocksize;
+
+    if (pos + len <= blocksize) {
+        return offset + len;
+    }
+    len -= blocksize - pos;
+    bid += 1 + (len - 1) / blocksize;
+    pos = len - ((len - 1) / blocksize) * blocksize;
+    return bid * real_blocksize + pos;
+}
+
+// copy 'len' bytes at 'offset' in 'blocks' into 'buf_out' (if not NULL),
+// and accumulate their checksum into 'crc' (if not NULL).
+// return the offset right after them.
+static uint64_t _docio_scan_component(struct docio_handle *handle,
+                                      struct docio_blocks *blocks,
+                                      uint64_t offset,
+                                      uint32_t len,
+                                      void *buf_out,
+                                      uint32_t *crc)
+{
+    uint32_t rest_len, restsize, n;
+    uint8_t *src;
+    size_t blocksize = handle->file->blocksize;
+    size_t real_blocksize = blocksize;
+#ifdef __CRC32
+    blocksize -= BLK_MARKER_SIZE;
+#endif
+
+    bid_t bid = offset / real_blocksize;
+    uint32_t pos = offset % real_blocksize;
+
+    rest_len = len;
+    while (rest_len > 0) {
+        assert(bid >= blocks->bid && bid < blocks->bid + blocks->nblocks);
+        src = (uint8_t *)blocks->buf +
+              (bid - blocks->bid) * real_blocksize + pos;
+        restsize = blocksize - pos;
+        n = MIN(restsize, rest_len);
+        if (buf_out) {
+            memcpy((uint8_t *)buf_out + (len - rest_len), src, n);
+        }
+        if (crc) {
+            *crc = chksum_scd(src, n, *crc);
+        }
+
+        if (restsize >= rest_len) {
+            pos += rest_len;
+            rest_len = 0;
+        } else {
+            bid++;
+            pos = 0;
+            rest_len -= restsize;
+        }
+    }
+
+    return bid * real_blocksize + pos;
+}
+
+// return the address of 'len' bytes at 'offset' in 'blocks' if they are
+// not split into different blocks, or NULL otherwise
+INLINE void *_docio_scan_ptr(struct docio_handle *handle,
+                             struct docio_blocks *blocks,
+                             uint64_t offset,
+                             uint32_t len)
+{
+    size_t blocksize = handle->file->blocksize;
+    size_t real_blocksize = blocksize;
+#ifdef __CRC32
+    blocksize -= BLK_MARKER_SIZE;
+#endif
+    bid_t bid = offset / real_blocksize;
+    uint32_t pos = offset % real_blocksize;
+
+    if (pos + len > blocksize) {
+        return NULL;
+    }
+    return (uint8_t *)blocks->buf + (bid - blocks->bid) * real_blocksize + pos;
+}
+
+uint64_t docio_scan_doc_length(struct docio_handle *handle,
+                               struct docio_blocks *blocks,
+                               uint64_t offset,
+                               struct docio_length *length)
+{
+    uint64_t _offset, len;
+    struct docio_length _length;
+    size_t real_blocksize = handle->file->blocksize;
+
+    if (filemgr_get_pos(handle->file) < (offset + sizeof(struct docio_length))) {
+        return offset;
+    }
+    _offset = _docio_next_offset(handle, offset, sizeof(struct docio_length));
+    if ((_offset - 1) / real_blocksize >= blocks->bid + blocks->nblocks) {
+        // the length is split and its latter part is not in 'blocks'
+        return 0;
+    }
+    _docio_scan_component(handle, blocks, offset, sizeof(struct docio_length),
+                          &_length, NULL);
+
+    if (_docio_length_checksum(_length) != _length.checksum) {
+        return offset;
+    }
+    *length = _docio_length_decode(_length);
+
+    if (length->flag & DOCIO_TXN_COMMITTED) {
+        // commit mark .. followed by the offset of the committed doc
+        len = sizeof(uint64_t);
+    } else {
+        if (length->keylen == 0 ||
+            length->keylen > FDB_MAX_KEYLEN_INTERNAL) {
+            return offset;
+        }
+        len = (uint64_t)length->keylen + sizeof(timestamp_t) +
+              sizeof(fdb_seqnum_t) + length->metalen +
+              length->bodylen_ondisk;
+#ifdef __CRC32
+        len += sizeof(uint32_t);
+#endif
+    }
+    _offset = _docio_next_offset(handle, _offset, len);
+
+    if (_offset > filemgr_get_pos(handle->file)) {
+        return offset;
+    }
+    return _offset;
+}
+
+uint64_t docio_scan_doc(struct docio_handle *handle,
+                        struct docio_blocks *blocks,
+                        uint64_t offset,
+                        struct docio_object *doc,
+                        uint8_t *key_alloc,
+                        uint8_t *meta_alloc)
+{
+    uint64_t _offset;
+    uint64_t doc_offset;
+    fdb_seqnum_t _seqnum;
+    timestamp_t _timestamp;
+    struct docio_length _length;
+    err_log_callback *log_callback = handle->log_callback;
+#ifdef __CRC32
+    uint32_t crc_file, crc;
+    uint32_t *pcrc = &crc;
+#else
+    uint32_t *pcrc = NULL;
+#endif
+
+    *key_alloc = *meta_alloc = 0;
+    doc->key = doc->meta = doc->body = NULL;
+
+    _offset = _docio_scan_component(handle, blocks, offset,
+                                    sizeof(struct docio_length),
+                                    &_length, NULL);
+    if (_docio_length_checksum(_length) != _length.checksum) {
+        fdb_log(log_callback, FDB_RESULT_CHECKSUM_ERROR,
+                "doc_length checksum mismatch error in a database file '%s'",
+                handle->file->filename);
+        return offset;
+    }
+    doc->length = _docio_length_decode(_length);
+
+    if (doc->length.flag & DOCIO_TXN_COMMITTED) {
+        _offset = _docio_scan_component(handle, blocks, _offset,
+                                        sizeof(doc_offset), &doc_offset,
+                                        NULL);
+        doc->doc_offset = _endian_decode(doc_offset);
+        return _offset;
+    }
+
+#ifdef __CRC32
+    crc = chksum((void *)&_length, sizeof(_length));
+#endif
+
+    // the checksum is accumulated in the same order as docio_read_doc()
+    doc->key = _docio_scan_ptr(handle, blocks, _offset, doc->length.keylen);
+    if (!doc->key) {
+        doc->key = (void *)malloc(doc->length.keylen);
+        *key_alloc = 1;
+    }
+    _offset = _docio_scan_component(handle, blocks, _offset,
+                                    doc->length.keylen,
+                                    (*key_alloc)?(doc->key):(NULL), pcrc);
+
+    _offset = _docio_scan_component(handle, blocks, _offset,
+                                    sizeof(timestamp_t), &_timestamp, pcrc);
+    doc->timestamp = _endian_decode(_timestamp);
+    _offset = _docio_scan_component(handle, blocks, _offset,
+                                    sizeof(fdb_seqnum_t), &_seqnum, pcrc);
+    doc->seqnum = _endian_decode(_seqnum);
+
+    if (doc->length.metalen) {
+        doc->meta = _docio_scan_ptr(handle, blocks, _offset,
+                                    doc->length.metalen);
+        if (!doc->meta) {
+            doc->meta = (void *)malloc(doc->length.metalen);
+            *meta_alloc = 1;
+        }
+    }
+    _offset = _docio_scan_component(handle, blocks, _offset,
+                                    doc->length.metalen,
+                                    (*meta_alloc)?(doc->meta):(NULL), pcrc);
+
+    // body on disk (compressed or not) is only verified
+    _offset = _docio_scan_component(handle, blocks, _offset,
+                                    doc->length.bodylen_ondisk, NULL, pcrc);
+
+#ifdef __CRC32
+    _offset = _docio_scan_component(handle, blocks, _offset,
+                                    sizeof(crc_file), &crc_file, NULL);
+    if (crc != crc_file) {
+        fdb_log(log_callback, FDB_RESULT_CHECKSUM_ERROR,
+                "doc_body checksum mismatch error in a database file '%s'",
+                handle->file->filename);
+        free_docio_object(doc, *key_alloc, *meta_alloc, 0);
+        doc->key = doc->meta = NULL;
+        *key_alloc = *meta_alloc = 0;
+        return offset;
+    }
+#endif
+
+    return _offset;
+}
+
 int docio_check_buffer(struct docio_handle *handle, bid_t bid)
 {
     uint8_t marker[BLK_MARKER_SIZE];
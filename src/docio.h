@@ -37,6 +37,9 @@ struct docio_handle {
     void *readbuffer;
     err_log_callback *log_callback;
     bool compress_document_body;
+    // blocks are read only once (e.g., by compaction),
+    // so they should not pollute the block cache
+    bool read_once;
 };
 
 #define DOCIO_NORMAL (0x00)
@@ -108,6 +111,37 @@ uint64_t docio_read_doc(struct docio_handle *handle,
                         uint64_t offset,
                         struct docio_object *doc);
 
+// blocks read into memory at once (e.g., by crash recovery), so that the
+// documents in them are parsed without going through the read buffer
+struct docio_blocks {
+    void *buf;
+    // BID of the first block in 'buf'
+    bid_t bid;
+    size_t nblocks;
+};
+
+// return the offset right after the doc (or commit mark) at 'offset' whose
+// length is parsed out of 'blocks', 'offset' if the length is not valid, or
+// 0 if the length is not entirely in 'blocks'.
+// (note that the rest of the doc may not be in 'blocks')
+uint64_t docio_scan_doc_length(struct docio_handle *handle,
+                               struct docio_blocks *blocks,
+                               uint64_t offset,
+                               struct docio_length *length);
+// parse the doc (or commit mark) at 'offset' out of 'blocks' and verify its
+// checksum. The entire doc should be in 'blocks'.
+// Its key and meta point into 'blocks' if they are not split into different
+// blocks; otherwise they are copied into memory allocated here, and
+// '*key_alloc' and '*meta_alloc' are set. The body is only verified
+// (doc->body is NULL).
+// return the offset right after the doc, or 'offset' if it is not valid.
+uint64_t docio_scan_doc(struct docio_handle *handle,
+                        struct docio_blocks *blocks,
+                        uint64_t offset,
+                        struct docio_object *doc,
+                        uint8_t *key_alloc,
+                        uint8_t *meta_alloc);
+
 int docio_check_buffer(struct docio_handle *dhandle, bid_t check_bid);
 int docio_check_compact_doc(struct docio_handle *handle,
                             struct docio_object *doc);
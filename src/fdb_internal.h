@@ -34,6 +34,9 @@ struct kvs_header {
     struct avl_tree *idx_name;
     struct avl_tree *idx_id;
     uint8_t custom_cmp_enabled;
+    // offset of the key filter image, as read from the file
+    // (BLK_NOT_FOUND if the filter was not maintained)
+    uint64_t bloom_offset;
     spin_t lock;
 };
 
@@ -79,6 +82,8 @@ fdb_status _fdb_open(fdb_kvs_handle *handle,
 fdb_status _fdb_close_root(fdb_kvs_handle *handle);
 fdb_status _fdb_close(fdb_kvs_handle *handle);
 fdb_status _fdb_commit(fdb_kvs_handle *handle, fdb_commit_opt_t opt);
+fdb_status _fdb_commit_deferred(fdb_kvs_handle *handle, fdb_commit_opt_t opt,
+                                uint64_t *async_revnum);
 
 fdb_status fdb_check_file_reopen(fdb_kvs_handle *handle, file_status_t *status);
 void fdb_link_new_file(fdb_kvs_handle *handle);
@@ -101,6 +106,14 @@ fdb_status fdb_open_for_compactor(fdb_file_handle **ptr_fhandle,
                                   const char *filename,
                                   fdb_config *config);
 
+fdb_status fdb_open_for_wal_flusher(fdb_kvs_handle *handle_in,
+                                    fdb_file_handle **ptr_fhandle);
+fdb_status fdb_open_file_for_wal_flusher(fdb_file_handle **ptr_fhandle,
+                                         const char *filename,
+                                         fdb_config *config);
+fdb_status fdb_flush_wal_for_flusher(fdb_file_handle *fhandle);
+fdb_status fdb_close_for_wal_flusher(fdb_file_handle *fhandle);
+
 fdb_status fdb_compact_file(fdb_file_handle *fhandle,
                             const char *new_filename,
                             bool in_place_compaction);
@@ -134,6 +147,9 @@ void fdb_kvs_header_read(struct filemgr *file,
 void fdb_kvs_header_copy(fdb_kvs_handle *handle,
                          struct filemgr *new_file,
                          struct docio_handle *new_dhandle);
+void fdb_kvs_bloom_read(struct filemgr *file,
+                        struct docio_handle *dhandle,
+                        uint64_t bloom_offset);
 
 struct kvs_header;
 void _fdb_kvs_init_root(fdb_kvs_handle *handle, struct filemgr *file);
@@ -30,6 +30,8 @@
 #include "filemgr_ops.h"
 #include "hash_functions.h"
 #include "blockcache.h"
+#include "nodecache.h"
+#include "bloomfilter.h"
 #include "wal.h"
 #include "list.h"
 #include "fdb_internal.h"
@@ -73,6 +75,21 @@ struct temp_buf_item{
 static struct list temp_buf;
 static spin_t temp_buf_lock;
 
+// commits waiting for fsync by the syncer thread
+struct sync_req_item {
+    struct filemgr *file;
+    filemgr_header_revnum_t revnum;
+    filemgr_sync_callback *callback;
+    void *ctx;
+    struct list_elem le;
+};
+static struct list syncer_queue;
+static mutex_t syncer_lock;
+static thread_cond_t syncer_cond;
+static thread_t syncer_tid;
+static volatile uint8_t syncer_running;
+static volatile uint8_t syncer_terminate;
+
 static void _filemgr_free_func(struct hash_elem *h);
 
 static void spin_init_wrap(void *lock) {
@@ -199,10 +216,27 @@ void filemgr_init(struct filemgr_config *config)
         if (!filemgr_initialized) {
             global_config = *config;
 
+#ifdef __BTREEBLK_NODECACHE
+            // the node cache takes its share out of the buffer cache
+            int nnodes = 0;
+            if (global_config.ncacheblock > 0 &&
+                global_config.nodecache_ratio > 0) {
+                nnodes = (int)((uint64_t)global_config.ncacheblock *
+                               global_config.nodecache_ratio / 100);
+                global_config.ncacheblock -= nnodes;
+            }
+#endif
             if (global_config.ncacheblock > 0)
-                bcache_init(global_config.ncacheblock, global_config.blocksize);
+                bcache_init(global_config.ncacheblock, global_config.blocksize,
+                            global_config.index_cache_ratio);
+#ifdef __BTREEBLK_NODECACHE
+            if (nnodes > 0) {
+                nodecache_init(nnodes, global_config.blocksize);
+            }
+#endif
 
             hash_init(&hash, NBUCKET, _file_hash, _file_cmp);
+            wal_global_init(global_config.wal_mem_budget);
 
             // initialize temp buffer
             list_init(&temp_buf);
@@ -211,6 +245,12 @@ void filemgr_init(struct filemgr_config *config)
             // initialize global lock
             spin_init(&filemgr_openlock);
 
+            // the syncer thread is started on the first asynchronous commit
+            list_init(&syncer_queue);
+            mutex_init(&syncer_lock);
+            thread_cond_init(&syncer_cond);
+            syncer_running = syncer_terminate = 0;
+
             // set the initialize flag
             filemgr_initialized = 1;
         }
@@ -395,10 +435,10 @@ struct filemgr_prefetch_args {
 static void *_filemgr_prefetch_thread(void *voidargs)
 {
     struct filemgr_prefetch_args *args = (struct filemgr_prefetch_args*)voidargs;
-    uint8_t *buf = alca(uint8_t, args->file->blocksize);
-    uint64_t cur_pos = 0, i;
+    uint64_t cur_pos = 0, i, j;
     uint64_t bcache_free_space;
-    bid_t bid;
+    bid_t *bids = alca(bid_t, FILEMGR_PREFETCH_BATCH);
+    size_t n;
     bool terminate = false;
     struct timeval begin, cur, gap;
 
@@ -415,7 +455,7 @@ static void *_filemgr_prefetch_thread(void *voidargs)
     while (!terminate) {
         for (i = cur_pos;
              i < cur_pos + FILEMGR_PREFETCH_UNIT;
-             i += args->file->blocksize) {
+             i += args->file->blocksize * FILEMGR_PREFETCH_BATCH) {
 
             gettimeofday(&cur, NULL);
             gap = _utime_gap(begin, cur);
@@ -432,8 +472,15 @@ static void *_filemgr_prefetch_thread(void *voidargs)
                 terminate = true;
                 break;
             } else {
-                bid = i / args->file->blocksize;
-                if (filemgr_read(args->file, bid, buf, NULL)
+                // read a batch of blocks at once
+                n = 0;
+                for (j = i;
+                     j < cur_pos + FILEMGR_PREFETCH_UNIT &&
+                     n < FILEMGR_PREFETCH_BATCH;
+                     j += args->file->blocksize) {
+                    bids[n++] = j / args->file->blocksize;
+                }
+                if (filemgr_prefetch_blocks(args->file, bids, n, NULL)
                         != FDB_RESULT_SUCCESS) {
                     // 4. read failure
                     terminate = true;
@@ -506,6 +553,12 @@ filemgr_open_result filemgr_open(char *filename, struct filemgr_ops *ops,
         file = _get_entry(e, struct filemgr, e);
 
         spin_lock(&file->lock);
+        if (file->ref_count == 0 && (config->options & FILEMGR_NO_REOPEN)) {
+            spin_unlock(&file->lock);
+            spin_unlock(&filemgr_openlock);
+            result.rv = FDB_RESULT_FILE_NOT_OPEN;
+            return result;
+        }
         file->ref_count++;
 
         if (file->status == FILE_CLOSED) { // if file was closed before
@@ -552,6 +605,11 @@ filemgr_open_result filemgr_open(char *filename, struct filemgr_ops *ops,
                 } else {
                     file->fflags &= ~FILEMGR_SYNC;
                 }
+                if (config->options & FILEMGR_GROUP_COMMIT) {
+                    file->fflags |= FILEMGR_GROUP_COMMIT;
+                } else {
+                    file->fflags &= ~FILEMGR_GROUP_COMMIT;
+                }
                 spin_unlock(&file->lock);
                 spin_unlock(&filemgr_openlock);
                 result.file = file;
@@ -565,6 +623,11 @@ filemgr_open_result filemgr_open(char *filename, struct filemgr_ops *ops,
             } else {
                 file->fflags &= ~FILEMGR_SYNC;
             }
+            if (config->options & FILEMGR_GROUP_COMMIT) {
+                file->fflags |= FILEMGR_GROUP_COMMIT;
+            } else {
+                file->fflags &= ~FILEMGR_GROUP_COMMIT;
+            }
 
             spin_unlock(&file->lock);
             spin_unlock(&filemgr_openlock);
@@ -574,6 +637,12 @@ filemgr_open_result filemgr_open(char *filename, struct filemgr_ops *ops,
         }
     }
 
+    if (config->options & FILEMGR_NO_REOPEN) {
+        spin_unlock(&filemgr_openlock);
+        result.rv = FDB_RESULT_FILE_NOT_OPEN;
+        return result;
+    }
+
     file_flag = O_RDWR;
     if (create) {
         file_flag |= O_CREAT;
@@ -623,6 +692,7 @@ filemgr_open_result filemgr_open(char *filename, struct filemgr_ops *ops,
     file->bcache = NULL;
     file->in_place_compaction = false;
     file->kv_header = NULL;
+    file->bloom = NULL;
     file->prefetch_status = FILEMGR_PREFETCH_IDLE;
 
     status = _filemgr_read_header(file);
@@ -639,6 +709,16 @@ filemgr_open_result filemgr_open(char *filename, struct filemgr_ops *ops,
 
     spin_init(&file->lock);
 
+    // the last header on disk is regarded as durable
+    mutex_init(&file->csync.lock);
+    thread_cond_init(&file->csync.cond);
+    file->csync.written = file->csync.synced = file->header.revnum;
+    file->csync.failed = 0;
+    file->csync.syncing = false;
+    file->csync.npending = file->csync.nasync = 0;
+    file->csync.ncommits = file->csync.nsyncs = 0;
+    file->csync.last_batch = file->csync.max_batch = 0;
+
 #ifdef __FILEMGR_DATA_PARTIAL_LOCK
     struct plock_ops pops;
     struct plock_config pconfig;
@@ -693,8 +773,6 @@ filemgr_open_result filemgr_open(char *filename, struct filemgr_ops *ops,
     } else {
         file->global_txn.prev_hdr_bid = BLK_NOT_FOUND;
     }
-    file->global_txn.items = (struct list *)malloc(sizeof(struct list));
-    list_init(file->global_txn.items);
     file->global_txn.isolation = FDB_ISOLATION_READ_COMMITTED;
     wal_add_transaction(file, &file->global_txn);
 
@@ -709,6 +787,11 @@ filemgr_open_result filemgr_open(char *filename, struct filemgr_ops *ops,
     } else {
         file->fflags &= ~FILEMGR_SYNC;
     }
+    if (config->options & FILEMGR_GROUP_COMMIT) {
+        file->fflags |= FILEMGR_GROUP_COMMIT;
+    } else {
+        file->fflags &= ~FILEMGR_GROUP_COMMIT;
+    }
 
     result.file = file;
     result.rv = FDB_RESULT_SUCCESS;
@@ -967,6 +1050,9 @@ fdb_status filemgr_close(struct filemgr *file, bool cleanup_cache_onclose,
 {
     int rv = FDB_RESULT_SUCCESS;
 
+    // the syncer thread may still refer to the file
+    filemgr_wait_async_commits(file);
+
     spin_lock(&filemgr_openlock); // Grab the filemgr lock to avoid the race with
                                   // filemgr_open() because file->lock won't
                                   // prevent the race condition.
@@ -1055,23 +1141,25 @@ static void _filemgr_free_func(struct hash_elem *h)
         bcache_remove_clean_blocks(file);
         bcache_remove_file(file);
     }
+    // remove all shared nodes (the address of FILE may be reused)
+    nodecache_remove_file(file);
 
     if (file->kv_header) {
         // multi KV intance mode & KV header exists
         file->free_kv_header(file);
     }
+    if (file->bloom) {
+        bloomfilter_free(file->bloom);
+    }
 
     // free global transaction
     wal_remove_transaction(file, &file->global_txn);
-    free(file->global_txn.items);
     free(file->global_txn.wrapper);
 
     // destroy WAL
     if (wal_is_initialized(file)) {
         wal_shutdown(file);
-        hash_free(&file->wal->hash_bykey);
-        hash_free(&file->wal->hash_byseq);
-        spin_destroy(&file->wal->lock);
+        wal_destroy(file);
     }
     free(file->wal);
 
@@ -1083,6 +1171,8 @@ static void _filemgr_free_func(struct hash_elem *h)
 
     // destroy locks
     spin_destroy(&file->lock);
+    mutex_destroy(&file->csync.lock);
+    thread_cond_destroy(&file->csync.cond);
 
 #ifdef __FILEMGR_DATA_PARTIAL_LOCK
     plock_destroy(&file->plock);
@@ -1133,10 +1223,26 @@ void filemgr_shutdown()
     if (filemgr_initialized) {
         spin_lock(&initial_lock);
 
+        // run all queued callbacks and stop the syncer
+        mutex_lock(&syncer_lock);
+        syncer_terminate = 1;
+        thread_cond_signal(&syncer_cond);
+        mutex_unlock(&syncer_lock);
+        if (syncer_running) {
+            void *ret;
+            thread_join(syncer_tid, &ret);
+        }
+        mutex_destroy(&syncer_lock);
+        thread_cond_destroy(&syncer_cond);
+
         hash_free_active(&hash, _filemgr_free_func);
+        wal_global_shutdown();
         if (global_config.ncacheblock > 0) {
             bcache_shutdown();
         }
+#ifdef __BTREEBLK_NODECACHE
+        nodecache_shutdown();
+#endif
         filemgr_initialized = 0;
 #ifndef SPIN_INITIALIZER
         initial_lock_status = 0;
@@ -1243,8 +1349,28 @@ void filemgr_invalidate_block(struct filemgr *file, bid_t bid)
     }
 }
 
-fdb_status filemgr_read(struct filemgr *file, bid_t bid, void *buf,
-                  err_log_callback *log_callback)
+// returns the address of the cached block, or NULL if the block is not
+// cached (or cannot be pinned). The block is never evicted nor modified
+// until filemgr_unpin() is called.
+void *filemgr_pin(struct filemgr *file, bid_t bid,
+                  filemgr_pin_prepare_func *prepare, void *ctx)
+{
+    if (global_config.ncacheblock > 0) {
+        return bcache_pin(file, bid, prepare, ctx);
+    }
+    return NULL;
+}
+
+void filemgr_unpin(struct filemgr *file, bid_t bid)
+{
+    if (global_config.ncacheblock > 0) {
+        bcache_unpin(file, bid);
+    }
+}
+
+static fdb_status _filemgr_read(struct filemgr *file, bid_t bid, void *buf,
+                                err_log_callback *log_callback,
+                                bcache_hint_t hint)
 {
     size_t lock_no;
     ssize_t r;
@@ -1275,7 +1401,7 @@ fdb_status filemgr_read(struct filemgr *file, bid_t bid, void *buf,
             locked = true;
         }
 
-        r = bcache_read(file, bid, buf);
+        r = bcache_read(file, bid, buf, hint);
         if (r == 0) {
             // cache miss
             // if normal file, just read a block
@@ -1302,7 +1428,7 @@ fdb_status filemgr_read(struct filemgr *file, bid_t bid, void *buf,
                 return status;
             }
 #endif
-            r = bcache_write(file, bid, buf, BCACHE_REQ_CLEAN);
+            r = bcache_write(file, bid, buf, BCACHE_REQ_CLEAN, hint);
             if (r != global_config.blocksize) {
                 _log_errno_str(file->ops, log_callback,
                                (fdb_status) r, "WRITE", file->filename);
@@ -1338,6 +1464,143 @@ fdb_status filemgr_read(struct filemgr *file, bid_t bid, void *buf,
     return status;
 }
 
+fdb_status filemgr_read(struct filemgr *file, bid_t bid, void *buf,
+                  err_log_callback *log_callback)
+{
+    return _filemgr_read(file, bid, buf, log_callback, BCACHE_HINT_NORMAL);
+}
+
+// read a block that will not be accessed again soon
+// (e.g., by compaction or prefetch), so that the block does not push
+// frequently used blocks out of the block cache
+fdb_status filemgr_read_once(struct filemgr *file, bid_t bid, void *buf,
+                             err_log_callback *log_callback)
+{
+    return _filemgr_read(file, bid, buf, log_callback, BCACHE_HINT_ONCE);
+}
+
+// read the given committed blocks into the block cache at once
+// (as read-once blocks); blocks that are already cached or not committed
+// yet are skipped, and duplicated BIDs should be adjacent. Runs of
+// consecutive BIDs are read with a single request.
+fdb_status filemgr_prefetch_blocks(struct filemgr *file, bid_t *bids, size_t n,
+                                   err_log_callback *log_callback)
+{
+    size_t i, nreqs = 0, nblocks = 0;
+    uint64_t last_commit;
+    uint8_t *buf, *tmp;
+    void *addr;
+    bid_t *req_bids;
+    struct filemgr_io_req *reqs;
+    fdb_status status = FDB_RESULT_SUCCESS;
+
+    if (global_config.ncacheblock <= 0 || n == 0) {
+        return FDB_RESULT_SUCCESS;
+    }
+
+    spin_lock(&file->lock);
+    last_commit = file->last_commit;
+    spin_unlock(&file->lock);
+
+    malloc_align(addr, FDB_SECTOR_SIZE, file->blocksize * n);
+    buf = (uint8_t *)addr;
+    tmp = alca(uint8_t, file->blocksize);
+    reqs = (struct filemgr_io_req *)malloc(sizeof(struct filemgr_io_req) * n);
+    req_bids = (bid_t *)malloc(sizeof(bid_t) * n);
+
+    for (i=0; i<n; ++i) {
+        if ((i > 0 && bids[i] == bids[i-1]) ||
+            bids[i] * file->blocksize >= last_commit) {
+            // duplicated or uncommitted (mutable) block
+            continue;
+        }
+        if (bcache_read(file, bids[i], tmp, BCACHE_HINT_ONCE)) {
+            // already cached
+            continue;
+        }
+        if (nblocks > 0 && req_bids[nblocks-1] + 1 == bids[i]) {
+            // extend the previous request
+            reqs[nreqs-1].count += file->blocksize;
+        } else {
+            reqs[nreqs].buf = buf + nblocks * file->blocksize;
+            reqs[nreqs].count = file->blocksize;
+            reqs[nreqs].offset = bids[i] * file->blocksize;
+            nreqs++;
+        }
+        req_bids[nblocks++] = bids[i];
+    }
+
+    if (nreqs > 0) {
+        status = (fdb_status)file->ops->pread_batch(file->fd, reqs, nreqs);
+    }
+    for (i=0; i<nreqs && status == FDB_RESULT_SUCCESS; ++i) {
+        if (reqs[i].result != (ssize_t)reqs[i].count) {
+            _log_errno_str(file->ops, log_callback,
+                           (fdb_status) reqs[i].result, "READ",
+                           file->filename);
+            status = FDB_RESULT_READ_FAIL;
+        }
+    }
+    for (i=0; i<nblocks && status == FDB_RESULT_SUCCESS; ++i) {
+        tmp = buf + i * file->blocksize;
+#ifdef __CRC32
+        status = _filemgr_crc32_check(file, tmp);
+        if (status != FDB_RESULT_SUCCESS) {
+            _log_errno_str(file->ops, log_callback, status, "READ",
+                           file->filename);
+            break;
+        }
+#endif
+        bcache_write(file, req_bids[i], tmp, BCACHE_REQ_CLEAN,
+                     BCACHE_HINT_ONCE);
+    }
+
+    free(req_bids);
+    free(reqs);
+    free_align(addr);
+    return status;
+}
+
+// read 'n' consecutive blocks starting from 'bid' into 'buf' (aligned to
+// FDB_SECTOR_SIZE) with a single I/O, bypassing the block cache, so that
+// a large region that is scanned only once (e.g., by crash recovery) does
+// not push other blocks out of the cache. Committed blocks are immutable
+// and already written back, while the others are read through the cache.
+fdb_status filemgr_read_blocks(struct filemgr *file, bid_t bid, size_t n,
+                               void *buf, err_log_callback *log_callback)
+{
+    size_t i, ncommitted;
+    ssize_t r;
+    uint64_t last_commit;
+    fdb_status status = FDB_RESULT_SUCCESS;
+
+    spin_lock(&file->lock);
+    last_commit = file->last_commit;
+    spin_unlock(&file->lock);
+
+    if (bid * file->blocksize >= last_commit) {
+        ncommitted = 0;
+    } else {
+        ncommitted = MIN(n, last_commit / file->blocksize - bid);
+    }
+
+    if (ncommitted > 0) {
+        r = file->ops->pread(file->fd, buf, file->blocksize * ncommitted,
+                             bid * file->blocksize);
+        if (r != (ssize_t)(file->blocksize * ncommitted)) {
+            _log_errno_str(file->ops, log_callback, (fdb_status) r, "READ",
+                           file->filename);
+            return (r < 0)?((fdb_status)r):(FDB_RESULT_READ_FAIL);
+        }
+    }
+    for (i=ncommitted; i<n && status == FDB_RESULT_SUCCESS; ++i) {
+        status = filemgr_read(file, bid + i,
+                              (uint8_t *)buf + i * file->blocksize,
+                              log_callback);
+    }
+    return status;
+}
+
 fdb_status filemgr_write_offset(struct filemgr *file, bid_t bid,
                                 uint64_t offset, uint64_t len, void *buf,
                                 err_log_callback *log_callback)
@@ -1355,7 +1618,8 @@ fdb_status filemgr_write_offset(struct filemgr *file, bid_t bid,
 
         if (len == file->blocksize) {
             // write entire block .. we don't need to read previous block
-            r = bcache_write(file, bid, buf, BCACHE_REQ_DIRTY);
+            r = bcache_write(file, bid, buf, BCACHE_REQ_DIRTY,
+                             BCACHE_HINT_NORMAL);
             if (r != global_config.blocksize) {
                 _log_errno_str(file->ops, log_callback,
                                (fdb_status) r, "WRITE", file->filename);
@@ -1400,7 +1664,8 @@ fdb_status filemgr_write_offset(struct filemgr *file, bid_t bid,
                     }
                 }
                 memcpy((uint8_t *)_buf + offset, buf, len);
-                r = bcache_write(file, bid, _buf, BCACHE_REQ_DIRTY);
+                r = bcache_write(file, bid, _buf, BCACHE_REQ_DIRTY,
+                                 BCACHE_HINT_NORMAL);
                 if (r != global_config.blocksize) {
                     _filemgr_release_temp_buf(_buf);
                     _log_errno_str(file->ops, log_callback,
@@ -1461,8 +1726,14 @@ int filemgr_is_writable(struct filemgr *file, bid_t bid)
     return cond;
 }
 
-fdb_status filemgr_commit(struct filemgr *file,
-                          err_log_callback *log_callback)
+// write the DB header (and fsync the file if FILEMGR_SYNC or DEFER_SYNC
+// is set); in group commit mode or if DEFER_SYNC is set, the fsync is not
+// issued here, and the revnum of the written header is returned through
+// SYNC_REVNUM (0 if there is nothing to wait for) .. it should be passed
+// to filemgr_sync_commit()
+static fdb_status _filemgr_commit(struct filemgr *file, bool defer_sync,
+                                  filemgr_header_revnum_t *sync_revnum,
+                                  err_log_callback *log_callback)
 {
     uint16_t header_len = file->header.size;
     uint16_t _header_len;
@@ -1472,6 +1743,14 @@ fdb_status filemgr_commit(struct filemgr *file,
     int result = FDB_RESULT_SUCCESS;
     filemgr_magic_t magic = FILEMGR_MAGIC;
     filemgr_magic_t _magic;
+    filemgr_header_revnum_t revnum = 0;
+    bool synced = false;
+    bool need_sync = (file->fflags & FILEMGR_SYNC) || defer_sync;
+    bool group_commit = defer_sync ||
+                        ((file->fflags & FILEMGR_SYNC) &&
+                         (file->fflags & FILEMGR_GROUP_COMMIT));
+
+    *sync_revnum = 0;
 
     if (global_config.ncacheblock > 0) {
         result = bcache_flush(file);
@@ -1502,7 +1781,8 @@ fdb_status filemgr_commit(struct filemgr *file,
         // header data
         memcpy(buf, file->header.data, header_len);
         // header rev number
-        _revnum = _endian_encode(file->header.revnum);
+        revnum = file->header.revnum;
+        _revnum = _endian_encode(revnum);
         memcpy((uint8_t *)buf + header_len, &_revnum,
                sizeof(filemgr_header_revnum_t));
         // file's sequence number (default KVS seqnum)
@@ -1530,34 +1810,259 @@ fdb_status filemgr_commit(struct filemgr *file,
         memcpy((uint8_t *)buf + file->blocksize - BLK_MARKER_SIZE,
                marker, BLK_MARKER_SIZE);
 
-        ssize_t rv = file->ops->pwrite(file->fd, buf, file->blocksize, file->pos);
+        // the header block is written without holding the lock, as the
+        // fsync (linked with the write) may take a long time; FILE->POS is
+        // not modified by others meanwhile, since only the writer holding
+        // the file mutex can commit or allocate blocks
+        cs_off_t header_pos = file->pos;
+        ssize_t rv;
+        spin_unlock(&file->lock);
+
+        if (group_commit) {
+            // a header with the same revnum may be written again (e.g., by
+            // compaction), so it cannot be tracked by revnum
+            mutex_lock(&file->csync.lock);
+            if (revnum <= file->csync.written) {
+                group_commit = false;
+            }
+            mutex_unlock(&file->csync.lock);
+        }
+
+        if (group_commit) {
+            // fsync is issued later by a leader of the group
+            rv = file->ops->pwrite(file->fd, buf, file->blocksize, header_pos);
+            synced = true;
+        } else if (need_sync) {
+            // write the header and then fsync the file
+            // (both requests can be submitted at once by the I/O backend)
+            rv = file->ops->pwrite_fsync(file->fd, buf, file->blocksize,
+                                         header_pos);
+            if (rv == FDB_RESULT_FSYNC_FAIL) {
+                _log_errno_str(file->ops, log_callback, (fdb_status) rv,
+                               "FSYNC", file->filename);
+                result = FDB_RESULT_FSYNC_FAIL;
+                rv = file->blocksize;
+            }
+            synced = true;
+        } else {
+            rv = file->ops->pwrite(file->fd, buf, file->blocksize, header_pos);
+        }
         _log_errno_str(file->ops, log_callback, (fdb_status) rv,
                        "WRITE", file->filename);
+        _filemgr_release_temp_buf(buf);
         if (rv != file->blocksize) {
-            _filemgr_release_temp_buf(buf);
-            spin_unlock(&file->lock);
             return FDB_RESULT_WRITE_FAIL;
         }
-        file->header.bid = file->pos / file->blocksize;
+
+        mutex_lock(&file->csync.lock);
+        if (file->csync.written < revnum) {
+            file->csync.written = revnum;
+        }
+        if (group_commit) {
+            file->csync.npending++;
+            *sync_revnum = revnum;
+        } else if (synced && result == FDB_RESULT_SUCCESS &&
+                   file->csync.synced < revnum) {
+            file->csync.synced = revnum;
+        }
+        mutex_unlock(&file->csync.lock);
+
+        spin_lock(&file->lock);
+        file->header.bid = header_pos / file->blocksize;
         file->pos += file->blocksize;
 
         file->header.dirty_idtree_root = BLK_NOT_FOUND;
         file->header.dirty_seqtree_root = BLK_NOT_FOUND;
-
-        _filemgr_release_temp_buf(buf);
     }
     // race condition?
     file->last_commit = file->pos;
 
     spin_unlock(&file->lock);
 
-    if (file->fflags & FILEMGR_SYNC) {
+    if (need_sync && !synced) {
         result = file->ops->fsync(file->fd);
         _log_errno_str(file->ops, log_callback, (fdb_status)result, "FSYNC", file->filename);
     }
     return (fdb_status) result;
 }
 
+fdb_status filemgr_commit(struct filemgr *file,
+                          err_log_callback *log_callback)
+{
+    filemgr_header_revnum_t sync_revnum;
+    fdb_status fs = _filemgr_commit(file, false, &sync_revnum, log_callback);
+    if (fs == FDB_RESULT_SUCCESS && sync_revnum) {
+        fs = filemgr_sync_commit(file, sync_revnum, log_callback);
+    }
+    return fs;
+}
+
+// same as filemgr_commit(), but the caller should call
+// filemgr_sync_commit() with SYNC_REVNUM (if not zero) to wait until the
+// commit becomes durable, after releasing the file mutex so that other
+// writers can join the same fsync; if DEFER_SYNC is set, the fsync is
+// deferred even if FILEMGR_SYNC is not set
+fdb_status filemgr_commit_deferred(struct filemgr *file, bool defer_sync,
+                                   filemgr_header_revnum_t *sync_revnum,
+                                   err_log_callback *log_callback)
+{
+    return _filemgr_commit(file, defer_sync, sync_revnum, log_callback);
+}
+
+// wait until the header REVNUM (and all headers before it) becomes durable
+// the first waiter becomes a leader, and issues a single fsync for all
+// headers written so far; commits written while the fsync is in flight
+// wait for the next fsync together
+fdb_status filemgr_sync_commit(struct filemgr *file,
+                               filemgr_header_revnum_t revnum,
+                               err_log_callback *log_callback)
+{
+    int rv;
+    uint64_t batch;
+    filemgr_header_revnum_t target;
+    fdb_status fs = FDB_RESULT_SUCCESS;
+
+    mutex_lock(&file->csync.lock);
+    while (file->csync.synced < revnum) {
+        if (revnum <= file->csync.failed) {
+            fs = FDB_RESULT_FSYNC_FAIL;
+            break;
+        }
+        if (file->csync.syncing) {
+            // join the next batch
+            thread_cond_wait(&file->csync.cond, &file->csync.lock);
+            continue;
+        }
+
+        // become a leader
+        file->csync.syncing = true;
+        target = file->csync.written;
+        batch = file->csync.npending;
+        file->csync.npending = 0;
+        mutex_unlock(&file->csync.lock);
+
+        rv = file->ops->fsync(file->fd);
+        _log_errno_str(file->ops, log_callback, (fdb_status)rv, "FSYNC",
+                       file->filename);
+
+        mutex_lock(&file->csync.lock);
+        if (rv == FDB_RESULT_SUCCESS) {
+            if (file->csync.synced < target) {
+                file->csync.synced = target;
+            }
+            file->csync.ncommits += batch;
+            file->csync.nsyncs++;
+            file->csync.last_batch = batch;
+            if (file->csync.max_batch < batch) {
+                file->csync.max_batch = batch;
+            }
+        } else if (file->csync.failed < target) {
+            file->csync.failed = target;
+        }
+        file->csync.syncing = false;
+        thread_cond_broadcast(&file->csync.cond);
+    }
+    mutex_unlock(&file->csync.lock);
+
+    return fs;
+}
+
+static void *_filemgr_syncer_thread(void *voidargs)
+{
+    struct list_elem *e;
+    struct sync_req_item *item;
+    struct filemgr *file;
+    fdb_status fs;
+
+    mutex_lock(&syncer_lock);
+    while (true) {
+        e = list_pop_front(&syncer_queue);
+        if (!e) {
+            if (syncer_terminate) {
+                break;
+            }
+            thread_cond_wait(&syncer_cond, &syncer_lock);
+            continue;
+        }
+        mutex_unlock(&syncer_lock);
+
+        item = _get_entry(e, struct sync_req_item, le);
+        file = item->file;
+        fs = FDB_RESULT_SUCCESS;
+        if (item->revnum) {
+            // the fsync covers all headers written so far, so that
+            // the following requests on the same file may not need any
+            fs = filemgr_sync_commit(file, item->revnum, NULL);
+        }
+        item->callback(fs, item->ctx);
+        free(item);
+
+        mutex_lock(&file->csync.lock);
+        if (--file->csync.nasync == 0) {
+            thread_cond_broadcast(&file->csync.cond);
+        }
+        mutex_unlock(&file->csync.lock);
+
+        mutex_lock(&syncer_lock);
+    }
+    mutex_unlock(&syncer_lock);
+
+    thread_exit(0);
+    return NULL;
+}
+
+// hand over a commit written by filemgr_commit_deferred() to the syncer
+// thread, which waits until the header REVNUM becomes durable and then
+// invokes CALLBACK (if REVNUM is 0, the callback is invoked without fsync)
+void filemgr_sync_commit_async(struct filemgr *file,
+                               filemgr_header_revnum_t revnum,
+                               filemgr_sync_callback *callback, void *ctx)
+{
+    struct sync_req_item *item;
+
+    item = (struct sync_req_item *)malloc(sizeof(struct sync_req_item));
+    item->file = file;
+    item->revnum = revnum;
+    item->callback = callback;
+    item->ctx = ctx;
+
+    // the file is not closed until the request is done
+    mutex_lock(&file->csync.lock);
+    file->csync.nasync++;
+    mutex_unlock(&file->csync.lock);
+
+    mutex_lock(&syncer_lock);
+    if (!syncer_running) {
+        syncer_running = 1;
+        thread_create(&syncer_tid, _filemgr_syncer_thread, NULL);
+    }
+    list_push_back(&syncer_queue, &item->le);
+    thread_cond_signal(&syncer_cond);
+    mutex_unlock(&syncer_lock);
+}
+
+// wait until all requests on the file queued to the syncer thread are done
+// (should not be called in the callback)
+void filemgr_wait_async_commits(struct filemgr *file)
+{
+    mutex_lock(&file->csync.lock);
+    while (file->csync.nasync) {
+        thread_cond_wait(&file->csync.cond, &file->csync.lock);
+    }
+    mutex_unlock(&file->csync.lock);
+}
+
+void filemgr_get_group_commit_stats(struct filemgr *file,
+                                    struct filemgr_group_commit_stats *stats)
+{
+    mutex_lock(&file->csync.lock);
+    stats->ncommits = file->csync.ncommits;
+    stats->nsyncs = file->csync.nsyncs;
+    stats->last_batch = file->csync.last_batch;
+    stats->max_batch = file->csync.max_batch;
+    mutex_unlock(&file->csync.lock);
+}
+
 fdb_status filemgr_sync(struct filemgr *file, err_log_callback *log_callback)
 {
     fdb_status result = FDB_RESULT_SUCCESS;
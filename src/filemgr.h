@@ -21,6 +21,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdint.h>
+#if !defined(WIN32) && !defined(_WIN32)
+#include <sys/uio.h>
+#endif
 
 #include "libforestdb/fdb_errors.h"
 
@@ -38,17 +41,38 @@ struct filemgr_config {
     int ncacheblock;
     int flag;
     int chunksize;
+    // percentage of the block cache reserved for index nodes
+    int index_cache_ratio;
+    // percentage of the buffer cache ('ncacheblock') used by the node cache
+    int nodecache_ratio;
+    // max bytes used by WAL entries of all files (0: no limit)
+    uint64_t wal_mem_budget;
     uint8_t options;
 #define FILEMGR_SYNC 0x01
 #define FILEMGR_READONLY 0x02
 #define FILEMGR_ROLLBACK_IN_PROG 0x04
 #define FILEMGR_CREATE 0x08
+// fsyncs of concurrent commits are coalesced (see filemgr_sync_commit())
+#define FILEMGR_GROUP_COMMIT 0x10
+// open the file only if it is currently opened by other handles
+#define FILEMGR_NO_REOPEN 0x20
     uint64_t prefetch_duration;
 };
 
+// an I/O request of a batch
+struct filemgr_io_req {
+    void *buf;
+    size_t count;
+    cs_off_t offset;
+    // number of bytes transferred, or error code
+    ssize_t result;
+};
+
 struct filemgr_ops {
     int (*open)(const char *pathname, int flags, mode_t mode);
     ssize_t (*pwrite)(int fd, void *buf, size_t count, cs_off_t offset);
+    // write IOVCNT buffers to consecutive file offsets starting at OFFSET
+    ssize_t (*pwritev)(int fd, struct iovec *iov, int iovcnt, cs_off_t offset);
     ssize_t (*pread)(int fd, void *buf, size_t count, cs_off_t offset);
     int (*close)(int fd);
     cs_off_t (*goto_eof)(int fd);
@@ -56,6 +80,12 @@ struct filemgr_ops {
     int (*fdatasync)(int fd);
     int (*fsync)(int fd);
     void (*get_errno_str)(char *buf, size_t size);
+    // issue N read requests (as many requests as possible are kept in
+    // flight at the same time) and wait for all of them
+    int (*pread_batch)(int fd, struct filemgr_io_req *reqs, int n);
+    // write a buffer and then fsync the file
+    // (return FDB_RESULT_FSYNC_FAIL if the write succeeds but fsync fails)
+    ssize_t (*pwrite_fsync)(int fd, void *buf, size_t count, cs_off_t offset);
 };
 
 struct filemgr_buffer{
@@ -86,9 +116,44 @@ enum {
 };
 
 #define DLOCK_MAX (41) /* a prime number */
+// state of durable commits
+// HEADER.REVNUM of the last written DB header, and that of the last header
+// made durable by fsync; in group commit mode, a commit is acknowledged
+// after a leader fsyncs the file on behalf of all commits written so far
+struct filemgr_commit_sync {
+    mutex_t lock;
+    thread_cond_t cond;
+    filemgr_header_revnum_t written;
+    filemgr_header_revnum_t synced;
+    // the headers up to this revnum could not be made durable
+    filemgr_header_revnum_t failed;
+    // a leader is fsyncing the file
+    bool syncing;
+    // number of written commits waiting for the next fsync
+    uint64_t npending;
+    // number of requests queued to the syncer thread
+    uint64_t nasync;
+    // statistics of group commits
+    uint64_t ncommits;
+    uint64_t nsyncs;
+    uint64_t last_batch;
+    uint64_t max_batch;
+};
+
+struct filemgr_group_commit_stats {
+    // number of commits acknowledged by group fsyncs
+    uint64_t ncommits;
+    // number of fsyncs issued for them
+    uint64_t nsyncs;
+    // number of commits covered by the last and the largest fsync
+    uint64_t last_batch;
+    uint64_t max_batch;
+};
+
 struct wal;
 struct fnamedic_item;
 struct kvs_header;
+struct bloomfilter;
 struct filemgr {
     char *filename; // Current file name.
     uint8_t ref_count;
@@ -111,11 +176,16 @@ struct filemgr {
     bool in_place_compaction;
     struct kvs_header *kv_header;
     void (*free_kv_header)(struct filemgr *file); // callback function
+    // filter of all keys in the main index (NULL if not maintained)
+    struct bloomfilter *bloom;
 
     // variables related to prefetching
     volatile filemgr_prefetch_status_t prefetch_status;
     thread_t prefetch_tid;
 
+    // durable commits
+    struct filemgr_commit_sync csync;
+
     // spin lock for small region
     spin_t lock;
 
@@ -180,9 +250,26 @@ bid_t filemgr_alloc_multiple_cond(struct filemgr *file, bid_t nextbid, int nbloc
 
 void filemgr_invalidate_block(struct filemgr *file, bid_t bid);
 
+// PREPARE is called when a cached block is pinned for the first time since
+// it was loaded, and returns false if the block cannot be used in place.
+// The block is still read by others while it is pinned, so PREPARE must not
+// change what they read. All callers pinning the same block must pass the
+// same function.
+typedef bool filemgr_pin_prepare_func(void *addr, void *ctx);
+void *filemgr_pin(struct filemgr *file, bid_t bid,
+                  filemgr_pin_prepare_func *prepare, void *ctx);
+void filemgr_unpin(struct filemgr *file, bid_t bid);
+
 fdb_status filemgr_read(struct filemgr *file,
                   bid_t bid, void *buf,
                   err_log_callback *log_callback);
+fdb_status filemgr_read_once(struct filemgr *file,
+                             bid_t bid, void *buf,
+                             err_log_callback *log_callback);
+fdb_status filemgr_prefetch_blocks(struct filemgr *file, bid_t *bids, size_t n,
+                                   err_log_callback *log_callback);
+fdb_status filemgr_read_blocks(struct filemgr *file, bid_t bid, size_t n,
+                               void *buf, err_log_callback *log_callback);
 
 fdb_status filemgr_write_offset(struct filemgr *file, bid_t bid, uint64_t offset,
                           uint64_t len, void *buf, err_log_callback *log_callback);
@@ -193,6 +280,20 @@ void filemgr_remove_file(struct filemgr *file);
 
 fdb_status filemgr_commit(struct filemgr *file,
                           err_log_callback *log_callback);
+fdb_status filemgr_commit_deferred(struct filemgr *file, bool defer_sync,
+                                   filemgr_header_revnum_t *sync_revnum,
+                                   err_log_callback *log_callback);
+fdb_status filemgr_sync_commit(struct filemgr *file,
+                               filemgr_header_revnum_t revnum,
+                               err_log_callback *log_callback);
+// callback invoked by the syncer thread when a queued commit becomes durable
+typedef void filemgr_sync_callback(fdb_status status, void *ctx);
+void filemgr_sync_commit_async(struct filemgr *file,
+                               filemgr_header_revnum_t revnum,
+                               filemgr_sync_callback *callback, void *ctx);
+void filemgr_wait_async_commits(struct filemgr *file);
+void filemgr_get_group_commit_stats(struct filemgr *file,
+                                    struct filemgr_group_commit_stats *stats);
 fdb_status filemgr_sync(struct filemgr *file,
                         err_log_callback *log_callback);
 
@@ -19,9 +19,19 @@
 
 struct filemgr_ops * get_win_filemgr_ops();
 struct filemgr_ops * get_linux_filemgr_ops();
+struct filemgr_ops * get_linux_uring_filemgr_ops(int queue_depth);
+void linux_uring_shutdown();
+
+// ops of the backend selected by filemgr_ops_init()
+// (NULL: the default ops of the platform)
+static struct filemgr_ops *selected_ops = NULL;
 
 struct filemgr_ops * get_filemgr_ops()
 {
+    if (selected_ops) {
+        return selected_ops;
+    }
+
 #if defined(WIN32) || defined(_WIN32)
     // windows
     return get_win_filemgr_ops();
@@ -30,3 +40,26 @@ struct filemgr_ops * get_filemgr_ops()
     return get_linux_filemgr_ops();
 #endif
 }
+
+fdb_io_backend_t filemgr_ops_init(fdb_io_backend_t backend, int queue_depth)
+{
+#if !defined(WIN32) && !defined(_WIN32)
+    if (backend == FDB_IO_BACKEND_IO_URING) {
+        selected_ops = get_linux_uring_filemgr_ops(queue_depth);
+        if (selected_ops) {
+            return FDB_IO_BACKEND_IO_URING;
+        }
+        // io_uring is not available .. fall back to the default ops
+    }
+#endif
+    selected_ops = NULL;
+    return FDB_IO_BACKEND_SYNC;
+}
+
+void filemgr_ops_shutdown()
+{
+#if !defined(WIN32) && !defined(_WIN32)
+    linux_uring_shutdown();
+#endif
+    selected_ops = NULL;
+}
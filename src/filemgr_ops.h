@@ -18,11 +18,18 @@
 #ifndef _JSAHN_FILEMGR_OPS
 #define _JSAHN_FILEMGR_OPS
 
+#include "libforestdb/fdb_types.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct filemgr_ops * get_filemgr_ops();
+// select the I/O backend returned by get_filemgr_ops(), and return the
+// backend actually selected (the default ops are used if BACKEND is not
+// available on this platform)
+fdb_io_backend_t filemgr_ops_init(fdb_io_backend_t backend, int queue_depth);
+void filemgr_ops_shutdown();
 
 #ifdef __cplusplus
 }
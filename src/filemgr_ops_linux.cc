@@ -23,9 +23,17 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 
 #include "filemgr.h"
 #include "filemgr_ops.h"
+#include "config.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 #if !defined(WIN32) && !defined(_WIN32)
 
@@ -59,6 +67,54 @@ ssize_t _filemgr_linux_pwrite(int fd, void *buf, size_t count, cs_off_t offset)
     return rv;
 }
 
+ssize_t _filemgr_linux_pwritev(int fd, struct iovec *iov, int iovcnt,
+                               cs_off_t offset)
+{
+    ssize_t rv, total = 0;
+    int i, n;
+
+    // note that pwritev() can write fewer bytes than requested,
+    // and the number of buffers is limited by IOV_MAX
+    while (iovcnt > 0) {
+        n = MIN(iovcnt, IOV_MAX);
+        do {
+            rv = pwritev(fd, iov, n, offset);
+        } while (rv == -1 && errno == EINTR); // LCOV_EXCL_LINE
+
+        if (rv < 0) {
+            return (ssize_t) FDB_RESULT_WRITE_FAIL; // LCOV_EXCL_LINE
+        }
+        if (rv == 0) {
+            break; // LCOV_EXCL_LINE
+        }
+        total += rv;
+        offset += rv;
+
+        // skip the buffers that were completely written
+        for (i=0; i<iovcnt && (size_t)rv >= iov[i].iov_len; ++i) {
+            rv -= iov[i].iov_len;
+        }
+        iov += i;
+        iovcnt -= i;
+        if (iovcnt > 0 && rv > 0) {
+            // LCOV_EXCL_START
+            // the remaining part of a partially written buffer
+            ssize_t ret = _filemgr_linux_pwrite(fd,
+                              (uint8_t*)iov[0].iov_base + rv,
+                              iov[0].iov_len - rv, offset);
+            if (ret != (ssize_t)(iov[0].iov_len - rv)) {
+                return (ssize_t) FDB_RESULT_WRITE_FAIL;
+            }
+            total += ret;
+            offset += ret;
+            iov++;
+            iovcnt--;
+            // LCOV_EXCL_STOP
+        }
+    }
+    return total;
+}
+
 ssize_t _filemgr_linux_pread(int fd, void *buf, size_t count, cs_off_t offset)
 {
     ssize_t rv;
@@ -157,16 +213,42 @@ void _filemgr_linux_get_errno_str(char *buf, size_t size) {
     }
 }
 
+int _filemgr_linux_pread_batch(int fd, struct filemgr_io_req *reqs, int n)
+{
+    int i;
+    for (i=0; i<n; ++i) {
+        reqs[i].result = _filemgr_linux_pread(fd, reqs[i].buf, reqs[i].count,
+                                              reqs[i].offset);
+    }
+    return FDB_RESULT_SUCCESS;
+}
+
+ssize_t _filemgr_linux_pwrite_fsync(int fd, void *buf, size_t count,
+                                    cs_off_t offset)
+{
+    ssize_t rv = _filemgr_linux_pwrite(fd, buf, count, offset);
+    if (rv != (ssize_t)count) {
+        return rv;
+    }
+    if (_filemgr_linux_fsync(fd) != FDB_RESULT_SUCCESS) {
+        return (ssize_t) FDB_RESULT_FSYNC_FAIL; // LCOV_EXCL_LINE
+    }
+    return rv;
+}
+
 struct filemgr_ops linux_ops = {
     _filemgr_linux_open,
     _filemgr_linux_pwrite,
+    _filemgr_linux_pwritev,
     _filemgr_linux_pread,
     _filemgr_linux_close,
     _filemgr_linux_goto_eof,
     _filemgr_linux_file_size,
     _filemgr_linux_fdatasync,
     _filemgr_linux_fsync,
-    _filemgr_linux_get_errno_str
+    _filemgr_linux_get_errno_str,
+    _filemgr_linux_pread_batch,
+    _filemgr_linux_pwrite_fsync
 };
 
 struct filemgr_ops * get_linux_filemgr_ops()
@@ -174,4 +256,504 @@ struct filemgr_ops * get_linux_filemgr_ops()
     return &linux_ops;
 }
 
+#ifdef HAVE_LINUX_IO_URING_H
+
+// io_uring backend
+// Single I/Os are issued by the same system calls as LINUX_OPS, since
+// going through a ring does not make them any faster. Batched reads and
+// vectored writes are split into requests that are submitted together,
+// keeping up to URING_DEPTH requests in flight, and a header write is
+// linked with the following fsync so that both are submitted at once.
+// Rings are not shared by threads: each caller takes a ring from
+// URING_FREE_LIST (or creates a new one) and returns it after the batch.
+
+struct uring {
+    int fd;
+    unsigned entries;
+    // submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_tail_local;
+    struct io_uring_sqe *sqes;
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // mapped regions
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+    struct uring *next;
+};
+
+// an internal request of a ring
+struct uring_req {
+    uint8_t opcode;
+    // buffer (or iovec array)
+    void *addr;
+    // length (or number of iovecs)
+    uint32_t len;
+    cs_off_t offset;
+    ssize_t result;
+};
+
+static spin_t uring_lock = SPIN_INITIALIZER;
+static struct uring *uring_free_list = NULL;
+static unsigned uring_depth = 0;
+
+static int _uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                        unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, NULL, 0);
+}
+
+static void _uring_destroy(struct uring *r)
+{
+    if (r->sqes) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_len);
+    }
+    if (r->sq_ptr) {
+        munmap(r->sq_ptr, r->sq_len);
+    }
+    close(r->fd);
+    free(r);
+}
+
+static struct uring * _uring_create(unsigned entries)
+{
+    struct io_uring_params p;
+    struct uring *r;
+    uint8_t *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    int fd = _uring_setup(entries, &p);
+    if (fd < 0) {
+        // not supported by the kernel, or not permitted
+        return NULL;
+    }
+
+    r = (struct uring *)calloc(1, sizeof(struct uring));
+    r->fd = fd;
+    r->entries = p.sq_entries;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        // both rings share a single mapping
+        r->sq_len = r->cq_len = MAX(r->sq_len, r->cq_len);
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = NULL;
+        _uring_destroy(r);
+        return NULL;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            _uring_destroy(r);
+            return NULL;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe *)
+              mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        _uring_destroy(r);
+        return NULL;
+    }
+
+    sq = (uint8_t *)r->sq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_tail_local = *r->sq_tail;
+
+    cq = (uint8_t *)r->cq_ptr;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return r;
+}
+
+static struct uring * _uring_get()
+{
+    struct uring *r;
+
+    spin_lock(&uring_lock);
+    r = uring_free_list;
+    if (r) {
+        uring_free_list = r->next;
+    }
+    spin_unlock(&uring_lock);
+
+    if (!r) {
+        r = _uring_create(uring_depth);
+    }
+    return r;
+}
+
+static void _uring_put(struct uring *r)
+{
+    spin_lock(&uring_lock);
+    r->next = uring_free_list;
+    uring_free_list = r;
+    spin_unlock(&uring_lock);
+}
+
+// queue a request; USER_DATA is returned with its completion
+static void _uring_prep(struct uring *r, uint8_t opcode, int fd,
+                        void *addr, uint32_t len, cs_off_t offset,
+                        uint8_t flags, uint64_t user_data)
+{
+    unsigned idx = r->sq_tail_local & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->flags = flags;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    r->sq_array[idx] = idx;
+    r->sq_tail_local++;
+}
+
+// submit all queued requests, and wait for at least MIN_COMPLETE completions
+static int _uring_submit_and_wait(struct uring *r, unsigned min_complete)
+{
+    int ret;
+    unsigned to_submit;
+
+    __atomic_store_n(r->sq_tail, r->sq_tail_local, __ATOMIC_RELEASE);
+    do {
+        to_submit = r->sq_tail_local -
+                    __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        ret = _uring_enter(r->fd, to_submit, min_complete,
+                           IORING_ENTER_GETEVENTS);
+    } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+    return ret;
+}
+
+// pop a completion; return false if there is no completion
+static bool _uring_reap(struct uring *r, uint64_t *user_data, int32_t *res)
+{
+    unsigned head = *r->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    cqe = &r->cqes[head & *r->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// synchronous fallback of a request that the ring failed to process
+// (e.g., the opcode is not supported by the running kernel)
+static ssize_t _uring_req_sync(int fd, struct uring_req *req)
+{
+    switch (req->opcode) {
+    case IORING_OP_READ:
+        return _filemgr_linux_pread(fd, req->addr, req->len, req->offset);
+    case IORING_OP_WRITE:
+        return _filemgr_linux_pwrite(fd, req->addr, req->len, req->offset);
+    case IORING_OP_WRITEV:
+        return _filemgr_linux_pwritev(fd, (struct iovec *)req->addr,
+                                      req->len, req->offset);
+    default:
+        return (ssize_t) FDB_RESULT_INVALID_ARGS;
+    }
+}
+
+// process N requests, keeping up to R->ENTRIES requests in flight
+// (return false if the ring fails)
+static bool _uring_run(struct uring *r, int fd, struct uring_req *reqs, int n)
+{
+    int submitted = 0, completed = 0, inflight = 0, ret;
+    uint64_t idx;
+    int32_t res;
+
+    while (completed < n) {
+        while (submitted < n && inflight < (int)r->entries) {
+            _uring_prep(r, reqs[submitted].opcode, fd,
+                        reqs[submitted].addr, reqs[submitted].len,
+                        reqs[submitted].offset, 0, submitted);
+            submitted++;
+            inflight++;
+        }
+        ret = _uring_submit_and_wait(r, 1);
+        if (ret < 0) {
+            return false; // LCOV_EXCL_LINE
+        }
+        while (_uring_reap(r, &idx, &res)) {
+            if (res < 0) {
+                // retry synchronously
+                reqs[idx].result = _uring_req_sync(fd, &reqs[idx]);
+            } else {
+                reqs[idx].result = res;
+            }
+            inflight--;
+            completed++;
+        }
+    }
+    return true;
+}
+
+int _filemgr_uring_pread_batch(int fd, struct filemgr_io_req *reqs, int n)
+{
+    int i;
+    struct uring *r;
+    struct uring_req *ureqs;
+
+    if (n <= 1 || !(r = _uring_get())) {
+        return _filemgr_linux_pread_batch(fd, reqs, n);
+    }
+
+    ureqs = (struct uring_req *)malloc(sizeof(struct uring_req) * n);
+    for (i=0; i<n; ++i) {
+        ureqs[i].opcode = IORING_OP_READ;
+        ureqs[i].addr = reqs[i].buf;
+        ureqs[i].len = reqs[i].count;
+        ureqs[i].offset = reqs[i].offset;
+    }
+    if (!_uring_run(r, fd, ureqs, n)) {
+        // LCOV_EXCL_START
+        // the ring is broken .. do not reuse it
+        _uring_destroy(r);
+        free(ureqs);
+        return _filemgr_linux_pread_batch(fd, reqs, n);
+        // LCOV_EXCL_STOP
+    }
+    _uring_put(r);
+    for (i=0; i<n; ++i) {
+        if (ureqs[i].result < 0) {
+            reqs[i].result = (ssize_t) FDB_RESULT_READ_FAIL;
+        } else {
+            reqs[i].result = ureqs[i].result;
+        }
+    }
+    free(ureqs);
+    return FDB_RESULT_SUCCESS;
+}
+
+ssize_t _filemgr_uring_pwritev(int fd, struct iovec *iov, int iovcnt,
+                               cs_off_t offset)
+{
+    int i, n, unit;
+    size_t total = 0;
+    struct uring *r;
+    struct uring_req *ureqs;
+
+    if (iovcnt <= 1 || !(r = _uring_get())) {
+        return _filemgr_linux_pwritev(fd, iov, iovcnt, offset);
+    }
+
+    // split the buffers into (up to) R->ENTRIES requests
+    unit = (iovcnt + r->entries - 1) / r->entries;
+    unit = MIN(unit, IOV_MAX);
+    n = (iovcnt + unit - 1) / unit;
+    ureqs = (struct uring_req *)malloc(sizeof(struct uring_req) * n);
+    for (i=0; i<n; ++i) {
+        int j, cnt = MIN(unit, iovcnt - i*unit);
+        ureqs[i].opcode = IORING_OP_WRITEV;
+        ureqs[i].addr = &iov[i*unit];
+        ureqs[i].len = cnt;
+        ureqs[i].offset = offset + total;
+        for (j=0; j<cnt; ++j) {
+            total += iov[i*unit + j].iov_len;
+        }
+    }
+    if (!_uring_run(r, fd, ureqs, n)) {
+        // LCOV_EXCL_START
+        // the ring is broken .. do not reuse it
+        _uring_destroy(r);
+        free(ureqs);
+        return _filemgr_linux_pwritev(fd, iov, iovcnt, offset);
+        // LCOV_EXCL_STOP
+    }
+    _uring_put(r);
+
+    total = 0;
+    for (i=0; i<n; ++i) {
+        size_t len = 0;
+        int j, cnt = MIN(unit, iovcnt - i*unit);
+        for (j=0; j<cnt; ++j) {
+            len += iov[i*unit + j].iov_len;
+        }
+        if (ureqs[i].result < 0) {
+            free(ureqs);
+            return (ssize_t) FDB_RESULT_WRITE_FAIL; // LCOV_EXCL_LINE
+        }
+        if ((size_t)ureqs[i].result != len) {
+            // short write .. write the rest of the request synchronously
+            // LCOV_EXCL_START
+            size_t done = ureqs[i].result;
+            for (j=0; j<cnt && done >= iov[i*unit + j].iov_len; ++j) {
+                done -= iov[i*unit + j].iov_len;
+            }
+            ssize_t rv = _filemgr_linux_pwrite(fd,
+                             (uint8_t *)iov[i*unit + j].iov_base + done,
+                             iov[i*unit + j].iov_len - done,
+                             ureqs[i].offset + ureqs[i].result);
+            if (rv != (ssize_t)(iov[i*unit + j].iov_len - done)) {
+                free(ureqs);
+                return (ssize_t) FDB_RESULT_WRITE_FAIL;
+            }
+            if (j+1 < cnt) {
+                rv = _filemgr_linux_pwritev(fd, &iov[i*unit + j + 1],
+                                            cnt - j - 1,
+                                            ureqs[i].offset + ureqs[i].result
+                                            + rv);
+                if (rv < 0) {
+                    free(ureqs);
+                    return (ssize_t) FDB_RESULT_WRITE_FAIL;
+                }
+            }
+            // LCOV_EXCL_STOP
+        }
+        total += len;
+    }
+    free(ureqs);
+    return total;
+}
+
+ssize_t _filemgr_uring_pwrite_fsync(int fd, void *buf, size_t count,
+                                    cs_off_t offset)
+{
+    struct uring *r;
+    ssize_t rv = 0;
+    int fsync_res = 0;
+    int ret, ncomp = 0;
+    uint64_t idx;
+    int32_t res;
+
+    if (!(r = _uring_get())) {
+        return _filemgr_linux_pwrite_fsync(fd, buf, count, offset);
+    }
+
+    // the fsync is started only after the write is completed
+    _uring_prep(r, IORING_OP_WRITE, fd, buf, count, offset,
+                IOSQE_IO_LINK, 0);
+    _uring_prep(r, IORING_OP_FSYNC, fd, NULL, 0, 0, 0, 1);
+    while (ncomp < 2) {
+        ret = _uring_submit_and_wait(r, 2 - ncomp);
+        if (ret < 0) {
+            break; // LCOV_EXCL_LINE
+        }
+        while (_uring_reap(r, &idx, &res)) {
+            if (idx == 0) {
+                rv = res;
+            } else {
+                fsync_res = res;
+            }
+            ncomp++;
+        }
+    }
+    if (ncomp < 2) {
+        // the ring is broken .. do not reuse it
+        _uring_destroy(r); // LCOV_EXCL_LINE
+    } else {
+        _uring_put(r);
+    }
+
+    if (ncomp < 2 || rv < 0) {
+        // the linked fsync is cancelled if the write fails
+        // (or the ring does not support the write) .. retry synchronously
+        return _filemgr_linux_pwrite_fsync(fd, buf, count, offset);
+    }
+    if ((size_t)rv != count) {
+        return rv; // LCOV_EXCL_LINE
+    }
+    if (fsync_res < 0) {
+        return (ssize_t) FDB_RESULT_FSYNC_FAIL; // LCOV_EXCL_LINE
+    }
+    return rv;
+}
+
+struct filemgr_ops linux_uring_ops = {
+    _filemgr_linux_open,
+    _filemgr_linux_pwrite,
+    _filemgr_uring_pwritev,
+    _filemgr_linux_pread,
+    _filemgr_linux_close,
+    _filemgr_linux_goto_eof,
+    _filemgr_linux_file_size,
+    _filemgr_linux_fdatasync,
+    _filemgr_linux_fsync,
+    _filemgr_linux_get_errno_str,
+    _filemgr_uring_pread_batch,
+    _filemgr_uring_pwrite_fsync
+};
+
+// return NULL if io_uring is not available
+struct filemgr_ops * get_linux_uring_filemgr_ops(int queue_depth)
+{
+    struct uring *r;
+
+    uring_depth = queue_depth;
+    // check if the kernel supports io_uring
+    r = _uring_get();
+    if (!r) {
+        return NULL;
+    }
+    _uring_put(r);
+    return &linux_uring_ops;
+}
+
+void linux_uring_shutdown()
+{
+    struct uring *r;
+
+    spin_lock(&uring_lock);
+    while (uring_free_list) {
+        r = uring_free_list;
+        uring_free_list = r->next;
+        _uring_destroy(r);
+    }
+    spin_unlock(&uring_lock);
+}
+
+#else
+
+struct filemgr_ops * get_linux_uring_filemgr_ops(int queue_depth)
+{
+    (void)queue_depth;
+    return NULL;
+}
+
+void linux_uring_shutdown()
+{
+}
+
+#endif // HAVE_LINUX_IO_URING_H
+
 #endif
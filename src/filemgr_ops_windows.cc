@@ -82,6 +82,27 @@ ssize_t _filemgr_win_pwrite(int fd, void *buf, size_t count, cs_off_t offset)
     return (ssize_t) byteswritten;
 }
 
+// there is no positional gather write for ordinary (buffered) file
+// handles on Windows .. write each buffer one by one
+ssize_t _filemgr_win_pwritev(int fd, struct iovec *iov, int iovcnt,
+                             cs_off_t offset)
+{
+    int i;
+    ssize_t rv, total = 0;
+    for (i=0; i<iovcnt; ++i) {
+        rv = _filemgr_win_pwrite(fd, iov[i].iov_base, iov[i].iov_len, offset);
+        if (rv < 0) {
+            return rv;
+        }
+        total += rv;
+        offset += rv;
+        if ((size_t)rv != iov[i].iov_len) {
+            break;
+        }
+    }
+    return total;
+}
+
 ssize_t _filemgr_win_pread(int fd, void *buf, size_t count, cs_off_t offset)
 {
     HANDLE file = handle_to_win(fd);
@@ -193,16 +214,42 @@ void _filemgr_win_get_errno_str(char *buf, size_t size)
     LocalFree(win_msg);
 }
 
+int _filemgr_win_pread_batch(int fd, struct filemgr_io_req *reqs, int n)
+{
+    int i;
+    for (i=0; i<n; ++i) {
+        reqs[i].result = _filemgr_win_pread(fd, reqs[i].buf, reqs[i].count,
+                                            reqs[i].offset);
+    }
+    return FDB_RESULT_SUCCESS;
+}
+
+ssize_t _filemgr_win_pwrite_fsync(int fd, void *buf, size_t count,
+                                  cs_off_t offset)
+{
+    ssize_t rv = _filemgr_win_pwrite(fd, buf, count, offset);
+    if (rv != (ssize_t)count) {
+        return rv;
+    }
+    if (_filemgr_win_fsync(fd) != FDB_RESULT_SUCCESS) {
+        return (ssize_t) FDB_RESULT_FSYNC_FAIL;
+    }
+    return rv;
+}
+
 struct filemgr_ops win_ops = {
     _filemgr_win_open,
     _filemgr_win_pwrite,
+    _filemgr_win_pwritev,
     _filemgr_win_pread,
     _filemgr_win_close,
     _filemgr_win_goto_eof,
     _filemgr_win_file_size,
     _filemgr_win_fdatasync,
     _filemgr_win_fsync,
-    _filemgr_win_get_errno_str
+    _filemgr_win_get_errno_str,
+    _filemgr_win_pread_batch,
+    _filemgr_win_pwrite_fsync
 };
 
 struct filemgr_ops * get_win_filemgr_ops()
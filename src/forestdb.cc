@@ -34,6 +34,8 @@
 #include "btree_var_kv_ops.h"
 #include "docio.h"
 #include "btreeblock.h"
+#include "blockcache.h"
+#include "bloomfilter.h"
 #include "common.h"
 #include "wal.h"
 #include "snapshot.h"
@@ -41,6 +43,7 @@
 #include "configuration.h"
 #include "internal_types.h"
 #include "compactor.h"
+#include "wal_flusher.h"
 #include "memleak.h"
 #include "time_utils.h"
 
@@ -218,6 +221,317 @@ typedef enum {
     FDB_RESTORE_KV_INS,
 } fdb_restore_mode_t;
 
+// insert a document found by crash recovery into the WAL (or the snapshot).
+// if the key is handed over to the snapshot, '*key_alloc' is cleared.
+static void _fdb_restore_wal_doc(fdb_kvs_handle *handle,
+                                 fdb_restore_mode_t mode,
+                                 fdb_kvs_id_t kv_id_req,
+                                 struct docio_object *doc,
+                                 uint64_t doc_offset,
+                                 uint8_t *key_alloc)
+{
+    struct filemgr *file = handle->file;
+    fdb_doc wal_doc;
+    fdb_kvs_id_t kv_id;
+    fdb_seqnum_t kv_seqnum;
+
+    // If say a snapshot is taken on a db handle after
+    // rollback, then skip WAL items after rollback point
+    if ((mode == FDB_RESTORE_KV_INS || !handle->kvs) &&
+        doc->seqnum > handle->seqnum) {
+        return;
+    }
+
+    // restore document
+    wal_doc.keylen = doc->length.keylen;
+    wal_doc.bodylen = doc->length.bodylen;
+    wal_doc.key = doc->key;
+    wal_doc.seqnum = doc->seqnum;
+    wal_doc.deleted = doc->length.flag & DOCIO_DELETED;
+
+    if (!handle->shandle) {
+        wal_doc.metalen = doc->length.metalen;
+        wal_doc.meta = doc->meta;
+        wal_doc.size_ondisk = _fdb_get_docsize(doc->length);
+
+        if (handle->kvs) {
+            // check seqnum before insert
+            buf2kvid(handle->config.chunksize, wal_doc.key, &kv_id);
+
+            if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
+                kv_seqnum = fdb_kvs_get_seqnum(handle->file, kv_id);
+            } else {
+                kv_seqnum = SEQNUM_NOT_USED;
+            }
+            if (doc->seqnum <= kv_seqnum &&
+                    ((mode == FDB_RESTORE_KV_INS &&
+                        kv_id == kv_id_req) ||
+                     (mode == FDB_RESTORE_NORMAL)) ) {
+                // if mode is NORMAL, restore all items
+                // if mode is KV_INS, restore items matching ID
+                wal_insert(&file->global_txn, file,
+                           &wal_doc, doc_offset, 0);
+            }
+        } else {
+            wal_insert(&file->global_txn, file,
+                       &wal_doc, doc_offset, 0);
+        }
+    } else {
+        // snapshot
+        if (handle->kvs) {
+            buf2kvid(handle->config.chunksize, wal_doc.key, &kv_id);
+            if (kv_id != handle->kvs->id) {
+                // snapshot: insert ID matched documents only
+                return;
+            }
+        }
+        // the snapshot takes the key
+        if (!*key_alloc) {
+            wal_doc.key = (void *)malloc(wal_doc.keylen);
+            memcpy(wal_doc.key, doc->key, wal_doc.keylen);
+        }
+        *key_alloc = 0;
+        snap_insert(handle->shandle, &wal_doc, doc_offset);
+    }
+}
+
+// crash recovery reads the blocks between the last WAL-flushed header and
+// the given header in large units (FDB_RECOVERY_READ_UNIT) at once,
+// bypassing the block cache. For each unit,
+// 1. the documents in the unit are located by following their lengths,
+// 2. worker threads (if 'recovery_num_threads' is not zero) parse and
+//    verify them in place, batch by batch, and
+// 3. meanwhile, the recovering thread inserts the parsed batches into the
+//    WAL in file order.
+struct _fdb_recovery_doc {
+    uint64_t offset;
+    // offset right after the doc, or 'offset' if the doc is not valid
+    uint64_t next_offset;
+    bool parsed;
+    uint8_t key_alloc;
+    uint8_t meta_alloc;
+    struct docio_object doc;
+};
+
+struct _fdb_recovery {
+    fdb_kvs_handle *handle;
+    struct docio_blocks blocks;
+    size_t buf_nblocks;
+    struct _fdb_recovery_doc *docs;
+    size_t docs_max;
+
+    // docs in [next_parse, ndocs) are not grabbed by any thread yet
+    mutex_t lock;
+    thread_cond_t parse_cond;
+    thread_cond_t done_cond;
+    size_t ndocs;
+    size_t next_parse;
+    size_t nparsed;
+    size_t nworkers;
+    thread_t *workers;
+    bool terminate;
+};
+
+static void _fdb_recovery_parse(struct _fdb_recovery *rec,
+                                size_t begin, size_t end)
+{
+    size_t i;
+    struct _fdb_recovery_doc *d;
+
+    for (i=begin; i<end; ++i){
+        d = &rec->docs[i];
+        d->next_offset = docio_scan_doc(rec->handle->dhandle, &rec->blocks,
+                                        d->offset, &d->doc,
+                                        &d->key_alloc, &d->meta_alloc);
+    }
+}
+
+// grab and parse a batch of docs; return false if there is nothing to parse
+// (should be called with the lock held)
+static bool _fdb_recovery_parse_batch(struct _fdb_recovery *rec)
+{
+    size_t begin, end;
+
+    if (rec->next_parse >= rec->ndocs) {
+        return false;
+    }
+    begin = rec->next_parse;
+    end = MIN(begin + FDB_RECOVERY_PARSE_BATCH, rec->ndocs);
+    rec->next_parse = end;
+    mutex_unlock(&rec->lock);
+
+    _fdb_recovery_parse(rec, begin, end);
+
+    mutex_lock(&rec->lock);
+    rec->nparsed += end - begin;
+    for (; begin<end; ++begin){
+        rec->docs[begin].parsed = true;
+    }
+    thread_cond_broadcast(&rec->done_cond);
+    return true;
+}
+
+static void *_fdb_recovery_worker_thread(void *voidargs)
+{
+    struct _fdb_recovery *rec = (struct _fdb_recovery *)voidargs;
+
+    mutex_lock(&rec->lock);
+    while (true) {
+        while (!rec->terminate && rec->next_parse >= rec->ndocs) {
+            thread_cond_wait(&rec->parse_cond, &rec->lock);
+        }
+        if (rec->terminate) {
+            break;
+        }
+        _fdb_recovery_parse_batch(rec);
+    }
+    mutex_unlock(&rec->lock);
+
+    thread_exit(0);
+    return NULL;
+}
+
+static void _fdb_recovery_init(struct _fdb_recovery *rec,
+                               fdb_kvs_handle *handle,
+                               size_t nworkers)
+{
+    size_t i;
+    void *addr = NULL;
+
+    rec->handle = handle;
+    rec->buf_nblocks = FDB_RECOVERY_READ_UNIT / handle->file->blocksize;
+    malloc_align(addr, FDB_SECTOR_SIZE,
+                 rec->buf_nblocks * handle->file->blocksize);
+    // if NULL, allocated again (or failed) by the first _fdb_recovery_read()
+    rec->blocks.buf = addr;
+    rec->blocks.bid = BLK_NOT_FOUND;
+    rec->blocks.nblocks = 0;
+    rec->docs_max = 1024;
+    rec->docs = (struct _fdb_recovery_doc *)
+                malloc(sizeof(struct _fdb_recovery_doc) * rec->docs_max);
+
+    mutex_init(&rec->lock);
+    thread_cond_init(&rec->parse_cond);
+    thread_cond_init(&rec->done_cond);
+    rec->ndocs = rec->next_parse = rec->nparsed = 0;
+    rec->nworkers = nworkers;
+    rec->workers = NULL;
+    rec->terminate = false;
+    if (nworkers) {
+        rec->workers = (thread_t *)calloc(nworkers, sizeof(thread_t));
+        for (i=0; i<nworkers; ++i){
+            thread_create(&rec->workers[i], _fdb_recovery_worker_thread, rec);
+        }
+    }
+}
+
+static void _fdb_recovery_free(struct _fdb_recovery *rec)
+{
+    size_t i;
+    void *ret;
+
+    if (rec->nworkers) {
+        mutex_lock(&rec->lock);
+        rec->terminate = true;
+        thread_cond_broadcast(&rec->parse_cond);
+        mutex_unlock(&rec->lock);
+        for (i=0; i<rec->nworkers; ++i){
+            thread_join(rec->workers[i], &ret);
+        }
+        free(rec->workers);
+    }
+    thread_cond_destroy(&rec->parse_cond);
+    thread_cond_destroy(&rec->done_cond);
+    mutex_destroy(&rec->lock);
+    free(rec->docs);
+    free_align(rec->blocks.buf);
+}
+
+// read 'nblocks' blocks starting from 'bid' into the buffer
+static fdb_status _fdb_recovery_read(struct _fdb_recovery *rec,
+                                     bid_t bid, size_t nblocks)
+{
+    void *addr = NULL;
+    fdb_status fs;
+    struct filemgr *file = rec->handle->file;
+
+    if (nblocks > rec->buf_nblocks || rec->blocks.buf == NULL) {
+        // a doc bigger than the read unit
+        malloc_align(addr, FDB_SECTOR_SIZE, nblocks * file->blocksize);
+        if (addr == NULL) { // LCOV_EXCL_START
+            return FDB_RESULT_ALLOC_FAIL;
+        } // LCOV_EXCL_STOP
+        free_align(rec->blocks.buf);
+        rec->blocks.buf = addr;
+        rec->buf_nblocks = nblocks;
+    }
+    fs = filemgr_read_blocks(file, bid, nblocks, rec->blocks.buf,
+                             rec->handle->dhandle->log_callback);
+    if (fs == FDB_RESULT_SUCCESS) {
+        rec->blocks.bid = bid;
+        rec->blocks.nblocks = nblocks;
+    } else {
+        rec->blocks.bid = BLK_NOT_FOUND;
+        rec->blocks.nblocks = 0;
+    }
+    return fs;
+}
+
+// start parsing the first 'n' docs located in the current blocks
+static void _fdb_recovery_start(struct _fdb_recovery *rec, size_t n)
+{
+    size_t i;
+
+    if (rec->nworkers == 0) {
+        _fdb_recovery_parse(rec, 0, n);
+        for (i=0; i<n; ++i){
+            rec->docs[i].parsed = true;
+        }
+        return;
+    }
+
+    mutex_lock(&rec->lock);
+    rec->ndocs = n;
+    rec->next_parse = rec->nparsed = 0;
+    thread_cond_broadcast(&rec->parse_cond);
+    mutex_unlock(&rec->lock);
+}
+
+// wait until the batch of docs beginning with the 'idx'-th doc is parsed,
+// or parse it if no worker has grabbed it yet
+static void _fdb_recovery_wait_batch(struct _fdb_recovery *rec, size_t idx)
+{
+    if (rec->nworkers == 0) {
+        return;
+    }
+
+    mutex_lock(&rec->lock);
+    while (!rec->docs[idx].parsed) {
+        if (rec->next_parse == idx) {
+            _fdb_recovery_parse_batch(rec);
+        } else {
+            thread_cond_wait(&rec->done_cond, &rec->lock);
+        }
+    }
+    mutex_unlock(&rec->lock);
+}
+
+// stop parsing the docs, and wait for the batches being parsed
+static void _fdb_recovery_stop(struct _fdb_recovery *rec)
+{
+    if (rec->nworkers == 0) {
+        return;
+    }
+
+    mutex_lock(&rec->lock);
+    rec->ndocs = rec->next_parse;
+    while (rec->nparsed < rec->ndocs) {
+        thread_cond_wait(&rec->done_cond, &rec->lock);
+    }
+    rec->ndocs = rec->next_parse = rec->nparsed = 0;
+    mutex_unlock(&rec->lock);
+}
+
 INLINE void _fdb_restore_wal(fdb_kvs_handle *handle,
                              fdb_restore_mode_t mode,
                              bid_t hdr_bid,
@@ -228,11 +542,25 @@ INLINE void _fdb_restore_wal(fdb_kvs_handle *handle,
     uint64_t last_wal_flush_hdr_bid = handle->last_wal_flush_hdr_bid;
     uint64_t hdr_off = hdr_bid * FDB_BLOCKSIZE;
     uint64_t offset = 0; //assume everything from first block needs restoration
+    uint64_t next_offset;
+    uint8_t marker;
+    bid_t bid, end_bid;
+    size_t i, n, nblocks;
+    bool in_docs, next_unit;
+    struct docio_length length;
+    struct docio_object doc;
+    struct _fdb_recovery_doc *d;
+    struct _fdb_recovery rec;
     err_log_callback *log_callback;
 
     if (!hdr_off) { // Nothing to do if we don't have a header block offset
         return;
     }
+    if (handle->wal_flusher) {
+        // the WAL may be empty because it was just flushed; replaying
+        // the docs would bring the flushed entries back into the WAL
+        return;
+    }
 
     filemgr_mutex_lock(file);
     if (last_wal_flush_hdr_bid != BLK_NOT_FOUND) {
@@ -254,125 +582,149 @@ INLINE void _fdb_restore_wal(fdb_kvs_handle *handle,
     log_callback = handle->dhandle->log_callback;
     handle->dhandle->log_callback = NULL;
 
-    for (; offset < hdr_off;
-        offset = ((offset / blocksize) + 1) * blocksize) { // next block's off
-        if (!docio_check_buffer(handle->dhandle, offset / blocksize)) {
-            continue;
-        } else {
-            do {
-                struct docio_object doc;
-                uint64_t _offset;
-                uint64_t doc_offset;
-                memset(&doc, 0, sizeof(doc));
-                _offset = docio_read_doc(handle->dhandle, offset, &doc);
-                if (doc.key || (doc.length.flag & DOCIO_TXN_COMMITTED)) {
-                    // check if the doc is transactional or not, and
-                    // also check if the doc contains system info
-                    if (!(doc.length.flag & DOCIO_TXN_DIRTY) &&
-                        !(doc.length.flag & DOCIO_SYSTEM)) {
-                        if (doc.length.flag & DOCIO_TXN_COMMITTED) {
-                            // commit mark .. read doc offset
-                            doc_offset = doc.doc_offset;
-                            // read the previously skipped doc
-                            docio_read_doc(handle->dhandle, doc_offset, &doc);
-                            if (doc.key == NULL) { // doc read error
-                                free(doc.meta);
-                                free(doc.body);
-                                offset = _offset;
-                                continue;
-                            }
-                        } else {
-                            doc_offset = offset;
-                        }
-
-                        // If say a snapshot is taken on a db handle after
-                        // rollback, then skip WAL items after rollback point
-                        if ((mode == FDB_RESTORE_KV_INS || !handle->kvs) &&
-                            doc.seqnum > handle->seqnum) {
-                            free(doc.key);
-                            free(doc.meta);
-                            free(doc.body);
-                            offset = _offset;
-                            continue;
-                        }
+    _fdb_recovery_init(&rec, handle, handle->config.recovery_num_threads);
+
+    // 'in_docs' is true if 'offset' is right after a valid doc, so that the
+    // next doc follows it; otherwise 'offset' is the beginning of a block,
+    // and docs start from there only if it is a document block.
+    in_docs = false;
+    while (offset < hdr_off) {
+        bid = offset / blocksize;
+        if (bid < rec.blocks.bid ||
+            bid >= rec.blocks.bid + rec.blocks.nblocks) {
+            nblocks = MIN(rec.buf_nblocks, hdr_bid - bid);
+            if (_fdb_recovery_read(&rec, bid, nblocks) !=
+                FDB_RESULT_SUCCESS) {
+                // skip the blocks that cannot be read
+                offset = (bid + nblocks) * blocksize;
+                in_docs = false;
+                continue;
+            }
+        }
+        end_bid = rec.blocks.bid + rec.blocks.nblocks;
 
-                        // restore document
-                        fdb_doc wal_doc;
-                        wal_doc.keylen = doc.length.keylen;
-                        wal_doc.bodylen = doc.length.bodylen;
-                        wal_doc.key = doc.key;
-                        wal_doc.seqnum = doc.seqnum;
-                        wal_doc.deleted = doc.length.flag & DOCIO_DELETED;
+        // 1. locate docs in the blocks
+        n = 0;
+        next_unit = false;
+        while (offset < hdr_off) {
+            bid = offset / blocksize;
+            if (!in_docs) {
+                if (bid >= end_bid) {
+                    break;
+                }
+                marker = *((uint8_t *)rec.blocks.buf +
+                           (bid - rec.blocks.bid + 1) * blocksize -
+                           BLK_MARKER_SIZE);
+                if (marker != BLK_MARKER_DOC) {
+                    offset = (bid + 1) * blocksize;
+                    continue;
+                }
+                in_docs = true;
+            } else if (offset + sizeof(struct docio_length) >= hdr_off) {
+                offset = (bid + 1) * blocksize;
+                in_docs = false;
+                continue;
+            }
 
-                        if (!handle->shandle) {
-                            wal_doc.metalen = doc.length.metalen;
-                            wal_doc.meta = doc.meta;
-                            wal_doc.size_ondisk = _fdb_get_docsize(doc.length);
-
-                            if (handle->kvs) {
-                                // check seqnum before insert
-                                fdb_kvs_id_t kv_id;
-                                fdb_seqnum_t kv_seqnum;
-                                buf2kvid(handle->config.chunksize,
-                                         wal_doc.key, &kv_id);
-
-                                if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
-                                    kv_seqnum = fdb_kvs_get_seqnum(handle->file, kv_id);
-                                } else {
-                                    kv_seqnum = SEQNUM_NOT_USED;
-                                }
-                                if (doc.seqnum <= kv_seqnum &&
-                                        ((mode == FDB_RESTORE_KV_INS &&
-                                            kv_id == kv_id_req) ||
-                                         (mode == FDB_RESTORE_NORMAL)) ) {
-                                    // if mode is NORMAL, restore all items
-                                    // if mode is KV_INS, restore items matching ID
-                                    wal_insert(&file->global_txn, file,
-                                               &wal_doc, doc_offset, 0);
-                                }
-                            } else {
-                                wal_insert(&file->global_txn, file,
-                                           &wal_doc, doc_offset, 0);
-                            }
-                            if (doc.key) free(doc.key);
-                        } else {
-                            // snapshot
-                            if (handle->kvs) {
-                                fdb_kvs_id_t kv_id;
-                                buf2kvid(handle->config.chunksize,
-                                         wal_doc.key, &kv_id);
-                                if (kv_id == handle->kvs->id) {
-                                    // snapshot: insert ID matched documents only
-                                    snap_insert(handle->shandle,
-                                                &wal_doc, doc_offset);
-                                } else {
-                                    free(doc.key);
-                                }
-                            } else {
-                                snap_insert(handle->shandle, &wal_doc, doc_offset);
-                            }
-                        }
-                        free(doc.meta);
-                        free(doc.body);
-                        offset = _offset;
-                    } else {
-                        // skip transactional document or system document
-                        free(doc.key);
-                        free(doc.meta);
-                        free(doc.body);
-                        offset = _offset;
-                        // do not break.. read next doc
+            next_offset = docio_scan_doc_length(handle->dhandle, &rec.blocks,
+                                                offset, &length);
+            if (next_offset == 0 ||
+                (next_offset > offset &&
+                 (next_offset - 1) / blocksize >= end_bid)) {
+                // the doc is not entirely in the blocks
+                nblocks = ((next_offset)?((next_offset - 1) / blocksize):
+                                         (end_bid)) + 1 - bid;
+                if (bid + nblocks > hdr_bid) {
+                    // .. and crosses the header, so it is not valid
+                    offset = (bid + 1) * blocksize;
+                    in_docs = false;
+                    continue;
+                }
+                if (n == 0 && bid == rec.blocks.bid) {
+                    // bigger than the read unit
+                    if (_fdb_recovery_read(&rec, bid, nblocks) !=
+                        FDB_RESULT_SUCCESS) {
+                        offset = (bid + nblocks) * blocksize;
+                        in_docs = false;
                     }
                 } else {
-                    free(doc.key);
-                    free(doc.meta);
-                    free(doc.body);
-                    offset = _offset;
-                    break;
+                    // read the next blocks from the block of the doc
+                    next_unit = true;
+                }
+                break;
+            }
+            if (next_offset == offset) {
+                // not a valid doc .. skip the rest of the block
+                offset = (bid + 1) * blocksize;
+                in_docs = false;
+                continue;
+            }
+
+            if (n == rec.docs_max) {
+                rec.docs_max *= 2;
+                rec.docs = (struct _fdb_recovery_doc *)
+                           realloc(rec.docs, sizeof(struct _fdb_recovery_doc) *
+                                             rec.docs_max);
+            }
+            rec.docs[n].offset = offset;
+            rec.docs[n].next_offset = next_offset;
+            rec.docs[n].parsed = false;
+            n++;
+            offset = next_offset;
+        }
+
+        // 2. parse and verify the docs
+        _fdb_recovery_start(&rec, n);
+
+        // 3. insert the docs into the WAL in order
+        for (i=0; i<n; ++i){
+            if (i % FDB_RECOVERY_PARSE_BATCH == 0) {
+                _fdb_recovery_wait_batch(&rec, i);
+            }
+            d = &rec.docs[i];
+            if (d->next_offset == d->offset) {
+                // not a valid doc .. skip the rest of the block,
+                // and locate the following docs again from the next block
+                offset = (d->offset / blocksize + 1) * blocksize;
+                in_docs = false;
+                break;
+            }
+            // check if the doc is transactional or not, and
+            // also check if the doc contains system info
+            if ((d->doc.length.flag & DOCIO_TXN_DIRTY) ||
+                (d->doc.length.flag & DOCIO_SYSTEM)) {
+                // skip transactional document or system document
+            } else if (d->doc.length.flag & DOCIO_TXN_COMMITTED) {
+                // commit mark .. read the previously skipped doc
+                memset(&doc, 0, sizeof(doc));
+                docio_read_doc(handle->dhandle, d->doc.doc_offset, &doc);
+                if (doc.key) {
+                    uint8_t key_alloc = 1;
+                    _fdb_restore_wal_doc(handle, mode, kv_id_req, &doc,
+                                         d->doc.doc_offset, &key_alloc);
+                    free_docio_object(&doc, key_alloc, 1, 1);
+                } else {
+                    // doc read error
+                    free_docio_object(&doc, 0, 1, 1);
                 }
-            } while (offset + sizeof(struct docio_length) < hdr_off);
+            } else {
+                _fdb_restore_wal_doc(handle, mode, kv_id_req, &d->doc,
+                                     d->offset, &d->key_alloc);
+            }
+        }
+        _fdb_recovery_stop(&rec);
+        for (i=0; i<n; ++i){
+            d = &rec.docs[i];
+            if (d->parsed && d->next_offset != d->offset) {
+                free_docio_object(&d->doc, d->key_alloc, d->meta_alloc, 0);
+            }
+        }
+        if (next_unit) {
+            rec.blocks.nblocks = 0;
         }
     }
+    _fdb_recovery_free(&rec);
+
     // wal commit
     if (!handle->shandle) {
         wal_commit(&file->global_txn, file, NULL);
@@ -524,7 +876,10 @@ INLINE fdb_status _fdb_recover_compaction(fdb_kvs_handle *handle,
                         free(doc.body);
                         offset = _offset;
                     } else {
-                        if (doc.length.flag & DOCIO_SYSTEM) {
+                        if ((doc.length.flag & DOCIO_SYSTEM) &&
+                            doc.length.keylen == sizeof("KV_header") &&
+                            !memcmp(doc.key, "KV_header",
+                                    sizeof("KV_header"))) {
                             // KV instances header
                             // free existing KV header of handle->file
                             if (handle->file->kv_header) {
@@ -605,11 +960,16 @@ fdb_status fdb_init(fdb_config *config)
         // initialize file manager and block cache
         f_config.blocksize = _config.blocksize;
         f_config.ncacheblock = _config.buffercache_size / _config.blocksize;
+        f_config.index_cache_ratio = _config.buffercache_index_ratio;
+        f_config.nodecache_ratio = _config.buffercache_node_ratio;
+        f_config.wal_mem_budget = _config.wal_memory_budget;
         filemgr_init(&f_config);
+        filemgr_ops_init(_config.io_backend, _config.io_queue_depth);
 
         // initialize compaction daemon
         c_config.sleep_duration = _config.compactor_sleep_duration;
         compactor_init(&c_config);
+        wal_flusher_init();
 
         fdb_initialized = 1;
     }
@@ -975,6 +1335,9 @@ fdb_status fdb_rollback(fdb_kvs_handle **handle_ptr, fdb_seqnum_t seqnum)
         return FDB_RESULT_ALLOC_FAIL;
     } // LCOV_EXCL_STOP
 
+    // the WAL flusher thread should not flush WAL entries during rollback
+    wal_flusher_wait(handle_in->file);
+
     filemgr_mutex_lock(handle_in->file);
     filemgr_set_rollback(handle_in->file, 1); // disallow writes operations
     // All transactions should be closed before rollback
@@ -1046,6 +1409,8 @@ static void _fdb_init_file_config(const fdb_config *config,
                                   struct filemgr_config *fconfig) {
     fconfig->blocksize = config->blocksize;
     fconfig->ncacheblock = config->buffercache_size / config->blocksize;
+    fconfig->index_cache_ratio = config->buffercache_index_ratio;
+    fconfig->nodecache_ratio = config->buffercache_node_ratio;
     fconfig->chunksize = config->chunksize;
 
     fconfig->options = 0x0;
@@ -1058,6 +1423,9 @@ static void _fdb_init_file_config(const fdb_config *config,
     if (!(config->durability_opt & FDB_DRB_ASYNC)) {
         fconfig->options |= FILEMGR_SYNC;
     }
+    if (config->group_commit) {
+        fconfig->options |= FILEMGR_GROUP_COMMIT;
+    }
 
     fconfig->flag = 0x0;
     if (config->durability_opt & FDB_DRB_ODIRECT) {
@@ -1067,6 +1435,19 @@ static void _fdb_init_file_config(const fdb_config *config,
     fconfig->prefetch_duration = config->prefetch_duration;
 }
 
+// create the key filter of a file whose main index is empty, so that
+// all keys are added to the filter before they are indexed
+static void _fdb_bloom_create(fdb_kvs_handle *handle,
+                              struct filemgr *file,
+                              uint64_t capacity)
+{
+    if (handle->config.bloom_bits_per_key == 0 || file->bloom) {
+        return;
+    }
+    file->bloom = bloomfilter_create(handle->config.bloom_bits_per_key,
+                                     capacity);
+}
+
 fdb_status _fdb_open(fdb_kvs_handle *handle,
                      const char *filename,
                      fdb_filename_mode_t filename_mode,
@@ -1111,6 +1492,10 @@ fdb_status _fdb_open(fdb_kvs_handle *handle,
     }
 
     _fdb_init_file_config(config, &fconfig);
+    if (handle->wal_flusher) {
+        // the WAL flusher thread never reopens a file closed by its users
+        fconfig.options |= FILEMGR_NO_REOPEN;
+    }
 
     if (filename_mode == FDB_VFILENAME) {
         compactor_get_actual_filename(filename, actual_filename,
@@ -1381,6 +1766,12 @@ fdb_status _fdb_open(fdb_kvs_handle *handle,
         stat.ndocs = ndocs;
         stat.datasize = datasize;
         _kvs_stat_set(handle->file, 0, stat);
+
+        if (!handle->config.multi_kv_instances &&
+            trie_root_bid == BLK_NOT_FOUND) {
+            // (the filter is not persisted without KV header)
+            _fdb_bloom_create(handle, handle->file, 0);
+        }
     }
 
     if (handle->config.multi_kv_instances) {
@@ -1389,12 +1780,20 @@ fdb_status _fdb_open(fdb_kvs_handle *handle,
             // there is no KV header .. create & initialize
             filemgr_mutex_lock(handle->file);
             fdb_kvs_header_create(handle->file);
+            if (trie_root_bid == BLK_NOT_FOUND) {
+                _fdb_bloom_create(handle, handle->file, 0);
+            }
             kv_info_offset = fdb_kvs_header_append(handle->file, handle->dhandle);
             filemgr_mutex_unlock(handle->file);
         } else if (handle->file->kv_header == NULL) {
             // KV header already exists but not loaded .. read & import
             fdb_kvs_header_create(handle->file);
             fdb_kvs_header_read(handle->file, handle->dhandle, kv_info_offset);
+            if (handle->config.bloom_bits_per_key) {
+                // load the key filter written along with the KV header
+                fdb_kvs_bloom_read(handle->file, handle->dhandle,
+                                   handle->file->kv_header->bloom_offset);
+            }
         }
 
         // validation check for key order of all KV stores
@@ -1678,101 +2077,140 @@ INLINE size_t _fdb_get_docsize(struct docio_length len)
     return ret;
 }
 
-INLINE uint64_t _fdb_wal_get_old_offset(void *voidhandle,
-                                        struct wal_item *item)
-{
-    fdb_kvs_handle *handle = (fdb_kvs_handle *)voidhandle;
-    uint64_t old_offset = 0;
-
-    hbtrie_find_offset(handle->trie,
-                       item->header->key,
-                       item->header->keylen,
-                       (void*)&old_offset);
-    btreeblk_end(handle->bhandle);
-    old_offset = _endian_decode(old_offset);
-
-    return old_offset;
-}
-
 INLINE fdb_status _fdb_wal_snapshot_func(void *handle, fdb_doc *doc,
                                          uint64_t offset) {
 
     return snap_insert((struct snap_handle *)handle, doc, offset);
 }
 
-INLINE fdb_status _fdb_wal_flush_func(void *voidhandle, struct wal_item *item)
+struct _fdb_seq_entry {
+    fdb_seqnum_t seqnum;
+    uint64_t offset;
+};
+
+static int _fdb_seq_entry_cmp(const void *a, const void *b)
+{
+    const struct _fdb_seq_entry *aa = (const struct _fdb_seq_entry *)a;
+    const struct _fdb_seq_entry *bb = (const struct _fdb_seq_entry *)b;
+    if (aa->seqnum < bb->seqnum) {
+        return -1;
+    } else if (aa->seqnum > bb->seqnum) {
+        return 1;
+    }
+    return 0;
+}
+
+// flush a batch of inserted (or logically removed) items in the same KV store
+// into the HB+trie and the sequence index
+static fdb_status _fdb_wal_flush_items(fdb_kvs_handle *handle,
+                                       fdb_kvs_id_t kv_id,
+                                       struct wal_item **items,
+                                       size_t nitems)
 {
-    hbtrie_result hr;
-    fdb_kvs_handle *handle = (fdb_kvs_handle *)voidhandle;
-    fdb_seqnum_t _seqnum;
-    fdb_kvs_id_t kv_id;
-    fdb_status fs = FDB_RESULT_SUCCESS;
-    uint8_t *var_key = alca(uint8_t, handle->config.chunksize);
-    uint64_t old_offset, _offset;
-    int delta, r;
     struct filemgr *file = handle->dhandle->file;
     struct kvs_stat stat;
+    struct wal_item *item;
+    struct _fdb_seq_entry *seqs;
+    fdb_status fs = FDB_RESULT_SUCCESS;
+    hbtrie_result *results;
+    void **keys, **values, **old_values;
+    int *keylens;
+    uint64_t *_offsets, *old_offsets;
+    fdb_seqnum_t *_seqnums;
+    size_t i;
+    int delta, r;
 
-    memset(var_key, 0, handle->config.chunksize);
-    if (handle->kvs) {
-        buf2kvid(handle->config.chunksize, item->header->key, &kv_id);
-    } else {
-        kv_id = 0;
+    r = _kvs_stat_get(file, kv_id, &stat);
+    if (r != 0) {
+        // KV store corresponding to kv_id is already removed
+        // skip these items
+        return FDB_RESULT_SUCCESS;
+    }
+    handle->bhandle->nlivenodes = stat.nlivenodes;
+
+    keys = (void **)malloc(sizeof(void *) * nitems * 3);
+    values = keys + nitems;
+    old_values = values + nitems;
+    keylens = (int *)malloc(sizeof(int) * nitems);
+    // (the latter half is for the sequence index in multi KV instance mode)
+    results = (hbtrie_result *)malloc(sizeof(hbtrie_result) * nitems * 2);
+    _offsets = (uint64_t *)malloc(sizeof(uint64_t) * nitems * 3);
+    old_offsets = _offsets + nitems;
+    _seqnums = old_offsets + nitems;
+    seqs = (struct _fdb_seq_entry *)
+           malloc(sizeof(struct _fdb_seq_entry) * nitems);
+
+    for (i=0;i<nitems;++i){
+        item = items[i];
+        keys[i] = item->header->key;
+        keylens[i] = item->header->keylen;
+        if (file->bloom) {
+            bloomfilter_add(file->bloom, keys[i], keylens[i]);
+        }
+        _offsets[i] = _endian_encode(item->offset);
+        values[i] = &_offsets[i];
+        old_offsets[i] = 0;
+        old_values[i] = &old_offsets[i];
+        seqs[i].seqnum = item->seqnum;
+        seqs[i].offset = item->offset;
+    }
+
+    // items are sorted by key, so that each leaf node of the HB+trie is
+    // modified only once for all the items that belong to it
+    hbtrie_insert_batch(handle->trie, nitems, keys, keylens, values,
+                        old_values, results);
+    fs = btreeblk_end(handle->bhandle);
+    if (fs != FDB_RESULT_SUCCESS) {
+        goto out;
     }
 
-    if (item->action == WAL_ACT_INSERT ||
-        item->action == WAL_ACT_LOGICAL_REMOVE) {
-        _offset = _endian_encode(item->offset);
-
-        r = _kvs_stat_get(file, kv_id, &stat);
-        if (r != 0) {
-            // KV store corresponding to kv_id is already removed
-            // skip this item
-            return FDB_RESULT_SUCCESS;
-        }
-        handle->bhandle->nlivenodes = stat.nlivenodes;
-
-        hr = hbtrie_insert(handle->trie,
-                           item->header->key,
-                           item->header->keylen,
-                           (void *)&_offset,
-                           (void *)&old_offset);
-
-        fs = btreeblk_end(handle->bhandle);
-        if (fs != FDB_RESULT_SUCCESS) {
-            return fs;
+    if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
+        // sort by sequence number, which usually makes all the items
+        // go into the rightmost leaf node of the sequence index
+        qsort(seqs, nitems, sizeof(struct _fdb_seq_entry),
+              _fdb_seq_entry_cmp);
+        for (i=0;i<nitems;++i){
+            _offsets[i] = _endian_encode(seqs[i].offset);
+            values[i] = &_offsets[i];
         }
-        old_offset = _endian_decode(old_offset);
+        if (handle->kvs) {
+            // multi KV instance mode .. HB+trie
+            int size_id, size_seq;
+            uint8_t *kvid_seqnum;
+            fdb_seqnum_t _seqnum;
 
-        if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
-            _seqnum = _endian_encode(item->seqnum);
-            if (handle->kvs) {
-                // multi KV instance mode .. HB+trie
-                int size_id, size_seq;
-                uint8_t *kvid_seqnum;
-                uint64_t old_offset_local;
-
-                size_id = sizeof(fdb_kvs_id_t);
-                size_seq = sizeof(fdb_seqnum_t);
-                kvid_seqnum = alca(uint8_t, size_id + size_seq);
-                kvid2buf(size_id, kv_id, kvid_seqnum);
-                memcpy(kvid_seqnum + size_id, &_seqnum, size_seq);
-                hbtrie_insert(handle->seqtrie, kvid_seqnum, size_id + size_seq,
-                              (void *)&_offset, (void *)&old_offset_local);
-            } else {
-                btree_insert(handle->seqtree, (void *)&_seqnum,
-                             (void *)&_offset);
+            size_id = sizeof(fdb_kvs_id_t);
+            size_seq = sizeof(fdb_seqnum_t);
+            kvid_seqnum = (uint8_t *)malloc((size_id + size_seq) * nitems);
+            for (i=0;i<nitems;++i){
+                keys[i] = kvid_seqnum + (size_id + size_seq) * i;
+                keylens[i] = size_id + size_seq;
+                kvid2buf(size_id, kv_id, keys[i]);
+                _seqnum = _endian_encode(seqs[i].seqnum);
+                memcpy((uint8_t *)keys[i] + size_id, &_seqnum, size_seq);
             }
-            fs = btreeblk_end(handle->bhandle);
-            if (fs != FDB_RESULT_SUCCESS) {
-                return fs;
+            hbtrie_insert_batch(handle->seqtrie, nitems, keys, keylens,
+                                values, NULL, results + nitems);
+            free(kvid_seqnum);
+        } else {
+            for (i=0;i<nitems;++i){
+                _seqnums[i] = _endian_encode(seqs[i].seqnum);
+                keys[i] = &_seqnums[i];
             }
+            btree_insert_batch(handle->seqtree, keys, values, nitems);
+        }
+        fs = btreeblk_end(handle->bhandle);
+        if (fs != FDB_RESULT_SUCCESS) {
+            goto out;
         }
+    }
 
-        delta = (int)handle->bhandle->nlivenodes - (int)stat.nlivenodes;
-        _kvs_stat_update_attr(file, kv_id, KVS_STAT_NLIVENODES, delta);
+    delta = (int)handle->bhandle->nlivenodes - (int)stat.nlivenodes;
+    _kvs_stat_update_attr(file, kv_id, KVS_STAT_NLIVENODES, delta);
 
-        if (hr == HBTRIE_RESULT_SUCCESS) {
+    for (i=0;i<nitems;++i){
+        item = items[i];
+        if (results[i] == HBTRIE_RESULT_SUCCESS) {
             if (item->action == WAL_ACT_INSERT) {
                 _kvs_stat_update_attr(file, kv_id, KVS_STAT_NDOCS, 1);
             }
@@ -1780,9 +2218,8 @@ INLINE fdb_status _fdb_wal_flush_func(void *voidhandle, struct wal_item *item)
                                   item->doc_size);
         } else { // update or logical delete
             struct docio_length len;
-            // This block is already cached when we call HBTRIE_INSERT.
-            // No additional block access.
-            len = docio_read_doc_length(handle->dhandle, old_offset);
+            len = docio_read_doc_length(handle->dhandle,
+                                        _endian_decode(old_offsets[i]));
 
             if (!(len.flag & DOCIO_DELETED)) {
                 if (item->action == WAL_ACT_LOGICAL_REMOVE) {
@@ -1797,34 +2234,92 @@ INLINE fdb_status _fdb_wal_flush_func(void *voidhandle, struct wal_item *item)
             delta = (int)item->doc_size - (int)_fdb_get_docsize(len);
             _kvs_stat_update_attr(file, kv_id, KVS_STAT_DATASIZE, delta);
         }
-    } else {
-        // Immediate remove
-        // LCOV_EXCL_START
-        hr = hbtrie_remove(handle->trie, item->header->key,
-                           item->header->keylen);
-        fs = btreeblk_end(handle->bhandle);
-        if (fs != FDB_RESULT_SUCCESS) {
-            return fs;
-        }
+    }
 
-        if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
-            _seqnum = _endian_encode(item->seqnum);
-            btree_remove(handle->seqtree, (void*)&_seqnum);
-            fs = btreeblk_end(handle->bhandle);
-            if (fs != FDB_RESULT_SUCCESS) {
-                return fs;
-            }
-        }
+out:
+    free(keys);
+    free(keylens);
+    free(results);
+    free(_offsets);
+    free(seqs);
+    return fs;
+}
 
-        if (hr == HBTRIE_RESULT_SUCCESS) {
-            _kvs_stat_update_attr(file, kv_id, KVS_STAT_NDOCS, -1);
-            delta = -(int)item->doc_size;
-            _kvs_stat_update_attr(file, kv_id, KVS_STAT_DATASIZE, delta);
+// immediate remove
+// LCOV_EXCL_START
+static fdb_status _fdb_wal_flush_remove(fdb_kvs_handle *handle,
+                                        fdb_kvs_id_t kv_id,
+                                        struct wal_item *item)
+{
+    hbtrie_result hr;
+    fdb_seqnum_t _seqnum;
+    fdb_status fs;
+    int delta;
+    struct filemgr *file = handle->dhandle->file;
+
+    hr = hbtrie_remove(handle->trie, item->header->key,
+                       item->header->keylen);
+    fs = btreeblk_end(handle->bhandle);
+    if (fs != FDB_RESULT_SUCCESS) {
+        return fs;
+    }
+
+    if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
+        _seqnum = _endian_encode(item->seqnum);
+        btree_remove(handle->seqtree, (void*)&_seqnum);
+        fs = btreeblk_end(handle->bhandle);
+        if (fs != FDB_RESULT_SUCCESS) {
+            return fs;
         }
-        // LCOV_EXCL_STOP
+    }
+
+    if (hr == HBTRIE_RESULT_SUCCESS) {
+        _kvs_stat_update_attr(file, kv_id, KVS_STAT_NDOCS, -1);
+        delta = -(int)item->doc_size;
+        _kvs_stat_update_attr(file, kv_id, KVS_STAT_DATASIZE, delta);
     }
     return FDB_RESULT_SUCCESS;
 }
+// LCOV_EXCL_STOP
+
+INLINE fdb_kvs_id_t _fdb_wal_item_kvid(fdb_kvs_handle *handle,
+                                       struct wal_item *item)
+{
+    fdb_kvs_id_t kv_id = 0;
+    if (handle->kvs) {
+        buf2kvid(handle->config.chunksize, item->header->key, &kv_id);
+    }
+    return kv_id;
+}
+
+static fdb_status _fdb_wal_flush_func(void *voidhandle,
+                                      struct wal_item **items,
+                                      size_t nitems)
+{
+    fdb_kvs_handle *handle = (fdb_kvs_handle *)voidhandle;
+    fdb_kvs_id_t kv_id;
+    fdb_status fs = FDB_RESULT_SUCCESS;
+    size_t i, j;
+
+    // split the batch into runs of items in the same KV store
+    // (immediate removes are flushed one by one)
+    for (i=0; i<nitems && fs == FDB_RESULT_SUCCESS; i=j) {
+        kv_id = _fdb_wal_item_kvid(handle, items[i]);
+        if (items[i]->action == WAL_ACT_REMOVE) {
+            fs = _fdb_wal_flush_remove(handle, kv_id, items[i]);
+            j = i+1;
+            continue;
+        }
+        for (j=i+1; j<nitems; ++j) {
+            if (items[j]->action == WAL_ACT_REMOVE ||
+                _fdb_wal_item_kvid(handle, items[j]) != kv_id) {
+                break;
+            }
+        }
+        fs = _fdb_wal_flush_items(handle, kv_id, items + i, j - i);
+    }
+    return fs;
+}
 
 void fdb_sync_db_header(fdb_kvs_handle *handle)
 {
@@ -2016,6 +2511,25 @@ void fdb_link_new_file(fdb_kvs_handle *handle)
     }
 }
 
+// return false if the key is definitely not in the main index
+// (the filter compares keys byte by byte, so it is not used for
+//  custom key orders where different bytes can be equal keys)
+INLINE bool _fdb_bloom_may_contain(fdb_kvs_handle *handle,
+                                   void *key, size_t keylen)
+{
+    if (handle->file->bloom == NULL || handle->kvs_config.custom_cmp) {
+        return true;
+    }
+    return bloomfilter_may_contain(handle->file->bloom, key, keylen);
+}
+
+INLINE void _fdb_bloom_false_positive(fdb_kvs_handle *handle)
+{
+    if (handle->file->bloom && !handle->kvs_config.custom_cmp) {
+        bloomfilter_false_positive(handle->file->bloom);
+    }
+}
+
 static bool _fdb_sync_dirty_root(fdb_kvs_handle *handle)
 {
     bool locked = false;
@@ -2105,6 +2619,12 @@ fdb_status fdb_get(fdb_kvs_handle *handle, fdb_doc *doc)
         dhandle = handle->dhandle;
     }
 
+    if (wr == FDB_RESULT_KEY_NOT_FOUND &&
+        !_fdb_bloom_may_contain(handle, doc_kv.key, doc_kv.keylen)) {
+        // no need to walk the main index
+        return FDB_RESULT_KEY_NOT_FOUND;
+    }
+
     if (wr == FDB_RESULT_KEY_NOT_FOUND) {
         bool locked = _fdb_sync_dirty_root(handle);
 
@@ -2117,6 +2637,9 @@ fdb_status fdb_get(fdb_kvs_handle *handle, fdb_doc *doc)
         }
         btreeblk_end(handle->bhandle);
         offset = _endian_decode(offset);
+        if (hr == HBTRIE_RESULT_FAIL) {
+            _fdb_bloom_false_positive(handle);
+        }
 
         if (locked) {
             // grab lock for writer if there are dirty updates
@@ -2228,6 +2751,12 @@ fdb_status fdb_get_metaonly(fdb_kvs_handle *handle, fdb_doc *doc)
         dhandle = handle->dhandle;
     }
 
+    if (wr == FDB_RESULT_KEY_NOT_FOUND &&
+        !_fdb_bloom_may_contain(handle, doc_kv.key, doc_kv.keylen)) {
+        // no need to walk the main index
+        return FDB_RESULT_KEY_NOT_FOUND;
+    }
+
     if (wr == FDB_RESULT_KEY_NOT_FOUND) {
         bool locked = _fdb_sync_dirty_root(handle);
 
@@ -2240,6 +2769,9 @@ fdb_status fdb_get_metaonly(fdb_kvs_handle *handle, fdb_doc *doc)
         }
         btreeblk_end(handle->bhandle);
         offset = _endian_decode(offset);
+        if (hr == HBTRIE_RESULT_FAIL) {
+            _fdb_bloom_false_positive(handle);
+        }
 
         if (locked) {
             filemgr_mutex_unlock(handle->file);
@@ -2285,6 +2817,263 @@ fdb_status fdb_get_metaonly(fdb_kvs_handle *handle, fdb_doc *doc)
     return FDB_RESULT_KEY_NOT_FOUND;
 }
 
+struct _fdb_multi_entry {
+    size_t idx;
+    // key in the main index (prefixed by KV ID in multi KV instance mode)
+    void *key;
+    size_t keylen;
+    uint64_t offset;
+    // doc handle to read the document (NULL if not found or already read)
+    struct docio_handle *dhandle;
+    // found in WAL (or snapshot)
+    bool in_wal;
+};
+
+static int _fdb_multi_key_cmp(const void *a, const void *b)
+{
+    const struct _fdb_multi_entry *aa = (const struct _fdb_multi_entry *)a;
+    const struct _fdb_multi_entry *bb = (const struct _fdb_multi_entry *)b;
+    int r = memcmp(aa->key, bb->key, MIN(aa->keylen, bb->keylen));
+    if (r == 0 && aa->keylen != bb->keylen) {
+        return (aa->keylen < bb->keylen)?(-1):(1);
+    }
+    return r;
+}
+
+static int _fdb_multi_offset_cmp(const void *a, const void *b)
+{
+    const struct _fdb_multi_entry *aa = (const struct _fdb_multi_entry *)a;
+    const struct _fdb_multi_entry *bb = (const struct _fdb_multi_entry *)b;
+    if (aa->dhandle != bb->dhandle) {
+        return (aa->dhandle < bb->dhandle)?(-1):(1);
+    }
+    if (aa->offset != bb->offset) {
+        return (aa->offset < bb->offset)?(-1):(1);
+    }
+    return 0;
+}
+
+// read the document of the entry, and return its status
+static fdb_status _fdb_multi_read_doc(struct _fdb_multi_entry *entry,
+                                      fdb_doc *doc)
+{
+    uint64_t _offset;
+    struct docio_object _doc;
+
+    _doc.key = entry->key;
+    _doc.length.keylen = entry->keylen;
+    _doc.meta = doc->meta;
+    _doc.body = doc->body;
+
+    _offset = docio_read_doc(entry->dhandle, entry->offset, &_doc);
+    if (_offset == entry->offset) {
+        return FDB_RESULT_KEY_NOT_FOUND;
+    }
+
+    doc->seqnum = _doc.seqnum;
+    doc->metalen = _doc.length.metalen;
+    doc->bodylen = _doc.length.bodylen;
+    doc->meta = _doc.meta;
+    doc->body = _doc.body;
+    doc->deleted = _doc.length.flag & DOCIO_DELETED;
+    doc->size_ondisk = _fdb_get_docsize(_doc.length);
+    doc->offset = entry->offset;
+
+    if (_doc.length.keylen != entry->keylen ||
+        _doc.length.flag & DOCIO_DELETED) {
+        return FDB_RESULT_KEY_NOT_FOUND;
+    }
+    return FDB_RESULT_SUCCESS;
+}
+
+// read the documents of the entries (sorted by their offsets)
+static void _fdb_multi_read_docs(fdb_kvs_handle *handle,
+                                 struct _fdb_multi_entry *entries, size_t n,
+                                 fdb_doc **docs, fdb_status *statuses)
+{
+    size_t i, j, nbids;
+    bid_t *bids;
+    struct docio_handle *dhandle;
+
+    // read the first blocks of the documents in each file at once,
+    // so that documents in adjacent blocks are read by a single request
+    bids = (bid_t *)malloc(sizeof(bid_t) * n);
+    for (i=0; i<n; i=j) {
+        dhandle = entries[i].dhandle;
+        nbids = 0;
+        for (j=i; j<n && entries[j].dhandle == dhandle; ++j) {
+            bids[nbids++] = entries[j].offset / dhandle->file->blocksize;
+        }
+        if (nbids > 1) {
+            filemgr_prefetch_blocks(dhandle->file, bids, nbids,
+                                    &handle->log_callback);
+        }
+    }
+    free(bids);
+
+    for (i=0; i<n; ++i) {
+        statuses[entries[i].idx] = _fdb_multi_read_doc(&entries[i],
+                                                       docs[entries[i].idx]);
+    }
+}
+
+// search multiple documents using keys
+LIBFDB_API
+fdb_status fdb_get_multi(fdb_kvs_handle *handle, fdb_doc **docs,
+                         size_t num_docs, fdb_status *statuses)
+{
+    size_t i, n = 0, nfound = 0, size_chunk = 0, keybuf_size = 0;
+    uint8_t *keybuf = NULL, *p;
+    bool locked;
+    fdb_doc *doc, doc_kv;
+    fdb_status wr;
+    hbtrie_result hr;
+    fdb_txn *txn = NULL;
+    struct filemgr *wal_file = NULL;
+    struct _fdb_multi_entry *entries, *entry;
+
+    if (handle == NULL || docs == NULL || statuses == NULL) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+    if (num_docs == 0) {
+        return FDB_RESULT_SUCCESS;
+    }
+
+    entries = (struct _fdb_multi_entry *)
+              malloc(sizeof(struct _fdb_multi_entry) * num_docs);
+
+    for (i=0; i<num_docs; ++i) {
+        doc = docs[i];
+        if (doc == NULL || doc->key == NULL || doc->keylen == 0 ||
+            doc->keylen > FDB_MAX_KEYLEN ||
+            (handle->kvs_config.custom_cmp &&
+                doc->keylen > handle->config.blocksize - HBTRIE_HEADROOM)) {
+            statuses[i] = FDB_RESULT_INVALID_ARGS;
+            continue;
+        }
+        statuses[i] = FDB_RESULT_KEY_NOT_FOUND;
+
+        entry = &entries[n++];
+        entry->idx = i;
+        entry->key = doc->key;
+        entry->keylen = doc->keylen;
+        keybuf_size += doc->keylen;
+    }
+
+    if (handle->kvs && n > 0) {
+        // multi KV instance mode
+        size_chunk = handle->config.chunksize;
+        keybuf = (uint8_t *)malloc(keybuf_size + size_chunk * n);
+        p = keybuf;
+        for (i=0; i<n; ++i) {
+            entry = &entries[i];
+            kvid2buf(size_chunk, handle->kvs->id, p);
+            memcpy(p + size_chunk, entry->key, entry->keylen);
+            entry->key = p;
+            entry->keylen += size_chunk;
+            p += entry->keylen;
+        }
+    }
+
+    // visit keys in order, so that consecutive lookups share the same
+    // index nodes
+    qsort(entries, n, sizeof(struct _fdb_multi_entry), _fdb_multi_key_cmp);
+
+    if (!handle->shandle) {
+        // the file and header are synchronized once for the whole batch
+        fdb_check_file_reopen(handle, NULL);
+        fdb_link_new_file(handle);
+        fdb_sync_db_header(handle);
+
+        if (handle->new_file == NULL) {
+            wal_file = handle->file;
+        }else{
+            wal_file = handle->new_file;
+        }
+
+        txn = handle->fhandle->root->txn;
+        if (!txn) {
+            txn = &wal_file->global_txn;
+        }
+    }
+
+    // 1. WAL (or snapshot)
+    for (i=0; i<n; ++i) {
+        entry = &entries[i];
+        memset(&doc_kv, 0, sizeof(doc_kv));
+        doc_kv.key = entry->key;
+        doc_kv.keylen = entry->keylen;
+        doc_kv.seqnum = SEQNUM_NOT_USED;
+        entry->dhandle = NULL;
+        entry->in_wal = false;
+
+        if (!handle->shandle) {
+            wr = wal_find(txn, wal_file, &doc_kv, &entry->offset);
+        } else {
+            wr = snap_find(handle->shandle, &doc_kv, &entry->offset);
+        }
+        if (wr != FDB_RESULT_SUCCESS) {
+            continue;
+        }
+        entry->in_wal = true;
+        if (doc_kv.deleted) {
+            // removed in WAL
+            continue;
+        }
+        if (wal_file == handle->new_file && !handle->shandle) {
+            entry->dhandle = handle->new_dhandle;
+        } else {
+            entry->dhandle = handle->dhandle;
+        }
+    }
+
+    // 2. main index, walked in key order while holding the dirty root once
+    locked = _fdb_sync_dirty_root(handle);
+    for (i=0; i<n; ++i) {
+        entry = &entries[i];
+        if (entry->in_wal) {
+            continue;
+        }
+        if (!_fdb_bloom_may_contain(handle, entry->key, entry->keylen)) {
+            continue;
+        }
+        hr = hbtrie_find(handle->trie, entry->key, entry->keylen,
+                         (void *)&entry->offset);
+        btreeblk_end(handle->bhandle);
+        if (hr == HBTRIE_RESULT_FAIL) {
+            _fdb_bloom_false_positive(handle);
+            continue;
+        }
+        entry->offset = _endian_decode(entry->offset);
+        entry->dhandle = handle->dhandle;
+        if (entry->offset / handle->file->blocksize ==
+            handle->dhandle->lastbid) {
+            // the index walk has just read the key of the document,
+            // so its block is still in the buffer of the doc handle
+            statuses[entry->idx] = _fdb_multi_read_doc(entry,
+                                                       docs[entry->idx]);
+            entry->dhandle = NULL;
+        }
+    }
+    if (locked) {
+        filemgr_mutex_unlock(handle->file);
+    }
+
+    // 3. the other documents, read in offset order
+    for (i=0; i<n; ++i) {
+        if (entries[i].dhandle) {
+            entries[nfound++] = entries[i];
+        }
+    }
+    qsort(entries, nfound, sizeof(struct _fdb_multi_entry),
+          _fdb_multi_offset_cmp);
+    _fdb_multi_read_docs(handle, entries, nfound, docs, statuses);
+
+    free(entries);
+    free(keybuf);
+    return FDB_RESULT_SUCCESS;
+}
+
 // search document using sequence number
 LIBFDB_API
 fdb_status fdb_get_byseq(fdb_kvs_handle *handle, fdb_doc *doc)
@@ -2658,92 +3447,286 @@ static uint64_t _fdb_get_wal_threshold(fdb_kvs_handle *handle)
     return handle->config.wal_threshold;
 }
 
-LIBFDB_API
-fdb_status fdb_set(fdb_kvs_handle *handle, fdb_doc *doc)
+// multiple of the WAL threshold (and of the WAL memory limits) up to which
+// writers leave WAL entries to the WAL flusher thread; beyond this, a writer
+// flushes the WAL by itself
+static uint64_t _fdb_get_wal_hard_ratio(fdb_kvs_handle *handle)
 {
-    uint64_t offset;
-    struct docio_object _doc;
-    struct filemgr *file;
-    struct docio_handle *dhandle;
-    struct timeval tv;
-    bool txn_enabled = false;
-    bool sub_handle = false;
-    bool wal_flushed = false;
-    file_status_t fstatus;
-    fdb_txn *txn = handle->fhandle->root->txn;
-    fdb_status wr = FDB_RESULT_SUCCESS;
-
-    if (handle->config.flags & FDB_OPEN_FLAG_RDONLY) {
-        return fdb_log(&handle->log_callback, FDB_RESULT_RONLY_VIOLATION,
-                       "Warning: SET is not allowed on the read-only DB file '%s'.",
-                       handle->file->filename);
+#ifdef __FDB_WAL_FLUSHER
+    struct kvs_header *kv_header = handle->file->kv_header;
+    // the flusher's own handle does not know custom compare functions
+    if (!kv_header || !kv_header->custom_cmp_enabled) {
+        return FDB_WAL_FLUSHER_HARD_LIMIT;
     }
+#endif
+    return 1;
+}
 
-    if ( doc->key == NULL || doc->keylen == 0 ||
-        doc->keylen > FDB_MAX_KEYLEN ||
-        (doc->metalen > 0 && doc->meta == NULL) ||
-        (doc->bodylen > 0 && doc->body == NULL) ||
-        (handle->kvs_config.custom_cmp &&
-            doc->keylen > handle->config.blocksize - HBTRIE_HEADROOM)) {
-        return FDB_RESULT_INVALID_ARGS;
+// whether WAL entries should be flushed because of their memory usage
+// (see wal_exceeds_mem_limit())
+static bool _fdb_wal_exceeds_mem_limit(fdb_kvs_handle *handle, uint64_t ratio)
+{
+    if (filemgr_get_file_status(handle->file) == FILE_COMPACT_NEW) {
+        // same as the WAL threshold
+        return false;
     }
+    return wal_exceeds_mem_limit(handle->file,
+                                 handle->config.wal_memory_limit, ratio);
+}
 
-    _doc.length.keylen = doc->keylen;
-    _doc.length.metalen = doc->metalen;
-    _doc.length.bodylen = doc->deleted ? 0 : doc->bodylen;
-    _doc.key = doc->key;
-    _doc.meta = doc->meta;
-    _doc.body = doc->deleted ? NULL : doc->body;
+// flush committed WAL entries into the trie and seqtree before commit,
+// and share the new root nodes with the other handles
+// (the file mutex should be grabbed by the caller)
+static fdb_status _fdb_wal_flush_before_commit(fdb_kvs_handle *handle)
+{
+    fdb_status fs;
+    struct filemgr *file = handle->file;
+    struct avl_tree flush_items;
+    bid_t dirty_idtree_root, dirty_seqtree_root = BLK_NOT_FOUND;
 
-    if (handle->kvs) {
-        // multi KV instance mode
-        // allocate more (temporary) space for key, to store ID number
-        int size_chunk = handle->config.chunksize;
-        _doc.length.keylen = doc->keylen + size_chunk;
-        _doc.key = alca(uint8_t, _doc.length.keylen);
-        // copy ID
-        kvid2buf(size_chunk, handle->kvs->id, _doc.key);
-        // copy key
-        memcpy((uint8_t*)_doc.key + size_chunk, doc->key, doc->keylen);
+    // discard all cached writable blocks
+    // to avoid data inconsistency with other writers
+    btreeblk_discard_blocks(handle->bhandle);
 
-        if (handle->kvs->type == KVS_SUB) {
-            sub_handle = true;
-        } else {
-            sub_handle = false;
-        }
+    // commit only for non-transactional WAL entries
+    fs = wal_commit(&file->global_txn, file, NULL);
+    if (fs != FDB_RESULT_SUCCESS) {
+        return fs;
     }
-
-fdb_set_start:
-    fdb_check_file_reopen(handle, NULL);
-    filemgr_mutex_lock(handle->file);
-    fdb_sync_db_header(handle);
-    fdb_link_new_file(handle);
-
-    if (filemgr_is_rollback_on(handle->file)) {
-        filemgr_mutex_unlock(handle->file);
-        return FDB_RESULT_FAIL_BY_ROLLBACK;
+    fs = wal_flush(file, (void *)handle,
+                   _fdb_wal_flush_func,
+                   &flush_items);
+    if (fs != FDB_RESULT_SUCCESS) {
+        return fs;
     }
+    wal_set_dirty_status(file, FDB_WAL_PENDING);
+    // it is ok to release flushed items becuase
+    // these items are not actually committed yet.
+    // they become visible after fdb_commit is invoked.
+    wal_release_flushed_items(file, &flush_items);
 
-    if (handle->new_file == NULL) {
-        file = handle->file;
-        dhandle = handle->dhandle;
-    } else {
-        // compaction is being performed and new file exists
-        // relay lock
-        filemgr_mutex_lock(handle->new_file);
-        filemgr_mutex_unlock(handle->file);
-        file = handle->new_file;
-        dhandle = handle->new_dhandle;
+    // sync new root node
+    dirty_idtree_root = handle->trie->root_bid;
+    if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
+        dirty_seqtree_root = handle->seqtree->root_bid;
     }
+    filemgr_set_dirty_root(file,
+                           dirty_idtree_root,
+                           dirty_seqtree_root);
+    return FDB_RESULT_SUCCESS;
+}
 
-    fstatus = file->status;
-    if (!(fstatus == FILE_NORMAL ||
-          fstatus == FILE_COMPACT_NEW ||
-          fstatus == FILE_COMPACT_INPROG)) {
-        // we must not write into this file
-        // file status was changed by other thread .. start over
-        filemgr_mutex_unlock(file);
-        goto fdb_set_start;
+static fdb_status _fdb_open_for_wal_flusher(fdb_file_handle **ptr_fhandle,
+                                           const char *filename,
+                                           fdb_config *config_in,
+                                           err_log_callback *log_callback)
+{
+    fdb_config config = *config_in;
+    fdb_file_handle *fhandle;
+    fdb_kvs_handle *handle;
+    fdb_status fs;
+
+    fhandle = (fdb_file_handle*)calloc(1, sizeof(fdb_file_handle));
+    if (!fhandle) { // LCOV_EXCL_START
+        return FDB_RESULT_ALLOC_FAIL;
+    } // LCOV_EXCL_STOP
+
+    handle = (fdb_kvs_handle *) calloc(1, sizeof(fdb_kvs_handle));
+    if (!handle) { // LCOV_EXCL_START
+        free(fhandle);
+        return FDB_RESULT_ALLOC_FAIL;
+    } // LCOV_EXCL_STOP
+    handle->shandle = NULL;
+    handle->wal_flusher = 1;
+    if (log_callback) {
+        handle->log_callback = *log_callback;
+    }
+
+    // neither registered in compactor nor committed on close,
+    // and the file is never created
+    config.compaction_mode = FDB_COMPACTION_MANUAL;
+    config.auto_commit = false;
+    config.flags &= ~FDB_OPEN_FLAG_CREATE;
+
+    fdb_file_handle_init(fhandle, handle);
+    fs = _fdb_open(handle, filename, FDB_AFILENAME, &config);
+    if (fs == FDB_RESULT_SUCCESS) {
+        *ptr_fhandle = fhandle;
+    } else {
+        *ptr_fhandle = NULL;
+        free(handle);
+        fdb_file_handle_free(fhandle);
+    }
+    return fs;
+}
+
+// open a private handle on the file of 'handle_in' for the WAL flusher
+// thread; the handle keeps the file open until the flush is done
+fdb_status fdb_open_for_wal_flusher(fdb_kvs_handle *handle_in,
+                                    fdb_file_handle **ptr_fhandle)
+{
+    return _fdb_open_for_wal_flusher(ptr_fhandle, handle_in->file->filename,
+                                     &handle_in->config,
+                                     &handle_in->log_callback);
+}
+
+// open a private handle on a file chosen to be flushed for the global WAL
+// memory budget, with the config kept by wal_set_flush_config()
+fdb_status fdb_open_file_for_wal_flusher(fdb_file_handle **ptr_fhandle,
+                                         const char *filename,
+                                         fdb_config *config)
+{
+    return _fdb_open_for_wal_flusher(ptr_fhandle, filename, config, NULL);
+}
+
+// invoked by the WAL flusher thread with a handle opened by
+// fdb_open_for_wal_flusher()
+fdb_status fdb_flush_wal_for_flusher(fdb_file_handle *fhandle)
+{
+    fdb_status fs = FDB_RESULT_SUCCESS;
+    fdb_kvs_handle *handle = fhandle->root;
+    struct filemgr *file = handle->file;
+    bid_t dirty_idtree_root, dirty_seqtree_root;
+
+    filemgr_mutex_lock(file);
+    // nothing to do if the WAL was flushed by commit (or by compaction)
+    // in the meantime
+    if (filemgr_get_file_status(file) == FILE_NORMAL &&
+        !filemgr_is_rollback_on(file) &&
+        wal_get_num_flushable(file) > 0) {
+        // other handles may have committed since this handle was opened
+        fdb_sync_db_header(handle);
+        // sync root node of each tree with other writers
+        filemgr_get_dirty_root(file, &dirty_idtree_root, &dirty_seqtree_root);
+        if (dirty_idtree_root != BLK_NOT_FOUND) {
+            handle->trie->root_bid = dirty_idtree_root;
+        }
+        if (handle->config.seqtree_opt == FDB_SEQTREE_USE &&
+            dirty_seqtree_root != BLK_NOT_FOUND) {
+            handle->seqtree->root_bid = dirty_seqtree_root;
+        }
+        fs = _fdb_wal_flush_before_commit(handle);
+    }
+    wal_set_flush_pending(file, 0);
+    filemgr_mutex_unlock(file);
+
+    return fs;
+}
+
+// hand over the WAL flush to the WAL flusher thread
+// (called without the file mutex)
+static void _fdb_request_wal_flush(fdb_kvs_handle *handle)
+{
+    fdb_file_handle *fhandle;
+
+    if (fdb_open_for_wal_flusher(handle, &fhandle) != FDB_RESULT_SUCCESS) {
+        // writers will retry on the next update
+        filemgr_mutex_lock(handle->file);
+        wal_set_flush_pending(handle->file, 0);
+        filemgr_mutex_unlock(handle->file);
+        return;
+    }
+    wal_flusher_request(fhandle);
+}
+
+LIBFDB_API
+fdb_status fdb_set(fdb_kvs_handle *handle, fdb_doc *doc)
+{
+    uint64_t offset;
+    struct docio_object _doc;
+    struct filemgr *file;
+    struct docio_handle *dhandle;
+    struct timeval tv;
+    bool txn_enabled = false;
+    bool sub_handle = false;
+    bool wal_flushed = false;
+    bool flush_requested = false;
+    size_t num_flushable;
+    uint64_t wal_threshold, hard_ratio;
+    file_status_t fstatus;
+    fdb_txn *txn = handle->fhandle->root->txn;
+    fdb_status wr = FDB_RESULT_SUCCESS;
+
+    if (handle->config.flags & FDB_OPEN_FLAG_RDONLY) {
+        return fdb_log(&handle->log_callback, FDB_RESULT_RONLY_VIOLATION,
+                       "Warning: SET is not allowed on the read-only DB file '%s'.",
+                       handle->file->filename);
+    }
+
+    if ( doc->key == NULL || doc->keylen == 0 ||
+        doc->keylen > FDB_MAX_KEYLEN ||
+        (doc->metalen > 0 && doc->meta == NULL) ||
+        (doc->bodylen > 0 && doc->body == NULL) ||
+        (handle->kvs_config.custom_cmp &&
+            doc->keylen > handle->config.blocksize - HBTRIE_HEADROOM)) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    _doc.length.keylen = doc->keylen;
+    _doc.length.metalen = doc->metalen;
+    _doc.length.bodylen = doc->deleted ? 0 : doc->bodylen;
+    _doc.key = doc->key;
+    _doc.meta = doc->meta;
+    _doc.body = doc->deleted ? NULL : doc->body;
+
+    if (handle->kvs) {
+        // multi KV instance mode
+        // allocate more (temporary) space for key, to store ID number
+        int size_chunk = handle->config.chunksize;
+        _doc.length.keylen = doc->keylen + size_chunk;
+        _doc.key = alca(uint8_t, _doc.length.keylen);
+        // copy ID
+        kvid2buf(size_chunk, handle->kvs->id, _doc.key);
+        // copy key
+        memcpy((uint8_t*)_doc.key + size_chunk, doc->key, doc->keylen);
+
+        if (handle->kvs->type == KVS_SUB) {
+            sub_handle = true;
+        } else {
+            sub_handle = false;
+        }
+    }
+
+    hard_ratio = _fdb_get_wal_hard_ratio(handle);
+    if (wal_exceeds_global_mem_budget(hard_ratio)) {
+        // WAL entries of all files are over the hard limit of the global
+        // budget, whichever file this writer writes to .. wait for the
+        // WAL flusher thread to flush the largest files
+        wal_flusher_reclaim();
+        wal_flusher_wait_reclaim();
+    }
+
+fdb_set_start:
+    fdb_check_file_reopen(handle, NULL);
+    filemgr_mutex_lock(handle->file);
+    fdb_sync_db_header(handle);
+    fdb_link_new_file(handle);
+
+    if (filemgr_is_rollback_on(handle->file)) {
+        filemgr_mutex_unlock(handle->file);
+        return FDB_RESULT_FAIL_BY_ROLLBACK;
+    }
+
+    if (handle->new_file == NULL) {
+        file = handle->file;
+        dhandle = handle->dhandle;
+    } else {
+        // compaction is being performed and new file exists
+        // relay lock
+        filemgr_mutex_lock(handle->new_file);
+        filemgr_mutex_unlock(handle->file);
+        file = handle->new_file;
+        dhandle = handle->new_dhandle;
+    }
+
+    fstatus = file->status;
+    if (!(fstatus == FILE_NORMAL ||
+          fstatus == FILE_COMPACT_NEW ||
+          fstatus == FILE_COMPACT_INPROG)) {
+        // we must not write into this file
+        // file status was changed by other thread .. start over
+        filemgr_mutex_unlock(file);
+        goto fdb_set_start;
     }
 
     if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
@@ -2824,47 +3807,63 @@ fdb_set_start:
             handle->seqtree->root_bid = dirty_seqtree_root;
         }
 
-        if (wal_get_num_flushable(file) > _fdb_get_wal_threshold(handle)) {
-            struct avl_tree flush_items;
+        if (hard_ratio > 1) {
+            // the WAL flusher thread can flush this file for the global
+            // budget even when no writer touches it
+            wal_set_flush_config(file, &handle->config);
+        }
 
-            // discard all cached writable blocks
-            // to avoid data inconsistency with other writers
-            btreeblk_discard_blocks(handle->bhandle);
+        num_flushable = wal_get_num_flushable(file);
+        wal_threshold = _fdb_get_wal_threshold(handle);
+        // the global usage may still be over the hard limit after the WAL
+        // flusher thread flushed the largest files (e.g., if they are not
+        // flushed before commit)
+        if (num_flushable > wal_threshold * hard_ratio ||
+            (num_flushable && _fdb_wal_exceeds_mem_limit(handle, hard_ratio)) ||
+            (num_flushable && wal_exceeds_global_mem_budget(hard_ratio))) {
+            struct timeval tv_begin, tv_end, tv_gap;
 
-            // commit only for non-transactional WAL entries
-            wr = wal_commit(&file->global_txn, file, NULL);
+            // flush by itself .. this writer is stalled
+            gettimeofday(&tv_begin, NULL);
+            wr = _fdb_wal_flush_before_commit(handle);
             if (wr != FDB_RESULT_SUCCESS) {
                 filemgr_mutex_unlock(file);
                 return wr;
             }
-            wr = wal_flush(file, (void *)handle,
-                      _fdb_wal_flush_func, _fdb_wal_get_old_offset,
-                      &flush_items);
-            if (wr != FDB_RESULT_SUCCESS) {
-                filemgr_mutex_unlock(file);
-                return wr;
-            }
-            wal_set_dirty_status(file, FDB_WAL_PENDING);
-            // it is ok to release flushed items becuase
-            // these items are not actually committed yet.
-            // they become visible after fdb_commit is invoked.
-            wal_release_flushed_items(file, &flush_items);
-
-            // sync new root node
-            dirty_idtree_root = handle->trie->root_bid;
-            if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
-                dirty_seqtree_root = handle->seqtree->root_bid;
+            gettimeofday(&tv_end, NULL);
+            tv_gap = _utime_gap(tv_begin, tv_end);
+            wal_add_flush_stats(file, true,
+                                (uint64_t)tv_gap.tv_sec * 1000000 +
+                                tv_gap.tv_usec);
+            wal_flushed = true;
+        } else if (num_flushable > wal_threshold ||
+                   (num_flushable && _fdb_wal_exceeds_mem_limit(handle, 1))) {
+            // hand over to the WAL flusher thread
+            // (only one request per file is in flight at a time)
+            if (!wal_get_flush_pending(file)) {
+                wal_set_flush_pending(file, 1);
+                flush_requested = true;
             }
-            filemgr_set_dirty_root(file,
-                                   dirty_idtree_root,
-                                   dirty_seqtree_root);
+        }
 
+        if (handle->config.auto_commit &&
+            wal_get_dirty_status(file) == FDB_WAL_PENDING &&
+            !wal_get_flush_pending(file)) {
+            // WAL entries were flushed by the WAL flusher thread,
+            // commit them in the same way as flushing by itself
             wal_flushed = true;
         }
     }
 
     filemgr_mutex_unlock(file);
 
+    if (flush_requested) {
+        _fdb_request_wal_flush(handle);
+    }
+    if (wal_exceeds_global_mem_budget(1)) {
+        // flush the largest files in background, including idle ones
+        wal_flusher_reclaim();
+    }
     if (wal_flushed && handle->config.auto_commit) {
         return fdb_commit(handle->fhandle, FDB_COMMIT_NORMAL);
     }
@@ -3087,7 +4086,63 @@ fdb_status fdb_commit(fdb_file_handle *fhandle, fdb_commit_opt_t opt)
     return _fdb_commit(fhandle->root, opt);
 }
 
+struct _fdb_commit_async_ctx {
+    fdb_file_handle *fhandle;
+    fdb_commit_callback callback;
+    void *ctx_data;
+    filemgr_header_revnum_t revnum;
+};
+
+static void _fdb_commit_async_done(fdb_status status, void *voidctx)
+{
+    struct _fdb_commit_async_ctx *ctx = (struct _fdb_commit_async_ctx *)voidctx;
+    ctx->callback(ctx->fhandle, status, ctx->revnum, ctx->ctx_data);
+    free(ctx);
+}
+
+LIBFDB_API
+fdb_status fdb_commit_async(fdb_file_handle *fhandle, fdb_commit_opt_t opt,
+                            fdb_commit_callback callback, void *ctx_data)
+{
+    fdb_kvs_handle *handle;
+    uint64_t sync_revnum = 0;
+    struct _fdb_commit_async_ctx *ctx;
+    fdb_status fs;
+
+    if (!fhandle || !callback) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    handle = fhandle->root;
+    fs = _fdb_commit_deferred(handle, opt, &sync_revnum);
+    if (fs != FDB_RESULT_SUCCESS) {
+        return fs;
+    }
+
+    ctx = (struct _fdb_commit_async_ctx *)
+          malloc(sizeof(struct _fdb_commit_async_ctx));
+    ctx->fhandle = fhandle;
+    ctx->callback = callback;
+    ctx->ctx_data = ctx_data;
+    ctx->revnum = handle->cur_header_revnum;
+    // HANDLE->FILE is not switched to the compacted file until this handle
+    // is used again, so the file is still referred to by this handle
+    filemgr_sync_commit_async(handle->file, sync_revnum,
+                              _fdb_commit_async_done, ctx);
+
+    return FDB_RESULT_SUCCESS;
+}
+
 fdb_status _fdb_commit(fdb_kvs_handle *handle, fdb_commit_opt_t opt)
+{
+    return _fdb_commit_deferred(handle, opt, NULL);
+}
+
+// if ASYNC_REVNUM is given, the commit is made visible without fsync and
+// the revnum of the header to be synced is returned through it (0 if the
+// commit is already durable) .. it should be handed over to the syncer
+fdb_status _fdb_commit_deferred(fdb_kvs_handle *handle, fdb_commit_opt_t opt,
+                                uint64_t *async_revnum)
 {
     fdb_txn *txn = handle->fhandle->root->txn;
     fdb_txn *earliest_txn;
@@ -3096,6 +4151,7 @@ fdb_status _fdb_commit(fdb_kvs_handle *handle, fdb_commit_opt_t opt)
     bid_t dirty_idtree_root, dirty_seqtree_root;
     struct avl_tree flush_items;
     fdb_status wr = FDB_RESULT_SUCCESS;
+    filemgr_header_revnum_t sync_revnum = 0;
 
     if (handle->kvs) {
         if (handle->kvs->type == KVS_SUB) {
@@ -3143,6 +4199,10 @@ fdb_status _fdb_commit(fdb_kvs_handle *handle, fdb_commit_opt_t opt)
         fs = filemgr_sync(handle->new_file, &handle->log_callback);
 
         filemgr_mutex_unlock(handle->new_file);
+        if (async_revnum) {
+            // already synced
+            *async_revnum = 0;
+        }
     } else {
         // normal case
         fs = btreeblk_end(handle->bhandle);
@@ -3185,16 +4245,17 @@ fdb_status _fdb_commit(fdb_kvs_handle *handle, fdb_commit_opt_t opt)
         }
 
         if (wal_get_num_flushable(handle->file) > _fdb_get_wal_threshold(handle) ||
+            _fdb_wal_exceeds_mem_limit(handle, 1) ||
             wal_get_dirty_status(handle->file) == FDB_WAL_PENDING ||
             opt & FDB_COMMIT_MANUAL_WAL_FLUSH) {
             // wal flush when
-            // 1. wal size exceeds threshold
+            // 1. wal size (or its memory usage) exceeds threshold
             // 2. wal is already flushed before commit
             //    (in this case, flush the rest of entries)
             // 3. user forces to manually flush wal
 
             wr = wal_flush(handle->file, (void *)handle,
-                      _fdb_wal_flush_func, _fdb_wal_get_old_offset,
+                      _fdb_wal_flush_func,
                       &flush_items);
             if (wr != FDB_RESULT_SUCCESS) {
                 filemgr_mutex_unlock(handle->file);
@@ -3237,13 +4298,23 @@ fdb_status _fdb_commit(fdb_kvs_handle *handle, fdb_commit_opt_t opt)
         }
 
         handle->cur_header_revnum = fdb_set_file_header(handle);
-        fs = filemgr_commit(handle->file, &handle->log_callback);
+        fs = filemgr_commit_deferred(handle->file, async_revnum != NULL,
+                                     &sync_revnum, &handle->log_callback);
         if (wal_flushed) {
             wal_release_flushed_items(handle->file, &flush_items);
         }
 
         handle->dirty_updates = 0;
         filemgr_mutex_unlock(handle->file);
+
+        if (async_revnum) {
+            *async_revnum = sync_revnum;
+        } else if (fs == FDB_RESULT_SUCCESS && sync_revnum) {
+            // wait for the fsync outside the file mutex, so that commits
+            // by other handles can join the same fsync
+            fs = filemgr_sync_commit(handle->file, sync_revnum,
+                                     &handle->log_callback);
+        }
     }
 
     return fs;
@@ -3292,7 +4363,7 @@ static fdb_status _fdb_commit_and_remove_pending(fdb_kvs_handle *handle,
     if (wal_get_num_flushable(handle->file)) {
         // flush wal if not empty
         wal_flush(handle->file, (void *)handle,
-                  _fdb_wal_flush_func, _fdb_wal_get_old_offset, &flush_items);
+                  _fdb_wal_flush_func, &flush_items);
         wal_set_dirty_status(handle->file, FDB_WAL_CLEAN);
         wal_flushed = true;
     } else if (wal_get_size(handle->file) == 0) {
@@ -3402,148 +4473,750 @@ static fdb_status _fdb_move_wal_docs(fdb_kvs_handle *handle,
     gettimeofday(&tv, NULL);
     cur_timestamp = tv.tv_sec;
 
-    // TODO: Need to adapt docio_read_doc to separate false checksum errors.
-    log_callback = handle->dhandle->log_callback;
-    handle->dhandle->log_callback = NULL;
+    // TODO: Need to adapt docio_read_doc to separate false checksum errors.
+    log_callback = handle->dhandle->log_callback;
+    handle->dhandle->log_callback = NULL;
+
+    for (; offset < stop_offset;
+        offset = ((offset / blocksize) + 1) * blocksize) { // next block's off
+        if (!docio_check_buffer(handle->dhandle, offset / blocksize)) {
+            continue;
+        } else {
+            do {
+                fdb_doc wal_doc;
+                uint8_t deleted;
+                struct docio_object doc;
+                uint64_t _offset;
+                memset(&doc, 0, sizeof(doc));
+                _offset = docio_read_doc(handle->dhandle, offset, &doc);
+                if (!doc.key && !(doc.length.flag & DOCIO_TXN_COMMITTED)) {
+                    // No more documents in this block, break go to next block
+                    free(doc.key);
+                    free(doc.meta);
+                    free(doc.body);
+                    offset = _offset;
+                    break;
+                }
+                // check if the doc is transactional or not, and
+                // also check if the doc contains system info
+                if (doc.length.flag & DOCIO_TXN_DIRTY ||
+                    doc.length.flag & DOCIO_SYSTEM) {
+                    // skip transactional document or system document
+                    free(doc.key);
+                    free(doc.meta);
+                    free(doc.body);
+                    offset = _offset;
+                    continue;
+                    // do not break.. read next doc
+                }
+                if (doc.length.flag & DOCIO_TXN_COMMITTED) {
+                    // commit mark .. read the previously skipped doc
+                    docio_read_doc(handle->dhandle, doc.doc_offset, &doc);
+                    if (doc.key == NULL) { // doc read error
+                        free(doc.meta);
+                        free(doc.body);
+                        offset = _offset;
+                        continue;
+                    }
+                }
+
+                // If a rollback was requested on this file, skip
+                // any db items written past the rollback point
+                if (!handle->kvs) {
+                    if (doc.seqnum > handle->seqnum) {
+                        free(doc.key);
+                        free(doc.meta);
+                        free(doc.body);
+                        offset = _offset;
+                        continue;
+                    }
+                } else {
+                    // check seqnum before insert
+                    fdb_kvs_id_t kv_id;
+                    fdb_seqnum_t kv_seqnum;
+                    buf2kvid(handle->config.chunksize, doc.key, &kv_id);
+
+                    if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
+                        kv_seqnum = fdb_kvs_get_seqnum(handle->file, kv_id);
+                    } else {
+                        kv_seqnum = SEQNUM_NOT_USED;
+                    }
+                    // Only pick up items written before any rollback
+                    if (doc.seqnum > kv_seqnum) {
+                        free(doc.key);
+                        free(doc.meta);
+                        free(doc.body);
+                        offset = _offset;
+                        continue;
+                    }
+                }
+                // compare timestamp
+                // Do not re-write the document to new file if
+                // 1. the document is deleted OR
+                // 2. the document is not logically deleted but
+                //    its timestamp is overdue
+                deleted = doc.length.flag & DOCIO_DELETED;
+                if (deleted && cur_timestamp >= doc.timestamp
+                                + handle->config.purging_interval) {
+                    free(doc.key);
+                    free(doc.meta);
+                    free(doc.body);
+                    offset = _offset;
+                    continue;
+                }
+                // Re-Write Document to the new file
+                new_offset = docio_append_doc(new_dhandle, &doc, deleted, 0);
+                if (new_offset == BLK_NOT_FOUND) {
+                    free(doc.key);
+                    free(doc.meta);
+                    free(doc.body);
+                    return FDB_RESULT_WRITE_FAIL;
+                }
+
+                // Restore the document into the WAL section of new file..
+                wal_doc.keylen = doc.length.keylen;
+                wal_doc.metalen = doc.length.metalen;
+                wal_doc.bodylen = doc.length.bodylen;
+                wal_doc.key = doc.key;
+                wal_doc.meta = doc.meta;
+                wal_doc.seqnum = doc.seqnum;
+                wal_doc.deleted = deleted;
+                wal_doc.size_ondisk = _fdb_get_docsize(doc.length);
+
+                wal_insert(&new_file->global_txn,
+                        new_file, &wal_doc, new_offset, 1);
+                n_moved_docs++;
+                free(doc.key);
+                free(doc.meta);
+                free(doc.body);
+                offset = _offset;
+            } while (offset + sizeof(struct docio_length) < stop_offset);
+        }
+    }
+    // wal flush into new file so all documents are reflected in its main index
+    if (n_moved_docs) {
+        struct avl_tree flush_items;
+        new_handle = *handle;
+        new_handle.file = new_file;
+        new_handle.trie = new_trie;
+        new_handle.idtree = new_idtree;
+        if (handle->kvs) {
+            new_handle.seqtrie = new_seqtrie;
+        } else {
+            new_handle.seqtree = new_seqtree;
+        }
+        new_handle.dhandle = new_dhandle;
+        new_handle.bhandle = new_bhandle;
+
+        wal_flush_by_compactor(new_file, (void*)&new_handle,
+                               _fdb_wal_flush_func,
+                               &flush_items);
+        wal_set_dirty_status(new_file, FDB_WAL_PENDING);
+        wal_release_flushed_items(new_file, &flush_items);
+    }
+
+    return fs;
+}
+
+// read the documents at the (sorted) offsets into DOC
+static void _fdb_compact_read_docs(fdb_kvs_handle *handle,
+                                   struct docio_handle *dhandle,
+                                   uint64_t *offsets, size_t n,
+                                   struct docio_object *doc)
+{
+    size_t i;
+    bid_t bids[FDB_COMPACTION_BATCHSIZE];
+
+    // read the first blocks of the documents at once
+    // (offsets are sorted so that duplicated BIDs are adjacent)
+    for (i=0; i<n; ++i){
+        bids[i] = offsets[i] / handle->file->blocksize;
+    }
+    filemgr_prefetch_blocks(handle->file, bids, n, &handle->log_callback);
+
+    // documents in the old file are read only once,
+    // so they should not evict hot blocks from the cache
+    dhandle->read_once = true;
+    for (i=0; i<n; ++i){
+        doc[i].key = NULL;
+        doc[i].meta = NULL;
+        doc[i].body = NULL;
+        docio_read_doc(dhandle, offsets[i], &doc[i]);
+    }
+    dhandle->read_once = false;
+}
+
+// document moved to the new file, which is bulk loaded into its main index
+// (instead of being inserted into its WAL)
+struct _fdb_compact_bulk_doc {
+    void *key;
+    uint64_t offset;
+    fdb_seqnum_t seqnum;
+    fdb_kvs_id_t kv_id;
+    uint32_t doc_size;
+    keylen_t keylen;
+    uint8_t deleted;
+    uint8_t moved;
+};
+
+// append the documents to the new file and insert them into its WAL
+// (or record them into BULK_DOCS at BULK_POS if it is not NULL)
+static void _fdb_compact_write_docs(fdb_kvs_handle *handle,
+                                    struct filemgr *new_file,
+                                    struct docio_handle *new_dhandle,
+                                    struct docio_object *doc, size_t n,
+                                    timestamp_t cur_timestamp,
+                                    struct _fdb_compact_bulk_doc *bulk_docs,
+                                    uint64_t *bulk_pos,
+                                    bool got_lock)
+{
+    size_t i;
+    uint8_t deleted;
+    uint64_t new_offset;
+    fdb_doc wal_doc;
+    struct _fdb_compact_bulk_doc *bulk_doc;
+
+    if (!got_lock) {
+        filemgr_mutex_lock(new_file);
+    }
+    for (i=0; i<n; ++i){
+        // compare timestamp
+        deleted = doc[i].length.flag & DOCIO_DELETED;
+        if (!deleted ||
+            (cur_timestamp < doc[i].timestamp +
+                             handle->config.purging_interval &&
+             deleted)) {
+            // re-write the document to new file when
+            // 1. the document is not deleted
+            // 2. the document is logically deleted but
+            //    its timestamp isn't overdue
+            new_offset = docio_append_doc(new_dhandle, &doc[i],
+                                          deleted, 0);
+
+            if (bulk_docs) {
+                // the key is freed after bulk loading
+                bulk_doc = &bulk_docs[bulk_pos[i]];
+                bulk_doc->key = doc[i].key;
+                bulk_doc->keylen = doc[i].length.keylen;
+                bulk_doc->offset = new_offset;
+                bulk_doc->seqnum = doc[i].seqnum;
+                bulk_doc->doc_size = _fdb_get_docsize(doc[i].length);
+                bulk_doc->deleted = deleted;
+                bulk_doc->moved = 1;
+                free(doc[i].meta);
+                free(doc[i].body);
+                continue;
+            }
+
+            wal_doc.keylen = doc[i].length.keylen;
+            wal_doc.metalen = doc[i].length.metalen;
+            wal_doc.bodylen = doc[i].length.bodylen;
+            wal_doc.key = doc[i].key;
+            wal_doc.seqnum = doc[i].seqnum;
+
+            wal_doc.meta = doc[i].meta;
+            wal_doc.body = doc[i].body;
+            wal_doc.size_ondisk= _fdb_get_docsize(doc[i].length);
+            wal_doc.deleted = deleted;
+
+            wal_insert(&new_file->global_txn,
+                       new_file, &wal_doc, new_offset, 1);
+        } else if (bulk_docs) {
+            bulk_docs[bulk_pos[i]].key = NULL;
+            bulk_docs[bulk_pos[i]].moved = 0;
+        }
+        free(doc[i].key);
+        free(doc[i].meta);
+        free(doc[i].body);
+    }
+    if (!got_lock) {
+        filemgr_mutex_unlock(new_file);
+    }
+}
+
+// reflect the documents moved so far into the main index of the new file
+static fdb_status _fdb_compact_build_index(fdb_kvs_handle *new_handle)
+{
+    fdb_status fs = FDB_RESULT_SUCCESS;
+    struct filemgr *new_file = new_handle->file;
+
+    if (wal_get_num_flushable(new_file) > 0) {
+        struct avl_tree flush_items;
+        fs = wal_flush_by_compactor(new_file, (void*)new_handle,
+                                    _fdb_wal_flush_func,
+                                    &flush_items);
+        wal_set_dirty_status(new_file, FDB_WAL_PENDING);
+        wal_release_flushed_items(new_file, &flush_items);
+    }
+    return fs;
+}
+
+INLINE int _fdb_compact_bulk_doc_cmp(const void *a, const void *b)
+{
+    struct _fdb_compact_bulk_doc *aa, *bb;
+    aa = (struct _fdb_compact_bulk_doc *)a;
+    bb = (struct _fdb_compact_bulk_doc *)b;
+
+    if (aa->kv_id != bb->kv_id) {
+        return (aa->kv_id < bb->kv_id)?(-1):(1);
+    }
+    if (aa->seqnum != bb->seqnum) {
+        return (aa->seqnum < bb->seqnum)?(-1):(1);
+    }
+    return 0;
+}
+
+// bulk load the moved documents (given in key order) into the main index of
+// the new file, and then insert them into its sequence index
+static fdb_status _fdb_compact_bulk_load(fdb_kvs_handle *new_handle,
+                                         struct hbtrie_bulk *bulk,
+                                         struct _fdb_compact_bulk_doc *docs,
+                                         size_t n,
+                                         bool got_lock)
+{
+    size_t i;
+    int delta, r;
+    uint64_t _offset, old_offset;
+    fdb_seqnum_t _seqnum;
+    fdb_doc wal_doc;
+    hbtrie_result hr;
+    struct kvs_stat stat;
+    struct filemgr *new_file = new_handle->file;
+    fdb_status fs = FDB_RESULT_SUCCESS;
+
+    for (i=0; i<n && fs == FDB_RESULT_SUCCESS; ++i){
+        if (!docs[i].moved) {
+            continue;
+        }
+        if (new_handle->kvs) {
+            buf2kvid(new_handle->config.chunksize, docs[i].key,
+                     &docs[i].kv_id);
+        } else {
+            docs[i].kv_id = 0;
+        }
+
+        r = _kvs_stat_get(new_file, docs[i].kv_id, &stat);
+        if (r != 0) {
+            // KV store corresponding to kv_id is already removed
+            docs[i].moved = 0;
+            continue;
+        }
+        new_handle->bhandle->nlivenodes = stat.nlivenodes;
+
+        if (new_file->bloom) {
+            bloomfilter_add(new_file->bloom, docs[i].key, docs[i].keylen);
+        }
+        _offset = _endian_encode(docs[i].offset);
+        hr = hbtrie_bulk_add(bulk, docs[i].key, docs[i].keylen,
+                             (void *)&_offset);
+        fs = btreeblk_end(new_handle->bhandle);
+
+        if (hr != HBTRIE_RESULT_SUCCESS) {
+            // keys of KV stores using custom cmp functions are indexed
+            // through WAL, which is flushed after the bulk loading is done
+            memset(&wal_doc, 0, sizeof(wal_doc));
+            wal_doc.keylen = docs[i].keylen;
+            wal_doc.key = docs[i].key;
+            wal_doc.seqnum = docs[i].seqnum;
+            wal_doc.size_ondisk = docs[i].doc_size;
+            wal_doc.deleted = docs[i].deleted;
+            if (!got_lock) {
+                filemgr_mutex_lock(new_file);
+            }
+            wal_insert(&new_file->global_txn,
+                       new_file, &wal_doc, docs[i].offset, 1);
+            if (!got_lock) {
+                filemgr_mutex_unlock(new_file);
+            }
+            docs[i].moved = 0;
+            continue;
+        }
+
+        delta = (int)new_handle->bhandle->nlivenodes - (int)stat.nlivenodes;
+        _kvs_stat_update_attr(new_file, docs[i].kv_id,
+                              KVS_STAT_NLIVENODES, delta);
+        if (!docs[i].deleted) {
+            _kvs_stat_update_attr(new_file, docs[i].kv_id, KVS_STAT_NDOCS, 1);
+        }
+        _kvs_stat_update_attr(new_file, docs[i].kv_id, KVS_STAT_DATASIZE,
+                              docs[i].doc_size);
+    }
+
+    if (fs == FDB_RESULT_SUCCESS &&
+        new_handle->config.seqtree_opt == FDB_SEQTREE_USE) {
+        int size_id, size_seq;
+        uint8_t *kvid_seqnum;
+
+        size_id = sizeof(fdb_kvs_id_t);
+        size_seq = sizeof(fdb_seqnum_t);
+        kvid_seqnum = alca(uint8_t, size_id + size_seq);
+
+        // sequence numbers are not in key order, so they are inserted
+        // into the sequence index as usual, in the order of sequence number
+        qsort(docs, n, sizeof(struct _fdb_compact_bulk_doc),
+              _fdb_compact_bulk_doc_cmp);
+        for (i=0; i<n; ++i){
+            if (!docs[i].moved) {
+                continue;
+            }
+            r = _kvs_stat_get(new_file, docs[i].kv_id, &stat);
+            if (r != 0) {
+                continue;
+            }
+            new_handle->bhandle->nlivenodes = stat.nlivenodes;
+
+            _offset = _endian_encode(docs[i].offset);
+            _seqnum = _endian_encode(docs[i].seqnum);
+            if (new_handle->kvs) {
+                // multi KV instance mode .. HB+trie
+                kvid2buf(size_id, docs[i].kv_id, kvid_seqnum);
+                memcpy(kvid_seqnum + size_id, &_seqnum, size_seq);
+                hbtrie_insert(new_handle->seqtrie, kvid_seqnum,
+                              size_id + size_seq,
+                              (void *)&_offset, (void *)&old_offset);
+            } else {
+                btree_insert(new_handle->seqtree, (void *)&_seqnum,
+                             (void *)&_offset);
+            }
+            fs = btreeblk_end(new_handle->bhandle);
+            if (fs != FDB_RESULT_SUCCESS) {
+                break;
+            }
+
+            delta = (int)new_handle->bhandle->nlivenodes -
+                    (int)stat.nlivenodes;
+            _kvs_stat_update_attr(new_file, docs[i].kv_id,
+                                  KVS_STAT_NLIVENODES, delta);
+        }
+    }
+
+    for (i=0; i<n; ++i){
+        free(docs[i].key);
+        docs[i].key = NULL;
+    }
+    return fs;
+}
+
+// write the remaining nodes of the bulk loaded main index,
+// and then flush the documents left in WAL into the index
+static fdb_status _fdb_compact_bulk_finish(fdb_kvs_handle *new_handle,
+                                           struct hbtrie_bulk *bulk)
+{
+    int delta, r;
+    fdb_kvs_id_t kv_id = 0;
+    hbtrie_result hr;
+    struct kvs_stat stat;
+    struct filemgr *new_file = new_handle->file;
+    fdb_status fs;
+
+    // the nodes written at the end are counted for
+    // the KV store that the last key belongs to
+    if (new_handle->kvs && bulk->prev_key) {
+        buf2kvid(new_handle->config.chunksize, bulk->prev_key, &kv_id);
+    }
+    r = _kvs_stat_get(new_file, kv_id, &stat);
+    if (r == 0) {
+        new_handle->bhandle->nlivenodes = stat.nlivenodes;
+    }
+
+    hr = hbtrie_bulk_finish(bulk);
+    fs = btreeblk_end(new_handle->bhandle);
+    if (hr != HBTRIE_RESULT_SUCCESS) {
+        return FDB_RESULT_COMPACTION_FAIL;
+    }
+    if (fs != FDB_RESULT_SUCCESS) {
+        return fs;
+    }
+    if (r == 0) {
+        delta = (int)new_handle->bhandle->nlivenodes - (int)stat.nlivenodes;
+        _kvs_stat_update_attr(new_file, kv_id, KVS_STAT_NLIVENODES, delta);
+    }
+
+    return _fdb_compact_build_index(new_handle);
+}
+
+// pipelined compaction:
+// 1. the compaction thread walks the HB+trie of the old file and sorts the
+//    offsets of documents (up to 'compaction_buf_maxsize' bytes at once),
+// 2. reader threads read the documents of the sorted offsets in batches,
+// 3. the compaction thread appends the batches to the new file in order, and
+// 4. an index builder thread flushes the WAL of the new file into its main
+//    index, while the next offsets are being walked, read, and appended.
+//    (if 'compaction_fill_factor' is set, the builder thread bulk loads
+//    the documents of the previous offsets into the main index instead.)
+struct _fdb_compact_batch {
+    size_t n;
+    bool ready;
+    struct docio_object doc[FDB_COMPACTION_BATCHSIZE];
+};
+
+struct _fdb_compact_pipeline {
+    fdb_kvs_handle *handle;
+    fdb_kvs_handle *new_handle;
+    mutex_t lock;
+
+    // readers
+    thread_cond_t read_cond;
+    thread_cond_t ready_cond;
+    uint64_t *offsets;
+    size_t noffsets;
+    size_t nbatches;
+    size_t next_read;
+    size_t next_write;
+    size_t nslots;
+    struct _fdb_compact_batch *slots;
+    size_t nreaders;
+    thread_t *readers;
+    bool terminate;
+
+    // index builder
+    thread_t builder;
+    thread_cond_t build_cond;
+    bool build_req;
+    bool building;
+    fdb_status build_status;
+    // documents to be bulk loaded by the current request
+    // (NULL: the WAL of the new file is flushed instead)
+    struct hbtrie_bulk *bulk;
+    struct _fdb_compact_bulk_doc *bulk_docs;
+    size_t bulk_n;
+    bool got_lock;
+};
+
+static void *_fdb_compact_reader_thread(void *voidargs)
+{
+    size_t idx, begin;
+    struct docio_handle dhandle;
+    struct _fdb_compact_batch *slot;
+    struct _fdb_compact_pipeline *pipe =
+        (struct _fdb_compact_pipeline *)voidargs;
+    fdb_kvs_handle *handle = pipe->handle;
+
+    // each reader has its own read buffer
+    docio_init(&dhandle, handle->file,
+               handle->config.compress_document_body);
+    dhandle.log_callback = handle->dhandle->log_callback;
+
+    mutex_lock(&pipe->lock);
+    while (true) {
+        // wait until there is a batch to be read and its slot is empty
+        while (!pipe->terminate &&
+               (pipe->next_read >= pipe->nbatches ||
+                pipe->next_read >= pipe->next_write + pipe->nslots)) {
+            thread_cond_wait(&pipe->read_cond, &pipe->lock);
+        }
+        if (pipe->terminate) {
+            break;
+        }
+        idx = pipe->next_read++;
+        mutex_unlock(&pipe->lock);
+
+        slot = &pipe->slots[idx % pipe->nslots];
+        begin = idx * FDB_COMPACTION_BATCHSIZE;
+        slot->n = MIN(pipe->noffsets - begin, FDB_COMPACTION_BATCHSIZE);
+        _fdb_compact_read_docs(handle, &dhandle, pipe->offsets + begin,
+                               slot->n, slot->doc);
+
+        mutex_lock(&pipe->lock);
+        slot->ready = true;
+        thread_cond_broadcast(&pipe->ready_cond);
+    }
+    mutex_unlock(&pipe->lock);
+
+    docio_free(&dhandle);
+    thread_exit(0);
+    return NULL;
+}
+
+static void *_fdb_compact_builder_thread(void *voidargs)
+{
+    size_t n;
+    struct _fdb_compact_bulk_doc *docs;
+    fdb_status fs;
+    struct _fdb_compact_pipeline *pipe =
+        (struct _fdb_compact_pipeline *)voidargs;
+
+    mutex_lock(&pipe->lock);
+    while (true) {
+        while (!pipe->build_req && !pipe->terminate) {
+            thread_cond_wait(&pipe->build_cond, &pipe->lock);
+        }
+        if (!pipe->build_req) {
+            break;
+        }
+        pipe->build_req = false;
+        docs = pipe->bulk_docs;
+        n = pipe->bulk_n;
+        mutex_unlock(&pipe->lock);
 
-    for (; offset < stop_offset;
-        offset = ((offset / blocksize) + 1) * blocksize) { // next block's off
-        if (!docio_check_buffer(handle->dhandle, offset / blocksize)) {
-            continue;
+        if (docs) {
+            fs = _fdb_compact_bulk_load(pipe->new_handle, pipe->bulk,
+                                        docs, n, pipe->got_lock);
         } else {
-            do {
-                fdb_doc wal_doc;
-                uint8_t deleted;
-                struct docio_object doc;
-                uint64_t _offset;
-                memset(&doc, 0, sizeof(doc));
-                _offset = docio_read_doc(handle->dhandle, offset, &doc);
-                if (!doc.key && !(doc.length.flag & DOCIO_TXN_COMMITTED)) {
-                    // No more documents in this block, break go to next block
-                    free(doc.key);
-                    free(doc.meta);
-                    free(doc.body);
-                    offset = _offset;
-                    break;
-                }
-                // check if the doc is transactional or not, and
-                // also check if the doc contains system info
-                if (doc.length.flag & DOCIO_TXN_DIRTY ||
-                    doc.length.flag & DOCIO_SYSTEM) {
-                    // skip transactional document or system document
-                    free(doc.key);
-                    free(doc.meta);
-                    free(doc.body);
-                    offset = _offset;
-                    continue;
-                    // do not break.. read next doc
-                }
-                if (doc.length.flag & DOCIO_TXN_COMMITTED) {
-                    // commit mark .. read the previously skipped doc
-                    docio_read_doc(handle->dhandle, doc.doc_offset, &doc);
-                    if (doc.key == NULL) { // doc read error
-                        free(doc.meta);
-                        free(doc.body);
-                        offset = _offset;
-                        continue;
-                    }
-                }
+            fs = _fdb_compact_build_index(pipe->new_handle);
+        }
 
-                // If a rollback was requested on this file, skip
-                // any db items written past the rollback point
-                if (!handle->kvs) {
-                    if (doc.seqnum > handle->seqnum) {
-                        free(doc.key);
-                        free(doc.meta);
-                        free(doc.body);
-                        offset = _offset;
-                        continue;
-                    }
-                } else {
-                    // check seqnum before insert
-                    fdb_kvs_id_t kv_id;
-                    fdb_seqnum_t kv_seqnum;
-                    buf2kvid(handle->config.chunksize, doc.key, &kv_id);
+        mutex_lock(&pipe->lock);
+        if (fs != FDB_RESULT_SUCCESS) {
+            pipe->build_status = fs;
+        }
+        pipe->building = false;
+        thread_cond_broadcast(&pipe->build_cond);
+    }
+    mutex_unlock(&pipe->lock);
 
-                    if (handle->config.seqtree_opt == FDB_SEQTREE_USE) {
-                        kv_seqnum = fdb_kvs_get_seqnum(handle->file, kv_id);
-                    } else {
-                        kv_seqnum = SEQNUM_NOT_USED;
-                    }
-                    // Only pick up items written before any rollback
-                    if (doc.seqnum > kv_seqnum) {
-                        free(doc.key);
-                        free(doc.meta);
-                        free(doc.body);
-                        offset = _offset;
-                        continue;
-                    }
-                }
-                // compare timestamp
-                // Do not re-write the document to new file if
-                // 1. the document is deleted OR
-                // 2. the document is not logically deleted but
-                //    its timestamp is overdue
-                deleted = doc.length.flag & DOCIO_DELETED;
-                if (deleted && cur_timestamp >= doc.timestamp
-                                + handle->config.purging_interval) {
-                    free(doc.key);
-                    free(doc.meta);
-                    free(doc.body);
-                    offset = _offset;
-                    continue;
-                }
-                // Re-Write Document to the new file
-                new_offset = docio_append_doc(new_dhandle, &doc, deleted, 0);
-                if (new_offset == BLK_NOT_FOUND) {
-                    free(doc.key);
-                    free(doc.meta);
-                    free(doc.body);
-                    return FDB_RESULT_WRITE_FAIL;
-                }
+    thread_exit(0);
+    return NULL;
+}
 
-                // Restore the document into the WAL section of new file..
-                wal_doc.keylen = doc.length.keylen;
-                wal_doc.metalen = doc.length.metalen;
-                wal_doc.bodylen = doc.length.bodylen;
-                wal_doc.key = doc.key;
-                wal_doc.meta = doc.meta;
-                wal_doc.seqnum = doc.seqnum;
-                wal_doc.deleted = deleted;
-                wal_doc.size_ondisk = _fdb_get_docsize(doc.length);
+static void _fdb_compact_pipeline_init(struct _fdb_compact_pipeline *pipe,
+                                       fdb_kvs_handle *handle,
+                                       fdb_kvs_handle *new_handle,
+                                       struct hbtrie_bulk *bulk,
+                                       size_t nreaders,
+                                       bool got_lock)
+{
+    size_t i;
+
+    pipe->handle = handle;
+    pipe->new_handle = new_handle;
+    mutex_init(&pipe->lock);
+    thread_cond_init(&pipe->read_cond);
+    thread_cond_init(&pipe->ready_cond);
+    thread_cond_init(&pipe->build_cond);
+    pipe->offsets = NULL;
+    pipe->noffsets = pipe->nbatches = 0;
+    pipe->next_read = pipe->next_write = 0;
+    // each reader can read ahead by one batch
+    pipe->nslots = nreaders * 2;
+    pipe->slots = (struct _fdb_compact_batch *)
+                  calloc(pipe->nslots, sizeof(struct _fdb_compact_batch));
+    pipe->nreaders = nreaders;
+    pipe->readers = (thread_t *)calloc(nreaders, sizeof(thread_t));
+    pipe->terminate = false;
+    pipe->build_req = pipe->building = false;
+    pipe->build_status = FDB_RESULT_SUCCESS;
+    pipe->bulk = bulk;
+    pipe->bulk_docs = NULL;
+    pipe->bulk_n = 0;
+    pipe->got_lock = got_lock;
+
+    for (i=0; i<nreaders; ++i){
+        thread_create(&pipe->readers[i], _fdb_compact_reader_thread, pipe);
+    }
+    thread_create(&pipe->builder, _fdb_compact_builder_thread, pipe);
+}
 
-                wal_insert(&new_file->global_txn,
-                        new_file, &wal_doc, new_offset, 1);
-                n_moved_docs++;
-                free(doc.key);
-                free(doc.meta);
-                free(doc.body);
-                offset = _offset;
-            } while (offset + sizeof(struct docio_length) < stop_offset);
-        }
+// wait until the index builder finishes the current request
+// (and returns the first error it met)
+static fdb_status _fdb_compact_pipeline_wait_build(
+                                    struct _fdb_compact_pipeline *pipe)
+{
+    fdb_status fs;
+    mutex_lock(&pipe->lock);
+    while (pipe->building) {
+        thread_cond_wait(&pipe->build_cond, &pipe->lock);
     }
-    // wal flush into new file so all documents are reflected in its main index
-    if (n_moved_docs) {
-        struct avl_tree flush_items;
-        new_handle = *handle;
-        new_handle.file = new_file;
-        new_handle.trie = new_trie;
-        new_handle.idtree = new_idtree;
-        if (handle->kvs) {
-            new_handle.seqtrie = new_seqtrie;
-        } else {
-            new_handle.seqtree = new_seqtree;
-        }
-        new_handle.dhandle = new_dhandle;
-        new_handle.bhandle = new_bhandle;
+    fs = pipe->build_status;
+    mutex_unlock(&pipe->lock);
+    return fs;
+}
 
-        wal_flush_by_compactor(new_file, (void*)&new_handle,
-                               _fdb_wal_flush_func, _fdb_wal_get_old_offset,
-                               &flush_items);
-        wal_set_dirty_status(new_file, FDB_WAL_PENDING);
-        wal_release_flushed_items(new_file, &flush_items);
+// flush the WAL of the new file, or bulk load DOCS if given
+// (DOCS should not be reused until the request is done)
+static fdb_status _fdb_compact_pipeline_build(
+                                    struct _fdb_compact_pipeline *pipe,
+                                    struct _fdb_compact_bulk_doc *docs,
+                                    size_t n)
+{
+    // only one WAL flush (or bulk load) is done at a time
+    fdb_status fs = _fdb_compact_pipeline_wait_build(pipe);
+    if (fs == FDB_RESULT_SUCCESS) {
+        mutex_lock(&pipe->lock);
+        pipe->bulk_docs = docs;
+        pipe->bulk_n = n;
+        pipe->build_req = pipe->building = true;
+        thread_cond_signal(&pipe->build_cond);
+        mutex_unlock(&pipe->lock);
     }
+    return fs;
+}
 
+// move the documents at the sorted offsets to the new file
+static void _fdb_compact_pipeline_move(struct _fdb_compact_pipeline *pipe,
+                                       uint64_t *offsets, size_t n,
+                                       struct filemgr *new_file,
+                                       struct docio_handle *new_dhandle,
+                                       timestamp_t cur_timestamp,
+                                       struct _fdb_compact_bulk_doc *bulk_docs,
+                                       uint64_t *bulk_pos,
+                                       bool got_lock)
+{
+    size_t i, nbatches;
+    struct _fdb_compact_batch *slot;
+
+    nbatches = (n + FDB_COMPACTION_BATCHSIZE - 1) / FDB_COMPACTION_BATCHSIZE;
+    mutex_lock(&pipe->lock);
+    pipe->offsets = offsets;
+    pipe->noffsets = n;
+    pipe->nbatches = nbatches;
+    pipe->next_read = pipe->next_write = 0;
+    thread_cond_broadcast(&pipe->read_cond);
+    mutex_unlock(&pipe->lock);
+
+    for (i=0; i<nbatches; ++i){
+        slot = &pipe->slots[i % pipe->nslots];
+        mutex_lock(&pipe->lock);
+        while (!slot->ready) {
+            thread_cond_wait(&pipe->ready_cond, &pipe->lock);
+        }
+        mutex_unlock(&pipe->lock);
+
+        _fdb_compact_write_docs(pipe->handle, new_file, new_dhandle,
+                                slot->doc, slot->n, cur_timestamp, bulk_docs,
+                                (bulk_pos)?(bulk_pos +
+                                            i * FDB_COMPACTION_BATCHSIZE):
+                                           (NULL),
+                                got_lock);
+
+        mutex_lock(&pipe->lock);
+        slot->ready = false;
+        pipe->next_write++;
+        thread_cond_broadcast(&pipe->read_cond);
+        mutex_unlock(&pipe->lock);
+    }
+
+    // all offsets have been consumed by readers
+    mutex_lock(&pipe->lock);
+    pipe->offsets = NULL;
+    pipe->noffsets = pipe->nbatches = 0;
+    pipe->next_read = pipe->next_write = 0;
+    mutex_unlock(&pipe->lock);
+}
+
+static fdb_status _fdb_compact_pipeline_free(struct _fdb_compact_pipeline *pipe)
+{
+    size_t i;
+    void *ret;
+    fdb_status fs = _fdb_compact_pipeline_wait_build(pipe);
+
+    mutex_lock(&pipe->lock);
+    pipe->terminate = true;
+    thread_cond_broadcast(&pipe->read_cond);
+    thread_cond_broadcast(&pipe->build_cond);
+    mutex_unlock(&pipe->lock);
+
+    for (i=0; i<pipe->nreaders; ++i){
+        thread_join(pipe->readers[i], &ret);
+    }
+    thread_join(pipe->builder, &ret);
+
+    free(pipe->readers);
+    free(pipe->slots);
+    thread_cond_destroy(&pipe->read_cond);
+    thread_cond_destroy(&pipe->ready_cond);
+    thread_cond_destroy(&pipe->build_cond);
+    mutex_destroy(&pipe->lock);
     return fs;
 }
 
@@ -3556,21 +5229,26 @@ static fdb_status _fdb_compact_move_docs(fdb_kvs_handle *handle,
                                          struct btreeblk_handle *new_bhandle,
                                          bool got_lock)
 {
-    uint8_t deleted;
     uint64_t offset;
-    uint64_t new_offset;
     uint64_t *offset_array;
-    uint64_t n_moved_docs;
-    size_t i, j, c, count;
+    uint64_t *bulk_pos = NULL;
+    uint64_t *bulk_sort = NULL;
+    size_t i, c, n, count;
     size_t offset_array_max;
+    size_t nthreads = handle->config.compaction_num_threads;
     hbtrie_result hr;
+    struct hbtrie_bulk bulk;
+    struct _fdb_compact_bulk_doc *bulk_docs = NULL;
+    // the builder thread bulk loads one buffer while the other is filled
+    struct _fdb_compact_bulk_doc *bulk_bufs[2] = {NULL, NULL};
     struct docio_object doc[FDB_COMPACTION_BATCHSIZE];
     struct hbtrie_iterator it;
     struct timeval tv;
-    fdb_doc wal_doc;
     fdb_kvs_handle new_handle;
     timestamp_t cur_timestamp;
+    struct _fdb_compact_pipeline pipe;
     fdb_status fs = FDB_RESULT_SUCCESS;
+    fdb_status fs_build;
 
     gettimeofday(&tv, NULL);
     cur_timestamp = tv.tv_sec;
@@ -3590,7 +5268,31 @@ static fdb_status _fdb_compact_move_docs(fdb_kvs_handle *handle,
     offset_array_max =
         handle->config.compaction_buf_maxsize / sizeof(uint64_t);
     offset_array = (uint64_t*)malloc(sizeof(uint64_t) * offset_array_max);
-    c = count = n_moved_docs = 0;
+    c = count = 0;
+
+    if (handle->config.compaction_fill_factor &&
+        new_trie->root_bid == BLK_NOT_FOUND) {
+        // documents are visited in key order, so the main index of the new
+        // file can be built bottom-up without going through its WAL
+        hbtrie_bulk_init(&bulk, new_trie,
+                         handle->config.compaction_fill_factor);
+        // pairs of {offset, position in key order}
+        bulk_sort = (uint64_t*)malloc(sizeof(uint64_t) * 2 *
+                                      offset_array_max);
+        bulk_pos = (uint64_t*)malloc(sizeof(uint64_t) * offset_array_max);
+        for (i=0; i<((nthreads)?(2):(1)); ++i){
+            bulk_bufs[i] = (struct _fdb_compact_bulk_doc *)
+                           calloc(offset_array_max,
+                                  sizeof(struct _fdb_compact_bulk_doc));
+        }
+        bulk_docs = bulk_bufs[0];
+    }
+
+    if (nthreads) {
+        _fdb_compact_pipeline_init(&pipe, handle, &new_handle,
+                                   (bulk_docs)?(&bulk):(NULL), nthreads,
+                                   got_lock);
+    }
 
     hr = hbtrie_iterator_init(handle->trie, &it, NULL, 0);
 
@@ -3599,15 +5301,18 @@ static fdb_status _fdb_compact_move_docs(fdb_kvs_handle *handle,
         hr = hbtrie_next_value_only(&it, (void*)&offset);
         fs = btreeblk_end(handle->bhandle);
         if (fs != FDB_RESULT_SUCCESS) {
-            hbtrie_iterator_free(&it);
-            free(offset_array);
-            return fs;
+            break;
         }
         offset = _endian_decode(offset);
 
         if ( hr != HBTRIE_RESULT_FAIL ) {
             // add to offset array
-            offset_array[c] = offset;
+            if (bulk_docs) {
+                bulk_sort[c*2] = offset;
+                bulk_sort[c*2+1] = c;
+            } else {
+                offset_array[c] = offset;
+            }
             c++;
         }
 
@@ -3617,73 +5322,58 @@ static fdb_status _fdb_compact_move_docs(fdb_kvs_handle *handle,
         if (c >= offset_array_max ||
             (c > 0 && hr == HBTRIE_RESULT_FAIL)) {
             // quick sort
-            qsort(offset_array, c, sizeof(uint64_t), _fdb_cmp_uint64_t);
-
-            for (i=0; i<c; i+=FDB_COMPACTION_BATCHSIZE) {
-                for(j=i; j<MIN(c, i+FDB_COMPACTION_BATCHSIZE); ++j){
-                    offset = offset_array[j];
-
-                    doc[j-i].key = NULL;
-                    doc[j-i].meta = NULL;
-                    doc[j-i].body = NULL;
-                    docio_read_doc(handle->dhandle, offset, &doc[j-i]);
-                }
-
-                if (!got_lock) {
-                    filemgr_mutex_lock(new_file);
+            if (bulk_docs) {
+                // keep the position of each offset in key order
+                qsort(bulk_sort, c, sizeof(uint64_t) * 2, _fdb_cmp_uint64_t);
+                for (i=0; i<c; ++i){
+                    offset_array[i] = bulk_sort[i*2];
+                    bulk_pos[i] = bulk_sort[i*2+1];
                 }
-                for(j=i; j<MIN(c, i+FDB_COMPACTION_BATCHSIZE); ++j){
-                    // compare timestamp
-                    deleted = doc[j-i].length.flag & DOCIO_DELETED;
-                    if (!deleted ||
-                        (cur_timestamp < doc[j-i].timestamp +
-                                         handle->config.purging_interval &&
-                         deleted)) {
-                        // re-write the document to new file when
-                        // 1. the document is not deleted
-                        // 2. the document is logically deleted but
-                        //    its timestamp isn't overdue
-                        new_offset = docio_append_doc(new_dhandle, &doc[j-i],
-                                                      deleted, 0);
-
-                        wal_doc.keylen = doc[j-i].length.keylen;
-                        wal_doc.metalen = doc[j-i].length.metalen;
-                        wal_doc.bodylen = doc[j-i].length.bodylen;
-                        wal_doc.key = doc[j-i].key;
-                        wal_doc.seqnum = doc[j-i].seqnum;
-
-                        wal_doc.meta = doc[j-i].meta;
-                        wal_doc.body = doc[j-i].body;
-                        wal_doc.size_ondisk= _fdb_get_docsize(doc[j-i].length);
-                        wal_doc.deleted = deleted;
-
-                        wal_insert(&new_file->global_txn,
-                                   new_file, &wal_doc, new_offset, 1);
-                        n_moved_docs++;
+            } else {
+                qsort(offset_array, c, sizeof(uint64_t), _fdb_cmp_uint64_t);
+            }
 
-                    }
-                    free(doc[j-i].key);
-                    free(doc[j-i].meta);
-                    free(doc[j-i].body);
-                }
-                if (!got_lock) {
-                    filemgr_mutex_unlock(new_file);
+            if (nthreads) {
+                _fdb_compact_pipeline_move(&pipe, offset_array, c, new_file,
+                                           new_dhandle, cur_timestamp,
+                                           bulk_docs, bulk_pos, got_lock);
+            } else {
+                for (i=0; i<c; i+=FDB_COMPACTION_BATCHSIZE) {
+                    n = MIN(c - i, FDB_COMPACTION_BATCHSIZE);
+                    _fdb_compact_read_docs(handle, handle->dhandle,
+                                           offset_array + i, n, doc);
+                    _fdb_compact_write_docs(handle, new_file, new_dhandle,
+                                            doc, n, cur_timestamp, bulk_docs,
+                                            (bulk_pos)?(bulk_pos + i):(NULL),
+                                            got_lock);
                 }
             }
+            n = c;
             // reset to zero
             c=0;
             count++;
 
             // wal flush
-            if (wal_get_num_flushable(new_file) > 0) {
-                struct avl_tree flush_items;
-                wal_flush_by_compactor(new_file, (void*)&new_handle,
-                                       _fdb_wal_flush_func,
-                                       _fdb_wal_get_old_offset,
-                                       &flush_items);
-                wal_set_dirty_status(new_file, FDB_WAL_PENDING);
-                wal_release_flushed_items(new_file, &flush_items);
-                n_moved_docs = 0;
+            if (nthreads) {
+                // the index is built while the next offsets are processed
+                fs = _fdb_compact_pipeline_build(&pipe, bulk_docs, n);
+                if (bulk_docs) {
+                    if (fs != FDB_RESULT_SUCCESS) {
+                        // not handed over to the builder thread
+                        for (i=0; i<n; ++i){
+                            free(bulk_docs[i].key);
+                        }
+                    }
+                    bulk_docs = bulk_bufs[count % 2];
+                }
+            } else if (bulk_docs) {
+                fs = _fdb_compact_bulk_load(&new_handle, &bulk, bulk_docs, n,
+                                            got_lock);
+            } else {
+                fs = _fdb_compact_build_index(&new_handle);
+            }
+            if (fs != FDB_RESULT_SUCCESS) {
+                break;
             }
 
             // If the rollback operation is issued, abort the compaction task.
@@ -3694,6 +5384,26 @@ static fdb_status _fdb_compact_move_docs(fdb_kvs_handle *handle,
         }
     }
 
+    if (nthreads) {
+        // wait for the last WAL flush
+        fs_build = _fdb_compact_pipeline_free(&pipe);
+        if (fs == FDB_RESULT_SUCCESS) {
+            fs = fs_build;
+        }
+    }
+
+    if (bulk_docs) {
+        if (fs == FDB_RESULT_SUCCESS) {
+            fs = _fdb_compact_bulk_finish(&new_handle, &bulk);
+        } else {
+            hbtrie_bulk_free(&bulk);
+        }
+        free(bulk_sort);
+        free(bulk_pos);
+        free(bulk_bufs[0]);
+        free(bulk_bufs[1]);
+    }
+
     hbtrie_iterator_free(&it);
     free(offset_array);
     return fs;
@@ -3851,6 +5561,9 @@ fdb_status fdb_compact_file(fdb_file_handle *fhandle,
     if (!(handle->config.durability_opt & FDB_DRB_ASYNC)) {
         fconfig.options |= FILEMGR_SYNC;
     }
+    if (handle->config.group_commit) {
+        fconfig.options |= FILEMGR_GROUP_COMMIT;
+    }
 
     // open new file
     filemgr_open_result result = filemgr_open((char *)new_filename,
@@ -3868,6 +5581,9 @@ fdb_status fdb_compact_file(fdb_file_handle *fhandle,
     filemgr_set_in_place_compaction(new_file, in_place_compaction);
     // prevent update to the new_file
     filemgr_mutex_lock(new_file);
+    // the key filter of the new file is built while moving documents
+    _fdb_bloom_create(handle, new_file,
+                      _kvs_stat_get_sum(handle->file, KVS_STAT_NDOCS));
 
     // create new hb-trie and related handles
     new_bhandle = (struct btreeblk_handle *)calloc(1, sizeof(struct btreeblk_handle));
@@ -3957,7 +5673,7 @@ fdb_status _fdb_compact_file(fdb_kvs_handle *handle,
     // flush WAL and set DB header
     wal_commit(&handle->file->global_txn, handle->file, NULL);
     wal_flush(handle->file, (void*)handle,
-              _fdb_wal_flush_func, _fdb_wal_get_old_offset, &flush_items);
+              _fdb_wal_flush_func, &flush_items);
     wal_set_dirty_status(handle->file, FDB_WAL_CLEAN);
 
     // migrate uncommitted transaction items to new file
@@ -4191,6 +5907,9 @@ catch_up_compaction:
         if (!(rhandle->config.durability_opt & FDB_DRB_ASYNC)) {
             fconfig.options |= FILEMGR_SYNC;
         }
+        if (rhandle->config.group_commit) {
+            fconfig.options |= FILEMGR_GROUP_COMMIT;
+        }
 
         // open new file
         filemgr_open_result result = filemgr_open((char *)new_filename,
@@ -4211,6 +5930,9 @@ catch_up_compaction:
         filemgr_set_in_place_compaction(new_file, in_place_compaction);
         // GRAB FILE LOCK: prevent any update to the new_file
         filemgr_mutex_lock(new_file);
+        // the key filter of the new file is built while moving documents
+        _fdb_bloom_create(rhandle, new_file,
+                          _kvs_stat_get_sum(rhandle->file, KVS_STAT_NDOCS));
         // create new hb-trie and related handles
         new_bhandle = (struct btreeblk_handle *)calloc(1,
                                                sizeof(struct btreeblk_handle));
@@ -4542,17 +6264,37 @@ LIBFDB_API
 fdb_status fdb_close(fdb_file_handle *fhandle)
 {
     fdb_status fs;
+    struct filemgr *file = fhandle->root->file;
+
+    // the WAL flusher thread may still refer to the file, and should not
+    // open it again while (or after) the last handle is closed
+    wal_flusher_close_begin(file);
 
     if (fhandle->root->config.auto_commit &&
-        filemgr_get_ref_count(fhandle->root->file) == 1) {
+        filemgr_get_ref_count(file) == 1) {
         // auto commit mode & the last handle referring the file
         // commit file before close
         fs = fdb_commit(fhandle, FDB_COMMIT_NORMAL);
         if (fs != FDB_RESULT_SUCCESS) {
+            wal_flusher_close_end(file);
             return fs;
         }
     }
 
+    fs = _fdb_close_root(fhandle->root);
+    if (fs == FDB_RESULT_SUCCESS) {
+        fdb_file_handle_close_all(fhandle);
+        fdb_file_handle_free(fhandle);
+    }
+    wal_flusher_close_end(file);
+    return fs;
+}
+
+// close a handle opened by fdb_open_for_wal_flusher()
+fdb_status fdb_close_for_wal_flusher(fdb_file_handle *fhandle)
+{
+    fdb_status fs;
+
     fs = _fdb_close_root(fhandle->root);
     if (fs == FDB_RESULT_SUCCESS) {
         fdb_file_handle_close_all(fhandle);
@@ -4791,6 +6533,106 @@ fdb_status fdb_get_file_info(fdb_file_handle *fhandle, fdb_file_info *info)
     return FDB_RESULT_SUCCESS;
 }
 
+LIBFDB_API
+fdb_status fdb_get_buffer_cache_info(fdb_buffer_cache_info *info)
+{
+    struct bcache_stats stats;
+
+    if (!info) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    // all counters are zero if the buffer cache is disabled
+    bcache_get_stats(&stats);
+    info->num_blocks = stats.nblock;
+    info->num_free_blocks = stats.nfree;
+    info->num_dirty_blocks = stats.ndirty;
+    info->num_index_blocks = stats.nindex;
+    info->num_data_blocks = stats.ndata;
+    info->num_index_reserved_blocks = stats.nindex_reserved;
+    info->num_index_evictions = stats.nindex_evict;
+    info->num_data_evictions = stats.ndata_evict;
+
+    return FDB_RESULT_SUCCESS;
+}
+
+LIBFDB_API
+fdb_status fdb_get_group_commit_info(fdb_file_handle *fhandle,
+                                     fdb_group_commit_info *info)
+{
+    struct filemgr_group_commit_stats stats;
+
+    if (!fhandle || !info) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    filemgr_get_group_commit_stats(fhandle->root->file, &stats);
+    info->num_commits = stats.ncommits;
+    info->num_syncs = stats.nsyncs;
+    info->last_batch_size = stats.last_batch;
+    info->max_batch_size = stats.max_batch;
+
+    return FDB_RESULT_SUCCESS;
+}
+
+LIBFDB_API
+fdb_status fdb_get_wal_flush_info(fdb_file_handle *fhandle,
+                                  fdb_wal_flush_info *info)
+{
+    struct wal_flush_stats stats;
+
+    if (!fhandle || !info) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    wal_get_flush_stats(fhandle->root->file, &stats);
+    info->num_bg_flushes = stats.nflushes;
+    info->bg_flush_time = stats.flush_time;
+    info->num_stalls = stats.nstalls;
+    info->stall_time = stats.stall_time;
+
+    return FDB_RESULT_SUCCESS;
+}
+
+LIBFDB_API
+fdb_status fdb_get_wal_memory_info(fdb_file_handle *fhandle,
+                                   fdb_wal_memory_info *info)
+{
+    if (!fhandle || !info) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    info->mem_usage = wal_get_mem_usage(fhandle->root->file);
+    info->global_mem_usage = wal_get_global_mem_usage();
+    info->global_mem_budget = wal_get_global_mem_budget();
+
+    return FDB_RESULT_SUCCESS;
+}
+
+LIBFDB_API
+fdb_status fdb_get_bloom_filter_info(fdb_file_handle *fhandle,
+                                     fdb_bloom_filter_info *info)
+{
+    struct bloomfilter *bf;
+
+    if (!fhandle || !info) {
+        return FDB_RESULT_INVALID_ARGS;
+    }
+
+    memset(info, 0x0, sizeof(fdb_bloom_filter_info));
+    fdb_check_file_reopen(fhandle->root, NULL);
+    bf = fhandle->root->file->bloom;
+    if (bf) {
+        info->num_keys = bloomfilter_get_num_keys(bf);
+        info->space_used = bloomfilter_get_space_used(bf);
+        info->num_lookups = bf->nlookups.value.val_64;
+        info->num_negatives = bf->nnegatives.value.val_64;
+        info->num_false_positives = bf->nfalse_positives.value.val_64;
+    }
+
+    return FDB_RESULT_SUCCESS;
+}
+
 LIBFDB_API
 fdb_status fdb_get_all_snap_markers(fdb_file_handle *fhandle,
                                     fdb_snapshot_info_t **markers_out,
@@ -4937,7 +6779,9 @@ fdb_status fdb_shutdown()
             return FDB_RESULT_FILE_IS_BUSY;
         }
         compactor_shutdown();
+        wal_flusher_shutdown();
         filemgr_shutdown();
+        filemgr_ops_shutdown();
 #ifdef _MEMPOOL
         mempool_shutdown();
 #endif
@@ -114,4 +114,17 @@
 #define _endian_decode(v) (v)
 #endif
 
+// conversion from/to little endian (for the fields stored in little-endian
+// byte order, which are used as they are on little-endian machines)
+#if defined(_LITTLE_ENDIAN) || !defined(__ENDIAN_SAFE)
+#define _endian_encode_le(v) (v)
+#define _endian_decode_le(v) (v)
+#else
+#define _endian_encode_le(v) \
+    ((sizeof(v) == 8)?(bitswap64(v)):( \
+     (sizeof(v) == 4)?(bitswap32(v)):( \
+     (sizeof(v) == 2)?(bitswap16(v)):(v))))
+#define _endian_decode_le(v) _endian_encode_le(v)
+#endif
+
 #endif
@@ -51,6 +51,17 @@ struct hbtrie_meta {
     void *prefix;
 };
 
+// working space for hbtrie_insert_batch()
+struct hbtrie_batch_buf {
+    // reformed key
+    uint8_t *key;
+    // raw key of an existing document
+    uint8_t *docrawkey;
+    // b+tree key (chunk or leaf key) for each key in a run
+    uint8_t *slots;
+    void **keys;
+};
+
 #define _l2c(trie, len) ( ( (len) + ((trie)->chunksize-1) ) / (trie)->chunksize )
 
 // MUST return same value to '_get_nchunk(_hbtrie_reform_key(RAWKEY))'
@@ -540,7 +551,7 @@ static hbtrie_result _hbtrie_prev(struct hbtrie_iterator *it,
                     }
                 }
 
-                btree.kv_ops = trie->btree_leaf_kv_ops;
+                btree_set_kv_ops(&btree, trie->btree_leaf_kv_ops);
                 item_new->leaf = 1;
             } else {
                 item_new->leaf = 0;
@@ -785,7 +796,7 @@ static hbtrie_result _hbtrie_next(struct hbtrie_iterator *it,
                     }
                 }
 
-                btree.kv_ops = trie->btree_leaf_kv_ops;
+                btree_set_kv_ops(&btree, trie->btree_leaf_kv_ops);
                 item_new->leaf = 1;
             } else {
                 item_new->leaf = 0;
@@ -1046,7 +1057,7 @@ static hbtrie_result _hbtrie_find(struct hbtrie *trie, void *key, int keylen,
         if (_is_leaf_btree(hbmeta.chunkno)) {
             cpt_node = 1;
             hbmeta.chunkno = _get_chunkno(hbmeta.chunkno);
-            btree->kv_ops = trie->btree_leaf_kv_ops;
+            btree_set_kv_ops(btree, trie->btree_leaf_kv_ops);
         }
         curchunkno = hbmeta.chunkno;
 
@@ -1541,7 +1552,7 @@ INLINE hbtrie_result _hbtrie_insert(struct hbtrie *trie,
         if (_is_leaf_btree(hbmeta.chunkno)) {
             cpt_node = 1;
             hbmeta.chunkno = _get_chunkno(hbmeta.chunkno);
-            btreeitem->btree.kv_ops = trie->btree_leaf_kv_ops;
+            btree_set_kv_ops(&btreeitem->btree, trie->btree_leaf_kv_ops);
         }
         btreeitem->chunkno = curchunkno = hbmeta.chunkno;
 
@@ -2016,3 +2027,534 @@ hbtrie_result hbtrie_insert_partial(struct hbtrie *trie,
     return _hbtrie_insert(trie, rawkey, rawkeylen,
                           value, oldvalue_out, HBTRIE_PARTIAL_UPDATE);
 }
+
+// insert RAWKEYS[0] and the following keys that go into the same b+tree
+// without creating any new sub-tree (i.e., insertion of a new chunk, or
+// update of an existing document), and return the number of keys processed.
+// The keys in a run are inserted by btree_insert_batch(), and the parent
+// b+trees are updated only once for all of them.
+static size_t _hbtrie_insert_run(struct hbtrie *trie, size_t n,
+                                 void **rawkeys, int *rawkeylens,
+                                 void **values, void **oldvalues_out,
+                                 hbtrie_result *results,
+                                 struct hbtrie_batch_buf *bbuf)
+{
+    int nchunk, nchunk_j, rawkeylen;
+    int prevchunkno, curchunkno;
+    int cpt_node = 0;
+    size_t j, nrun;
+    uint32_t docrawkeylen = 0;
+    uint64_t offset;
+    uint8_t *slot;
+    void *chunk, *void_cmp;
+    struct list btreelist;
+    struct btreelist_item *btreeitem;
+    struct btree *btree;
+    struct hbtrie_meta hbmeta;
+    struct btree_meta meta;
+    btree_result r;
+    bid_t bid_new;
+    uint8_t *buf = alca(uint8_t, trie->btree_nodesize);
+    uint8_t *btree_value = alca(uint8_t, trie->valuelen);
+    uint8_t *key;
+
+    rawkeylen = rawkeylens[0];
+    nchunk = _get_nchunk_raw(trie, rawkeys[0], rawkeylen);
+    key = alca(uint8_t, nchunk * trie->chunksize);
+    _hbtrie_reform_key(trie, rawkeys[0], rawkeylen, key);
+
+    if (n == 1 || trie->root_bid == BLK_NOT_FOUND) {
+        goto insert_single;
+    }
+
+    if (trie->map) { // custom cmp functions exist
+        if (memcmp(trie->last_map_chunk, key, trie->chunksize)) {
+            // get cmp function corresponding to the key
+            void_cmp = trie->map(key, (void *)trie);
+            if (void_cmp) {
+                memcpy(trie->last_map_chunk, key, trie->chunksize);
+                // set aux for _fdb_custom_cmp_wrap()
+                trie->cmp_args.aux = void_cmp;
+                trie->aux = &trie->cmp_args;
+            }
+        }
+    }
+
+    meta.data = buf;
+    curchunkno = 0;
+    list_init(&btreelist);
+    btreeitem = (struct btreelist_item*)
+                mempool_alloc(sizeof(struct btreelist_item));
+    list_push_back(&btreelist, &btreeitem->e);
+    r = btree_init_from_bid(&btreeitem->btree, trie->btreeblk_handle,
+                            trie->btree_blk_ops, trie->btree_kv_ops,
+                            trie->btree_nodesize, trie->root_bid);
+    if (r != BTREE_RESULT_SUCCESS) {
+        goto fallback;
+    }
+    btreeitem->btree.aux = trie->aux;
+
+    // find the b+tree that the first key goes into
+    while (1) {
+        btree = &btreeitem->btree;
+        meta.size = btree_read_meta(btree, meta.data);
+        _hbtrie_fetch_meta(trie, meta.size, &hbmeta, meta.data);
+        prevchunkno = curchunkno;
+        if (_is_leaf_btree(hbmeta.chunkno)) {
+            cpt_node = 1;
+            hbmeta.chunkno = _get_chunkno(hbmeta.chunkno);
+            btree_set_kv_ops(btree, trie->btree_leaf_kv_ops);
+        }
+        btreeitem->chunkno = curchunkno = hbmeta.chunkno;
+        if (curchunkno >= nchunk) {
+            goto fallback;
+        }
+
+        if (curchunkno - prevchunkno > 1) {
+            // prefix mismatch requires a new sub-tree
+            int diffchunkno = _hbtrie_find_diff_chunk(trie, hbmeta.prefix,
+                                  key + trie->chunksize * (prevchunkno+1),
+                                  0, curchunkno - (prevchunkno+1));
+            if (diffchunkno < curchunkno - (prevchunkno+1)) {
+                goto fallback;
+            }
+        }
+        if ((cpt_node && rawkeylen == curchunkno * trie->chunksize) ||
+            (!cpt_node && nchunk == curchunkno)) {
+            // key is stored in the meta section
+            goto fallback;
+        }
+
+        chunk = key + curchunkno * trie->chunksize;
+        slot = bbuf->slots;
+        if (cpt_node) {
+            _set_leaf_key(slot, chunk,
+                          rawkeylen - curchunkno * trie->chunksize);
+        } else {
+            memcpy(slot, chunk, trie->chunksize);
+        }
+        r = btree_find(btree, slot, btree_value);
+        if (r == BTREE_RESULT_FAIL) {
+            // new chunk
+            results[0] = HBTRIE_RESULT_SUCCESS;
+            break;
+        }
+
+        if (_hbtrie_is_msb_set(trie, btree_value)) {
+            // traverse to the sub-tree
+            if (cpt_node) {
+                _free_leaf_key(slot);
+            }
+            _hbtrie_clear_msb(trie, btree_value);
+            bid_new = trie->btree_kv_ops->value2bid(btree_value);
+            bid_new = _endian_decode(bid_new);
+            btreeitem->child_rootbid = bid_new;
+            btreeitem = (struct btreelist_item*)
+                        mempool_alloc(sizeof(struct btreelist_item));
+            list_push_back(&btreelist, &btreeitem->e);
+            r = btree_init_from_bid(&btreeitem->btree,
+                                    trie->btreeblk_handle,
+                                    trie->btree_blk_ops,
+                                    trie->btree_kv_ops,
+                                    trie->btree_nodesize, bid_new);
+            if (r != BTREE_RESULT_SUCCESS) {
+                goto fallback;
+            }
+            btreeitem->btree.aux = trie->aux;
+            continue;
+        }
+
+        // offset of a document .. only update of the same key is allowed
+        offset = trie->btree_kv_ops->value2bid(btree_value);
+        docrawkeylen = trie->readkey(trie->doc_handle, offset,
+                                     bbuf->docrawkey);
+        if (docrawkeylen != (uint32_t)rawkeylen ||
+            memcmp(bbuf->docrawkey, rawkeys[0], rawkeylen)) {
+            if (cpt_node) {
+                _free_leaf_key(slot);
+            }
+            goto fallback;
+        }
+        if (oldvalues_out && oldvalues_out[0]) {
+            memcpy(oldvalues_out[0], btree_value, trie->valuelen);
+        }
+        results[0] = HBTRIE_RESULT_UPDATE;
+        break;
+    }
+    bbuf->keys[0] = bbuf->slots;
+
+    // gather the following keys that go into the same b+tree
+    for (nrun = 1; nrun < n; ++nrun) {
+        j = nrun;
+        nchunk_j = _get_nchunk_raw(trie, rawkeys[j], rawkeylens[j]);
+        if (nchunk_j <= curchunkno ||
+            (cpt_node && rawkeylens[j] <= curchunkno * trie->chunksize) ||
+            (!cpt_node && nchunk_j == curchunkno)) {
+            break;
+        }
+        _hbtrie_reform_key(trie, rawkeys[j], rawkeylens[j], bbuf->key);
+        // the path from the root should be the same
+        if (memcmp(bbuf->key, key, curchunkno * trie->chunksize)) {
+            break;
+        }
+
+        chunk = bbuf->key + curchunkno * trie->chunksize;
+        slot = bbuf->slots + j * trie->chunksize;
+        if (cpt_node) {
+            _set_leaf_key(slot, chunk,
+                          rawkeylens[j] - curchunkno * trie->chunksize);
+        } else {
+            memcpy(slot, chunk, trie->chunksize);
+        }
+        // keys should be in ascending order without duplicates
+        if (btree->kv_ops->cmp(slot, bbuf->keys[j-1], btree->aux) <= 0) {
+            if (cpt_node) {
+                _free_leaf_key(slot);
+            }
+            break;
+        }
+
+        r = btree_find(btree, slot, btree_value);
+        if (r == BTREE_RESULT_FAIL) {
+            results[j] = HBTRIE_RESULT_SUCCESS;
+        } else {
+            if (!_hbtrie_is_msb_set(trie, btree_value)) {
+                offset = trie->btree_kv_ops->value2bid(btree_value);
+                docrawkeylen = trie->readkey(trie->doc_handle, offset,
+                                             bbuf->docrawkey);
+            }
+            if (_hbtrie_is_msb_set(trie, btree_value) ||
+                docrawkeylen != (uint32_t)rawkeylens[j] ||
+                memcmp(bbuf->docrawkey, rawkeys[j], rawkeylens[j])) {
+                // sub-tree or a different document with the same chunk
+                if (cpt_node) {
+                    _free_leaf_key(slot);
+                }
+                break;
+            }
+            if (oldvalues_out && oldvalues_out[j]) {
+                memcpy(oldvalues_out[j], btree_value, trie->valuelen);
+            }
+            results[j] = HBTRIE_RESULT_UPDATE;
+        }
+        bbuf->keys[j] = slot;
+    }
+
+    r = btree_insert_batch(btree, bbuf->keys, values, nrun);
+    if (cpt_node) {
+        for (j=0;j<nrun;++j){
+            _free_leaf_key(bbuf->keys[j]);
+        }
+    }
+    if (r == BTREE_RESULT_FAIL) {
+        for (j=0;j<nrun;++j){
+            results[j] = HBTRIE_RESULT_FAIL;
+        }
+    }
+
+    if (cpt_node && btree->height > trie->leaf_height_limit) {
+        // height growth .. extend!
+        _hbtrie_extend_leaf_tree(trie, &btreelist, btreeitem,
+                                 key, curchunkno * trie->chunksize);
+        return nrun;
+    }
+    _hbtrie_btree_cascaded_update(trie, &btreelist, key, 1);
+    return nrun;
+
+fallback:
+    _hbtrie_free_btreelist(&btreelist);
+insert_single:
+    results[0] = _hbtrie_insert(trie, rawkeys[0], rawkeylen, values[0],
+                                (oldvalues_out)?(oldvalues_out[0]):(NULL),
+                                0x0);
+    return 1;
+}
+
+hbtrie_result hbtrie_insert_batch(struct hbtrie *trie, size_t n,
+                                  void **rawkeys, int *rawkeylens,
+                                  void **values, void **oldvalues_out,
+                                  hbtrie_result *results)
+{
+    size_t i, nrun, maxlen = 0;
+    struct hbtrie_batch_buf bbuf;
+    hbtrie_result hr = HBTRIE_RESULT_SUCCESS;
+
+    if (n == 0) {
+        return hr;
+    }
+    for (i=0;i<n;++i){
+        if ((size_t)rawkeylens[i] > maxlen) {
+            maxlen = rawkeylens[i];
+        }
+    }
+    bbuf.key = (uint8_t *)malloc(
+        _get_nchunk_raw(trie, NULL, maxlen) * trie->chunksize);
+    bbuf.docrawkey = (uint8_t *)malloc(HBTRIE_MAX_KEYLEN);
+    bbuf.slots = (uint8_t *)malloc(n * trie->chunksize);
+    bbuf.keys = (void **)malloc(n * sizeof(void *));
+
+    for (i=0;i<n;i+=nrun){
+        nrun = _hbtrie_insert_run(trie, n-i, rawkeys+i, rawkeylens+i,
+                                  values+i,
+                                  (oldvalues_out)?(oldvalues_out+i):(NULL),
+                                  results+i, &bbuf);
+    }
+    for (i=0;i<n;++i){
+        if (results[i] == HBTRIE_RESULT_FAIL) {
+            hr = HBTRIE_RESULT_FAIL;
+        }
+    }
+
+    free(bbuf.key);
+    free(bbuf.docrawkey);
+    free(bbuf.slots);
+    free(bbuf.keys);
+    return hr;
+}
+
+struct hbtrie_bulk_level {
+    struct btree btree;
+    struct btree_bulk bulk;
+    chunkno_t chunkno;
+    // value of the key that is exactly same as the tree's prefix
+    uint8_t has_value;
+    uint8_t value[8];
+};
+
+void hbtrie_bulk_init(struct hbtrie_bulk *bulk, struct hbtrie *trie,
+                      uint8_t fill_factor)
+{
+    bulk->trie = trie;
+    bulk->fill_factor = fill_factor;
+    bulk->nlevels = bulk->max_levels = 0;
+    bulk->levels = NULL;
+    bulk->prev_key = NULL;
+    bulk->prev_keybuf_size = 0;
+    bulk->prev_nchunk = 0;
+    bulk->prev_pending = false;
+}
+
+// insert a new b+tree for CHUNKNO at POS of the stack
+static void _hbtrie_bulk_push(struct hbtrie_bulk *bulk, int pos,
+                              int chunkno)
+{
+    struct hbtrie *trie = bulk->trie;
+    struct hbtrie_bulk_level *level;
+
+    if (bulk->nlevels == bulk->max_levels) {
+        bulk->max_levels = (bulk->max_levels)?(bulk->max_levels * 2):(4);
+        bulk->levels = (struct hbtrie_bulk_level **)
+                       realloc(bulk->levels, sizeof(struct hbtrie_bulk_level*) *
+                                             bulk->max_levels);
+    }
+    level = (struct hbtrie_bulk_level *)
+            malloc(sizeof(struct hbtrie_bulk_level));
+    btree_bulk_init(&level->bulk, &level->btree, trie->btreeblk_handle,
+                    trie->btree_blk_ops, trie->btree_kv_ops,
+                    trie->btree_nodesize, trie->chunksize, trie->valuelen,
+                    0x0, bulk->fill_factor);
+    level->btree.aux = trie->aux;
+    level->chunkno = chunkno;
+    level->has_value = 0;
+
+    memmove(bulk->levels + pos + 1, bulk->levels + pos,
+            sizeof(struct hbtrie_bulk_level*) * (bulk->nlevels - pos));
+    bulk->levels[pos] = level;
+    bulk->nlevels++;
+}
+
+// add the pending previous key into the top b+tree
+static void _hbtrie_bulk_add_prev(struct hbtrie_bulk *bulk)
+{
+    btree_result br;
+    struct hbtrie *trie = bulk->trie;
+    struct hbtrie_bulk_level *level = bulk->levels[bulk->nlevels-1];
+
+    if (bulk->prev_nchunk == level->chunkno) {
+        // the key is exactly same as the tree's prefix .. meta section
+        level->has_value = 1;
+        memcpy(level->value, bulk->prev_value, trie->valuelen);
+    } else {
+        br = btree_bulk_add(&level->bulk,
+                            bulk->prev_key + level->chunkno * trie->chunksize,
+                            bulk->prev_value);
+        assert(br == BTREE_RESULT_SUCCESS);
+        (void)br;
+    }
+    bulk->prev_pending = false;
+}
+
+// finish the top b+tree and link it to its parent
+// (all keys in the tree share their prefix with the previous key)
+static hbtrie_result _hbtrie_bulk_pop(struct hbtrie_bulk *bulk)
+{
+    int prevchunkno;
+    bid_t _bid;
+    btree_result br;
+    struct btree_meta meta;
+    struct hbtrie *trie = bulk->trie;
+    struct hbtrie_bulk_level *level = bulk->levels[bulk->nlevels-1];
+    struct hbtrie_bulk_level *parent = NULL;
+    uint8_t *buf = alca(uint8_t, trie->btree_nodesize);
+
+    if (bulk->prev_pending) {
+        _hbtrie_bulk_add_prev(bulk);
+    }
+
+    if (bulk->nlevels > 1) {
+        parent = bulk->levels[bulk->nlevels-2];
+        prevchunkno = parent->chunkno;
+    } else {
+        prevchunkno = -1;
+    }
+    meta.data = buf;
+    _hbtrie_store_meta(trie, &meta.size, level->chunkno, HBMETA_NORMAL,
+                       bulk->prev_key + trie->chunksize * (prevchunkno+1),
+                       (level->chunkno - (prevchunkno+1)) * trie->chunksize,
+                       (level->has_value)?(level->value):(NULL), buf);
+    br = btree_bulk_finish(&level->bulk, &meta);
+    bulk->levels[--bulk->nlevels] = NULL;
+    if (br != BTREE_RESULT_SUCCESS) {
+        free(level);
+        return HBTRIE_RESULT_FAIL;
+    }
+
+    if (parent) {
+        _bid = _endian_encode(level->btree.root_bid);
+        _hbtrie_set_msb(trie, (void *)&_bid);
+        br = btree_bulk_add(&parent->bulk,
+                            bulk->prev_key + parent->chunkno * trie->chunksize,
+                            (void *)&_bid);
+        assert(br == BTREE_RESULT_SUCCESS);
+    } else {
+        trie->root_bid = level->btree.root_bid;
+    }
+    free(level);
+    return HBTRIE_RESULT_SUCCESS;
+}
+
+hbtrie_result hbtrie_bulk_add(struct hbtrie_bulk *bulk,
+                              void *rawkey, int rawkeylen, void *value)
+{
+    int i, c, pos;
+    int nchunk, minchunkno, diffchunkno;
+    size_t chunksize;
+    struct hbtrie *trie = bulk->trie;
+    hbtrie_result hr;
+    uint8_t *key;
+
+    chunksize = trie->chunksize;
+    if (trie->flag & HBTRIE_FLAG_COMPACT) {
+        // optimization mode uses leaf b+trees, which are not supported
+        return HBTRIE_RESULT_FAIL;
+    }
+
+    nchunk = _get_nchunk_raw(trie, rawkey, rawkeylen);
+    key = alca(uint8_t, nchunk * chunksize);
+    _hbtrie_reform_key(trie, rawkey, rawkeylen, key);
+
+    if (trie->map) {
+        if (!memcmp(trie->last_map_chunk, key, chunksize) ||
+            trie->map(key, (void *)trie)) {
+            // keys having a custom cmp function go to leaf b+trees
+            return HBTRIE_RESULT_FAIL;
+        }
+    }
+
+    if (bulk->nlevels == 0) {
+        if (trie->root_bid != BLK_NOT_FOUND) {
+            // bulk loading is allowed only for an empty trie
+            return HBTRIE_RESULT_FAIL;
+        }
+        // root b-tree
+        _hbtrie_bulk_push(bulk, 0, 0);
+    } else {
+        minchunkno = MIN(bulk->prev_nchunk, nchunk);
+        diffchunkno = _hbtrie_find_diff_chunk(trie, bulk->prev_key, key,
+                                              0, minchunkno);
+        if (diffchunkno == minchunkno) {
+            // the previous key should be the shorter one
+            // (the key in meta section is returned first by the iterator)
+            if (bulk->prev_nchunk >= nchunk) {
+                return HBTRIE_RESULT_FAIL;
+            }
+        } else if (memcmp(key + diffchunkno * chunksize,
+                          bulk->prev_key + diffchunkno * chunksize,
+                          chunksize) < 0) {
+            // out of order
+            return HBTRIE_RESULT_FAIL;
+        }
+
+        // find the deepest tree whose chunk number is not greater than
+        // the chunk where the two keys diverge
+        for (i = bulk->nlevels-1; bulk->levels[i]->chunkno > diffchunkno; --i);
+
+        if (bulk->levels[i]->chunkno < diffchunkno) {
+            // the previous key (or its sub-tree) shares the same chunk with
+            // the key in tree I .. create new sub-tree(s) between them,
+            // splitting the skipped prefix if it is too long
+            c = bulk->levels[i]->chunkno;
+            pos = i+1;
+            while (trie->btree_nodesize > HBTRIE_HEADROOM &&
+                   (diffchunkno - c) * chunksize >
+                       trie->btree_nodesize - HBTRIE_HEADROOM) {
+                c += (trie->btree_nodesize - HBTRIE_HEADROOM) / chunksize;
+                _hbtrie_bulk_push(bulk, pos++, c);
+            }
+            _hbtrie_bulk_push(bulk, pos, diffchunkno);
+            i = pos;
+        }
+
+        // all sub-trees of the previous key below tree I are complete now
+        while (bulk->nlevels-1 > i) {
+            hr = _hbtrie_bulk_pop(bulk);
+            if (hr != HBTRIE_RESULT_SUCCESS) {
+                return hr;
+            }
+        }
+        if (bulk->prev_pending) {
+            _hbtrie_bulk_add_prev(bulk);
+        }
+    }
+
+    // the key is pending until the next key arrives
+    if (bulk->prev_keybuf_size < nchunk * (int)chunksize) {
+        bulk->prev_keybuf_size = nchunk * chunksize;
+        bulk->prev_key = (uint8_t *)realloc(bulk->prev_key,
+                                            bulk->prev_keybuf_size);
+    }
+    memcpy(bulk->prev_key, key, nchunk * chunksize);
+    bulk->prev_nchunk = nchunk;
+    memcpy(bulk->prev_value, value, trie->valuelen);
+    bulk->prev_pending = true;
+
+    return HBTRIE_RESULT_SUCCESS;
+}
+
+hbtrie_result hbtrie_bulk_finish(struct hbtrie_bulk *bulk)
+{
+    hbtrie_result hr = HBTRIE_RESULT_SUCCESS;
+
+    while (bulk->nlevels > 0 && hr == HBTRIE_RESULT_SUCCESS) {
+        hr = _hbtrie_bulk_pop(bulk);
+    }
+    hbtrie_bulk_free(bulk);
+    return hr;
+}
+
+void hbtrie_bulk_free(struct hbtrie_bulk *bulk)
+{
+    int i;
+
+    for (i=0; i<bulk->nlevels; ++i){
+        btree_bulk_free(&bulk->levels[i]->bulk);
+        free(bulk->levels[i]);
+    }
+    free(bulk->levels);
+    free(bulk->prev_key);
+    bulk->levels = NULL;
+    bulk->prev_key = NULL;
+    bulk->nlevels = bulk->max_levels = 0;
+    bulk->prev_keybuf_size = 0;
+    bulk->prev_pending = false;
+}
@@ -157,6 +157,42 @@ hbtrie_result hbtrie_insert(struct hbtrie *trie,
 hbtrie_result hbtrie_insert_partial(struct hbtrie *trie,
                                     void *rawkey, int rawkeylen,
                                     void *value, void *oldvalue_out);
+// insert N keys at once. Keys sorted in lexicographical order are grouped by
+// the b+tree (and its leaf node) they belong to, and each group is inserted
+// by btree_insert_batch(), so that every node on the path is modified only
+// once per group. The result (SUCCESS for a new key, or UPDATE) and the old
+// value of each key are returned through RESULTS and OLDVALUES_OUT.
+hbtrie_result hbtrie_insert_batch(struct hbtrie *trie, size_t n,
+                                  void **rawkeys, int *rawkeylens,
+                                  void **values, void **oldvalues_out,
+                                  hbtrie_result *results);
+
+// bottom-up bulk loading of an empty HB+trie from keys given in the order of
+// hbtrie_next(). Each b+tree in the trie is built by btree_bulk_add(), while
+// the previous key is kept pending until the next key shows which chunk they
+// diverge at (i.e., whether the previous key needs its own sub-tree or not).
+struct hbtrie_bulk_level;
+struct hbtrie_bulk {
+    struct hbtrie *trie;
+    uint8_t fill_factor;
+    // stack of b+trees on the path of the previous key
+    int nlevels;
+    int max_levels;
+    struct hbtrie_bulk_level **levels;
+    // previous key (reformed) that is not added into the top b+tree yet
+    uint8_t *prev_key;
+    int prev_keybuf_size;
+    int prev_nchunk;
+    uint8_t prev_value[8];
+    bool prev_pending;
+};
+
+void hbtrie_bulk_init(struct hbtrie_bulk *bulk, struct hbtrie *trie,
+                      uint8_t fill_factor);
+hbtrie_result hbtrie_bulk_add(struct hbtrie_bulk *bulk,
+                              void *rawkey, int rawkeylen, void *value);
+hbtrie_result hbtrie_bulk_finish(struct hbtrie_bulk *bulk);
+void hbtrie_bulk_free(struct hbtrie_bulk *bulk);
 
 #ifdef __cplusplus
 }
@@ -274,6 +274,11 @@ struct _fdb_kvs_handle {
      * Flag that indicates whether this handle made dirty updates or not.
      */
     uint8_t dirty_updates;
+    /**
+     * Flag that indicates whether this handle is opened by the WAL flusher
+     * thread, which does not restore WAL entries from the file.
+     */
+    uint8_t wal_flusher;
     /**
      * List element that will be inserted into 'handles' list in the root handle.
      */
@@ -281,6 +286,8 @@ struct _fdb_kvs_handle {
 };
 
 struct hbtrie_iterator;
+struct wal_view;
+struct snap_wal_entry;
 struct avl_tree;
 struct avl_node;
 
@@ -347,6 +354,15 @@ struct _fdb_iterator {
      * AVL tree for WAL entries.
      */
     struct avl_tree *wal_tree;
+    /**
+     * MVCC view of the WAL's key index, used instead of copying WAL entries
+     * into 'wal_tree'. The cursors then point to 'wal_item's in the index.
+     */
+    struct wal_view *wal_view;
+    /**
+     * WAL entry at a cursor of 'wal_view'.
+     */
+    struct snap_wal_entry *wal_entry;
     /**
      * Cursor instance of AVL tree for WAL entries.
      */
@@ -441,7 +457,7 @@ struct _fdb_transaction {
      */
     uint64_t prev_hdr_bid;
     /**
-     * List of dirty WAL items.
+     * Lists of dirty WAL items (one for each WAL key shard).
      */
     struct list *items;
     /**
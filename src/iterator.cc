@@ -195,6 +195,158 @@ static bool _fdb_itr_chk_lock(fdb_iterator *iterator)
     return locked;
 }
 
+// WAL cursor operations. Cursors point either to entries in the iterator's
+// own WAL tree (snapshot or custom compare function), or to items in the
+// WAL's key index seen through 'wal_view'. In the latter case, keys out of
+// the iteration range are hidden, as they are not copied into 'wal_tree'.
+
+// returns -1 if the key is smaller than the range, 1 if greater, or 0
+static int _fdb_itr_wal_range(fdb_iterator *iterator,
+                              void *key, size_t keylen)
+{
+    int cmp;
+
+    if (iterator->start_key) {
+        cmp = _fdb_key_cmp(iterator, iterator->start_key,
+                           iterator->start_keylen, key, keylen);
+        if ((cmp == 0 && iterator->opt & FDB_ITR_SKIP_MIN_KEY) || cmp > 0) {
+            return -1;
+        }
+    }
+    if (iterator->end_key) {
+        cmp = _fdb_key_cmp(iterator, iterator->end_key,
+                           iterator->end_keylen, key, keylen);
+        if ((cmp == 0 && iterator->opt & FDB_ITR_SKIP_MAX_KEY) || cmp < 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// move forward until the item enters the range
+static struct avl_node *_fdb_itr_wal_fwd(fdb_iterator *iterator,
+                                         struct wal_item *item)
+{
+    int range;
+
+    while (item) {
+        range = _fdb_itr_wal_range(iterator, item->header->key,
+                                   item->header->keylen);
+        if (range > 0) {
+            return NULL;
+        } else if (range == 0) {
+            return &item->avl_key;
+        }
+        item = wal_view_next(iterator->wal_view, item);
+    }
+    return NULL;
+}
+
+// move backward until the item enters the range
+static struct avl_node *_fdb_itr_wal_rev(fdb_iterator *iterator,
+                                         struct wal_item *item)
+{
+    int range;
+
+    while (item) {
+        range = _fdb_itr_wal_range(iterator, item->header->key,
+                                   item->header->keylen);
+        if (range < 0) {
+            return NULL;
+        } else if (range == 0) {
+            return &item->avl_key;
+        }
+        item = wal_view_prev(iterator->wal_view, item);
+    }
+    return NULL;
+}
+
+static struct avl_node *_fdb_itr_wal_next(fdb_iterator *iterator,
+                                          struct avl_node *cursor)
+{
+    if (!iterator->wal_view) {
+        return avl_next(cursor);
+    }
+    return _fdb_itr_wal_fwd(iterator,
+               wal_view_next(iterator->wal_view,
+                             _get_entry(cursor, struct wal_item, avl_key)));
+}
+
+static struct avl_node *_fdb_itr_wal_prev(fdb_iterator *iterator,
+                                          struct avl_node *cursor)
+{
+    if (!iterator->wal_view) {
+        return avl_prev(cursor);
+    }
+    return _fdb_itr_wal_rev(iterator,
+               wal_view_prev(iterator->wal_view,
+                             _get_entry(cursor, struct wal_item, avl_key)));
+}
+
+static struct avl_node *_fdb_itr_wal_first(fdb_iterator *iterator)
+{
+    if (!iterator->wal_view) {
+        return avl_first(iterator->wal_tree);
+    }
+    return _fdb_itr_wal_fwd(iterator, wal_view_first(iterator->wal_view));
+}
+
+static struct avl_node *_fdb_itr_wal_last(fdb_iterator *iterator)
+{
+    if (!iterator->wal_view) {
+        return avl_last(iterator->wal_tree);
+    }
+    return _fdb_itr_wal_rev(iterator, wal_view_last(iterator->wal_view));
+}
+
+static struct avl_node *_fdb_itr_wal_search_greater(fdb_iterator *iterator,
+                                                    void *key, size_t keylen)
+{
+    struct snap_wal_entry query;
+
+    if (!iterator->wal_view) {
+        query.key = key;
+        query.keylen = keylen;
+        return avl_search_greater(iterator->wal_tree, &query.avl,
+                                  _fdb_wal_cmp);
+    }
+    return _fdb_itr_wal_fwd(iterator,
+               wal_view_search_greater(iterator->wal_view, key, keylen));
+}
+
+static struct avl_node *_fdb_itr_wal_search_smaller(fdb_iterator *iterator,
+                                                    void *key, size_t keylen)
+{
+    struct snap_wal_entry query;
+
+    if (!iterator->wal_view) {
+        query.key = key;
+        query.keylen = keylen;
+        return avl_search_smaller(iterator->wal_tree, &query.avl,
+                                  _fdb_wal_cmp);
+    }
+    return _fdb_itr_wal_rev(iterator,
+               wal_view_search_smaller(iterator->wal_view, key, keylen));
+}
+
+// the returned entry is valid until the next call
+static struct snap_wal_entry *_fdb_itr_wal_entry(fdb_iterator *iterator,
+                                                 struct avl_node *cursor)
+{
+    struct wal_item *item;
+
+    if (!iterator->wal_view) {
+        return _get_entry(cursor, struct snap_wal_entry, avl);
+    }
+    // items (and their keys) are not freed until the view is closed
+    item = _get_entry(cursor, struct wal_item, avl_key);
+    iterator->wal_entry->key = item->header->key;
+    iterator->wal_entry->keylen = item->header->keylen;
+    iterator->wal_entry->action = item->action;
+    iterator->wal_entry->offset = item->offset;
+    return iterator->wal_entry;
+}
+
 fdb_status fdb_iterator_init(fdb_kvs_handle *handle,
                              fdb_iterator **ptr_iterator,
                              const void *start_key,
@@ -208,6 +360,8 @@ fdb_status fdb_iterator_init(fdb_kvs_handle *handle,
     fdb_status fs;
     struct list_elem *he, *ie;
     struct wal_item_header *wal_item_header;
+    struct wal_shard *kshard;
+    size_t i;
     struct wal_item *wal_item;
     struct snap_wal_entry *snap_item;
 
@@ -360,91 +514,107 @@ fdb_status fdb_iterator_init(fdb_kvs_handle *handle,
             txn = &wal_file->global_txn;
         }
 
-        iterator->wal_tree = (struct avl_tree*)malloc(sizeof(struct avl_tree));
-        avl_init(iterator->wal_tree, (void*)iterator->handle);
-
-        spin_lock(&wal_file->wal->lock);
-        he = list_begin(&wal_file->wal->list);
-        while(he) {
-            wal_item_header = _get_entry(he, struct wal_item_header, list_elem);
-            ie = list_begin(&wal_item_header->items);
-            if (txn->isolation == FDB_ISOLATION_READ_COMMITTED) {
-                // Search for the first uncommitted item belonging to this txn..
-                for (; ie; ie = list_next(ie)) {
-                    wal_item = _get_entry(ie, struct wal_item, list_elem);
-                    if (wal_item->txn == txn) {
-                        break;
-                    } // else fall through and pick the committed item at end..
-                }
-                if (!ie) {
-                    ie = list_end(&wal_item_header->items);
-                }
+        if (!iterator->handle->kvs_config.custom_cmp) {
+            // WAL's key index is in the same order as the iterator ..
+            // just open a view on it instead of copying WAL entries
+            iterator->wal_tree = NULL;
+            iterator->wal_view = (struct wal_view *)
+                                 malloc(sizeof(struct wal_view));
+            wal_view_open(wal_file, txn, iterator->wal_view);
+            iterator->wal_entry = (struct snap_wal_entry *)
+                                  malloc(sizeof(struct snap_wal_entry));
+            if (wal_file == iterator->handle->new_file) {
+                iterator->wal_entry->flag = SNAP_ITEM_IN_NEW_FILE;
+            } else {
+                iterator->wal_entry->flag = 0x0;
             }
+        } else {
+            iterator->wal_tree = (struct avl_tree*)
+                                 malloc(sizeof(struct avl_tree));
+            avl_init(iterator->wal_tree, (void*)iterator->handle);
+
+            for (i=0;i<wal_file->wal->num_shards;++i) {
+                kshard = &wal_file->wal->key_shards[i];
+                spin_lock(&kshard->lock);
+                he = list_begin(&kshard->list);
+                while(he) {
+                    wal_item_header = _get_entry(he, struct wal_item_header, list_elem);
+                    ie = list_begin(&wal_item_header->items);
+                    if (txn->isolation == FDB_ISOLATION_READ_COMMITTED) {
+                        // Search for the first uncommitted item belonging to this txn..
+                        for (; ie; ie = list_next(ie)) {
+                            wal_item = _get_entry(ie, struct wal_item, list_elem);
+                            if (wal_item->txn == txn) {
+                                break;
+                            } // else fall through and pick the committed item at end..
+                        }
+                        if (!ie) {
+                            ie = list_end(&wal_item_header->items);
+                        }
+                    }
 
-            wal_item = _get_entry(ie, struct wal_item, list_elem);
-            if (wal_item->flag & WAL_ITEM_BY_COMPACTOR) {
-                // ignore items moved by compactor
-                he = list_next(he);
-                continue;
-            }
-            if ((wal_item->flag & WAL_ITEM_COMMITTED) ||
-                (wal_item->txn == txn) ||
-                (txn->isolation == FDB_ISOLATION_READ_UNCOMMITTED)) {
-                if (end_key) {
-                    cmp = _fdb_key_cmp(iterator,
-                                       (void *)end_key, end_keylen,
-                                       wal_item_header->key,
-                                       wal_item_header->keylen);
-                    if ((cmp == 0 && opt & FDB_ITR_SKIP_MAX_KEY) || cmp < 0) {
+                    wal_item = _get_entry(ie, struct wal_item, list_elem);
+                    if (wal_item->flag & WAL_ITEM_BY_COMPACTOR) {
+                        // ignore items moved by compactor
                         he = list_next(he);
-                        continue; // skip keys greater than max or equal (opt)
+                        continue;
                     }
-                }
-                if (start_key) {
-                    cmp = _fdb_key_cmp(iterator,
-                                       (void *)start_key, start_keylen,
-                                       wal_item_header->key,
-                                       wal_item_header->keylen);
-                    if ((cmp == 0 && opt & FDB_ITR_SKIP_MIN_KEY) || cmp > 0) {
-                        he = list_next(he);
-                        continue; // skip keys smaller than min or equal (opt)
+                    if ((wal_item->flag & WAL_ITEM_COMMITTED) ||
+                        (wal_item->txn == txn) ||
+                        (txn->isolation == FDB_ISOLATION_READ_UNCOMMITTED)) {
+                        if (end_key) {
+                            cmp = _fdb_key_cmp(iterator,
+                                               (void *)end_key, end_keylen,
+                                               wal_item_header->key,
+                                               wal_item_header->keylen);
+                            if ((cmp == 0 && opt & FDB_ITR_SKIP_MAX_KEY) || cmp < 0) {
+                                he = list_next(he);
+                                continue; // skip keys greater than max or equal (opt)
+                            }
+                        }
+                        if (start_key) {
+                            cmp = _fdb_key_cmp(iterator,
+                                               (void *)start_key, start_keylen,
+                                               wal_item_header->key,
+                                               wal_item_header->keylen);
+                            if ((cmp == 0 && opt & FDB_ITR_SKIP_MIN_KEY) || cmp > 0) {
+                                he = list_next(he);
+                                continue; // skip keys smaller than min or equal (opt)
+                            }
+                        }
+                        // copy from 'wal_item_header'
+                        snap_item = (struct snap_wal_entry*)malloc(sizeof(
+                                     struct snap_wal_entry));
+                        snap_item->keylen = wal_item_header->keylen;
+                        snap_item->key = (void*)malloc(snap_item->keylen);
+                        memcpy(snap_item->key, wal_item_header->key, snap_item->keylen);
+                        snap_item->action = wal_item->action;
+                        snap_item->offset = wal_item->offset;
+                        if (wal_file == iterator->handle->new_file) {
+                            snap_item->flag = SNAP_ITEM_IN_NEW_FILE;
+                        } else {
+                            snap_item->flag = 0x0;
+                        }
+
+                        // insert into tree
+                        avl_insert(iterator->wal_tree, &snap_item->avl, _fdb_wal_cmp);
                     }
-                }
-                // copy from 'wal_item_header'
-                snap_item = (struct snap_wal_entry*)malloc(sizeof(
-                             struct snap_wal_entry));
-                snap_item->keylen = wal_item_header->keylen;
-                snap_item->key = (void*)malloc(snap_item->keylen);
-                memcpy(snap_item->key, wal_item_header->key, snap_item->keylen);
-                snap_item->action = wal_item->action;
-                snap_item->offset = wal_item->offset;
-                if (wal_file == iterator->handle->new_file) {
-                    snap_item->flag = SNAP_ITEM_IN_NEW_FILE;
-                } else {
-                    snap_item->flag = 0x0;
+                    he = list_next(he);
                 }
 
-                // insert into tree
-                avl_insert(iterator->wal_tree, &snap_item->avl, _fdb_wal_cmp);
+                spin_unlock(&kshard->lock);
             }
-            he = list_next(he);
         }
-
-        spin_unlock(&wal_file->wal->lock);
     } else {
         iterator->wal_tree = handle->shandle->key_tree;
     }
 
-    if (iterator->wal_tree) {
+    if (iterator->wal_tree || iterator->wal_view) {
         if (start_key) {
-            struct snap_wal_entry query;
-            query.key = (void*)start_key;
-            query.keylen = start_keylen;
-            iterator->tree_cursor = avl_search_greater(iterator->wal_tree,
-                                                       &query.avl,
-                                                       _fdb_wal_cmp);
+            iterator->tree_cursor = _fdb_itr_wal_search_greater(iterator,
+                                        (void *)start_key, start_keylen);
         } else {
-            iterator->tree_cursor = avl_first(iterator->wal_tree);
+            iterator->tree_cursor = _fdb_itr_wal_first(iterator);
         }
     } else {
         iterator->tree_cursor = NULL;
@@ -472,6 +642,8 @@ fdb_status fdb_iterator_sequence_init(fdb_kvs_handle *handle,
 {
     struct list_elem *he, *ie;
     struct wal_item_header *wal_item_header;
+    struct wal_shard *kshard;
+    size_t i;
     struct wal_item *wal_item;
     struct snap_wal_entry *snap_item;
     fdb_status fs;
@@ -591,58 +763,61 @@ fdb_status fdb_iterator_sequence_init(fdb_kvs_handle *handle,
                              malloc(sizeof(struct avl_tree));
         avl_init(iterator->wal_tree, (void*)_fdb_seqnum_cmp);
 
-        spin_lock(&wal_file->wal->lock);
-        he = list_begin(&wal_file->wal->list);
-        while(he) {
-            wal_item_header = _get_entry(he, struct wal_item_header, list_elem);
-
-            // compare committed item only (at the end of the list)
-            ie = list_end(&wal_item_header->items);
-            wal_item = _get_entry(ie, struct wal_item, list_elem);
-            if (wal_item->flag & WAL_ITEM_BY_COMPACTOR) {
-                // ignore items moved by compactor
-                he = list_next(he);
-                continue;
-            }
-            if ((wal_item->flag & WAL_ITEM_COMMITTED) ||
-                (wal_item->txn == txn) ||
-                (txn->isolation == FDB_ISOLATION_READ_UNCOMMITTED)) {
-                if (iterator->_seqnum <= wal_item->seqnum) {
-                    // (documents whose seq numbers are greater than end_seqnum
-                    //  also have to be included for duplication check)
-                    // copy from WAL_ITEM
-                    if (iterator->handle->kvs) { // multi KV instance mode
-                        // get KV ID from key
-                        buf2kvid(wal_item_header->chunksize,
-                                 wal_item_header->key, &kv_id);
-                        if (kv_id != iterator->handle->kvs->id) {
-                            // KV instance doesn't match
-                            he = list_next(he);
-                            continue;
+        for (i=0;i<wal_file->wal->num_shards;++i) {
+            kshard = &wal_file->wal->key_shards[i];
+            spin_lock(&kshard->lock);
+            he = list_begin(&kshard->list);
+            while(he) {
+                wal_item_header = _get_entry(he, struct wal_item_header, list_elem);
+
+                // compare committed item only (at the end of the list)
+                ie = list_end(&wal_item_header->items);
+                wal_item = _get_entry(ie, struct wal_item, list_elem);
+                if (wal_item->flag & WAL_ITEM_BY_COMPACTOR) {
+                    // ignore items moved by compactor
+                    he = list_next(he);
+                    continue;
+                }
+                if ((wal_item->flag & WAL_ITEM_COMMITTED) ||
+                    (wal_item->txn == txn) ||
+                    (txn->isolation == FDB_ISOLATION_READ_UNCOMMITTED)) {
+                    if (iterator->_seqnum <= wal_item->seqnum) {
+                        // (documents whose seq numbers are greater than end_seqnum
+                        //  also have to be included for duplication check)
+                        // copy from WAL_ITEM
+                        if (iterator->handle->kvs) { // multi KV instance mode
+                            // get KV ID from key
+                            buf2kvid(wal_item_header->chunksize,
+                                     wal_item_header->key, &kv_id);
+                            if (kv_id != iterator->handle->kvs->id) {
+                                // KV instance doesn't match
+                                he = list_next(he);
+                                continue;
+                            }
+                        }
+                        snap_item = (struct snap_wal_entry*)
+                                    malloc(sizeof(struct snap_wal_entry));
+                        snap_item->keylen = wal_item_header->keylen;
+                        snap_item->key = (void*)malloc(snap_item->keylen);
+                        memcpy(snap_item->key, wal_item_header->key, snap_item->keylen);
+                        snap_item->seqnum = wal_item->seqnum;
+                        snap_item->action = wal_item->action;
+                        snap_item->offset = wal_item->offset;
+                        if (wal_file == iterator->handle->new_file) {
+                            snap_item->flag = SNAP_ITEM_IN_NEW_FILE;
+                        } else {
+                            snap_item->flag = 0x0;
                         }
-                    }
-                    snap_item = (struct snap_wal_entry*)
-                                malloc(sizeof(struct snap_wal_entry));
-                    snap_item->keylen = wal_item_header->keylen;
-                    snap_item->key = (void*)malloc(snap_item->keylen);
-                    memcpy(snap_item->key, wal_item_header->key, snap_item->keylen);
-                    snap_item->seqnum = wal_item->seqnum;
-                    snap_item->action = wal_item->action;
-                    snap_item->offset = wal_item->offset;
-                    if (wal_file == iterator->handle->new_file) {
-                        snap_item->flag = SNAP_ITEM_IN_NEW_FILE;
-                    } else {
-                        snap_item->flag = 0x0;
-                    }
 
-                    // insert into tree
-                    avl_insert(iterator->wal_tree, &snap_item->avl_seq,
-                               _fdb_seqnum_cmp);
+                        // insert into tree
+                        avl_insert(iterator->wal_tree, &snap_item->avl_seq,
+                                   _fdb_seqnum_cmp);
+                    }
                 }
+                he = list_next(he);
             }
-            he = list_next(he);
+            spin_unlock(&kshard->lock);
         }
-        spin_unlock(&wal_file->wal->lock);
     } else {
         iterator->wal_tree = handle->shandle->seq_tree;
     }
@@ -684,16 +859,19 @@ static fdb_status _fdb_iterator_prev(fdb_iterator *iterator)
             // (when seek is executed using a key larger than
             //  the largest key in WAL)
             if (iterator->status == FDB_ITR_WAL) {
-                iterator->tree_cursor = avl_prev(iterator->tree_cursor_prev);
+                iterator->tree_cursor = _fdb_itr_wal_prev(iterator,
+                                                          iterator->tree_cursor_prev);
                 iterator->tree_cursor_prev = iterator->tree_cursor;
             } else {
                 iterator->tree_cursor = iterator->tree_cursor_prev;
             }
         } else if (iterator->tree_cursor) { // on turning direction
             if (iterator->status == FDB_ITR_WAL) { // skip 2 items
-                iterator->tree_cursor = avl_prev(iterator->tree_cursor_prev);
+                iterator->tree_cursor = _fdb_itr_wal_prev(iterator,
+                                                          iterator->tree_cursor_prev);
             } else { // skip 1 item if the last doc was returned from the main index
-                iterator->tree_cursor = avl_prev(iterator->tree_cursor);
+                iterator->tree_cursor = _fdb_itr_wal_prev(iterator,
+                                                          iterator->tree_cursor);
             }
             iterator->tree_cursor_prev = iterator->tree_cursor;
         }
@@ -744,8 +922,7 @@ start:
 
     while (iterator->tree_cursor) {
         // get the current item of avl-tree
-        snap_item = _get_entry(iterator->tree_cursor, struct snap_wal_entry,
-                               avl);
+        snap_item = _fdb_itr_wal_entry(iterator, iterator->tree_cursor);
         if (hr != HBTRIE_RESULT_FAIL) {
             cmp = _fdb_key_cmp(iterator, snap_item->key, snap_item->keylen,
                                key, keylen);
@@ -756,7 +933,8 @@ start:
 
         if (cmp >= 0) {
             // key[WAL] >= key[hb-trie] .. take key[WAL] first
-            iterator->tree_cursor = avl_prev(iterator->tree_cursor);
+            iterator->tree_cursor = _fdb_itr_wal_prev(iterator,
+                                                      iterator->tree_cursor);
             iterator->tree_cursor_prev = iterator->tree_cursor;
             uint8_t drop_logical_deletes =
                 (snap_item->action == WAL_ACT_LOGICAL_REMOVE) &&
@@ -836,12 +1014,14 @@ static fdb_status _fdb_iterator_next(fdb_iterator *iterator)
     if (iterator->direction == FDB_ITR_REVERSE) {
         iterator->_offset = BLK_NOT_FOUND; // need to re-examine Trie/trees
         if (iterator->tree_cursor) {
-            iterator->tree_cursor = avl_next(iterator->tree_cursor);
+            iterator->tree_cursor = _fdb_itr_wal_next(iterator,
+                                                      iterator->tree_cursor);
             if (iterator->tree_cursor &&
                 iterator->status == FDB_ITR_WAL) {
                 // if the last document was returned from WAL,
                 // shift again, past curkey into next
-                iterator->tree_cursor = avl_next(iterator->tree_cursor);
+                iterator->tree_cursor = _fdb_itr_wal_next(iterator,
+                                                          iterator->tree_cursor);
             }
         }
     }
@@ -898,8 +1078,7 @@ start:
 
     while (iterator->tree_cursor) {
         // get the current item of avl-tree
-        snap_item = _get_entry(iterator->tree_cursor, struct snap_wal_entry,
-                               avl);
+        snap_item = _fdb_itr_wal_entry(iterator, iterator->tree_cursor);
         if (hr != HBTRIE_RESULT_FAIL) {
             cmp = _fdb_key_cmp(iterator, snap_item->key, snap_item->keylen,
                                key, keylen);
@@ -912,7 +1091,8 @@ start:
             // key[WAL] <= key[hb-trie] .. take key[WAL] first
             // save the current pointer for reverse iteration
             iterator->tree_cursor_prev = iterator->tree_cursor;
-            iterator->tree_cursor = avl_next(iterator->tree_cursor);
+            iterator->tree_cursor = _fdb_itr_wal_next(iterator,
+                                                      iterator->tree_cursor);
             uint8_t drop_logical_deletes =
                 (snap_item->action == WAL_ACT_LOGICAL_REMOVE) &&
                 (iterator->opt & FDB_ITR_NO_DELETES);
@@ -990,7 +1170,7 @@ fdb_status fdb_iterator_seek(fdb_iterator *iterator,
     bool skip_wal = false, fetch_next = true, fetch_wal = true;
     bool locked = false;
     hbtrie_result hr = HBTRIE_RESULT_SUCCESS;
-    struct snap_wal_entry *snap_item = NULL, query;
+    struct snap_wal_entry *snap_item = NULL;
     struct docio_object _doc;
     fdb_iterator_seek_opt_t seek_pref = seek_preference;
 
@@ -1166,21 +1346,17 @@ fetch_hbtrie:
     iterator->status = FDB_ITR_IDX;
 
     // retrieve avl-tree
-    query.key = seek_key_kv;
-    query.keylen = seek_keylen_kv;
-
     if (seek_pref == FDB_ITR_SEEK_HIGHER) {
         if (fetch_wal) {
-            iterator->tree_cursor = avl_search_greater(iterator->wal_tree,
-                                                       &query.avl,
-                                                       _fdb_wal_cmp);
+            iterator->tree_cursor = _fdb_itr_wal_search_greater(iterator,
+                                        seek_key_kv, seek_keylen_kv);
         }
         if (iterator->opt & FDB_ITR_NO_DELETES &&
             iterator->tree_cursor) {
             // skip deleted WAL entry
             do {
-                snap_item = _get_entry(iterator->tree_cursor,
-                                       struct snap_wal_entry, avl);
+                snap_item = _fdb_itr_wal_entry(iterator,
+                                       iterator->tree_cursor);
                 if (snap_item->action == WAL_ACT_LOGICAL_REMOVE) {
                     if (iterator->_dhandle) {
                         cmp = _fdb_key_cmp(iterator,
@@ -1189,8 +1365,8 @@ fetch_hbtrie:
                         if (cmp == 0) {
                             // same doc exists in HB+trie
                             // move tree cursor
-                            iterator->tree_cursor = avl_next(iterator->
-                                                             tree_cursor);
+                            iterator->tree_cursor = _fdb_itr_wal_next(
+                                        iterator, iterator->tree_cursor);
                             // do not move tree cursor next time
                             fetch_wal = false;
                             // fetch next key[HB+trie]
@@ -1199,7 +1375,8 @@ fetch_hbtrie:
                             break;
                         }
                     }
-                    iterator->tree_cursor = avl_next(iterator->tree_cursor);
+                    iterator->tree_cursor = _fdb_itr_wal_next(iterator,
+                                                              iterator->tree_cursor);
                     continue;
                 }
                 break;
@@ -1210,24 +1387,22 @@ fetch_hbtrie:
             // set prev key to the largest key.
             // if prev operation is called next, tree_cursor will be set to
             // tree_cursor_prev.
-            iterator->tree_cursor_prev = avl_search_smaller(iterator->wal_tree,
-                                                            &query.avl,
-                                                            _fdb_wal_cmp);
+            iterator->tree_cursor_prev = _fdb_itr_wal_search_smaller(iterator,
+                                             seek_key_kv, seek_keylen_kv);
         } else {
             iterator->tree_cursor_prev = iterator->tree_cursor;
         }
     } else if (seek_pref == FDB_ITR_SEEK_LOWER) {
         if (fetch_wal) {
-            iterator->tree_cursor = avl_search_smaller(iterator->wal_tree,
-                                                       &query.avl,
-                                                       _fdb_wal_cmp);
+            iterator->tree_cursor = _fdb_itr_wal_search_smaller(iterator,
+                                        seek_key_kv, seek_keylen_kv);
         }
         if (iterator->opt & FDB_ITR_NO_DELETES &&
             iterator->tree_cursor) {
             // skip deleted WAL entry
             do {
-                snap_item = _get_entry(iterator->tree_cursor,
-                                       struct snap_wal_entry, avl);
+                snap_item = _fdb_itr_wal_entry(iterator,
+                                       iterator->tree_cursor);
                 if (snap_item->action == WAL_ACT_LOGICAL_REMOVE) {
                     if (iterator->_dhandle) {
                         cmp = _fdb_key_cmp(iterator,
@@ -1236,8 +1411,8 @@ fetch_hbtrie:
                         if (cmp == 0) {
                             // same doc exists in HB+trie
                             // move tree cursor
-                            iterator->tree_cursor = avl_prev(iterator->
-                                                             tree_cursor);
+                            iterator->tree_cursor = _fdb_itr_wal_prev(
+                                        iterator, iterator->tree_cursor);
                             // do not move tree cursor next time
                             fetch_wal = false;
                             // fetch next key[HB+trie]
@@ -1246,7 +1421,8 @@ fetch_hbtrie:
                             break;
                         }
                     }
-                    iterator->tree_cursor = avl_prev(iterator->tree_cursor);
+                    iterator->tree_cursor = _fdb_itr_wal_prev(iterator,
+                                                              iterator->tree_cursor);
                     continue;
                 }
                 break;
@@ -1255,9 +1431,8 @@ fetch_hbtrie:
         iterator->tree_cursor_prev = iterator->tree_cursor;
         if (!iterator->tree_cursor) {
             // seek_key is smaller than the smallest key
-            iterator->tree_cursor = avl_search_greater(iterator->wal_tree,
-                                                       &query.avl,
-                                                       _fdb_wal_cmp);
+            iterator->tree_cursor = _fdb_itr_wal_search_greater(iterator,
+                                        seek_key_kv, seek_keylen_kv);
             // need to set direction to NONE.
             // if next operation is called next, tree_cursor will be set to
             // cursor_start.
@@ -1272,8 +1447,7 @@ fetch_hbtrie:
         bool take_wal = false;
         bool discard_hbtrie = false;
 
-        snap_item = _get_entry(iterator->tree_cursor, struct snap_wal_entry,
-                               avl);
+        snap_item = _fdb_itr_wal_entry(iterator, iterator->tree_cursor);
 
         if (hr == HBTRIE_RESULT_SUCCESS) {
             cmp = _fdb_key_cmp(iterator,
@@ -1291,7 +1465,8 @@ fetch_hbtrie:
                     discard_hbtrie = false;
                 } else if (seek_pref == FDB_ITR_SEEK_LOWER) {
                     // lower mode .. discard smaller one (key[WAL])
-                    iterator->tree_cursor = avl_next(iterator->tree_cursor);
+                    iterator->tree_cursor = _fdb_itr_wal_next(iterator,
+                                                              iterator->tree_cursor);
                     take_wal = false;
                     discard_hbtrie = false;
                     // In seek_to_max call with skip_max_key option,
@@ -1372,7 +1547,8 @@ fetch_hbtrie:
                 iterator->_dhandle = iterator->handle->dhandle;
             }
             // move to next WAL entry
-            iterator->tree_cursor = avl_next(iterator->tree_cursor);
+            iterator->tree_cursor = _fdb_itr_wal_next(iterator,
+                                                      iterator->tree_cursor);
             iterator->status = FDB_ITR_WAL;
         }
     }
@@ -1500,7 +1676,7 @@ fdb_status fdb_iterator_seek_to_max(fdb_iterator *iterator) {
     }
 
     // also move WAL tree's cursor to the last entry
-    iterator->tree_cursor = avl_last(iterator->wal_tree);
+    iterator->tree_cursor = _fdb_itr_wal_last(iterator);
     iterator->tree_cursor_prev = iterator->tree_cursor;
 
     if (locked) {
@@ -1902,12 +2078,14 @@ fdb_status fdb_iterator_prev(fdb_iterator *iterator)
                 iterator->_offset = BLK_NOT_FOUND;
             }
             if (iterator->tree_cursor) {
-                iterator->tree_cursor = avl_next(iterator->tree_cursor);
+                iterator->tree_cursor = _fdb_itr_wal_next(iterator,
+                                                          iterator->tree_cursor);
                 if (iterator->tree_cursor &&
                         iterator->status == FDB_ITR_WAL) {
                     // if the last document was returned from WAL,
                     // shift again, past curkey into next
-                    iterator->tree_cursor = avl_next(iterator->tree_cursor);
+                    iterator->tree_cursor = _fdb_itr_wal_next(iterator,
+                                                              iterator->tree_cursor);
                 }
             }
         }
@@ -1944,11 +2122,12 @@ fdb_status fdb_iterator_next(fdb_iterator *iterator)
             }
             if (iterator->tree_cursor) {
                 if (iterator->status == FDB_ITR_WAL) { // move 2 steps
-                    iterator->tree_cursor =
-                                  avl_prev(iterator->tree_cursor_prev);
+                    iterator->tree_cursor = _fdb_itr_wal_prev(iterator,
+                                                iterator->tree_cursor_prev);
                 } else {
                     // move 1 step if last doc was returned from the main index
-                    iterator->tree_cursor = avl_prev(iterator->tree_cursor);
+                    iterator->tree_cursor = _fdb_itr_wal_prev(iterator,
+                                                              iterator->tree_cursor);
                 }
                 iterator->tree_cursor_prev = iterator->tree_cursor;
             }
@@ -2133,7 +2312,12 @@ fdb_status fdb_iterator_close(fdb_iterator *iterator)
         hbtrie_iterator_free(iterator->hbtrie_iterator);
         free(iterator->hbtrie_iterator);
 
-        if (!iterator->handle->shandle) {
+        if (iterator->wal_view) {
+            // release WAL items retired while the iterator was open
+            wal_view_close(iterator->wal_view);
+            free(iterator->wal_view);
+            free(iterator->wal_entry);
+        } else if (!iterator->handle->shandle) {
             a = avl_first(iterator->wal_tree);
             while(a) {
                 snap_item = _get_entry(a, struct snap_wal_entry, avl);
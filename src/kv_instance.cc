@@ -31,6 +31,7 @@
 #include "hbtrie.h"
 #include "btreeblock.h"
 #include "snapshot.h"
+#include "bloomfilter.h"
 
 #include "memleak.h"
 #include "time_utils.h"
@@ -406,6 +407,7 @@ void _fdb_kvs_header_create(struct kvs_header **kv_header_ptr)
     kv_header->id_counter = 1;
     kv_header->default_kvs_cmp = NULL;
     kv_header->custom_cmp_enabled = 0;
+    kv_header->bloom_offset = BLK_NOT_FOUND;
     kv_header->idx_name = (struct avl_tree*)malloc(sizeof(struct avl_tree));
     kv_header->idx_id = (struct avl_tree*)malloc(sizeof(struct avl_tree));
     avl_init(kv_header->idx_name, NULL);
@@ -479,6 +481,7 @@ void fdb_kvs_header_copy(fdb_kvs_handle *handle,
 
 // export KV header info to raw data
 static void _fdb_kvs_header_export(struct kvs_header *kv_header,
+                                   uint64_t bloom_offset,
                                    void **data, size_t *len)
 {
     /* << raw data structure >>
@@ -494,6 +497,8 @@ static void _fdb_kvs_header_export(struct kvs_header *kv_header,
      * [data size]:             8 bytes
      * [flags]:                 8 bytes
      * ...
+     * ---
+     * [key filter offset]:     8 bytes
      */
 
     int size = 0;
@@ -501,7 +506,7 @@ static void _fdb_kvs_header_export(struct kvs_header *kv_header,
     uint16_t name_len, _name_len;
     uint64_t c = 0;
     uint64_t _n_kv, _kv_id, _flags;
-    uint64_t _nlivenodes, _ndocs, _datasize;
+    uint64_t _nlivenodes, _ndocs, _datasize, _bloom_offset;
     fdb_kvs_id_t _id_counter;
     fdb_seqnum_t _seqnum;
     struct kvs_node *node;
@@ -532,6 +537,7 @@ static void _fdb_kvs_header_export(struct kvs_header *kv_header,
         size += sizeof(node->flags); // flags
         a = avl_next(a);
     }
+    size += sizeof(bloom_offset);
 
     *data = (void *)malloc(size);
 
@@ -592,6 +598,11 @@ static void _fdb_kvs_header_export(struct kvs_header *kv_header,
         a = avl_next(a);
     }
 
+    // key filter offset
+    _bloom_offset = _endian_encode(bloom_offset);
+    memcpy((uint8_t*)*data + offset, &_bloom_offset, sizeof(_bloom_offset));
+    offset += sizeof(_bloom_offset);
+
     *len = size;
 
     spin_unlock(&kv_header->lock);
@@ -603,7 +614,7 @@ void _fdb_kvs_header_import(struct kvs_header *kv_header,
     int i, offset = 0;
     uint16_t name_len, _name_len;
     uint64_t n_kv, _n_kv, kv_id, _kv_id, flags, _flags;
-    uint64_t _nlivenodes, _ndocs, _datasize;
+    uint64_t _nlivenodes, _ndocs, _datasize, _bloom_offset;
     fdb_kvs_id_t id_counter, _id_counter;
     fdb_seqnum_t seqnum, _seqnum;
     struct kvs_node *node;
@@ -673,6 +684,15 @@ void _fdb_kvs_header_import(struct kvs_header *kv_header,
         avl_insert(kv_header->idx_name, &node->avl_name, _kvs_cmp_name);
         avl_insert(kv_header->idx_id, &node->avl_id, _kvs_cmp_id);
     }
+
+    // key filter offset (not in the files written by older versions)
+    if (offset + sizeof(_bloom_offset) <= len) {
+        memcpy(&_bloom_offset, (uint8_t*)data + offset, sizeof(_bloom_offset));
+        offset += sizeof(_bloom_offset);
+        kv_header->bloom_offset = _endian_decode(_bloom_offset);
+    } else {
+        kv_header->bloom_offset = BLK_NOT_FOUND;
+    }
     spin_unlock(&kv_header->lock);
 }
 
@@ -733,6 +753,48 @@ fdb_status _fdb_kvs_get_snap_info(void *data,
     return FDB_RESULT_SUCCESS;
 }
 
+static uint64_t _fdb_kvs_bloom_write(void *ctx, void *buf, size_t len)
+{
+    struct docio_handle *dhandle = (struct docio_handle *)ctx;
+    char *doc_key = alca(char, 32);
+    struct docio_object doc;
+
+    memset(&doc, 0, sizeof(struct docio_object));
+    sprintf(doc_key, "Bloom_filter");
+    doc.key = (void *)doc_key;
+    doc.meta = NULL;
+    doc.body = buf;
+    doc.length.keylen = strlen(doc_key) + 1;
+    doc.length.metalen = 0;
+    doc.length.bodylen = len;
+    doc.seqnum = 0;
+    return docio_append_doc_system(dhandle, &doc);
+}
+
+static int _fdb_kvs_bloom_read(void *ctx, uint64_t offset,
+                               void **buf, size_t *len)
+{
+    struct docio_handle *dhandle = (struct docio_handle *)ctx;
+    struct docio_object doc;
+    uint64_t _offset;
+
+    memset(&doc, 0, sizeof(struct docio_object));
+    _offset = docio_read_doc(dhandle, offset, &doc);
+    if (_offset == offset || !(doc.length.flag & DOCIO_SYSTEM) ||
+        doc.length.keylen != strlen("Bloom_filter") + 1 ||
+        memcmp(doc.key, "Bloom_filter", doc.length.keylen)) {
+        if (_offset != offset) {
+            free_docio_object(&doc, 1, 1, 1);
+        }
+        return -1;
+    }
+
+    *buf = doc.body;
+    *len = doc.length.bodylen;
+    free_docio_object(&doc, 1, 1, 0);
+    return 0;
+}
+
 uint64_t fdb_kvs_header_append(struct filemgr *file,
                                   struct docio_handle *dhandle)
 {
@@ -740,9 +802,16 @@ uint64_t fdb_kvs_header_append(struct filemgr *file,
     void *data;
     size_t len;
     uint64_t kv_info_offset;
+    uint64_t bloom_offset = BLK_NOT_FOUND;
     struct docio_object doc;
 
-    _fdb_kvs_header_export(file->kv_header, &data, &len);
+    if (file->bloom) {
+        // the key filter image is written along with the KV header,
+        // so that it always reflects the index of the same DB header
+        bloom_offset = bloomfilter_persist(file->bloom,
+                                           _fdb_kvs_bloom_write, dhandle);
+    }
+    _fdb_kvs_header_export(file->kv_header, bloom_offset, &data, &len);
 
     memset(&doc, 0, sizeof(struct docio_object));
     sprintf(doc_key, "KV_header");
@@ -777,6 +846,18 @@ void fdb_kvs_header_read(struct filemgr *file,
     free_docio_object(&doc, 1, 1, 1);
 }
 
+void fdb_kvs_bloom_read(struct filemgr *file,
+                        struct docio_handle *dhandle,
+                        uint64_t bloom_offset)
+{
+    if (bloom_offset == BLK_NOT_FOUND) {
+        return;
+    }
+    // the filter is not used if any of its images is missing
+    file->bloom = bloomfilter_load(_fdb_kvs_bloom_read, dhandle,
+                                   bloom_offset);
+}
+
 fdb_seqnum_t _fdb_kvs_get_seqnum(struct kvs_header *kv_header,
                                  fdb_kvs_id_t id)
 {
@@ -0,0 +1,366 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "nodecache.h"
+#include "atomic.h"
+
+#include "memleak.h"
+
+struct nodecache_item {
+    struct filemgr *file;
+    bid_t bid;
+    void *addr;
+    // next item in the same bucket (followed by readers without lock)
+    struct nodecache_item * volatile next;
+    // reference bit for CLOCK replacement (set by readers without lock)
+    volatile uint8_t ref;
+    // global epoch when the item was removed from the hash table
+    uint64_t retire_epoch;
+    // list elem for the CLOCK list or the retired list
+    struct list_elem le;
+};
+
+static volatile uint8_t nodecache_initialized = 0;
+static size_t nodecache_blocksize;
+static uint64_t nodecache_nblock;
+
+// hash table (buckets are modified only while holding NODECACHE_LOCK)
+static struct nodecache_item * volatile *nodecache_buckets;
+static size_t nodecache_nbuckets;
+
+// lock for all modifications
+static spin_t nodecache_lock;
+// cached items in CLOCK order
+static struct list nodecache_clock;
+static uint64_t nodecache_nitems;
+// items removed from the hash table but possibly still used by readers
+static struct list nodecache_retired;
+// registered readers
+static struct list nodecache_readers;
+// incremented whenever an item is retired
+static volatile uint64_t nodecache_epoch;
+
+INLINE size_t _nodecache_hash(struct filemgr *file, bid_t bid)
+{
+    uint64_t h = (bid ^ ((uint64_t)(size_t)file >> 4)) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> 32) & (nodecache_nbuckets - 1);
+}
+
+INLINE void _nodecache_free_item(struct nodecache_item *item)
+{
+    free_align(item->addr);
+    free(item);
+}
+
+// unlink the item from the hash table, and defer its release
+// (NODECACHE_LOCK should be held)
+static void _nodecache_retire(struct nodecache_item *item)
+{
+    struct nodecache_item * volatile *p;
+
+    p = &nodecache_buckets[_nodecache_hash(item->file, item->bid)];
+    while (*p != item) {
+        p = &(*p)->next;
+    }
+    // readers currently on this item can still follow ITEM->next
+    *p = item->next;
+
+    list_remove(&nodecache_clock, &item->le);
+    nodecache_nitems--;
+    item->retire_epoch = nodecache_epoch;
+    nodecache_epoch++;
+    list_push_back(&nodecache_retired, &item->le);
+}
+
+// free the retired items that no reader can refer to
+// (NODECACHE_LOCK should be held)
+static void _nodecache_reclaim()
+{
+    struct list_elem *e;
+    struct nodecache_reader *reader;
+    struct nodecache_item *item;
+    uint64_t epoch, min_epoch = (uint64_t)-1;
+
+    if (list_begin(&nodecache_retired) == NULL) {
+        return;
+    }
+
+    // the unlinks above should be visible before checking readers,
+    // so that a reader entering its section from now on cannot see them
+    fdb_sync_synchronize();
+    e = list_begin(&nodecache_readers);
+    while (e) {
+        reader = _get_entry(e, struct nodecache_reader, le);
+        epoch = reader->epoch;
+        if (epoch && epoch < min_epoch) {
+            min_epoch = epoch;
+        }
+        e = list_next(e);
+    }
+
+    // a reader that entered at epoch E may refer to items retired
+    // at E or later (retired items are sorted by their epochs)
+    e = list_begin(&nodecache_retired);
+    while (e) {
+        item = _get_entry(e, struct nodecache_item, le);
+        if (item->retire_epoch >= min_epoch) {
+            break;
+        }
+        e = list_remove(&nodecache_retired, e);
+        _nodecache_free_item(item);
+    }
+}
+
+// retire an item not referenced recently (NODECACHE_LOCK should be held)
+static void _nodecache_evict()
+{
+    struct list_elem *e;
+    struct nodecache_item *item;
+
+    // each item gets at most one second chance,
+    // so this loop ends within a single round
+    while ((e = list_begin(&nodecache_clock))) {
+        item = _get_entry(e, struct nodecache_item, le);
+        if (item->ref) {
+            item->ref = 0;
+            list_remove(&nodecache_clock, e);
+            list_push_back(&nodecache_clock, e);
+            continue;
+        }
+        _nodecache_retire(item);
+        break;
+    }
+}
+
+void nodecache_init(uint64_t nblock, size_t blocksize)
+{
+    if (nodecache_initialized) {
+        return;
+    }
+
+    nodecache_blocksize = blocksize;
+    nodecache_nblock = nblock;
+    nodecache_nbuckets = 1;
+    while (nodecache_nbuckets < nblock) {
+        nodecache_nbuckets <<= 1;
+    }
+    nodecache_buckets = (struct nodecache_item * volatile *)
+                        calloc(nodecache_nbuckets,
+                               sizeof(struct nodecache_item *));
+
+    spin_init(&nodecache_lock);
+    list_init(&nodecache_clock);
+    list_init(&nodecache_retired);
+    list_init(&nodecache_readers);
+    nodecache_nitems = 0;
+    nodecache_epoch = 1;
+    nodecache_initialized = 1;
+}
+
+void nodecache_shutdown()
+{
+    struct list_elem *e;
+    struct nodecache_item *item;
+    struct nodecache_reader *reader;
+
+    if (!nodecache_initialized) {
+        return;
+    }
+
+    spin_lock(&nodecache_lock);
+    nodecache_initialized = 0;
+    e = list_begin(&nodecache_clock);
+    while (e) {
+        item = _get_entry(e, struct nodecache_item, le);
+        e = list_remove(&nodecache_clock, e);
+        _nodecache_free_item(item);
+    }
+    e = list_begin(&nodecache_retired);
+    while (e) {
+        item = _get_entry(e, struct nodecache_item, le);
+        e = list_remove(&nodecache_retired, e);
+        _nodecache_free_item(item);
+    }
+    // readers still registered do not use the cache anymore
+    e = list_begin(&nodecache_readers);
+    while (e) {
+        reader = _get_entry(e, struct nodecache_reader, le);
+        e = list_remove(&nodecache_readers, e);
+        reader->registered = 0;
+        reader->epoch = 0;
+    }
+    free((void *)nodecache_buckets);
+    nodecache_buckets = NULL;
+    nodecache_nitems = 0;
+    spin_unlock(&nodecache_lock);
+    spin_destroy(&nodecache_lock);
+}
+
+void nodecache_reader_register(struct nodecache_reader *reader)
+{
+    reader->epoch = 0;
+    reader->registered = 0;
+    if (!nodecache_initialized) {
+        return;
+    }
+
+    spin_lock(&nodecache_lock);
+    list_push_back(&nodecache_readers, &reader->le);
+    reader->registered = 1;
+    spin_unlock(&nodecache_lock);
+}
+
+void nodecache_reader_unregister(struct nodecache_reader *reader)
+{
+    if (!reader->registered) {
+        return;
+    }
+
+    nodecache_read_end(reader);
+    spin_lock(&nodecache_lock);
+    list_remove(&nodecache_readers, &reader->le);
+    reader->registered = 0;
+    _nodecache_reclaim();
+    spin_unlock(&nodecache_lock);
+}
+
+INLINE void _nodecache_read_begin(struct nodecache_reader *reader)
+{
+    if (reader->epoch) {
+        return;
+    }
+    reader->epoch = nodecache_epoch;
+    // announce the epoch before following any pointer in the hash table
+    fdb_sync_synchronize();
+}
+
+void nodecache_read_end(struct nodecache_reader *reader)
+{
+    if (!reader->epoch) {
+        return;
+    }
+    // all accesses to cached blocks should be done before leaving
+    fdb_sync_synchronize();
+    reader->epoch = 0;
+}
+
+void *nodecache_get(struct nodecache_reader *reader,
+                    struct filemgr *file, bid_t bid)
+{
+    struct nodecache_item *item;
+
+    if (!reader->registered) {
+        return NULL;
+    }
+
+    _nodecache_read_begin(reader);
+    item = nodecache_buckets[_nodecache_hash(file, bid)];
+    while (item) {
+        if (item->bid == bid && item->file == file) {
+            if (!item->ref) {
+                // avoid writing to the shared cache line on every hit
+                item->ref = 1;
+            }
+            return item->addr;
+        }
+        item = item->next;
+    }
+    return NULL;
+}
+
+void *nodecache_insert(struct nodecache_reader *reader,
+                       struct filemgr *file, bid_t bid, void *src,
+                       nodecache_prepare_func *prepare, void *ctx)
+{
+    size_t idx;
+    struct nodecache_item *item, *cur;
+
+    if (!reader->registered) {
+        return NULL;
+    }
+
+    // make a copy before grabbing the lock
+    item = (struct nodecache_item *)malloc(sizeof(struct nodecache_item));
+    item->file = file;
+    item->bid = bid;
+    item->ref = 1;
+    malloc_align(item->addr, FDB_SECTOR_SIZE, nodecache_blocksize);
+    memcpy(item->addr, src, nodecache_blocksize);
+    if (prepare) {
+        prepare(item->addr, ctx);
+    }
+
+    _nodecache_read_begin(reader);
+    idx = _nodecache_hash(file, bid);
+
+    spin_lock(&nodecache_lock);
+    // the block may be inserted by another reader in the meantime
+    for (cur = nodecache_buckets[idx]; cur; cur = cur->next) {
+        if (cur->bid == bid && cur->file == file) {
+            spin_unlock(&nodecache_lock);
+            _nodecache_free_item(item);
+            return cur->addr;
+        }
+    }
+
+    if (nodecache_nitems >= nodecache_nblock) {
+        _nodecache_evict();
+    }
+
+    // the contents should be visible before the item is published
+    item->next = nodecache_buckets[idx];
+    fdb_sync_synchronize();
+    nodecache_buckets[idx] = item;
+    list_push_back(&nodecache_clock, &item->le);
+    nodecache_nitems++;
+
+    _nodecache_reclaim();
+    spin_unlock(&nodecache_lock);
+
+    return item->addr;
+}
+
+void nodecache_remove_file(struct filemgr *file)
+{
+    struct list_elem *e;
+    struct nodecache_item *item;
+
+    if (!nodecache_initialized) {
+        return;
+    }
+
+    spin_lock(&nodecache_lock);
+    e = list_begin(&nodecache_clock);
+    while (e) {
+        item = _get_entry(e, struct nodecache_item, le);
+        e = list_next(e);
+        if (item->file == file) {
+            _nodecache_retire(item);
+        }
+    }
+    _nodecache_reclaim();
+    spin_unlock(&nodecache_lock);
+}
+
+uint64_t nodecache_get_num_blocks()
+{
+    return nodecache_nitems;
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef _JSAHN_NODECACHE_H
+#define _JSAHN_NODECACHE_H
+
+#include <stdint.h>
+#include "common.h"
+#include "list.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Process-wide cache of decoded B+tree node blocks, shared by all handles
+// and threads without copying.
+//
+// Only committed (i.e., immutable) blocks should be inserted, so a cached
+// block is never modified. Lookups do not grab any lock; instead, each
+// reader announces the global epoch when it starts to use cached blocks,
+// and blocks removed from the cache are freed only after all readers that
+// may still refer to them have left their read-side sections.
+struct filemgr;
+
+struct nodecache_reader {
+    // global epoch when the reader entered its read-side section
+    // (0: not in a read-side section)
+    volatile uint64_t epoch;
+    uint8_t registered;
+    struct list_elem le;
+};
+
+// called once for a new cached block before it is visible to other readers
+typedef void nodecache_prepare_func(void *addr, void *ctx);
+
+void nodecache_init(uint64_t nblock, size_t blocksize);
+void nodecache_shutdown();
+
+// a reader should be used by a single thread at a time
+void nodecache_reader_register(struct nodecache_reader *reader);
+void nodecache_reader_unregister(struct nodecache_reader *reader);
+// blocks returned by nodecache_get() and nodecache_insert() remain valid
+// until the reader calls nodecache_read_end()
+void nodecache_read_end(struct nodecache_reader *reader);
+
+// return NULL if the block is not cached
+void *nodecache_get(struct nodecache_reader *reader,
+                    struct filemgr *file, bid_t bid);
+// cache a copy of the block at SRC, and return the cached block
+// (return NULL if the cache is not initialized)
+void *nodecache_insert(struct nodecache_reader *reader,
+                       struct filemgr *file, bid_t bid, void *src,
+                       nodecache_prepare_func *prepare, void *ctx);
+// remove all blocks of the file (called before the file is freed)
+void nodecache_remove_file(struct filemgr *file);
+
+uint64_t nodecache_get_num_blocks();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
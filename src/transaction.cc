@@ -82,9 +82,7 @@ fdb_status fdb_begin_transaction(fdb_file_handle *fhandle,
         // there is no previous header until the compaction is done.
         handle->txn->prev_hdr_bid = BLK_NOT_FOUND;
     }
-    handle->txn->items = (struct list *)malloc(sizeof(struct list));
     handle->txn->isolation = isolation_level;
-    list_init(handle->txn->items);
     wal_add_transaction(file, handle->txn);
 
     filemgr_mutex_unlock(file);
@@ -136,7 +134,6 @@ fdb_status _fdb_abort_transaction(fdb_kvs_handle *handle)
     wal_discard(file, handle->txn);
     wal_remove_transaction(file, handle->txn);
 
-    free(handle->txn->items);
     free(handle->txn->wrapper);
     free(handle->txn);
     handle->txn = NULL;
@@ -165,7 +162,7 @@ fdb_status fdb_end_transaction(fdb_file_handle *fhandle,
     }
 
     fdb_status fs = FDB_RESULT_SUCCESS;
-    if (list_begin(handle->txn->items)) {
+    if (wal_txn_has_items(handle->txn)) {
         fs = _fdb_commit(handle, opt);
     }
 
@@ -192,7 +189,6 @@ fdb_status fdb_end_transaction(fdb_file_handle *fhandle,
 
         wal_remove_transaction(file, handle->txn);
 
-        free(handle->txn->items);
         free(handle->txn->wrapper);
         free(handle->txn);
         handle->txn = NULL;
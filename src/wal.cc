@@ -27,6 +27,7 @@
 #include "wal.h"
 #include "hash_functions.h"
 #include "fdb_internal.h"
+#include "atomic.h"
 
 #include "memleak.h"
 
@@ -44,7 +45,23 @@
 INLINE uint32_t _wal_hash_bykey(struct hash *hash, struct hash_elem *e)
 {
     struct wal_item_header *item = _get_entry(e, struct wal_item_header, he_key);
-    return chksum((uint8_t*)item->key, item->keylen) & ((uint64_t)hash->nbuckets - 1);
+    // keys in the same shard share the same remainder,
+    // so use the quotient for the bucket index
+    return (chksum((uint8_t*)item->key, item->keylen) / FDB_WAL_NSHARDS) &
+           ((uint64_t)hash->nbuckets - 1);
+}
+
+INLINE int _wal_keycmp(void *key1, size_t keylen1, void *key2, size_t keylen2)
+{
+    if (keylen1 == keylen2) return memcmp(key1, key2, keylen1);
+    else {
+        size_t len = MIN(keylen1, keylen2);
+        int cmp = memcmp(key1, key2, len);
+        if (cmp != 0) return cmp;
+        else {
+            return (int)((int)keylen1 - (int)keylen2);
+        }
+    }
 }
 
 INLINE int _wal_cmp_bykey(struct hash_elem *a, struct hash_elem *b)
@@ -53,21 +70,36 @@ INLINE int _wal_cmp_bykey(struct hash_elem *a, struct hash_elem *b)
     aa = _get_entry(a, struct wal_item_header, he_key);
     bb = _get_entry(b, struct wal_item_header, he_key);
 
-    if (aa->keylen == bb->keylen) return memcmp(aa->key, bb->key, aa->keylen);
-    else {
-        size_t len = MIN(aa->keylen , bb->keylen);
-        int cmp = memcmp(aa->key, bb->key, len);
-        if (cmp != 0) return cmp;
-        else {
-            return (int)((int)aa->keylen - (int)bb->keylen);
-        }
+    return _wal_keycmp(aa->key, aa->keylen, bb->key, bb->keylen);
+}
+
+// ordered by key, and then by version in descending order
+static int _wal_cmp_key_index(struct avl_node *a, struct avl_node *b,
+                              void *aux)
+{
+    struct wal_item *aa, *bb;
+    int cmp;
+    aa = _get_entry(a, struct wal_item, avl_key);
+    bb = _get_entry(b, struct wal_item, avl_key);
+
+    cmp = _wal_keycmp(aa->header->key, aa->header->keylen,
+                      bb->header->key, bb->header->keylen);
+    if (cmp != 0) {
+        return cmp;
+    }
+    if (aa->gen_begin > bb->gen_begin) {
+        return -1;
+    } else if (aa->gen_begin < bb->gen_begin) {
+        return 1;
+    } else {
+        return 0;
     }
 }
 
 INLINE uint32_t _wal_hash_byseq(struct hash *hash, struct hash_elem *e)
 {
     struct wal_item *item = _get_entry(e, struct wal_item, he_seq);
-    return (item->seqnum) & ((uint64_t)hash->nbuckets - 1);
+    return (item->seqnum / FDB_WAL_NSHARDS) & ((uint64_t)hash->nbuckets - 1);
 }
 
 INLINE int _wal_cmp_byseq(struct hash_elem *a, struct hash_elem *b)
@@ -95,23 +127,284 @@ INLINE int _wal_cmp_byseq(struct hash_elem *a, struct hash_elem *b)
     }
 }
 
+INLINE size_t _wal_key_shard_idx(struct wal *wal, void *key, size_t keylen)
+{
+    return chksum((uint8_t*)key, keylen) % wal->num_shards;
+}
+
+INLINE struct wal_seq_shard * _wal_get_seq_shard(struct wal *wal,
+                                                 fdb_seqnum_t seqnum)
+{
+    return &wal->seq_shards[seqnum % wal->num_shards];
+}
+
+// the caller should hold the lock of the key shard that the item belongs to
+INLINE void _wal_seq_insert(struct wal *wal, struct wal_item *item)
+{
+    struct wal_seq_shard *sshard = _wal_get_seq_shard(wal, item->seqnum);
+    spin_lock(&sshard->lock);
+    hash_insert(&sshard->hash_byseq, &item->he_seq);
+    spin_unlock(&sshard->lock);
+}
+
+// the caller should hold the lock of the key shard that the item belongs to
+INLINE void _wal_seq_remove(struct wal *wal, struct wal_item *item)
+{
+    struct wal_seq_shard *sshard = _wal_get_seq_shard(wal, item->seqnum);
+    spin_lock(&sshard->lock);
+    hash_remove(&sshard->hash_byseq, &item->he_seq);
+    spin_unlock(&sshard->lock);
+}
+
+#define _WAL_GEN_NONE ((uint64_t)-1)
+
+// memory used by WAL entries of all files
+static atomic_val_t wal_global_memsize;
+static uint64_t wal_mem_budget;
+// list of all WALs, and the lock protecting it
+static struct list wal_list;
+static spin_t wal_list_lock;
+// files whose WAL uses this many bytes or more should be flushed
+// to bring the global usage back under the budget
+static volatile uint64_t wal_victim_memsize;
+// global usage when 'wal_victim_memsize' was chosen
+static volatile uint64_t wal_victim_base;
+
+INLINE void _wal_mem_add(struct wal_shard *kshard, size_t size)
+{
+    kshard->memsize += size;
+    atomic_val_add_64(&wal_global_memsize, size);
+}
+
+INLINE void _wal_mem_sub(struct wal_shard *kshard, size_t size)
+{
+    kshard->memsize -= size;
+    atomic_val_sub_64(&wal_global_memsize, size);
+}
+
+// the caller should hold the lock of the key shard
+INLINE struct wal_item_header * _wal_alloc_header(struct wal_shard *kshard,
+                                                  size_t keylen)
+{
+    struct wal_item_header *header = (struct wal_item_header*)
+        arena_alloc(&kshard->arena, sizeof(struct wal_item_header));
+    header->keylen = keylen;
+    header->key = arena_alloc(&kshard->arena, keylen);
+    _wal_mem_add(kshard, sizeof(struct wal_item_header) + keylen);
+    return header;
+}
+
+// the caller should hold the lock of the key shard
+INLINE void _wal_put_header(struct wal_shard *kshard,
+                            struct wal_item_header *header)
+{
+    if (--header->refcount > 0) {
+        return;
+    }
+    _wal_mem_sub(kshard, sizeof(struct wal_item_header) + header->keylen);
+    arena_free(&kshard->arena, header->key, header->keylen);
+    arena_free(&kshard->arena, header, sizeof(struct wal_item_header));
+}
+
+// the caller should hold the lock of the key shard
+INLINE struct wal_item * _wal_alloc_item(struct wal_shard *kshard,
+                                         struct wal_item_header *header)
+{
+    struct wal_item *item = (struct wal_item *)
+        arena_alloc(&kshard->arena, sizeof(struct wal_item));
+    item->header = header;
+    header->refcount++;
+    _wal_mem_add(kshard, sizeof(struct wal_item));
+    return item;
+}
+
+// the caller should hold the lock of the key shard
+INLINE void _wal_free_item(struct wal_shard *kshard, struct wal_item *item)
+{
+    struct wal_item_header *header = item->header;
+    _wal_mem_sub(kshard, sizeof(struct wal_item));
+    arena_free(&kshard->arena, item, sizeof(struct wal_item));
+    _wal_put_header(kshard, header);
+}
+
+INLINE void _wal_lock_all_shards(struct wal *wal)
+{
+    size_t i;
+    for (i=0;i<wal->num_shards;++i) {
+        spin_lock(&wal->key_shards[i].lock);
+    }
+}
+
+INLINE void _wal_unlock_all_shards(struct wal *wal)
+{
+    size_t i;
+    for (i=0;i<wal->num_shards;++i) {
+        spin_unlock(&wal->key_shards[i].lock);
+    }
+}
+
+// add a new version into the key shard's index, and also into the
+// transaction's list if 'txn_items' is given.
+// the caller should hold the lock of the key shard
+INLINE void _wal_key_index_insert(struct wal_shard *kshard,
+                                  struct wal_item *item,
+                                  struct list *txn_items)
+{
+    item->gen_begin = ++kshard->gen;
+    if (item->flag & WAL_ITEM_COMMITTED) {
+        item->gen_commit = item->gen_begin;
+    } else {
+        item->gen_commit = _WAL_GEN_NONE;
+    }
+    item->gen_end = _WAL_GEN_NONE;
+    avl_insert(&kshard->key_index, &item->avl_key, _wal_cmp_key_index);
+    if (txn_items) {
+        list_push_back(txn_items, &item->list_elem_txn);
+    }
+}
+
+// the caller should hold the lock of the key shard that the item belongs to
+INLINE bool _wal_item_in_views(struct wal *wal, struct wal_item *item)
+{
+    struct list_elem *e;
+    struct wal_view *view;
+    uint64_t gen;
+
+    for (e = list_begin(&wal->views); e; e = list_next(e)) {
+        view = _get_entry(e, struct wal_view, le);
+        gen = view->gens[item->header->shard_idx];
+        if (item->gen_begin <= gen && gen < item->gen_end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// remove the version from the key index at 'gen_end' (or at a new version
+// if 0 is given), and free the item unless any view still sees it.
+// the caller should hold the lock of the key shard, and should have taken
+// the item out of the header's list, the seq index and the txn's list.
+static void _wal_retire_item(struct wal *wal, struct wal_shard *kshard,
+                             struct wal_item *item, uint64_t gen_end)
+{
+    item->gen_end = (gen_end)?(gen_end):(++kshard->gen);
+    if (_wal_item_in_views(wal, item)) {
+        // freed when the last view seeing the item is closed
+        list_push_back(&kshard->retired, &item->list_elem);
+        return;
+    }
+    avl_remove(&kshard->key_index, &item->avl_key);
+    _wal_free_item(kshard, item);
+}
+
+void wal_global_init(uint64_t mem_budget)
+{
+    atomic_val_init_64(&wal_global_memsize, 0);
+    wal_mem_budget = mem_budget;
+    list_init(&wal_list);
+    spin_init(&wal_list_lock);
+    wal_victim_memsize = (uint64_t)-1;
+    wal_victim_base = 0;
+}
+
+void wal_global_shutdown()
+{
+    spin_destroy(&wal_list_lock);
+    atomic_val_destroy(&wal_global_memsize);
+}
+
 fdb_status wal_init(struct filemgr *file, int nbucket)
 {
+    size_t i, nbucket_shard;
+
     file->wal->flag = WAL_FLAG_INITIALIZED;
-    file->wal->size = 0;
-    file->wal->num_flushable = 0;
-    file->wal->datasize = 0;
+    file->wal->file = file;
     file->wal->wal_dirty = FDB_WAL_CLEAN;
-    hash_init(&file->wal->hash_bykey, nbucket, _wal_hash_bykey, _wal_cmp_bykey);
-    hash_init(&file->wal->hash_byseq, nbucket, _wal_hash_byseq, _wal_cmp_byseq);
-    list_init(&file->wal->list);
+    file->wal->flush_pending = 0;
+    memset(&file->wal->fstats, 0, sizeof(file->wal->fstats));
+    file->wal->flush_config = NULL;
+    file->wal->num_shards = FDB_WAL_NSHARDS;
+    nbucket_shard = nbucket / file->wal->num_shards;
+    if (nbucket_shard == 0) {
+        nbucket_shard = 1;
+    }
+
+    file->wal->key_shards = (struct wal_shard *)
+        malloc(sizeof(struct wal_shard) * file->wal->num_shards);
+    file->wal->seq_shards = (struct wal_seq_shard *)
+        malloc(sizeof(struct wal_seq_shard) * file->wal->num_shards);
+    for (i=0;i<file->wal->num_shards;++i) {
+        struct wal_shard *kshard = &file->wal->key_shards[i];
+        struct wal_seq_shard *sshard = &file->wal->seq_shards[i];
+
+        kshard->size = 0;
+        kshard->num_flushable = 0;
+        kshard->datasize = 0;
+        kshard->memsize = 0;
+        hash_init(&kshard->hash_bykey, nbucket_shard,
+                  _wal_hash_bykey, _wal_cmp_bykey);
+        list_init(&kshard->list);
+        avl_init(&kshard->key_index, NULL);
+        kshard->gen = 0;
+        kshard->commit_gen = 0;
+        list_init(&kshard->retired);
+        arena_init(&kshard->arena, FDB_WAL_ARENA_CHUNKSIZE);
+        spin_init(&kshard->lock);
+
+        hash_init(&sshard->hash_byseq, nbucket_shard,
+                  _wal_hash_byseq, _wal_cmp_byseq);
+        spin_init(&sshard->lock);
+    }
     list_init(&file->wal->txn_list);
+    list_init(&file->wal->views);
     spin_init(&file->wal->lock);
 
+    spin_lock(&wal_list_lock);
+    list_push_back(&wal_list, &file->wal->le);
+    spin_unlock(&wal_list_lock);
+
     DBG("wal item size %d\n", (int)sizeof(struct wal_item));
     return FDB_RESULT_SUCCESS;
 }
 
+void wal_destroy(struct filemgr *file)
+{
+    size_t i;
+    struct list_elem *e;
+    struct wal_item *item;
+    struct wal_shard *kshard;
+
+    // free items left by views that were not closed
+    for (i=0;i<file->wal->num_shards;++i) {
+        kshard = &file->wal->key_shards[i];
+        e = list_begin(&kshard->retired);
+        while (e) {
+            item = _get_entry(e, struct wal_item, list_elem);
+            e = list_remove(&kshard->retired, e);
+            _wal_free_item(kshard, item);
+        }
+    }
+
+    spin_lock(&wal_list_lock);
+    list_remove(&wal_list, &file->wal->le);
+    spin_unlock(&wal_list_lock);
+    free(file->wal->flush_config);
+
+    for (i=0;i<file->wal->num_shards;++i) {
+        // entries left in the shard are released at once
+        atomic_val_sub_64(&wal_global_memsize,
+                          file->wal->key_shards[i].memsize);
+        hash_free(&file->wal->key_shards[i].hash_bykey);
+        arena_free_all(&file->wal->key_shards[i].arena);
+        spin_destroy(&file->wal->key_shards[i].lock);
+        hash_free(&file->wal->seq_shards[i].hash_byseq);
+        spin_destroy(&file->wal->seq_shards[i].lock);
+    }
+    free(file->wal->key_shards);
+    free(file->wal->seq_shards);
+    spin_destroy(&file->wal->lock);
+}
+
 int wal_is_initialized(struct filemgr *file)
 {
     return file->wal->flag & WAL_FLAG_INITIALIZED;
@@ -125,10 +418,12 @@ fdb_status wal_insert(fdb_txn *txn,
 {
     struct wal_item *item;
     struct wal_item_header query, *header;
+    struct wal_shard *kshard;
     struct list_elem *le;
     struct hash_elem *he;
     void *key = doc->key;
     size_t keylen = doc->keylen;
+    size_t shard_idx;
     fdb_kvs_id_t kv_id;
 
     if (file->kv_header) { // multi KV instance mode
@@ -138,10 +433,12 @@ fdb_status wal_insert(fdb_txn *txn,
     }
     query.key = key;
     query.keylen = keylen;
+    shard_idx = _wal_key_shard_idx(file->wal, key, keylen);
+    kshard = &file->wal->key_shards[shard_idx];
 
-    spin_lock(&file->wal->lock);
+    spin_lock(&kshard->lock);
 
-    he = hash_find(&file->wal->hash_bykey, &query.he_key);
+    he = hash_find(&kshard->hash_bykey, &query.he_key);
 
     if (he) {
         // already exist .. retrieve header
@@ -162,21 +459,34 @@ fdb_status wal_insert(fdb_txn *txn,
                 item = _get_entry(le, struct wal_item, list_elem);
 
                 if (item->txn == txn && !(item->flag & WAL_ITEM_COMMITTED)) {
-                    item->flag &= ~WAL_ITEM_FLUSH_READY;
-
-                    hash_remove(&file->wal->hash_byseq, &item->he_seq);
+                    // replace the item with a new version rather than
+                    // updating it in place, as iterators may still see
+                    // the old one
+                    struct wal_item *old_item = item;
+
+                    item = _wal_alloc_item(kshard, header);
+                    item->txn = txn;
+                    item->flag = old_item->flag & ~WAL_ITEM_FLUSH_READY;
                     item->seqnum = doc->seqnum;
-                    hash_insert(&file->wal->hash_byseq, &item->he_seq);
 
-                    file->wal->datasize -= item->doc_size;
-                    file->wal->datasize += doc->size_ondisk;
+                    kshard->datasize -= old_item->doc_size;
+                    kshard->datasize += doc->size_ondisk;
                     item->doc_size = doc->size_ondisk;
                     item->offset = offset;
                     item->action = doc->deleted ? WAL_ACT_LOGICAL_REMOVE : WAL_ACT_INSERT;
 
-                    // move the item to the front of the list (header)
-                    list_remove(&header->items, &item->list_elem);
+                    _wal_seq_remove(file->wal, old_item);
+                    _wal_seq_insert(file->wal, item);
+                    // put the new one at the front of the list (header)
+                    list_remove(&header->items, &old_item->list_elem);
                     list_push_front(&header->items, &item->list_elem);
+                    // and replace the old one in the transaction's list
+                    list_remove(&txn->items[shard_idx],
+                                &old_item->list_elem_txn);
+                    _wal_key_index_insert(kshard, item,
+                                          &txn->items[shard_idx]);
+                    _wal_retire_item(file->wal, kshard, old_item,
+                                     item->gen_begin);
                     break;
                 }
                 le = list_next(le);
@@ -201,7 +511,7 @@ fdb_status wal_insert(fdb_txn *txn,
         if (le == NULL) {
             // not exist
             // create new item
-            item = (struct wal_item *)malloc(sizeof(struct wal_item));
+            item = _wal_alloc_item(kshard, header);
             if (is_compactor) {
                 item->flag = WAL_ITEM_COMMITTED | WAL_ITEM_BY_COMPACTOR;
             } else {
@@ -212,41 +522,41 @@ fdb_status wal_insert(fdb_txn *txn,
             }
             item->txn = txn;
             if (txn == &file->global_txn) {
-                file->wal->num_flushable++;
+                kshard->num_flushable++;
             }
-            item->header = header;
 
             item->seqnum = doc->seqnum;
             item->action = doc->deleted ? WAL_ACT_LOGICAL_REMOVE : WAL_ACT_INSERT;
             item->offset = offset;
             item->doc_size = doc->size_ondisk;
-            file->wal->datasize += doc->size_ondisk;
+            kshard->datasize += doc->size_ondisk;
 
-            hash_insert(&file->wal->hash_byseq, &item->he_seq);
+            _wal_seq_insert(file->wal, item);
             if (!is_compactor) {
                 // insert into header's list
                 list_push_front(&header->items, &item->list_elem);
                 // also insert into transaction's list
-                list_push_back(txn->items, &item->list_elem_txn);
+                _wal_key_index_insert(kshard, item, &txn->items[shard_idx]);
             } else {
                 // compactor
                 // always push back because it is already committed
                 list_push_back(&header->items, &item->list_elem);
+                _wal_key_index_insert(kshard, item, NULL);
             }
-            file->wal->size++;
+            kshard->size++;
         }
     } else {
         // not exist .. create new one
         // create new header and new item
-        header = (struct wal_item_header*)malloc(sizeof(struct wal_item_header));
+        header = _wal_alloc_header(kshard, keylen);
         list_init(&header->items);
         header->chunksize = file->config->chunksize;
-        header->keylen = keylen;
-        header->key = (void *)malloc(header->keylen);
+        header->shard_idx = shard_idx;
+        header->refcount = 1;
         memcpy(header->key, key, header->keylen);
-        hash_insert(&file->wal->hash_bykey, &header->he_key);
+        hash_insert(&kshard->hash_bykey, &header->he_key);
 
-        item = (struct wal_item *)malloc(sizeof(struct wal_item));
+        item = _wal_alloc_item(kshard, header);
         // entries inserted by compactor is already committed
         if (is_compactor) {
             item->flag = WAL_ITEM_COMMITTED | WAL_ITEM_BY_COMPACTOR;
@@ -258,33 +568,33 @@ fdb_status wal_insert(fdb_txn *txn,
         }
         item->txn = txn;
         if (txn == &file->global_txn) {
-            file->wal->num_flushable++;
+            kshard->num_flushable++;
         }
-        item->header = header;
 
         item->seqnum = doc->seqnum;
         item->action = doc->deleted ? WAL_ACT_LOGICAL_REMOVE : WAL_ACT_INSERT;
         item->offset = offset;
         item->doc_size = doc->size_ondisk;
-        file->wal->datasize += doc->size_ondisk;
-        hash_insert(&file->wal->hash_byseq, &item->he_seq);
+        kshard->datasize += doc->size_ondisk;
+        _wal_seq_insert(file->wal, item);
         // insert into header's list
         // (pushing front is ok for compactor because no other item already exists)
         list_push_front(&header->items, &item->list_elem);
         if (!is_compactor) {
             // also insert into transaction's list
-            list_push_back(txn->items, &item->list_elem_txn);
+            _wal_key_index_insert(kshard, item, &txn->items[shard_idx]);
         } else {
+            _wal_key_index_insert(kshard, item, NULL);
             // increase num_docs
             _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDOCS, 1);
         }
 
-        // insert header into wal global list
-        list_push_back(&file->wal->list, &header->list_elem);
-        ++file->wal->size;
+        // insert header into the shard's list
+        list_push_back(&kshard->list, &header->list_elem);
+        ++kshard->size;
     }
 
-    spin_unlock(&file->wal->lock);
+    spin_unlock(&kshard->lock);
 
     return FDB_RESULT_SUCCESS;
 }
@@ -302,13 +612,18 @@ static fdb_status _wal_find(fdb_txn *txn,
     void *key = doc->key;
     size_t keylen = doc->keylen;
 
-    spin_lock(&file->wal->lock);
-
     if (doc->seqnum == SEQNUM_NOT_USED || (key && keylen>0)) {
         // search by key
+        // (only the shard that the key belongs to is locked,
+        //  so that lookups of other keys are not blocked)
+        struct wal_shard *kshard;
+
+        kshard = &file->wal->key_shards[_wal_key_shard_idx(file->wal,
+                                                           key, keylen)];
+        spin_lock(&kshard->lock);
         query.key = key;
         query.keylen = keylen;
-        he = hash_find(&file->wal->hash_bykey, &query.he_key);
+        he = hash_find(&kshard->hash_bykey, &query.he_key);
         if (he) {
             // retrieve header
             header = _get_entry(he, struct wal_item_header, he_key);
@@ -327,15 +642,17 @@ static fdb_status _wal_find(fdb_txn *txn,
                     } else {
                         doc->deleted = true;
                     }
-                    spin_unlock(&file->wal->lock);
+                    spin_unlock(&kshard->lock);
                     return FDB_RESULT_SUCCESS;
                 }
                 le = list_next(le);
             }
         }
+        spin_unlock(&kshard->lock);
     } else {
         // search by seqnum
         struct wal_item_header temp_header;
+        struct wal_seq_shard *sshard;
 
         if (file->kv_header) { // multi KV instance mode
             temp_header.key = (void*)alca(uint8_t, file->config->chunksize);
@@ -343,7 +660,9 @@ static fdb_status _wal_find(fdb_txn *txn,
             item_query.header = &temp_header;
         }
         item_query.seqnum = doc->seqnum;
-        he = hash_find(&file->wal->hash_byseq, &item_query.he_seq);
+        sshard = _wal_get_seq_shard(file->wal, doc->seqnum);
+        spin_lock(&sshard->lock);
+        he = hash_find(&sshard->hash_byseq, &item_query.he_seq);
         if (he) {
             item = _get_entry(he, struct wal_item, he_seq);
             if ((item->flag & WAL_ITEM_COMMITTED) ||
@@ -355,13 +674,13 @@ static fdb_status _wal_find(fdb_txn *txn,
                 } else {
                     doc->deleted = true;
                 }
-                spin_unlock(&file->wal->lock);
+                spin_unlock(&sshard->lock);
                 return FDB_RESULT_SUCCESS;
             }
         }
+        spin_unlock(&sshard->lock);
     }
 
-    spin_unlock(&file->wal->lock);
     return FDB_RESULT_KEY_NOT_FOUND;
 }
 
@@ -387,68 +706,76 @@ fdb_status wal_txn_migration(void *dbhandle,
                              wal_doc_move_func *move_doc)
 {
     uint64_t offset;
+    size_t i;
     fdb_doc doc;
     fdb_txn *txn;
     struct wal_txn_wrapper *txn_wrapper;
     struct wal_item_header *header;
     struct wal_item *item;
+    struct wal_shard *kshard;
     struct list_elem *e1, *e2;
 
-    spin_lock(&old_file->wal->lock);
+    for (i=0;i<old_file->wal->num_shards;++i) {
+        kshard = &old_file->wal->key_shards[i];
+        spin_lock(&kshard->lock);
 
-    e1 = list_begin(&old_file->wal->list);
-    while(e1) {
-        header = _get_entry(e1, struct wal_item_header, list_elem);
+        e1 = list_begin(&kshard->list);
+        while(e1) {
+            header = _get_entry(e1, struct wal_item_header, list_elem);
 
-        e2 = list_end(&header->items);
-        while(e2) {
-            item = _get_entry(e2, struct wal_item, list_elem);
-            if (!(item->flag & WAL_ITEM_COMMITTED)) {
-                // not committed yet
-                // move doc
-                offset = move_doc(dbhandle, new_dhandle, item, &doc);
-                // insert into new_file's WAL
-                wal_insert(item->txn, new_file, &doc, offset, 0);
-                // remove from seq hash table
-                hash_remove(&old_file->wal->hash_byseq, &item->he_seq);
-                // remove from header's list
-                e2 = list_remove_reverse(&header->items, e2);
-                // remove from transaction's list
-                list_remove(item->txn->items, &item->list_elem_txn);
-                // decrease num_flushable of old_file if non-transactional update
-                if (item->txn == &old_file->global_txn) {
-                    old_file->wal->num_flushable--;
-                }
-                if (item->action != WAL_ACT_REMOVE) {
-                    old_file->wal->datasize -= item->doc_size;
+            e2 = list_end(&header->items);
+            while(e2) {
+                item = _get_entry(e2, struct wal_item, list_elem);
+                if (!(item->flag & WAL_ITEM_COMMITTED)) {
+                    // not committed yet
+                    // move doc
+                    offset = move_doc(dbhandle, new_dhandle, item, &doc);
+                    // insert into new_file's WAL
+                    wal_insert(item->txn, new_file, &doc, offset, 0);
+                    // remove from seq hash table
+                    _wal_seq_remove(old_file->wal, item);
+                    // remove from header's list
+                    e2 = list_remove_reverse(&header->items, e2);
+                    // remove from transaction's list
+                    list_remove(&item->txn->items[i], &item->list_elem_txn);
+                    // decrease num_flushable of old_file if non-transactional update
+                    if (item->txn == &old_file->global_txn) {
+                        kshard->num_flushable--;
+                    }
+                    if (item->action != WAL_ACT_REMOVE) {
+                        kshard->datasize -= item->doc_size;
+                    }
+                    // free item
+                    _wal_retire_item(old_file->wal, kshard, item, 0);
+                    // free doc
+                    free(doc.key);
+                    free(doc.meta);
+                    free(doc.body);
+                    kshard->size--;
+                } else {
+                    e2= list_prev(e2);
                 }
-                // free item
-                free(item);
-                // free doc
-                free(doc.key);
-                free(doc.meta);
-                free(doc.body);
-                old_file->wal->size--;
+            }
+
+            if (list_begin(&header->items) == NULL) {
+                // header's list becomes empty
+                // remove from key hash table
+                hash_remove(&kshard->hash_bykey, &header->he_key);
+                // remove from wal list
+                e1 = list_remove(&kshard->list, &header->list_elem);
+                // free key & header
+                _wal_put_header(kshard, header);
             } else {
-                e2= list_prev(e2);
+                e1 = list_next(e1);
             }
         }
 
-        if (list_begin(&header->items) == NULL) {
-            // header's list becomes empty
-            // remove from key hash table
-            hash_remove(&old_file->wal->hash_bykey, &header->he_key);
-            // remove from wal list
-            e1 = list_remove(&old_file->wal->list, &header->list_elem);
-            // free key & header
-            free(header->key);
-            free(header);
-        } else {
-            e1 = list_next(e1);
-        }
+        spin_unlock(&kshard->lock);
     }
 
     // migrate all entries in txn list
+    spin_lock(&old_file->wal->lock);
+    spin_lock(&new_file->wal->lock);
     e1 = list_begin(&old_file->wal->txn_list);
     while(e1) {
         txn_wrapper = _get_entry(e1, struct wal_txn_wrapper, le);
@@ -463,12 +790,34 @@ fdb_status wal_txn_migration(void *dbhandle,
             e1 = list_next(e1);
         }
     }
-
+    spin_unlock(&new_file->wal->lock);
     spin_unlock(&old_file->wal->lock);
 
     return FDB_RESULT_SUCCESS;
 }
 
+// reserve a version for the commit in each key shard, and hold the locks of
+// all key shards until the commit is done, so that neither lookups nor views
+// see only a part of the transaction
+// (commits of a file are serialized by the file mutex)
+static void _wal_begin_commit(struct wal *wal)
+{
+    size_t i;
+    _wal_lock_all_shards(wal);
+    for (i=0;i<wal->num_shards;++i) {
+        wal->key_shards[i].commit_gen = ++wal->key_shards[i].gen;
+    }
+}
+
+static void _wal_end_commit(struct wal *wal)
+{
+    size_t i;
+    for (i=0;i<wal->num_shards;++i) {
+        wal->key_shards[i].commit_gen = 0;
+    }
+    _wal_unlock_all_shards(wal);
+}
+
 fdb_status wal_commit(fdb_txn *txn, struct filemgr *file,
                       wal_commit_mark_func *func)
 {
@@ -476,108 +825,128 @@ fdb_status wal_commit(fdb_txn *txn, struct filemgr *file,
     wal_item_action prev_action;
     struct wal_item *item;
     struct wal_item *_item;
+    struct wal_shard *kshard;
+    struct wal_seq_shard *sshard;
     struct list_elem *e1, *e2;
     fdb_kvs_id_t kv_id;
     fdb_status status;
+    size_t i;
 
-    spin_lock(&file->wal->lock);
+    _wal_begin_commit(file->wal);
+    for (i=0;i<file->wal->num_shards;++i) {
+        // items in the txn's list of a shard are protected by its lock
+        kshard = &file->wal->key_shards[i];
 
-    e1 = list_begin(txn->items);
-    while(e1) {
-        item = _get_entry(e1, struct wal_item, list_elem_txn);
-        assert(item->txn == txn);
+        e1 = list_begin(&txn->items[i]);
+        while(e1) {
+            item = _get_entry(e1, struct wal_item, list_elem_txn);
+            assert(item->txn == txn);
 
-        if (!(item->flag & WAL_ITEM_COMMITTED)) {
-            // get KVS ID
-            if (item->flag & WAL_ITEM_MULTI_KV_INS_MODE) {
-                buf2kvid(item->header->chunksize, item->header->key, &kv_id);
-            } else {
-                kv_id = 0;
-            }
+            if (!(item->flag & WAL_ITEM_COMMITTED)) {
+                // get KVS ID
+                if (item->flag & WAL_ITEM_MULTI_KV_INS_MODE) {
+                    buf2kvid(item->header->chunksize, item->header->key, &kv_id);
+                } else {
+                    kv_id = 0;
+                }
 
-            item->flag |= WAL_ITEM_COMMITTED;
-            // append commit mark if necessary
-            if (func) {
-                status = func(txn->handle, item->offset);
-                if (status != FDB_RESULT_SUCCESS) {
-                    spin_unlock(&file->wal->lock);
-                    return status;
+                sshard = _wal_get_seq_shard(file->wal, item->seqnum);
+                spin_lock(&sshard->lock);
+                item->flag |= WAL_ITEM_COMMITTED;
+                spin_unlock(&sshard->lock);
+                // all items are committed at the version reserved for the
+                // commit, which is hidden from views until the commit is done
+                item->gen_commit = kshard->commit_gen;
+                // append commit mark if necessary
+                if (func) {
+                    status = func(txn->handle, item->offset);
+                    if (status != FDB_RESULT_SUCCESS) {
+                        _wal_end_commit(file->wal);
+                        return status;
+                    }
                 }
-            }
-            // remove previously committed item
-            prev_commit = 0;
-            // next item on the wal_item_header's items
-            e2 = list_next(&item->list_elem);
-            while(e2) {
-                _item = _get_entry(e2, struct wal_item, list_elem);
-                e2 = list_next(e2);
-                // committed but not flush-ready
-                // (flush-readied item will be removed by flushing)
-                if ((_item->flag & WAL_ITEM_COMMITTED) &&
-                    !(_item->flag & WAL_ITEM_FLUSH_READY)) {
-                    list_remove(&item->header->items, &_item->list_elem);
-                    hash_remove(&file->wal->hash_byseq, &_item->he_seq);
-                    prev_action = _item->action;
-                    prev_commit = 1;
-                    file->wal->size--;
-                    file->wal->num_flushable--;
-                    if (item->action != WAL_ACT_REMOVE) {
-                        file->wal->datasize -= _item->doc_size;
+                // remove previously committed item
+                prev_commit = 0;
+                // next item on the wal_item_header's items
+                e2 = list_next(&item->list_elem);
+                while(e2) {
+                    _item = _get_entry(e2, struct wal_item, list_elem);
+                    e2 = list_next(e2);
+                    // committed but not flush-ready
+                    // (flush-readied item will be removed by flushing)
+                    if ((_item->flag & WAL_ITEM_COMMITTED) &&
+                        !(_item->flag & WAL_ITEM_FLUSH_READY)) {
+                        list_remove(&item->header->items, &_item->list_elem);
+                        _wal_seq_remove(file->wal, _item);
+                        prev_action = _item->action;
+                        prev_commit = 1;
+                        kshard->size--;
+                        kshard->num_flushable--;
+                        if (item->action != WAL_ACT_REMOVE) {
+                            kshard->datasize -= _item->doc_size;
+                        }
+                        _wal_retire_item(file->wal, kshard, _item,
+                                         kshard->commit_gen);
                     }
-                    free(_item);
                 }
-            }
-            if (!prev_commit) {
-                // there was no previous commit .. increase num_docs
-                _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDOCS, 1);
-                if (item->action == WAL_ACT_LOGICAL_REMOVE) {
-                    _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, 1);
+                if (!prev_commit) {
+                    // there was no previous commit .. increase num_docs
+                    _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDOCS, 1);
+                    if (item->action == WAL_ACT_LOGICAL_REMOVE) {
+                        _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, 1);
+                    }
+                } else {
+                    if (prev_action == WAL_ACT_INSERT &&
+                        item->action == WAL_ACT_LOGICAL_REMOVE) {
+                        _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, 1);
+                    } else if (prev_action == WAL_ACT_LOGICAL_REMOVE &&
+                               item->action == WAL_ACT_INSERT) {
+                        _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, -1);
+                    }
                 }
-            } else {
-                if (prev_action == WAL_ACT_INSERT &&
-                    item->action == WAL_ACT_LOGICAL_REMOVE) {
-                    _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, 1);
-                } else if (prev_action == WAL_ACT_LOGICAL_REMOVE &&
-                           item->action == WAL_ACT_INSERT) {
-                    _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, -1);
+                // increase num_flushable if it is transactional update
+                if (item->txn != &file->global_txn) {
+                    kshard->num_flushable++;
                 }
+                // move the committed item to the end of the wal_item_header's list
+                list_remove(&item->header->items, &item->list_elem);
+                list_push_back(&item->header->items, &item->list_elem);
             }
-            // increase num_flushable if it is transactional update
-            if (item->txn != &file->global_txn) {
-                file->wal->num_flushable++;
-            }
-            // move the committed item to the end of the wal_item_header's list
-            list_remove(&item->header->items, &item->list_elem);
-            list_push_back(&item->header->items, &item->list_elem);
-        }
 
-        // remove from transaction's list
-        e1 = list_remove(txn->items, e1);
+            // remove from transaction's list
+            e1 = list_remove(&txn->items[i], e1);
+        }
     }
+    _wal_end_commit(file->wal);
 
-    spin_unlock(&file->wal->lock);
     return FDB_RESULT_SUCCESS;
 }
 
+// sort by key (and by offset for the same key, so that the latest
+// document is flushed last), for batched updates of the main index
 static int _wal_flush_cmp(struct avl_node *a, struct avl_node *b, void *aux)
 {
     struct wal_item *aa, *bb;
+    size_t keylen;
+    int cmp;
     aa = _get_entry(a, struct wal_item, avl);
     bb = _get_entry(b, struct wal_item, avl);
 
-    if (aa->old_offset < bb->old_offset) {
+    keylen = MIN(aa->header->keylen, bb->header->keylen);
+    cmp = memcmp(aa->header->key, bb->header->key, keylen);
+    if (cmp) {
+        return cmp;
+    }
+    if (aa->header->keylen != bb->header->keylen) {
+        return (aa->header->keylen < bb->header->keylen)?(-1):(1);
+    }
+
+    if (aa->offset < bb->offset) {
         return -1;
-    } else if (aa->old_offset > bb->old_offset) {
+    } else if (aa->offset > bb->offset) {
         return 1;
     } else {
-        // old_offset can be 0 if the document was newly inserted
-        if (aa->offset < bb->offset) {
-            return -1;
-        } else if (aa->offset > bb->offset) {
-            return 1;
-        } else {
-            return 0;
-        }
+        return 0;
     }
 }
 
@@ -587,10 +956,10 @@ fdb_status wal_release_flushed_items(struct filemgr *file,
     struct avl_tree *tree = flush_items;
     struct avl_node *a;
     struct wal_item *item;
+    struct wal_shard *kshard;
     fdb_kvs_id_t kv_id;
 
     // scan and remove entries in the avl-tree
-    spin_lock(&file->wal->lock);
     while (1) {
         if ((a = avl_first(tree)) == NULL) {
             break;
@@ -605,15 +974,16 @@ fdb_status wal_release_flushed_items(struct filemgr *file,
             kv_id = 0;
         }
 
+        kshard = &file->wal->key_shards[item->header->shard_idx];
+        spin_lock(&kshard->lock);
         list_remove(&item->header->items, &item->list_elem);
-        hash_remove(&file->wal->hash_byseq, &item->he_seq);
+        _wal_seq_remove(file->wal, item);
         if (list_begin(&item->header->items) == NULL) {
             // wal_item_header becomes empty
             // free header and remove from hash table & wal list
-            list_remove(&file->wal->list, &item->header->list_elem);
-            hash_remove(&file->wal->hash_bykey, &item->header->he_key);
-            free(item->header->key);
-            free(item->header);
+            list_remove(&kshard->list, &item->header->list_elem);
+            hash_remove(&kshard->hash_bykey, &item->header->he_key);
+            _wal_put_header(kshard, item->header);
         }
 
         if (item->action == WAL_ACT_LOGICAL_REMOVE ||
@@ -621,14 +991,14 @@ fdb_status wal_release_flushed_items(struct filemgr *file,
             _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, -1);
         }
         _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDOCS, -1);
-        file->wal->size--;
-        file->wal->num_flushable--;
+        kshard->size--;
+        kshard->num_flushable--;
         if (item->action != WAL_ACT_REMOVE) {
-            file->wal->datasize -= item->doc_size;
+            kshard->datasize -= item->doc_size;
         }
-        free(item);
+        _wal_retire_item(file->wal, kshard, item, 0);
+        spin_unlock(&kshard->lock);
     }
-    spin_unlock(&file->wal->lock);
 
     return FDB_RESULT_SUCCESS;
 }
@@ -636,7 +1006,6 @@ fdb_status wal_release_flushed_items(struct filemgr *file,
 static fdb_status _wal_flush(struct filemgr *file,
                              void *dbhandle,
                              wal_flush_func *flush_func,
-                             wal_get_old_offset_func *get_old_offset,
                              struct avl_tree *flush_items,
                              bool by_compactor)
 {
@@ -644,43 +1013,56 @@ static fdb_status _wal_flush(struct filemgr *file,
     struct avl_node *a;
     struct list_elem *e, *ee;
     struct wal_item *item;
+    struct wal_item **batch;
     struct wal_item_header *header;
+    struct wal_shard *kshard;
+    fdb_status fs = FDB_RESULT_SUCCESS;
+    size_t i, nitems = 0, nbatch;
 
-    // sort by old byte-offset of the document (for sequential access)
-    spin_lock(&file->wal->lock);
+    // sort by key, so that the items are flushed in batches
+    // that update the main index sequentially
     avl_init(tree, NULL);
-    e = list_begin(&file->wal->list);
-    while(e){
-        header = _get_entry(e, struct wal_item_header, list_elem);
-        ee = list_end(&header->items);
-        while(ee) {
-            item = _get_entry(ee, struct wal_item, list_elem);
-            // committed but not flushed items
-            if (!(item->flag & WAL_ITEM_COMMITTED)) {
-                break;
-            }
-            if (by_compactor &&
-                !(item->flag & WAL_ITEM_BY_COMPACTOR)) {
-                // during compaction, do not flush normally committed item
-                break;
-            }
-            if (!(item->flag & WAL_ITEM_FLUSH_READY)) {
-                item->flag |= WAL_ITEM_FLUSH_READY;
-                // if WAL_ITEM_FLUSH_READY flag is set,
-                // this item becomes immutable, so that
-                // no other concurrent thread modifies it.
-                spin_unlock(&file->wal->lock);
-                item->old_offset = get_old_offset(dbhandle, item);
-                avl_insert(tree, &item->avl, _wal_flush_cmp);
-                spin_lock(&file->wal->lock);
+    for (i=0;i<file->wal->num_shards;++i) {
+        kshard = &file->wal->key_shards[i];
+        spin_lock(&kshard->lock);
+        e = list_begin(&kshard->list);
+        while(e){
+            header = _get_entry(e, struct wal_item_header, list_elem);
+            ee = list_end(&header->items);
+            while(ee) {
+                item = _get_entry(ee, struct wal_item, list_elem);
+                // committed but not flushed items
+                if (!(item->flag & WAL_ITEM_COMMITTED)) {
+                    break;
+                }
+                if (by_compactor &&
+                    !(item->flag & WAL_ITEM_BY_COMPACTOR)) {
+                    // during compaction, do not flush normally committed item
+                    break;
+                }
+                if (!(item->flag & WAL_ITEM_FLUSH_READY)) {
+                    item->flag |= WAL_ITEM_FLUSH_READY;
+                    // if WAL_ITEM_FLUSH_READY flag is set,
+                    // this item becomes immutable, so that
+                    // no other concurrent thread modifies it.
+                    avl_insert(tree, &item->avl, _wal_flush_cmp);
+                    nitems++;
+                }
+                ee = list_prev(ee);
             }
-            ee = list_prev(ee);
+            e = list_next(e);
         }
-        e = list_next(e);
+        spin_unlock(&kshard->lock);
     }
-    spin_unlock(&file->wal->lock);
 
-    // scan and flush entries in the avl-tree
+    if (nitems == 0) {
+        return FDB_RESULT_SUCCESS;
+    }
+
+    // scan the avl-tree and flush entries in batches
+    batch = (struct wal_item **)malloc(sizeof(struct wal_item *) *
+                                       MIN(nitems, FDB_WAL_FLUSH_BATCHSIZE));
+    nbatch = 0;
     a = avl_first(tree);
     while (a) {
         item = _get_entry(a, struct wal_item, avl);
@@ -688,34 +1070,35 @@ static fdb_status _wal_flush(struct filemgr *file,
 
         // check weather this item is updated after insertion into tree
         if (item->flag & WAL_ITEM_FLUSH_READY) {
-            fdb_status fs = flush_func(dbhandle, item);
+            batch[nbatch++] = item;
+        }
+        if (nbatch == FDB_WAL_FLUSH_BATCHSIZE || (a == NULL && nbatch > 0)) {
+            fs = flush_func(dbhandle, batch, nbatch);
             if (fs != FDB_RESULT_SUCCESS) {
-                return fs;
+                break;
             }
+            nbatch = 0;
         }
     }
+    free(batch);
 
-    return FDB_RESULT_SUCCESS;
+    return fs;
 }
 
 fdb_status wal_flush(struct filemgr *file,
                      void *dbhandle,
                      wal_flush_func *flush_func,
-                     wal_get_old_offset_func *get_old_offset,
                      struct avl_tree *flush_items)
 {
-    return _wal_flush(file, dbhandle, flush_func, get_old_offset,
-                      flush_items, false);
+    return _wal_flush(file, dbhandle, flush_func, flush_items, false);
 }
 
 fdb_status wal_flush_by_compactor(struct filemgr *file,
                                   void *dbhandle,
                                   wal_flush_func *flush_func,
-                                  wal_get_old_offset_func *get_old_offset,
                                   struct avl_tree *flush_items)
 {
-    return _wal_flush(file, dbhandle, flush_func, get_old_offset,
-                      flush_items, true);
+    return _wal_flush(file, dbhandle, flush_func, flush_items, true);
 }
 
 // Used to copy all the WAL items for non-durable snapshots
@@ -727,54 +1110,59 @@ fdb_status wal_snapshot(struct filemgr *file,
     struct list_elem *e, *ee;
     struct wal_item *item;
     struct wal_item_header *header;
+    struct wal_shard *kshard;
     fdb_seqnum_t copy_upto = *upto_seq;
     fdb_seqnum_t copied_seq = 0;
     fdb_doc doc;
-
-    spin_lock(&file->wal->lock);
-    e = list_begin(&file->wal->list);
-    while(e){
-        header = _get_entry(e, struct wal_item_header, list_elem);
-        ee = list_begin(&header->items);
-        while(ee) {
-            item = _get_entry(ee, struct wal_item, list_elem);
-            if (item->flag & WAL_ITEM_BY_COMPACTOR) { // Always skip
-                ee = list_next(ee); // items moved by compactor to prevent
-                continue; // duplication of items in WAL & Main-index
-            }
-            if (copy_upto != FDB_SNAPSHOT_INMEM) {
-                // Take stable snapshot in new_file: Skip all items that are...
-                if (copy_upto < item->seqnum || // higher than requested seqnum
-                   !(item->flag & WAL_ITEM_COMMITTED)) { // or uncommitted
-                    ee = list_next(ee);
-                    continue;
+    size_t i;
+
+    for (i=0;i<file->wal->num_shards;++i) {
+        kshard = &file->wal->key_shards[i];
+        spin_lock(&kshard->lock);
+        e = list_begin(&kshard->list);
+        while(e){
+            header = _get_entry(e, struct wal_item_header, list_elem);
+            ee = list_begin(&header->items);
+            while(ee) {
+                item = _get_entry(ee, struct wal_item, list_elem);
+                if (item->flag & WAL_ITEM_BY_COMPACTOR) { // Always skip
+                    ee = list_next(ee); // items moved by compactor to prevent
+                    continue; // duplication of items in WAL & Main-index
                 }
-            } else { // An in-memory snapshot in current file..
-                // Skip any uncommitted item, if not part of either global or
-                // the current transaction
-                if (!(item->flag & WAL_ITEM_COMMITTED) &&
-                      item->txn != &file->global_txn &&
-                      item->txn != txn) {
-                    ee = list_next(ee);
-                    continue;
+                if (copy_upto != FDB_SNAPSHOT_INMEM) {
+                    // Take stable snapshot in new_file: Skip all items that are...
+                    if (copy_upto < item->seqnum || // higher than requested seqnum
+                       !(item->flag & WAL_ITEM_COMMITTED)) { // or uncommitted
+                        ee = list_next(ee);
+                        continue;
+                    }
+                } else { // An in-memory snapshot in current file..
+                    // Skip any uncommitted item, if not part of either global or
+                    // the current transaction
+                    if (!(item->flag & WAL_ITEM_COMMITTED) &&
+                          item->txn != &file->global_txn &&
+                          item->txn != txn) {
+                        ee = list_next(ee);
+                        continue;
+                    }
                 }
-            }
 
-            doc.keylen = item->header->keylen;
-            doc.key = malloc(doc.keylen); // (freed in fdb_snapshot_close)
-            memcpy(doc.key, item->header->key, doc.keylen);
-            doc.seqnum = item->seqnum;
-            doc.deleted = (item->action == WAL_ACT_LOGICAL_REMOVE ||
-                    item->action == WAL_ACT_REMOVE);
-            snapshot_func(dbhandle, &doc, item->offset);
-            if (doc.seqnum > copied_seq) {
-                copied_seq = doc.seqnum;
+                doc.keylen = item->header->keylen;
+                doc.key = malloc(doc.keylen); // (freed in fdb_snapshot_close)
+                memcpy(doc.key, item->header->key, doc.keylen);
+                doc.seqnum = item->seqnum;
+                doc.deleted = (item->action == WAL_ACT_LOGICAL_REMOVE ||
+                        item->action == WAL_ACT_REMOVE);
+                snapshot_func(dbhandle, &doc, item->offset);
+                if (doc.seqnum > copied_seq) {
+                    copied_seq = doc.seqnum;
+                }
+                break; // We just require a single latest copy in the snapshot
             }
-            break; // We just require a single latest copy in the snapshot
+            e = list_next(e);
         }
-        e = list_next(e);
+        spin_unlock(&kshard->lock);
     }
-    spin_unlock(&file->wal->lock);
 
     *upto_seq = copied_seq; // Return to caller the highest copied seqnum
     return FDB_RESULT_SUCCESS;
@@ -784,43 +1172,50 @@ fdb_status wal_snapshot(struct filemgr *file,
 fdb_status wal_discard(struct filemgr *file, fdb_txn *txn)
 {
     struct wal_item *item;
+    struct wal_item_header *header;
+    struct wal_shard *kshard;
     struct list_elem *e;
-
-    spin_lock(&file->wal->lock);
-
-    e = list_begin(txn->items);
-    while(e) {
-        item = _get_entry(e, struct wal_item, list_elem_txn);
-
-        // remove from seq hash table
-        hash_remove(&file->wal->hash_byseq, &item->he_seq);
-        // remove from header's list
-        list_remove(&item->header->items, &item->list_elem);
-        // remove header if empty
-        if (list_begin(&item->header->items) == NULL) {
-            //remove from key hash table
-            hash_remove(&file->wal->hash_bykey, &item->header->he_key);
-            // remove from wal list
-            list_remove(&file->wal->list, &item->header->list_elem);
-            // free key and header
-            free(item->header->key);
-            free(item->header);
-        }
-        // remove from txn's list
-        e = list_remove(txn->items, e);
-        if (item->txn == &file->global_txn ||
-            item->flag & WAL_ITEM_COMMITTED) {
-            file->wal->num_flushable--;
-        }
-        if (item->action != WAL_ACT_REMOVE) {
-            file->wal->datasize -= item->doc_size;
+    size_t i;
+
+    for (i=0;i<file->wal->num_shards;++i) {
+        kshard = &file->wal->key_shards[i];
+        spin_lock(&kshard->lock);
+
+        e = list_begin(&txn->items[i]);
+        while(e) {
+            item = _get_entry(e, struct wal_item, list_elem_txn);
+            header = item->header;
+
+            // remove from seq hash table
+            _wal_seq_remove(file->wal, item);
+            // remove from header's list
+            list_remove(&header->items, &item->list_elem);
+            // remove header if empty
+            if (list_begin(&header->items) == NULL) {
+                //remove from key hash table
+                hash_remove(&kshard->hash_bykey, &header->he_key);
+                // remove from wal list
+                list_remove(&kshard->list, &header->list_elem);
+                // free key and header
+                _wal_put_header(kshard, header);
+            }
+            // remove from txn's list
+            e = list_remove(&txn->items[i], e);
+            if (item->txn == &file->global_txn ||
+                item->flag & WAL_ITEM_COMMITTED) {
+                kshard->num_flushable--;
+            }
+            if (item->action != WAL_ACT_REMOVE) {
+                kshard->datasize -= item->doc_size;
+            }
+            // free
+            _wal_retire_item(file->wal, kshard, item, 0);
+            kshard->size--;
         }
-        // free
-        free(item);
-        file->wal->size--;
+
+        spin_unlock(&kshard->lock);
     }
 
-    spin_unlock(&file->wal->lock);
     return FDB_RESULT_SUCCESS;
 }
 
@@ -836,10 +1231,12 @@ static fdb_status _wal_close(struct filemgr *file,
 {
     struct wal_item *item;
     struct wal_item_header *header;
+    struct wal_shard *kshard;
     struct list_elem *e1, *e2;
     fdb_kvs_id_t kv_id, kv_id_req;
     bool committed;
     wal_item_action committed_item_action;
+    size_t i;
 
     if (type == WAL_DISCARD_KV_INS) { // multi KV ins mode
         if (aux == NULL) { // aux must contain pointer to KV ID
@@ -848,78 +1245,82 @@ static fdb_status _wal_close(struct filemgr *file,
         kv_id_req = *(fdb_kvs_id_t*)aux;
     }
 
-    spin_lock(&file->wal->lock);
+    for (i=0;i<file->wal->num_shards;++i) {
+        kshard = &file->wal->key_shards[i];
+        spin_lock(&kshard->lock);
 
-    e1 = list_begin(&file->wal->list);
-    while(e1){
-        header = _get_entry(e1, struct wal_item_header, list_elem);
+        e1 = list_begin(&kshard->list);
+        while(e1){
+            header = _get_entry(e1, struct wal_item_header, list_elem);
 
-        if (type == WAL_DISCARD_KV_INS) { // multi KV ins mode
-            buf2kvid(header->chunksize, header->key, &kv_id);
-            // begin while loop only on matching KV ID
-            e2 = (kv_id == kv_id_req)?(list_begin(&header->items)):(NULL);
-        } else {
-            kv_id = 0;
-            e2 = list_begin(&header->items);
-        }
+            if (type == WAL_DISCARD_KV_INS) { // multi KV ins mode
+                buf2kvid(header->chunksize, header->key, &kv_id);
+                // begin while loop only on matching KV ID
+                e2 = (kv_id == kv_id_req)?(list_begin(&header->items)):(NULL);
+            } else {
+                kv_id = 0;
+                e2 = list_begin(&header->items);
+            }
 
-        committed = false;
-        while(e2) {
-            item = _get_entry(e2, struct wal_item, list_elem);
+            committed = false;
+            while(e2) {
+                item = _get_entry(e2, struct wal_item, list_elem);
+
+                if ( type == WAL_DISCARD_ALL ||
+                    (type == WAL_DISCARD_UNCOMMITTED_ONLY &&
+                        !(item->flag & WAL_ITEM_COMMITTED)) ||
+                     type == WAL_DISCARD_KV_INS) {
+                    // remove from header's list
+                    e2 = list_remove(&header->items, e2);
+                    if (!(item->flag & WAL_ITEM_COMMITTED)) {
+                        // and also remove from transaction's list
+                        list_remove(&item->txn->items[i],
+                                    &item->list_elem_txn);
+                    } else {
+                        // committed item exists and will be removed
+                        committed = true;
+                        committed_item_action = item->action;
+                    }
+                    // remove from seq hash table
+                    _wal_seq_remove(file->wal, item);
 
-            if ( type == WAL_DISCARD_ALL ||
-                (type == WAL_DISCARD_UNCOMMITTED_ONLY &&
-                    !(item->flag & WAL_ITEM_COMMITTED)) ||
-                 type == WAL_DISCARD_KV_INS) {
-                // remove from header's list
-                e2 = list_remove(&header->items, e2);
-                if (!(item->flag & WAL_ITEM_COMMITTED)) {
-                    // and also remove from transaction's list
-                    list_remove(item->txn->items, &item->list_elem_txn);
-                } else {
-                    // committed item exists and will be removed
-                    committed = true;
-                    committed_item_action = item->action;
-                }
-                // remove from seq hash table
-                hash_remove(&file->wal->hash_byseq, &item->he_seq);
+                    if (item->action != WAL_ACT_REMOVE) {
+                        kshard->datasize -= item->doc_size;
+                    }
+                    if (item->txn == &file->global_txn) {
+                        kshard->num_flushable--;
+                    }
 
-                if (item->action != WAL_ACT_REMOVE) {
-                    file->wal->datasize -= item->doc_size;
-                }
-                if (item->txn == &file->global_txn) {
-                    file->wal->num_flushable--;
+                    _wal_retire_item(file->wal, kshard, item, 0);
+                    kshard->size--;
+                } else {
+                    e2 = list_next(e2);
                 }
-
-                free(item);
-                file->wal->size--;
-            } else {
-                e2 = list_next(e2);
             }
-        }
-        e1 = list_next(e1);
+            e1 = list_next(e1);
 
-        if (list_begin(&header->items) == NULL) {
-            // wal_item_header becomes empty
-            // free header and remove from hash table & wal list
-            list_remove(&file->wal->list, &header->list_elem);
-            hash_remove(&file->wal->hash_bykey, &header->he_key);
-            free(header->key);
-            free(header);
-
-            if (committed) {
-                // this document was committed
-                // num_docs and num_deletes should be updated
-                if (committed_item_action == WAL_ACT_LOGICAL_REMOVE ||
-                    committed_item_action == WAL_ACT_REMOVE) {
-                    _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, -1);
+            if (list_begin(&header->items) == NULL) {
+                // wal_item_header becomes empty
+                // free header and remove from hash table & wal list
+                list_remove(&kshard->list, &header->list_elem);
+                hash_remove(&kshard->hash_bykey, &header->he_key);
+                _wal_put_header(kshard, header);
+
+                if (committed) {
+                    // this document was committed
+                    // num_docs and num_deletes should be updated
+                    if (committed_item_action == WAL_ACT_LOGICAL_REMOVE ||
+                        committed_item_action == WAL_ACT_REMOVE) {
+                        _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDELETES, -1);
+                    }
+                    _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDOCS, -1);
                 }
-                _kvs_stat_update_attr(file, kv_id, KVS_STAT_WAL_NDOCS, -1);
             }
         }
+
+        spin_unlock(&kshard->lock);
     }
 
-    spin_unlock(&file->wal->lock);
     return FDB_RESULT_SUCCESS;
 }
 
@@ -931,9 +1332,12 @@ fdb_status wal_close(struct filemgr *file)
 // discard all WAL entries
 fdb_status wal_shutdown(struct filemgr *file)
 {
+    size_t i;
     fdb_status wr = _wal_close(file, WAL_DISCARD_ALL, NULL);
-    file->wal->size = 0;
-    file->wal->num_flushable = 0;
+    for (i=0;i<file->wal->num_shards;++i) {
+        file->wal->key_shards[i].size = 0;
+        file->wal->key_shards[i].num_flushable = 0;
+    }
     return wr;
 }
 
@@ -944,14 +1348,347 @@ fdb_status wal_close_kv_ins(struct filemgr *file,
     return _wal_close(file, WAL_DISCARD_KV_INS, &kv_id);
 }
 
+void wal_view_open(struct filemgr *file, fdb_txn *txn, struct wal_view *view)
+{
+    struct wal *wal = file->wal;
+    struct wal_shard *kshard;
+    size_t i;
+
+    view->file = file;
+    view->txn = txn;
+    view->isolation = txn->isolation;
+    view->gens = (uint64_t *)malloc(sizeof(uint64_t) * wal->num_shards);
+    view->fwd = (struct wal_item **)
+                malloc(sizeof(struct wal_item *) * wal->num_shards);
+    view->rev = (struct wal_item **)
+                malloc(sizeof(struct wal_item *) * wal->num_shards);
+    view->fwd_pos = view->rev_pos = NULL;
+
+    // the versions of all shards are taken at the same time
+    // (never in the middle of a commit, which holds all the shard locks)
+    _wal_lock_all_shards(wal);
+    for (i=0;i<wal->num_shards;++i) {
+        kshard = &wal->key_shards[i];
+        view->gens[i] = kshard->gen;
+    }
+    list_push_back(&wal->views, &view->le);
+    _wal_unlock_all_shards(wal);
+}
+
+void wal_view_close(struct wal_view *view)
+{
+    struct wal *wal = view->file->wal;
+    struct wal_item *item;
+    struct wal_shard *kshard;
+    struct list_elem *e;
+    size_t i;
+
+    _wal_lock_all_shards(wal);
+    list_remove(&wal->views, &view->le);
+    for (i=0;i<wal->num_shards;++i) {
+        kshard = &wal->key_shards[i];
+        e = list_begin(&kshard->retired);
+        while (e) {
+            item = _get_entry(e, struct wal_item, list_elem);
+            if (!_wal_item_in_views(wal, item)) {
+                e = list_remove(&kshard->retired, e);
+                avl_remove(&kshard->key_index, &item->avl_key);
+                _wal_free_item(kshard, item);
+            } else {
+                e = list_next(e);
+            }
+        }
+    }
+    _wal_unlock_all_shards(wal);
+
+    free(view->gens);
+    free(view->fwd);
+    free(view->rev);
+}
+
+INLINE bool _wal_same_key(struct wal_item *a, struct wal_item *b)
+{
+    return a->header == b->header ||
+           _wal_keycmp(a->header->key, a->header->keylen,
+                       b->header->key, b->header->keylen) == 0;
+}
+
+// pick the version of the key that the view sees, in the same way as
+// wal_find() does: the newest uncommitted version visible to the view's
+// transaction first, and then the last committed one.
+// 'a' should be the first (i.e., newest) version of the key, and 'next' is
+// set to the first version of the next key.
+// the caller should hold the lock of the key shard
+static struct wal_item * _wal_view_pick(struct wal_view *view,
+                                        struct avl_node *a,
+                                        struct avl_node **next)
+{
+    struct wal_item *first, *item, *ret;
+    struct wal_item *uncommitted = NULL, *committed = NULL;
+    uint64_t gen;
+
+    first = _get_entry(a, struct wal_item, avl_key);
+    gen = view->gens[first->header->shard_idx];
+    for (; a; a = avl_next(a)) {
+        item = _get_entry(a, struct wal_item, avl_key);
+        if (!_wal_same_key(first, item)) {
+            break;
+        }
+        if (item->gen_begin > gen || item->gen_end <= gen) {
+            // not in the WAL at the time of the view
+            continue;
+        }
+        if (item->gen_commit <= gen) {
+            if (!committed || item->gen_commit > committed->gen_commit) {
+                committed = item;
+            }
+        } else if (!uncommitted &&
+                   (item->txn == view->txn ||
+                    view->isolation == FDB_ISOLATION_READ_UNCOMMITTED)) {
+            uncommitted = item;
+        }
+    }
+    *next = a;
+
+    ret = (uncommitted)?(uncommitted):(committed);
+    if (ret && ret->flag & WAL_ITEM_BY_COMPACTOR) {
+        // ignore items moved by compactor
+        ret = NULL;
+    }
+    return ret;
+}
+
+// the caller should hold the lock of the key shard
+static struct wal_item * _wal_view_scan_fwd(struct wal_view *view,
+                                            struct avl_node *a)
+{
+    struct wal_item *item;
+    while (a) {
+        item = _wal_view_pick(view, a, &a);
+        if (item) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+// 'a' is the last version of the key to start with
+// the caller should hold the lock of the key shard
+static struct wal_item * _wal_view_scan_rev(struct wal_view *view,
+                                            struct avl_node *a)
+{
+    struct avl_node *p, *next;
+    struct wal_item *item, *first;
+
+    while (a) {
+        // rewind to the first version of the key
+        first = _get_entry(a, struct wal_item, avl_key);
+        while ((p = avl_prev(a))) {
+            item = _get_entry(p, struct wal_item, avl_key);
+            if (!_wal_same_key(first, item)) {
+                break;
+            }
+            a = p;
+        }
+        item = _wal_view_pick(view, a, &next);
+        if (item) {
+            return item;
+        }
+        a = avl_prev(a);
+    }
+    return NULL;
+}
+
+// the smallest key in the key shard that the view sees, greater than 'key'
+// (or equal to it if 'inclusive'; the first one if 'key' is NULL)
+static struct wal_item * _wal_view_shard_greater(struct wal_view *view,
+                                                 size_t shard_idx,
+                                                 void *key, size_t keylen,
+                                                 bool inclusive)
+{
+    struct wal_shard *kshard = &view->file->wal->key_shards[shard_idx];
+    struct wal_item query, *item;
+    struct wal_item_header query_header;
+    struct avl_node *a;
+
+    spin_lock(&kshard->lock);
+    if (key) {
+        query_header.key = key;
+        query_header.keylen = keylen;
+        query.header = &query_header;
+        // sorted before (or after) all versions of the same key
+        query.gen_begin = (inclusive)?(_WAL_GEN_NONE):(0);
+        a = avl_search_greater(&kshard->key_index, &query.avl_key,
+                               _wal_cmp_key_index);
+    } else {
+        a = avl_first(&kshard->key_index);
+    }
+    item = _wal_view_scan_fwd(view, a);
+    spin_unlock(&kshard->lock);
+    return item;
+}
+
+// the greatest key in the key shard that the view sees, smaller than 'key'
+// (or equal to it if 'inclusive'; the last one if 'key' is NULL)
+static struct wal_item * _wal_view_shard_smaller(struct wal_view *view,
+                                                 size_t shard_idx,
+                                                 void *key, size_t keylen,
+                                                 bool inclusive)
+{
+    struct wal_shard *kshard = &view->file->wal->key_shards[shard_idx];
+    struct wal_item query, *item;
+    struct wal_item_header query_header;
+    struct avl_node *a;
+
+    spin_lock(&kshard->lock);
+    if (key) {
+        query_header.key = key;
+        query_header.keylen = keylen;
+        query.header = &query_header;
+        // sorted after (or before) all versions of the same key
+        query.gen_begin = (inclusive)?(0):(_WAL_GEN_NONE);
+        a = avl_search_smaller(&kshard->key_index, &query.avl_key,
+                               _wal_cmp_key_index);
+    } else {
+        a = avl_last(&kshard->key_index);
+    }
+    item = _wal_view_scan_rev(view, a);
+    spin_unlock(&kshard->lock);
+    return item;
+}
+
+// return the smallest key among the forward cursors of the shards, and
+// advance the cursor of the shard that the key belongs to.
+// (a key belongs to only one shard, so that the other cursors are still
+//  greater than the key returned)
+static struct wal_item * _wal_view_step_fwd(struct wal_view *view)
+{
+    struct wal_item *item = NULL;
+    size_t i;
+
+    for (i=0;i<view->file->wal->num_shards;++i) {
+        if (view->fwd[i] &&
+            (!item || _wal_keycmp(view->fwd[i]->header->key,
+                                  view->fwd[i]->header->keylen,
+                                  item->header->key,
+                                  item->header->keylen) < 0)) {
+            item = view->fwd[i];
+        }
+    }
+    view->fwd_pos = item;
+    if (item) {
+        i = item->header->shard_idx;
+        view->fwd[i] = _wal_view_shard_greater(view, i, item->header->key,
+                                               item->header->keylen, false);
+    }
+    return item;
+}
+
+static struct wal_item * _wal_view_step_rev(struct wal_view *view)
+{
+    struct wal_item *item = NULL;
+    size_t i;
+
+    for (i=0;i<view->file->wal->num_shards;++i) {
+        if (view->rev[i] &&
+            (!item || _wal_keycmp(view->rev[i]->header->key,
+                                  view->rev[i]->header->keylen,
+                                  item->header->key,
+                                  item->header->keylen) > 0)) {
+            item = view->rev[i];
+        }
+    }
+    view->rev_pos = item;
+    if (item) {
+        i = item->header->shard_idx;
+        view->rev[i] = _wal_view_shard_smaller(view, i, item->header->key,
+                                               item->header->keylen, false);
+    }
+    return item;
+}
+
+// reset the forward cursors of all shards to 'key', and return the first one
+static struct wal_item * _wal_view_seek_fwd(struct wal_view *view,
+                                            void *key, size_t keylen,
+                                            bool inclusive)
+{
+    size_t i;
+    for (i=0;i<view->file->wal->num_shards;++i) {
+        view->fwd[i] = _wal_view_shard_greater(view, i, key, keylen,
+                                               inclusive);
+    }
+    return _wal_view_step_fwd(view);
+}
+
+static struct wal_item * _wal_view_seek_rev(struct wal_view *view,
+                                            void *key, size_t keylen,
+                                            bool inclusive)
+{
+    size_t i;
+    for (i=0;i<view->file->wal->num_shards;++i) {
+        view->rev[i] = _wal_view_shard_smaller(view, i, key, keylen,
+                                               inclusive);
+    }
+    return _wal_view_step_rev(view);
+}
+
+struct wal_item * wal_view_first(struct wal_view *view)
+{
+    return _wal_view_seek_fwd(view, NULL, 0, false);
+}
+
+struct wal_item * wal_view_last(struct wal_view *view)
+{
+    return _wal_view_seek_rev(view, NULL, 0, false);
+}
+
+struct wal_item * wal_view_next(struct wal_view *view, struct wal_item *item)
+{
+    if (item == view->fwd_pos) {
+        // the cursors are still valid, as the view never changes
+        return _wal_view_step_fwd(view);
+    }
+    return _wal_view_seek_fwd(view, item->header->key,
+                              item->header->keylen, false);
+}
+
+struct wal_item * wal_view_prev(struct wal_view *view, struct wal_item *item)
+{
+    if (item == view->rev_pos) {
+        return _wal_view_step_rev(view);
+    }
+    return _wal_view_seek_rev(view, item->header->key,
+                              item->header->keylen, false);
+}
+
+struct wal_item * wal_view_search_greater(struct wal_view *view,
+                                          void *key, size_t keylen)
+{
+    return _wal_view_seek_fwd(view, key, keylen, true);
+}
+
+struct wal_item * wal_view_search_smaller(struct wal_view *view,
+                                          void *key, size_t keylen)
+{
+    return _wal_view_seek_rev(view, key, keylen, true);
+}
+
 size_t wal_get_size(struct filemgr *file)
 {
-    return file->wal->size;
+    size_t i, size = 0;
+    for (i=0;i<file->wal->num_shards;++i) {
+        size += file->wal->key_shards[i].size;
+    }
+    return size;
 }
 
 size_t wal_get_num_flushable(struct filemgr *file)
 {
-    return file->wal->num_flushable;
+    size_t i, num_flushable = 0;
+    for (i=0;i<file->wal->num_shards;++i) {
+        num_flushable += file->wal->key_shards[i].num_flushable;
+    }
+    return num_flushable;
 }
 
 size_t wal_get_num_docs(struct filemgr *file) {
@@ -964,10 +1701,12 @@ size_t wal_get_num_deletes(struct filemgr *file) {
 
 size_t wal_get_datasize(struct filemgr *file)
 {
-    size_t datasize = 0;
-    spin_lock(&file->wal->lock);
-    datasize = file->wal->datasize;
-    spin_unlock(&file->wal->lock);
+    size_t i, datasize = 0;
+    for (i=0;i<file->wal->num_shards;++i) {
+        spin_lock(&file->wal->key_shards[i].lock);
+        datasize += file->wal->key_shards[i].datasize;
+        spin_unlock(&file->wal->key_shards[i].lock);
+    }
 
     return datasize;
 }
@@ -988,8 +1727,194 @@ wal_dirty_t wal_get_dirty_status(struct filemgr *file)
     return ret;
 }
 
+void wal_set_flush_pending(struct filemgr *file, uint8_t pending)
+{
+    file->wal->flush_pending = pending;
+}
+
+uint8_t wal_get_flush_pending(struct filemgr *file)
+{
+    return file->wal->flush_pending;
+}
+
+void wal_add_flush_stats(struct filemgr *file, bool stall, uint64_t elapsed)
+{
+    spin_lock(&file->wal->lock);
+    if (stall) {
+        file->wal->fstats.nstalls++;
+        file->wal->fstats.stall_time += elapsed;
+    } else {
+        file->wal->fstats.nflushes++;
+        file->wal->fstats.flush_time += elapsed;
+    }
+    spin_unlock(&file->wal->lock);
+}
+
+void wal_get_flush_stats(struct filemgr *file, struct wal_flush_stats *stats)
+{
+    spin_lock(&file->wal->lock);
+    *stats = file->wal->fstats;
+    spin_unlock(&file->wal->lock);
+}
+
+uint64_t wal_get_mem_usage(struct filemgr *file)
+{
+    size_t i;
+    uint64_t memsize = 0;
+    for (i=0;i<file->wal->num_shards;++i) {
+        memsize += file->wal->key_shards[i].memsize;
+    }
+    return memsize;
+}
+
+uint64_t wal_get_global_mem_usage()
+{
+    return wal_global_memsize.value.val_64;
+}
+
+uint64_t wal_get_global_mem_budget()
+{
+    return wal_mem_budget;
+}
+
+static int _wal_cmp_memsize_desc(const void *a, const void *b)
+{
+    uint64_t aa = *(uint64_t *)a;
+    uint64_t bb = *(uint64_t *)b;
+    if (aa > bb) {
+        return -1;
+    } else if (aa < bb) {
+        return 1;
+    }
+    return 0;
+}
+
+// choose the largest files whose WAL entries together exceed the amount
+// by which the global usage 'usage' is over the budget
+static void _wal_choose_victims(uint64_t usage)
+{
+    size_t i, n = 0, nwals = 0;
+    uint64_t *memsizes, sum = 0;
+    struct list_elem *e;
+    struct wal *wal;
+
+    spin_lock(&wal_list_lock);
+    // not chosen again until the usage changes by 1/16 of the budget
+    if (wal_victim_memsize != (uint64_t)-1 &&
+        usage < wal_victim_base + wal_mem_budget / 16 &&
+        usage + wal_mem_budget / 16 > wal_victim_base) {
+        spin_unlock(&wal_list_lock);
+        return;
+    }
+
+    for (e = list_begin(&wal_list); e; e = list_next(e)) {
+        nwals++;
+    }
+    memsizes = (uint64_t *)malloc(sizeof(uint64_t) * (nwals + 1));
+    for (e = list_begin(&wal_list); e; e = list_next(e)) {
+        wal = _get_entry(e, struct wal, le);
+        memsizes[n] = 0;
+        for (i=0;i<wal->num_shards;++i) {
+            memsizes[n] += wal->key_shards[i].memsize;
+        }
+        n++;
+    }
+    qsort(memsizes, n, sizeof(uint64_t), _wal_cmp_memsize_desc);
+
+    wal_victim_memsize = (uint64_t)-1;
+    for (i=0;i<n && memsizes[i];++i) {
+        wal_victim_memsize = memsizes[i];
+        sum += memsizes[i];
+        if (sum + wal_mem_budget >= usage) {
+            break;
+        }
+    }
+    wal_victim_base = usage;
+    free(memsizes);
+    spin_unlock(&wal_list_lock);
+}
+
+bool wal_exceeds_mem_limit(struct filemgr *file, uint64_t mem_limit,
+                           uint64_t ratio)
+{
+    uint64_t memsize = wal_get_mem_usage(file);
+    uint64_t usage;
+
+    if (mem_limit && memsize > mem_limit * ratio) {
+        return true;
+    }
+    if (!wal_mem_budget || !memsize) {
+        return false;
+    }
+    usage = wal_get_global_mem_usage();
+    if (usage <= wal_mem_budget * ratio) {
+        return false;
+    }
+    _wal_choose_victims(usage);
+    return memsize >= wal_victim_memsize;
+}
+
+bool wal_exceeds_global_mem_budget(uint64_t ratio)
+{
+    return wal_mem_budget &&
+           wal_get_global_mem_usage() > wal_mem_budget * ratio;
+}
+
+void wal_set_flush_config(struct filemgr *file, fdb_config *config)
+{
+    fdb_config *copy;
+
+    if (file->wal->flush_config) {
+        return;
+    }
+    copy = (fdb_config *)malloc(sizeof(fdb_config));
+    *copy = *config;
+    spin_lock(&wal_list_lock);
+    if (!file->wal->flush_config) {
+        file->wal->flush_config = copy;
+        copy = NULL;
+    }
+    spin_unlock(&wal_list_lock);
+    free(copy);
+}
+
+void wal_get_victims(wal_victim_func *func, void *ctx)
+{
+    uint64_t usage = wal_get_global_mem_usage();
+    uint64_t memsize;
+    struct list_elem *e;
+    struct wal *wal;
+
+    if (!wal_exceeds_global_mem_budget(1)) {
+        return;
+    }
+    _wal_choose_victims(usage);
+
+    spin_lock(&wal_list_lock);
+    for (e = list_begin(&wal_list); e; e = list_next(e)) {
+        wal = _get_entry(e, struct wal, le);
+        if (!wal->flush_config) {
+            continue;
+        }
+        memsize = wal_get_mem_usage(wal->file);
+        if (memsize && memsize >= wal_victim_memsize) {
+            func(wal->file, wal->flush_config, ctx);
+        }
+    }
+    spin_unlock(&wal_list_lock);
+}
+
 void wal_add_transaction(struct filemgr *file, fdb_txn *txn)
 {
+    size_t i;
+
+    // items of each key shard are listed separately, so that they are
+    // protected by the lock of the shard
+    txn->items = (struct list *)malloc(sizeof(struct list) * FDB_WAL_NSHARDS);
+    for (i=0;i<FDB_WAL_NSHARDS;++i) {
+        list_init(&txn->items[i]);
+    }
+
     spin_lock(&file->wal->lock);
     list_push_front(&file->wal->txn_list, &txn->wrapper->le);
     spin_unlock(&file->wal->lock);
@@ -1000,6 +1925,22 @@ void wal_remove_transaction(struct filemgr *file, fdb_txn *txn)
     spin_lock(&file->wal->lock);
     list_remove(&file->wal->txn_list, &txn->wrapper->le);
     spin_unlock(&file->wal->lock);
+
+    free(txn->items);
+    txn->items = NULL;
+}
+
+// the lists are not locked, as they are only read to check
+// whether the transaction has updated anything
+bool wal_txn_has_items(fdb_txn *txn)
+{
+    size_t i;
+    for (i=0;i<FDB_WAL_NSHARDS;++i) {
+        if (list_begin(&txn->items[i])) {
+            return true;
+        }
+    }
+    return false;
 }
 
 fdb_txn * wal_earliest_txn(struct filemgr *file, fdb_txn *cur_txn)
@@ -1016,7 +1957,7 @@ fdb_txn * wal_earliest_txn(struct filemgr *file, fdb_txn *cur_txn)
     while(le) {
         txn_wrapper = _get_entry(le, struct wal_txn_wrapper, le);
         txn = txn_wrapper->txn;
-        if (txn != cur_txn && list_begin(txn->items)) {
+        if (txn != cur_txn && wal_txn_has_items(txn)) {
             if (bid == BLK_NOT_FOUND || txn->prev_hdr_bid < bid) {
                 bid = txn->prev_hdr_bid;
                 ret = txn;
@@ -23,6 +23,7 @@
 #include "hash.h"
 #include "list.h"
 #include "avltree.h"
+#include "arena.h"
 #include "libforestdb/fdb_errors.h"
 
 #ifdef __cplusplus
@@ -40,6 +41,10 @@ struct wal_item_header{
     void *key;
     uint16_t keylen;
     uint8_t chunksize;
+    uint16_t shard_idx; // index of the key shard that the header belongs to
+    // # 'wal_item's (including retired ones) referring to this header,
+    // plus one while the header is linked in the key shard
+    uint32_t refcount;
     struct list items;
     struct hash_elem he_key;
     struct list_elem list_elem;
@@ -55,20 +60,26 @@ struct wal_item{
     uint8_t flag;
     uint32_t doc_size;
     uint64_t offset;
-    uint64_t old_offset;
     fdb_seqnum_t seqnum;
     struct hash_elem he_seq;
     struct list_elem list_elem; // for wal_item_header's 'items'
     struct list_elem list_elem_txn; // for transaction
     struct avl_node avl;
+    // version of the item in the ordered key index of the key shard
+    // (protected by the lock of the key shard): visible from 'gen_begin',
+    // committed at 'gen_commit', and removed from the WAL at 'gen_end'.
+    uint64_t gen_begin;
+    uint64_t gen_commit;
+    uint64_t gen_end;
+    struct avl_node avl_key; // for the key shard's 'key_index'
     struct wal_item_header *header;
 };
 
-typedef fdb_status wal_flush_func(void *dbhandle, struct wal_item *item);
+// called with a batch of items sorted by key
+typedef fdb_status wal_flush_func(void *dbhandle, struct wal_item **items,
+                                  size_t nitems);
 typedef fdb_status wal_snapshot_func(void *shandle, fdb_doc *doc,
                                      uint64_t offset);
-typedef uint64_t wal_get_old_offset_func(void *dbhandle,
-                                         struct wal_item *item);
 typedef uint64_t wal_doc_move_func(void *dbhandle,
                                    void *new_dhandle,
                                    struct wal_item *item,
@@ -86,25 +97,106 @@ enum {
     FDB_WAL_PENDING = 2
 };
 
-struct wal {
-    uint8_t flag;
-    size_t size; // total # entries in WAL
-    size_t num_flushable; // # flushable entries in WAL
+// partition of the WAL chosen by hash of key: a 'wal_item_header' and all of
+// its 'wal_item's are protected by the lock of the key shard.
+struct wal_shard {
+    size_t size; // # entries in this shard
+    size_t num_flushable; // # flushable entries in this shard
     uint64_t datasize;
+    // bytes of 'wal_item's, 'wal_item_header's and their keys in this shard
+    uint64_t memsize;
     struct hash hash_bykey; // indexes 'wal_item_header's
-    struct hash hash_byseq; // indexes 'wal_item's
     struct list list; // list of 'wal_item_header's
+    // 'wal_item's of this shard ordered by key, and then by version
+    // (newer first); views merge the key indexes of all shards
+    struct avl_tree key_index;
+    // version counter of the key index
+    uint64_t gen;
+    // version of the commit in progress (0 if none); a commit holds the
+    // locks of all key shards, so that it is seen atomically
+    uint64_t commit_gen;
+    // items removed from the shard but still visible to some views
+    struct list retired;
+    // allocates 'wal_item's, 'wal_item_header's and their keys
+    struct arena arena;
+    spin_t lock;
+};
+
+// partition of the seq number index chosen by seq number.
+// Lock ordering: key shard -> seq shard -> wal->lock.
+// Key shards are locked all together only in ascending order.
+struct wal_seq_shard {
+    struct hash hash_byseq; // indexes 'wal_item's
+    spin_t lock;
+};
+
+struct wal_flush_stats {
+    // flushes done by the WAL flusher thread, and their total time (in us)
+    uint64_t nflushes;
+    uint64_t flush_time;
+    // flushes done by writers themselves at the hard limit, and the total
+    // time (in us) the writers were stalled by them
+    uint64_t nstalls;
+    uint64_t stall_time;
+};
+
+struct wal {
+    uint8_t flag;
+    struct filemgr *file;
+    size_t num_shards;
+    struct wal_shard *key_shards;
+    struct wal_seq_shard *seq_shards;
     struct list txn_list; // list of active transactions
     wal_dirty_t wal_dirty;
+    // list of open 'wal_view's
+    // (changed only while holding the locks of all key shards,
+    //  so that it can be read while holding any of them)
+    struct list views;
+    // a flush is requested to the WAL flusher thread
+    // (read and written while holding the file mutex)
+    uint8_t flush_pending;
+    // statistics of WAL flushes before commit
+    struct wal_flush_stats fstats;
+    // config of a handle flushing the WAL before commit, with which the WAL
+    // flusher thread opens the file when it is chosen to be flushed for the
+    // global memory budget (NULL if not set; protected by the WAL list lock)
+    fdb_config *flush_config;
+    // element of the list of all WALs (for the global memory budget)
+    struct list_elem le;
+    // protects 'txn_list', 'wal_dirty' and 'fstats'
+    // (never grabbed when inserting, committing or discarding items)
     spin_t lock;
 };
 
+// MVCC view of the WAL's ordered key indexes taken by an iterator.
+// The view sees the WAL as of the time it was opened; versions visible to
+// the view are not freed by updating, committing or flushing, but retired
+// until the view is closed, so that nothing needs to be copied.
+struct wal_view {
+    struct filemgr *file;
+    fdb_txn *txn; // only compared with items' transactions
+    fdb_isolation_level_t isolation;
+    // version of each key shard seen by the view
+    uint64_t *gens;
+    // cursors merging the key shards: for each shard, the next key that the
+    // view sees after 'fwd_pos' (or before 'rev_pos') in the shard
+    struct wal_item **fwd;
+    struct wal_item *fwd_pos;
+    struct wal_item **rev;
+    struct wal_item *rev_pos;
+    struct list_elem le;
+};
+
 struct wal_txn_wrapper {
     fdb_txn *txn;
     struct list_elem le;
 };
 
+// 'mem_budget' is the max bytes used by WAL entries of all files (0: no limit)
+void wal_global_init(uint64_t mem_budget);
+void wal_global_shutdown();
 fdb_status wal_init(struct filemgr *file, int nbucket);
+void wal_destroy(struct filemgr *file);
 int wal_is_initialized(struct filemgr *file);
 fdb_status wal_insert(fdb_txn *txn,
                       struct filemgr *file,
@@ -130,12 +222,10 @@ fdb_status wal_release_flushed_items(struct filemgr *file,
 fdb_status wal_flush(struct filemgr *file,
                      void *dbhandle,
                      wal_flush_func *flush_func,
-                     wal_get_old_offset_func *get_old_offset,
                      struct avl_tree *flush_items);
 fdb_status wal_flush_by_compactor(struct filemgr *file,
                                   void *dbhandle,
                                   wal_flush_func *flush_func,
-                                  wal_get_old_offset_func *get_old_offset,
                                   struct avl_tree *flush_items);
 fdb_status wal_snapshot(struct filemgr *file,
                         void *dbhandle, fdb_txn *txn,
@@ -147,6 +237,21 @@ fdb_status wal_shutdown(struct filemgr *file);
 fdb_status wal_close_kv_ins(struct filemgr *file,
                             fdb_kvs_id_t kv_id);
 
+void wal_view_open(struct filemgr *file, fdb_txn *txn, struct wal_view *view);
+void wal_view_close(struct wal_view *view);
+// the functions below return the version of a key seen by the view;
+// the item is valid until the view is closed.
+struct wal_item * wal_view_first(struct wal_view *view);
+struct wal_item * wal_view_last(struct wal_view *view);
+struct wal_item * wal_view_next(struct wal_view *view, struct wal_item *item);
+struct wal_item * wal_view_prev(struct wal_view *view, struct wal_item *item);
+// the smallest key greater than or equal to 'key'
+struct wal_item * wal_view_search_greater(struct wal_view *view,
+                                          void *key, size_t keylen);
+// the greatest key smaller than or equal to 'key'
+struct wal_item * wal_view_search_smaller(struct wal_view *view,
+                                          void *key, size_t keylen);
+
 size_t wal_get_size(struct filemgr *file);
 size_t wal_get_num_flushable(struct filemgr *file);
 size_t wal_get_num_docs(struct filemgr *file);
@@ -154,8 +259,39 @@ size_t wal_get_num_deletes(struct filemgr *file);
 size_t wal_get_datasize(struct filemgr *file);
 void wal_set_dirty_status(struct filemgr *file, wal_dirty_t status);
 wal_dirty_t wal_get_dirty_status(struct filemgr *file);
+void wal_set_flush_pending(struct filemgr *file, uint8_t pending);
+uint8_t wal_get_flush_pending(struct filemgr *file);
+// account a WAL flush that took 'elapsed' microseconds
+// ('stall' is true if a writer flushed the WAL by itself)
+void wal_add_flush_stats(struct filemgr *file, bool stall, uint64_t elapsed);
+void wal_get_flush_stats(struct filemgr *file, struct wal_flush_stats *stats);
+// bytes used by WAL entries (items, headers and keys) of the file,
+// and of all files
+uint64_t wal_get_mem_usage(struct filemgr *file);
+uint64_t wal_get_global_mem_usage();
+uint64_t wal_get_global_mem_budget();
+// whether the file's WAL entries should be flushed because of memory usage,
+// i.e., the file uses more than 'mem_limit' bytes (if not 0), or the global
+// budget is exceeded and the file is one of the largest ones.
+// Both limits are multiplied by 'ratio'.
+bool wal_exceeds_mem_limit(struct filemgr *file, uint64_t mem_limit,
+                           uint64_t ratio);
+// whether the global usage exceeds the budget multiplied by 'ratio'
+bool wal_exceeds_global_mem_budget(uint64_t ratio);
+// keep a copy of 'config' (if none is kept yet), so that the file's WAL can be
+// flushed by the WAL flusher thread for the global memory budget
+void wal_set_flush_config(struct filemgr *file, fdb_config *config);
+typedef void wal_victim_func(struct filemgr *file, fdb_config *config,
+                             void *ctx);
+// invoke 'func' on each file that should be flushed to bring the global usage
+// back under the budget, and that has a config set by wal_set_flush_config()
+// ('func' is called while holding the lock of the list of all WALs)
+void wal_get_victims(wal_victim_func *func, void *ctx);
+// the transaction's item lists (one for each key shard) are allocated by
+// wal_add_transaction() and freed by wal_remove_transaction()
 void wal_add_transaction(struct filemgr *file, fdb_txn *txn);
 void wal_remove_transaction(struct filemgr *file, fdb_txn *txn);
+bool wal_txn_has_items(fdb_txn *txn);
 fdb_txn * wal_earliest_txn(struct filemgr *file, fdb_txn *cur_txn);
 bool wal_txn_exists(struct filemgr *file);
 
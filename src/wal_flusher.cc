@@ -0,0 +1,350 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#if !defined(WIN32) && !defined(_WIN32)
+#include <sys/time.h>
+#endif
+
+#include "libforestdb/forestdb.h"
+#include "fdb_internal.h"
+#include "filemgr.h"
+#include "list.h"
+#include "wal.h"
+#include "wal_flusher.h"
+#include "time_utils.h"
+#include "memleak.h"
+
+struct wal_flush_req {
+    // NULL if the file is flushed for the global budget; then the flusher
+    // opens the file by itself with 'filename' and 'config'
+    fdb_file_handle *fhandle;
+    struct filemgr *file;
+    char *filename;
+    fdb_config config;
+    struct list_elem le;
+};
+
+// file being closed by fdb_close()
+struct wal_flusher_closing {
+    struct filemgr *file;
+    struct list_elem le;
+};
+
+static struct list flusher_queue;
+// files being closed (not opened for the global budget)
+static struct list flusher_closing;
+// file of the request being served (NULL if idle)
+static struct filemgr *flusher_cur_file;
+static mutex_t flusher_lock;
+// signaled when a request is queued, or when the flusher should terminate
+static thread_cond_t flusher_cond;
+// signaled whenever a request is done
+static thread_cond_t flusher_done_cond;
+static thread_t flusher_tid;
+static volatile uint8_t flusher_running;
+static volatile uint8_t flusher_terminate;
+
+enum {
+    FLUSHER_RECLAIM_NONE = 0,
+    FLUSHER_RECLAIM_REQUESTED = 1,
+    FLUSHER_RECLAIM_INPROG = 2
+};
+// state of the flush of the files chosen for the global budget
+static volatile uint8_t flusher_reclaim;
+// # requests of the reclaim in progress that are not done yet
+static size_t flusher_reclaim_left;
+
+static bool _wal_flusher_busy(struct filemgr *file);
+static bool _wal_flusher_closing(struct filemgr *file);
+
+// called while holding the lock of the list of all WALs
+static void _wal_flusher_add_victim(struct filemgr *file, fdb_config *config,
+                                    void *ctx)
+{
+    struct list *victims = (struct list *)ctx;
+    struct wal_flush_req *req;
+
+    req = (struct wal_flush_req *)malloc(sizeof(struct wal_flush_req));
+    req->fhandle = NULL;
+    req->file = file;
+    // the file may be closed before the flusher gets to it
+    req->filename = (char *)malloc(strlen(file->filename) + 1);
+    strcpy(req->filename, file->filename);
+    req->config = *config;
+    list_push_back(victims, &req->le);
+}
+
+// queue the files chosen for the global budget
+// (the flusher lock should be grabbed by the caller)
+static void _wal_flusher_queue_victims()
+{
+    struct list victims;
+    struct list_elem *e;
+    struct wal_flush_req *req;
+
+    flusher_reclaim = FLUSHER_RECLAIM_INPROG;
+    flusher_reclaim_left = 0;
+    list_init(&victims);
+    mutex_unlock(&flusher_lock);
+    wal_get_victims(_wal_flusher_add_victim, &victims);
+    mutex_lock(&flusher_lock);
+
+    while ((e = list_pop_front(&victims))) {
+        req = _get_entry(e, struct wal_flush_req, le);
+        if (_wal_flusher_busy(req->file)) {
+            // will be flushed by the request in flight
+            free(req->filename);
+            free(req);
+            continue;
+        }
+        list_push_back(&flusher_queue, &req->le);
+        flusher_reclaim_left++;
+    }
+    if (!flusher_reclaim_left) {
+        flusher_reclaim = FLUSHER_RECLAIM_NONE;
+        thread_cond_broadcast(&flusher_done_cond);
+    }
+}
+
+static void *_wal_flusher_thread(void *voidargs)
+{
+    struct list_elem *e;
+    struct wal_flush_req *req;
+    struct timeval tv_begin, tv_end, tv_gap;
+    bool victim;
+    fdb_status fs;
+
+    mutex_lock(&flusher_lock);
+    while (true) {
+        if (flusher_reclaim == FLUSHER_RECLAIM_REQUESTED) {
+            _wal_flusher_queue_victims();
+        }
+        e = list_pop_front(&flusher_queue);
+        if (!e) {
+            if (flusher_terminate) {
+                break;
+            }
+            thread_cond_wait(&flusher_cond, &flusher_lock);
+            continue;
+        }
+        req = _get_entry(e, struct wal_flush_req, le);
+        victim = (req->fhandle == NULL);
+        fs = FDB_RESULT_SUCCESS;
+        if (victim && _wal_flusher_closing(req->file)) {
+            // the handle being closed may be the last one
+            fs = FDB_RESULT_FILE_NOT_OPEN;
+        } else {
+            // fdb_close() on the file waits until the flush is done
+            flusher_cur_file = req->file;
+        }
+        mutex_unlock(&flusher_lock);
+
+        if (victim && fs == FDB_RESULT_SUCCESS) {
+            // skipped if the last handle on the file was closed in the
+            // meantime; the flusher never reopens a closed file
+            fs = fdb_open_file_for_wal_flusher(&req->fhandle, req->filename,
+                                               &req->config);
+        }
+        if (fs == FDB_RESULT_SUCCESS) {
+            gettimeofday(&tv_begin, NULL);
+            fs = fdb_flush_wal_for_flusher(req->fhandle);
+            gettimeofday(&tv_end, NULL);
+            if (fs == FDB_RESULT_SUCCESS) {
+                tv_gap = _utime_gap(tv_begin, tv_end);
+                wal_add_flush_stats(req->fhandle->root->file, false,
+                                    (uint64_t)tv_gap.tv_sec * 1000000 +
+                                    tv_gap.tv_usec);
+            }
+            // if the flush failed, the writers will flush the WAL by
+            // themselves (and get the error) at the hard limit
+            fdb_close_for_wal_flusher(req->fhandle);
+        }
+        free(req->filename);
+        free(req);
+
+        mutex_lock(&flusher_lock);
+        flusher_cur_file = NULL;
+        if (victim && --flusher_reclaim_left == 0) {
+            flusher_reclaim = FLUSHER_RECLAIM_NONE;
+        }
+        thread_cond_broadcast(&flusher_done_cond);
+    }
+    mutex_unlock(&flusher_lock);
+
+    thread_exit(0);
+    return NULL;
+}
+
+void wal_flusher_init()
+{
+    list_init(&flusher_queue);
+    list_init(&flusher_closing);
+    flusher_cur_file = NULL;
+    mutex_init(&flusher_lock);
+    thread_cond_init(&flusher_cond);
+    thread_cond_init(&flusher_done_cond);
+    flusher_running = flusher_terminate = 0;
+    flusher_reclaim = FLUSHER_RECLAIM_NONE;
+    flusher_reclaim_left = 0;
+}
+
+void wal_flusher_shutdown()
+{
+    void *ret;
+
+    // serve all queued requests and stop the flusher
+    mutex_lock(&flusher_lock);
+    flusher_terminate = 1;
+    thread_cond_signal(&flusher_cond);
+    mutex_unlock(&flusher_lock);
+    if (flusher_running) {
+        thread_join(flusher_tid, &ret);
+        flusher_running = 0;
+    }
+    mutex_destroy(&flusher_lock);
+    thread_cond_destroy(&flusher_cond);
+    thread_cond_destroy(&flusher_done_cond);
+}
+
+void wal_flusher_request(fdb_file_handle *fhandle)
+{
+    struct wal_flush_req *req;
+
+    req = (struct wal_flush_req *)malloc(sizeof(struct wal_flush_req));
+    req->fhandle = fhandle;
+    req->file = fhandle->root->file;
+    req->filename = NULL;
+
+    mutex_lock(&flusher_lock);
+    if (!flusher_running) {
+        flusher_running = 1;
+        thread_create(&flusher_tid, _wal_flusher_thread, NULL);
+    }
+    list_push_back(&flusher_queue, &req->le);
+    thread_cond_signal(&flusher_cond);
+    mutex_unlock(&flusher_lock);
+}
+
+static bool _wal_flusher_busy(struct filemgr *file)
+{
+    struct list_elem *e;
+    struct wal_flush_req *req;
+
+    if (flusher_cur_file == file) {
+        return true;
+    }
+    e = list_begin(&flusher_queue);
+    while (e) {
+        req = _get_entry(e, struct wal_flush_req, le);
+        if (req->file == file) {
+            return true;
+        }
+        e = list_next(e);
+    }
+    return false;
+}
+
+void wal_flusher_wait(struct filemgr *file)
+{
+    mutex_lock(&flusher_lock);
+    while (_wal_flusher_busy(file)) {
+        thread_cond_wait(&flusher_done_cond, &flusher_lock);
+    }
+    mutex_unlock(&flusher_lock);
+}
+
+static bool _wal_flusher_closing(struct filemgr *file)
+{
+    struct list_elem *e;
+    struct wal_flusher_closing *closing;
+
+    e = list_begin(&flusher_closing);
+    while (e) {
+        closing = _get_entry(e, struct wal_flusher_closing, le);
+        if (closing->file == file) {
+            return true;
+        }
+        e = list_next(e);
+    }
+    return false;
+}
+
+void wal_flusher_close_begin(struct filemgr *file)
+{
+    struct wal_flusher_closing *closing;
+
+    closing = (struct wal_flusher_closing *)
+              malloc(sizeof(struct wal_flusher_closing));
+    closing->file = file;
+
+    mutex_lock(&flusher_lock);
+    list_push_back(&flusher_closing, &closing->le);
+    while (_wal_flusher_busy(file)) {
+        thread_cond_wait(&flusher_done_cond, &flusher_lock);
+    }
+    mutex_unlock(&flusher_lock);
+}
+
+void wal_flusher_close_end(struct filemgr *file)
+{
+    struct list_elem *e;
+    struct wal_flusher_closing *closing = NULL;
+
+    // note that FILE may be already freed; it is only compared
+    mutex_lock(&flusher_lock);
+    e = list_begin(&flusher_closing);
+    while (e) {
+        closing = _get_entry(e, struct wal_flusher_closing, le);
+        if (closing->file == file) {
+            list_remove(&flusher_closing, e);
+            break;
+        }
+        e = list_next(e);
+    }
+    mutex_unlock(&flusher_lock);
+    assert(e);
+    free(closing);
+}
+
+void wal_flusher_reclaim()
+{
+    if (flusher_reclaim != FLUSHER_RECLAIM_NONE) {
+        return;
+    }
+    mutex_lock(&flusher_lock);
+    if (flusher_reclaim == FLUSHER_RECLAIM_NONE) {
+        flusher_reclaim = FLUSHER_RECLAIM_REQUESTED;
+        if (!flusher_running) {
+            flusher_running = 1;
+            thread_create(&flusher_tid, _wal_flusher_thread, NULL);
+        }
+        thread_cond_signal(&flusher_cond);
+    }
+    mutex_unlock(&flusher_lock);
+}
+
+void wal_flusher_wait_reclaim()
+{
+    mutex_lock(&flusher_lock);
+    while (flusher_reclaim != FLUSHER_RECLAIM_NONE) {
+        thread_cond_wait(&flusher_done_cond, &flusher_lock);
+    }
+    mutex_unlock(&flusher_lock);
+}
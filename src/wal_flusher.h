@@ -0,0 +1,56 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef _FDB_WAL_FLUSHER_H
+#define _FDB_WAL_FLUSHER_H
+
+#include "internal_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Background thread that flushes WAL entries before commit on behalf of
+// writers (in 'wal_flush_before_commit' or 'auto_commit' mode), so that the
+// writer crossing the WAL threshold does not have to do it by itself.
+// It also flushes the largest files (even idle ones) when the WAL entries of
+// all files exceed the global memory budget.
+// The thread is started on the first request.
+
+void wal_flusher_init();
+void wal_flusher_shutdown();
+// queue a flush with a handle opened by fdb_open_for_wal_flusher();
+// the handle is closed by the flusher thread once the flush is done
+void wal_flusher_request(fdb_file_handle *fhandle);
+// wait until all requests on the file are done
+void wal_flusher_wait(struct filemgr *file);
+// called by fdb_close() around closing a handle: wait until all requests on
+// the file are done, and do not open the file for the global budget until
+// wal_flusher_close_end() (the file may be closed by then)
+void wal_flusher_close_begin(struct filemgr *file);
+void wal_flusher_close_end(struct filemgr *file);
+// flush the files chosen by wal_get_victims() to bring the WAL memory usage
+// of all files back under the global budget
+void wal_flusher_reclaim();
+// wait until the files chosen by the last wal_flusher_reclaim() are flushed
+void wal_flusher_wait_reclaim();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,6 +28,7 @@
 
 #include "filemgr.h"
 #include "filemgr_anomalous_ops.h"
+#include "filemgr_ops.h"
 #include "libforestdb/forestdb.h"
 
 struct filemgr_ops * get_anomalous_filemgr_ops();
@@ -36,11 +37,19 @@ static int filemgr_anomalous_behavior = 0;
 // The routines below are adapted from filemgr_ops.cc to add indirection
 struct filemgr_ops * get_win_filemgr_ops();
 struct filemgr_ops * get_linux_filemgr_ops();
+struct filemgr_ops * get_linux_uring_filemgr_ops(int queue_depth);
+void linux_uring_shutdown();
+
+static struct filemgr_ops *selected_ops = NULL;
+
 struct filemgr_ops * get_filemgr_ops()
 {
     if (filemgr_anomalous_behavior) {
         return get_anomalous_filemgr_ops();
     }
+    if (selected_ops) {
+        return selected_ops;
+    }
 
 #if defined(WIN32) || defined(_WIN32)
     // windows
@@ -51,6 +60,28 @@ struct filemgr_ops * get_filemgr_ops()
 #endif
 }
 
+fdb_io_backend_t filemgr_ops_init(fdb_io_backend_t backend, int queue_depth)
+{
+#if !defined(WIN32) && !defined(_WIN32)
+    if (backend == FDB_IO_BACKEND_IO_URING) {
+        selected_ops = get_linux_uring_filemgr_ops(queue_depth);
+        if (selected_ops) {
+            return FDB_IO_BACKEND_IO_URING;
+        }
+    }
+#endif
+    selected_ops = NULL;
+    return FDB_IO_BACKEND_SYNC;
+}
+
+void filemgr_ops_shutdown()
+{
+#if !defined(WIN32) && !defined(_WIN32)
+    linux_uring_shutdown();
+#endif
+    selected_ops = NULL;
+}
+
 void filemgr_ops_set_anomalous(int behavior) {
     filemgr_anomalous_behavior = behavior;
 }
@@ -137,6 +168,18 @@ ssize_t _filemgr_anomalous_pwrite(int fd, void *buf, size_t count, cs_off_t offs
     return normal_filemgr_ops->pwrite(fd, buf, count, offset);
 }
 
+ssize_t _filemgr_anomalous_pwritev(int fd, struct iovec *iov, int iovcnt,
+                                   cs_off_t offset)
+{
+    // vectored writes are controlled by the same callback as pwrite
+    ssize_t ret = anon_cbs->pwrite_cb(anon_ctx);
+    if (ret) {
+        return ret;
+    }
+
+    return normal_filemgr_ops->pwritev(fd, iov, iovcnt, offset);
+}
+
 ssize_t _filemgr_anomalous_pread(int fd, void *buf, size_t count, cs_off_t offset)
 {
     ssize_t ret = anon_cbs->pread_cb(anon_ctx);
@@ -195,16 +238,45 @@ void _filemgr_anomalous_get_errno_str(char *buf, size_t size) {
     return normal_filemgr_ops->get_errno_str(buf, size);
 }
 
+int _filemgr_anomalous_pread_batch(int fd, struct filemgr_io_req *reqs, int n)
+{
+    // each request is controlled by the pread callback
+    int i;
+    for (i=0; i<n; ++i) {
+        reqs[i].result = _filemgr_anomalous_pread(fd, reqs[i].buf,
+                                                  reqs[i].count,
+                                                  reqs[i].offset);
+    }
+    return FDB_RESULT_SUCCESS;
+}
+
+ssize_t _filemgr_anomalous_pwrite_fsync(int fd, void *buf, size_t count,
+                                        cs_off_t offset)
+{
+    // controlled by the pwrite and fsync callbacks
+    ssize_t ret = _filemgr_anomalous_pwrite(fd, buf, count, offset);
+    if (ret != (ssize_t)count) {
+        return ret;
+    }
+    if (_filemgr_anomalous_fsync(fd) != FDB_RESULT_SUCCESS) {
+        return (ssize_t) FDB_RESULT_FSYNC_FAIL;
+    }
+    return ret;
+}
+
 struct filemgr_ops anomalous_ops = {
     _filemgr_anomalous_open,
     _filemgr_anomalous_pwrite,
+    _filemgr_anomalous_pwritev,
     _filemgr_anomalous_pread,
     _filemgr_anomalous_close,
     _filemgr_anomalous_goto_eof,
     _filemgr_anomalous_file_size,
     _filemgr_anomalous_fdatasync,
     _filemgr_anomalous_fsync,
-    _filemgr_anomalous_get_errno_str
+    _filemgr_anomalous_get_errno_str,
+    _filemgr_anomalous_pread_batch,
+    _filemgr_anomalous_pwrite_fsync
 };
 
 struct filemgr_ops * get_anomalous_filemgr_ops()
@@ -133,6 +133,295 @@ void compact_wo_reopen_test()
     TEST_RESULT("compaction without reopen test");
 }
 
+void compact_parallel_test(uint8_t nthreads)
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int n = 20000;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_doc *rdoc;
+    fdb_status status;
+    fdb_file_info info;
+
+    char keybuf[256], bodybuf[256];
+
+    // remove previous dummy files
+    r = system(SHELL_DEL" dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.buffercache_size = 0;
+    fconfig.wal_threshold = 1024;
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.compaction_num_threads = nthreads;
+    // move documents in several rounds
+    fconfig.compaction_buf_maxsize = 4096 * sizeof(uint64_t);
+
+    // open db
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+
+    // insert documents, and then update or delete some of them
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%08d", i);
+        sprintf(bodybuf, "body%d", i);
+        fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+    }
+    fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    for (i=0;i<n;i+=3){
+        sprintf(keybuf, "key%08d", i);
+        if (i % 2) {
+            fdb_del_kv(db, keybuf, strlen(keybuf));
+        } else {
+            sprintf(bodybuf, "updated%d", i);
+            fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+        }
+    }
+    fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+
+    status = fdb_compact(dbfile, (char *) "./dummy2");
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    // all documents should be moved to the new file in the same state
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%08d", i);
+        if (i % 3 == 0 && i % 2 == 0) {
+            sprintf(bodybuf, "updated%d", i);
+        } else {
+            sprintf(bodybuf, "body%d", i);
+        }
+        fdb_doc_create(&rdoc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, rdoc);
+        if (i % 3 == 0 && i % 2) {
+            TEST_CHK(status == FDB_RESULT_KEY_NOT_FOUND);
+        } else {
+            TEST_CHK(status == FDB_RESULT_SUCCESS);
+            TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+        }
+        fdb_doc_free(rdoc);
+    }
+    fdb_get_file_info(dbfile, &info);
+    TEST_CHK(!strcmp("./dummy2", info.filename));
+    TEST_CHK(info.doc_count == (uint64_t)(n - (n / 3 + 1) / 2));
+
+    // close db file
+    fdb_kvs_close(db);
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    sprintf(bodybuf, "compaction with %d reader threads test", (int)nthreads);
+    TEST_RESULT(bodybuf);
+}
+
+static int _compact_rev_keycmp(void *key1, size_t keylen1,
+                               void *key2, size_t keylen2)
+{
+    // reverse lexicographical order
+    size_t len = (keylen1 < keylen2)?(keylen1):(keylen2);
+    int cmp = memcmp(key1, key2, len);
+    if (cmp == 0) {
+        return (int)keylen2 - (int)keylen1;
+    }
+    return -cmp;
+}
+
+void compact_bulk_load_test(uint8_t fill_factor)
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, j, r, count;
+    int n = 5000;
+    int nkvs = 3;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db[3];
+    fdb_doc *rdoc = NULL;
+    fdb_status status;
+    fdb_iterator *iterator;
+    fdb_kvs_info kvs_info;
+    const char *kvs_names[] = {NULL, "kv_long", "kv_rev"};
+
+    char keybuf[1024], bodybuf[256], prev_key[1024];
+    size_t prev_keylen;
+
+    // remove previous dummy files
+    r = system(SHELL_DEL" dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.buffercache_size = 0;
+    fconfig.wal_threshold = 1024;
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.compaction_fill_factor = fill_factor;
+    // move documents in several rounds
+    fconfig.compaction_buf_maxsize = 4096 * sizeof(uint64_t);
+
+    // open db with three KV stores,
+    // one of which uses a custom cmp function
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db[0], &kvs_config);
+    fdb_kvs_open(dbfile, &db[1], kvs_names[1], &kvs_config);
+    kvs_config.custom_cmp = _compact_rev_keycmp;
+    fdb_kvs_open(dbfile, &db[2], kvs_names[2], &kvs_config);
+    kvs_config.custom_cmp = NULL;
+
+    // keys in 'kv_long' share a long common prefix
+    for (j=0;j<nkvs;++j){
+        for (i=0;i<n;++i){
+            if (j == 1) {
+                memset(keybuf, 'p', 600);
+                sprintf(keybuf + 600, "%08d", i);
+            } else {
+                sprintf(keybuf, "key%08d", i);
+            }
+            sprintf(bodybuf, "body%d_%d", j, i);
+            fdb_set_kv(db[j], keybuf, strlen(keybuf),
+                       bodybuf, strlen(bodybuf));
+        }
+    }
+    fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    for (j=0;j<nkvs;++j){
+        for (i=0;i<n;i+=5){
+            sprintf(keybuf, "key%08d", i);
+            if (j == 1) {
+                memset(keybuf, 'p', 600);
+                sprintf(keybuf + 600, "%08d", i);
+            }
+            fdb_del_kv(db[j], keybuf, strlen(keybuf));
+        }
+    }
+    fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+
+    status = fdb_compact(dbfile, (char *) "./dummy2");
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    for (r=0;r<2;++r){
+        for (j=0;j<nkvs;++j){
+            // point query
+            for (i=0;i<n;++i){
+                if (j == 1) {
+                    memset(keybuf, 'p', 600);
+                    sprintf(keybuf + 600, "%08d", i);
+                } else {
+                    sprintf(keybuf, "key%08d", i);
+                }
+                fdb_doc_create(&rdoc, keybuf, strlen(keybuf),
+                               NULL, 0, NULL, 0);
+                status = fdb_get(db[j], rdoc);
+                if (i % 5 == 0) {
+                    TEST_CHK(status == FDB_RESULT_KEY_NOT_FOUND);
+                } else {
+                    TEST_CHK(status == FDB_RESULT_SUCCESS);
+                    sprintf(bodybuf, "body%d_%d", j, i);
+                    TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+                }
+                fdb_doc_free(rdoc);
+                rdoc = NULL;
+            }
+
+            // range scan in the order of each KV store
+            fdb_iterator_init(db[j], &iterator, NULL, 0, NULL, 0,
+                              FDB_ITR_NO_DELETES);
+            count = 0;
+            prev_keylen = 0;
+            do {
+                status = fdb_iterator_get(iterator, &rdoc);
+                TEST_CHK(status == FDB_RESULT_SUCCESS);
+                if (count) {
+                    if (j == 2) {
+                        TEST_CHK(_compact_rev_keycmp(prev_key, prev_keylen,
+                                                     rdoc->key,
+                                                     rdoc->keylen) < 0);
+                    } else {
+                        TEST_CHK(memcmp(prev_key, rdoc->key,
+                                        rdoc->keylen) < 0);
+                    }
+                }
+                memcpy(prev_key, rdoc->key, rdoc->keylen);
+                prev_keylen = rdoc->keylen;
+                fdb_doc_free(rdoc);
+                rdoc = NULL;
+                count++;
+            } while (fdb_iterator_next(iterator) != FDB_RESULT_ITERATOR_FAIL);
+            fdb_iterator_close(iterator);
+            TEST_CHK(count == n - n / 5);
+
+            // range scan by sequence
+            fdb_iterator_sequence_init(db[j], &iterator, 0, 0,
+                                       FDB_ITR_NO_DELETES);
+            count = 0;
+            do {
+                status = fdb_iterator_get(iterator, &rdoc);
+                TEST_CHK(status == FDB_RESULT_SUCCESS);
+                fdb_doc_free(rdoc);
+                rdoc = NULL;
+                count++;
+            } while (fdb_iterator_next(iterator) != FDB_RESULT_ITERATOR_FAIL);
+            fdb_iterator_close(iterator);
+            TEST_CHK(count == n - n / 5);
+
+            fdb_get_kvs_info(db[j], &kvs_info);
+            TEST_CHK(kvs_info.doc_count == (uint64_t)(n - n / 5));
+        }
+
+        // the compacted index can be updated as usual
+        for (j=0;j<nkvs && r==0;++j){
+            for (i=0;i<n;i+=5){
+                if (j == 1) {
+                    memset(keybuf, 'p', 600);
+                    sprintf(keybuf + 600, "%08d", i);
+                } else {
+                    sprintf(keybuf, "key%08d", i);
+                }
+                fdb_del_kv(db[j], keybuf, strlen(keybuf));
+            }
+        }
+        fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+
+        // reopen the compacted file
+        for (j=0;j<nkvs;++j){
+            fdb_kvs_close(db[j]);
+        }
+        fdb_close(dbfile);
+        fdb_custom_cmp_variable functions[] = {_compact_rev_keycmp};
+        char *names[] = {(char *)kvs_names[2]};
+        fdb_open_custom_cmp(&dbfile, "./dummy2", &fconfig, 1, names,
+                            functions);
+        fdb_kvs_open_default(dbfile, &db[0], &kvs_config);
+        fdb_kvs_open(dbfile, &db[1], kvs_names[1], &kvs_config);
+        kvs_config.custom_cmp = _compact_rev_keycmp;
+        fdb_kvs_open(dbfile, &db[2], kvs_names[2], &kvs_config);
+        kvs_config.custom_cmp = NULL;
+    }
+
+    // close db file
+    for (j=0;j<nkvs;++j){
+        fdb_kvs_close(db[j]);
+    }
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    sprintf(bodybuf, "compaction with %d%% fill factor test", (int)fill_factor);
+    TEST_RESULT(bodybuf);
+}
+
 void compact_with_reopen_test()
 {
     TEST_INIT();
@@ -1352,6 +1641,12 @@ void auto_compaction_with_concurrent_insert_test(size_t t_limit)
 
 int main(){
     compact_wo_reopen_test();
+    compact_parallel_test(0);
+    compact_parallel_test(1);
+    compact_parallel_test(4);
+    compact_bulk_load_test(0);
+    compact_bulk_load_test(50);
+    compact_bulk_load_test(100);
     compact_with_reopen_test();
     compact_reopen_named_kvs();
     compact_upto_test(false); // single kv instance in file
@@ -3015,6 +3015,1006 @@ void long_key_test()
     TEST_RESULT("long key test");
 }
 
+struct group_commit_args {
+    fdb_config *config;
+    int id;
+    int ncommits;
+};
+
+static void *_group_commit_thread(void *voidargs)
+{
+    TEST_INIT();
+
+    int i;
+    char keybuf[256], bodybuf[256];
+    struct group_commit_args *args = (struct group_commit_args *)voidargs;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fdb_status status;
+
+    // each thread commits through its own file handle
+    status = fdb_open(&dbfile, "./dummy1", args->config);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+
+    for (i=0;i<args->ncommits;++i){
+        sprintf(keybuf, "key%d_%d", args->id, i);
+        sprintf(bodybuf, "body%d_%d", args->id, i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        status = fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+
+    fdb_close(dbfile);
+    thread_exit(0);
+    return NULL;
+}
+
+void group_commit_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, j, r;
+    int nthreads = 8, ncommits = 50;
+    size_t valuelen;
+    void *value;
+    char keybuf[256], bodybuf[256];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_status status;
+    fdb_group_commit_info info;
+    thread_t *tid = alca(thread_t, nthreads);
+    void **thread_ret = alca(void *, nthreads);
+    struct group_commit_args *args = alca(struct group_commit_args, nthreads);
+
+    // remove previous dummy files
+    r = system(SHELL_DEL " dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.group_commit = true;
+
+    // keep the file open so that the statistics are not reset
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+
+    for (i=0;i<nthreads;++i){
+        args[i].config = &fconfig;
+        args[i].id = i;
+        args[i].ncommits = ncommits;
+        thread_create(&tid[i], _group_commit_thread, &args[i]);
+    }
+    for (i=0;i<nthreads;++i){
+        thread_join(tid[i], &thread_ret[i]);
+    }
+
+    status = fdb_get_group_commit_info(dbfile, &info);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(info.num_commits >= (uint64_t)nthreads * ncommits);
+    TEST_CHK(info.num_syncs >= 1);
+    TEST_CHK(info.num_syncs <= info.num_commits);
+    TEST_CHK(info.max_batch_size >= 1);
+    TEST_CHK(info.last_batch_size <= info.max_batch_size);
+    printf("%d commits by %d threads: %d fsyncs, max batch %d\n",
+           (int)info.num_commits, nthreads, (int)info.num_syncs,
+           (int)info.max_batch_size);
+
+    fdb_close(dbfile);
+
+    // all committed docs should be retrieved after reopen
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    for (i=0;i<nthreads;++i){
+        for (j=0;j<ncommits;++j){
+            sprintf(keybuf, "key%d_%d", i, j);
+            sprintf(bodybuf, "body%d_%d", i, j);
+            status = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+            TEST_CHK(status == FDB_RESULT_SUCCESS);
+            TEST_CMP(value, bodybuf, valuelen);
+            free(value);
+        }
+    }
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("group commit test");
+}
+
+struct wal_concurrency_args {
+    fdb_config *config;
+    int id;
+    int ndocs;
+    int nloops;
+    // # writers that are still running
+    volatile int *nwriters;
+    spin_t *lock;
+};
+
+static void *_wal_concurrency_writer(void *voidargs)
+{
+    TEST_INIT();
+
+    int i;
+    char keybuf[256], bodybuf[256];
+    struct wal_concurrency_args *args = (struct wal_concurrency_args *)voidargs;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fdb_status status;
+
+    status = fdb_open(&dbfile, "./dummy1", args->config);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+
+    for (i=0;i<args->ndocs;++i){
+        sprintf(keybuf, "wkey%d_%d", args->id, i);
+        sprintf(bodybuf, "wbody%d_%d", args->id, i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        if (i % 100 == 99) {
+            status = fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+            TEST_CHK(status == FDB_RESULT_SUCCESS);
+        }
+    }
+    status = fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    fdb_close(dbfile);
+    spin_lock(args->lock);
+    (*args->nwriters)--;
+    spin_unlock(args->lock);
+    thread_exit(0);
+    return NULL;
+}
+
+static void *_wal_concurrency_reader(void *voidargs)
+{
+    TEST_INIT();
+
+    int i, loop;
+    size_t valuelen;
+    void *value;
+    char keybuf[256], bodybuf[256];
+    struct wal_concurrency_args *args = (struct wal_concurrency_args *)voidargs;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fdb_doc *rdoc;
+    fdb_status status;
+
+    status = fdb_open(&dbfile, "./dummy1", args->config);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+
+    // keep reading the pre-loaded docs by key and by seq number
+    // until all writers finish (at least 'nloops' times)
+    for (loop=0; loop < args->nloops || *args->nwriters > 0; ++loop){
+        for (i=0;i<args->ndocs;++i){
+            sprintf(keybuf, "key%d", i);
+            sprintf(bodybuf, "body%d", i);
+            status = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+            TEST_CHK(status == FDB_RESULT_SUCCESS);
+            TEST_CMP(value, bodybuf, valuelen);
+            free(value);
+
+            fdb_doc_create(&rdoc, NULL, 0, NULL, 0, NULL, 0);
+            rdoc->seqnum = i+1;
+            status = fdb_get_byseq(db, rdoc);
+            TEST_CHK(status == FDB_RESULT_SUCCESS);
+            TEST_CMP(rdoc->key, keybuf, rdoc->keylen);
+            TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+            fdb_doc_free(rdoc);
+        }
+    }
+
+    fdb_close(dbfile);
+    thread_exit(0);
+    return NULL;
+}
+
+void wal_concurrent_access_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, j, r;
+    int nwriters = 4, nreaders = 4, ndocs = 1000;
+    volatile int nwriters_running;
+    spin_t lock;
+    size_t valuelen;
+    void *value;
+    char keybuf[256], bodybuf[256];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_status status;
+    fdb_kvs_info kvs_info;
+    int nthreads = nwriters + nreaders;
+    thread_t *tid = alca(thread_t, nthreads);
+    void **thread_ret = alca(void *, nthreads);
+    struct wal_concurrency_args *args =
+        alca(struct wal_concurrency_args, nthreads);
+
+    // remove previous dummy files
+    r = system(SHELL_DEL " dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    // keep all docs in WAL so that readers and writers
+    // concurrently access the WAL index only
+    fconfig.wal_threshold = 8192;
+
+    // pre-load docs that are read by readers (seq numbers 1 ~ ndocs)
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    for (i=0;i<ndocs;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+    fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+
+    nwriters_running = nwriters;
+    spin_init(&lock);
+    for (i=0;i<nthreads;++i){
+        args[i].config = &fconfig;
+        args[i].id = i;
+        args[i].ndocs = ndocs;
+        args[i].nloops = 2;
+        args[i].nwriters = &nwriters_running;
+        args[i].lock = &lock;
+        if (i < nwriters) {
+            thread_create(&tid[i], _wal_concurrency_writer, &args[i]);
+        } else {
+            thread_create(&tid[i], _wal_concurrency_reader, &args[i]);
+        }
+    }
+    for (i=0;i<nthreads;++i){
+        thread_join(tid[i], &thread_ret[i]);
+    }
+    spin_destroy(&lock);
+
+    // all docs by writers should be visible
+    for (i=0;i<nwriters;++i){
+        for (j=0;j<ndocs;++j){
+            sprintf(keybuf, "wkey%d_%d", i, j);
+            sprintf(bodybuf, "wbody%d_%d", i, j);
+            status = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+            TEST_CHK(status == FDB_RESULT_SUCCESS);
+            TEST_CMP(value, bodybuf, valuelen);
+            free(value);
+        }
+    }
+    fdb_get_kvs_info(db, &kvs_info);
+    TEST_CHK(kvs_info.doc_count == (size_t)(nwriters+1) * ndocs);
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("WAL concurrent access test");
+}
+
+struct commit_async_ctx {
+    int ncallbacks;
+    int nfails;
+    uint64_t last_revnum;
+    bool ordered;
+};
+
+static void _commit_async_callback(fdb_file_handle *fhandle,
+                                   fdb_status status,
+                                   uint64_t header_revnum,
+                                   void *ctx_data)
+{
+    struct commit_async_ctx *ctx = (struct commit_async_ctx *)ctx_data;
+    (void)fhandle;
+    // callbacks are invoked by a single syncer thread in commit order
+    if (status != FDB_RESULT_SUCCESS) {
+        ctx->nfails++;
+    }
+    if (header_revnum <= ctx->last_revnum) {
+        ctx->ordered = false;
+    }
+    ctx->last_revnum = header_revnum;
+    ctx->ncallbacks++;
+}
+
+void commit_async_test(fdb_durability_opt_t durability)
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int n = 100;
+    size_t valuelen;
+    void *value;
+    char keybuf[256], bodybuf[256];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_status status;
+    struct commit_async_ctx ctx;
+
+    // remove previous dummy files
+    r = system(SHELL_DEL " dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.durability_opt = durability;
+
+    ctx.ncallbacks = ctx.nfails = 0;
+    ctx.last_revnum = 0;
+    ctx.ordered = true;
+
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+
+    status = fdb_commit_async(dbfile, FDB_COMMIT_NORMAL, NULL, NULL);
+    TEST_CHK(status == FDB_RESULT_INVALID_ARGS);
+
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+        status = fdb_commit_async(dbfile, FDB_COMMIT_NORMAL,
+                                  _commit_async_callback, &ctx);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+        // the commit is visible before it becomes durable
+        status = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        free(value);
+    }
+
+    // close waits for all pending callbacks
+    fdb_close(dbfile);
+    TEST_CHK(ctx.ncallbacks == n);
+    TEST_CHK(ctx.nfails == 0);
+    TEST_CHK(ctx.ordered);
+
+    // all committed docs should be retrieved after reopen
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        TEST_CMP(value, bodybuf, valuelen);
+        free(value);
+    }
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    sprintf(bodybuf, "commit async test (%s)",
+            (durability == FDB_DRB_ASYNC) ? "async durability" : "sync durability");
+    TEST_RESULT(bodybuf);
+}
+
+void wal_flusher_test(bool auto_commit)
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int wal_threshold = 64;
+    // below the hard limit, so that writers never flush WAL by themselves
+    int n = wal_threshold * 3;
+    size_t valuelen;
+    void *value;
+    char keybuf[256], bodybuf[256];
+    fdb_file_handle *dbfile, *dbfile2;
+    fdb_kvs_handle *db, *db2;
+    fdb_status status;
+    fdb_wal_flush_info info;
+
+    // remove previous dummy files
+    r = system(SHELL_DEL " dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.wal_threshold = wal_threshold;
+    if (auto_commit) {
+        fconfig.auto_commit = true;
+    } else {
+        fconfig.wal_flush_before_commit = true;
+    }
+
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    // another handle keeps the file open
+    fdb_open(&dbfile2, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile2, &db2, &kvs_config);
+
+    status = fdb_get_wal_flush_info(dbfile, NULL);
+    TEST_CHK(status == FDB_RESULT_INVALID_ARGS);
+
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+
+    // all docs are visible regardless of background flushes
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        TEST_CMP(value, bodybuf, valuelen);
+        free(value);
+    }
+
+    // close waits for the WAL flusher thread
+    fdb_close(dbfile);
+
+    status = fdb_get_wal_flush_info(dbfile2, &info);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(info.num_bg_flushes >= 1);
+    TEST_CHK(info.num_stalls == 0);
+    TEST_CHK(info.stall_time == 0);
+
+    if (!auto_commit) {
+        status = fdb_commit(dbfile2, FDB_COMMIT_NORMAL);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+    // (auto commit mode commits on closing the last handle)
+    fdb_close(dbfile2);
+
+    // all docs should be retrieved after reopen
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        TEST_CMP(value, bodybuf, valuelen);
+        free(value);
+    }
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    sprintf(bodybuf, "WAL flusher test (%s)",
+            (auto_commit) ? "auto commit" : "flush before commit");
+    TEST_RESULT(bodybuf);
+}
+
+void wal_memory_budget_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int n = 512;
+    size_t valuelen;
+    void *value;
+    char keybuf[1024], bodybuf[256];
+    fdb_file_handle *dbfile, *dbfile2, *dbfile_small;
+    fdb_kvs_handle *db, *db_small;
+    fdb_status status;
+    fdb_wal_flush_info finfo;
+    fdb_wal_memory_info minfo, minfo_small;
+
+    // remove previous dummy files
+    r = system(SHELL_DEL " dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.wal_flush_before_commit = true;
+    // flushes are triggered only by memory usage
+    fconfig.wal_threshold = 1024 * 1024;
+    fconfig.wal_memory_limit = 0;
+    fconfig.wal_memory_budget = 256 * 1024;
+
+    // a file with a few small keys
+    fdb_open(&dbfile_small, "./dummy2", &fconfig);
+    fdb_kvs_open_default(dbfile_small, &db_small, &kvs_config);
+    for (i=0;i<10;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        fdb_set_kv(db_small, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+    }
+    status = fdb_get_wal_memory_info(dbfile_small, &minfo_small);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(minfo_small.mem_usage > 10 * sizeof(uint64_t));
+    TEST_CHK(minfo_small.global_mem_usage >= minfo_small.mem_usage);
+    TEST_CHK(minfo_small.global_mem_budget == 256 * 1024);
+
+    // a file with large keys (512 x 1KB keys exceed the global budget)
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    // another handle keeps the file open
+    fdb_open(&dbfile2, "./dummy1", &fconfig);
+    for (i=0;i<n;++i){
+        memset(keybuf, 'a' + (i % 26), 1000);
+        sprintf(keybuf + 1000, "%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+    // close waits for the WAL flusher thread
+    fdb_close(dbfile);
+
+    // only the largest file is flushed
+    status = fdb_get_wal_flush_info(dbfile2, &finfo);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(finfo.num_bg_flushes + finfo.num_stalls >= 1);
+    status = fdb_get_wal_flush_info(dbfile_small, &finfo);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(finfo.num_bg_flushes + finfo.num_stalls == 0);
+
+    status = fdb_get_wal_memory_info(dbfile2, &minfo);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(minfo.mem_usage < (uint64_t)n * 1000);
+    status = fdb_get_wal_memory_info(dbfile_small, &minfo);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(minfo.mem_usage == minfo_small.mem_usage);
+
+    status = fdb_commit(dbfile2, FDB_COMMIT_NORMAL);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    fdb_close(dbfile2);
+    fdb_close(dbfile_small);
+
+    // all docs should be retrieved after reopen
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    for (i=0;i<n;++i){
+        memset(keybuf, 'a' + (i % 26), 1000);
+        sprintf(keybuf + 1000, "%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_get_kv(db, keybuf, strlen(keybuf), &value, &valuelen);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        TEST_CMP(value, bodybuf, valuelen);
+        free(value);
+    }
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("WAL memory budget test");
+}
+
+void wal_memory_budget_idle_file_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, j, r;
+    int n_idle = 150, n = 10000;
+    size_t valuelen;
+    void *value;
+    char keybuf[1024], bodybuf[256];
+    fdb_file_handle *dbfile, *dbfile_idle;
+    fdb_kvs_handle *db, *db_idle;
+    fdb_status status;
+    fdb_wal_flush_info finfo;
+    fdb_wal_memory_info minfo, minfo_idle;
+
+    // remove previous dummy files
+    r = system(SHELL_DEL " dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.wal_flush_before_commit = true;
+    // flushes are triggered only by memory usage
+    fconfig.wal_threshold = 1024 * 1024;
+    fconfig.wal_memory_limit = 0;
+    fconfig.wal_memory_budget = 256 * 1024;
+
+    // a file with large keys, under the global budget by itself
+    fdb_open(&dbfile_idle, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile_idle, &db_idle, &kvs_config);
+    for (i=0;i<n_idle;++i){
+        memset(keybuf, 'a' + (i % 26), 1000);
+        sprintf(keybuf + 1000, "%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db_idle, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+    status = fdb_get_wal_memory_info(dbfile_idle, &minfo_idle);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(minfo_idle.mem_usage > (uint64_t)n_idle * 1000);
+    TEST_CHK(minfo_idle.global_mem_usage <= 256 * 1024);
+
+    // the other file with small keys exceeds the global budget,
+    // while the first file stays idle
+    fdb_open(&dbfile, "./dummy2", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        status = fdb_get_wal_memory_info(dbfile, &minfo);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        status = fdb_get_wal_flush_info(dbfile_idle, &finfo);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        if (minfo.global_mem_usage > 256 * 1024 || finfo.num_bg_flushes) {
+            break;
+        }
+    }
+
+    // the idle file is the largest one, and flushed by the WAL flusher thread
+    // (which may happen before the usage is checked above)
+    for (j=0;j<1000;++j){
+        status = fdb_get_wal_flush_info(dbfile_idle, &finfo);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        if (finfo.num_bg_flushes) {
+            break;
+        }
+        usleep(10000);
+    }
+    TEST_CHK(finfo.num_bg_flushes >= 1);
+    TEST_CHK(finfo.num_stalls == 0);
+    status = fdb_get_wal_memory_info(dbfile_idle, &minfo);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(minfo.mem_usage < minfo_idle.mem_usage);
+
+    for (++i;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        status = fdb_get_wal_memory_info(dbfile, &minfo);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        // writers are stalled beyond the hard limit
+        TEST_CHK(minfo.global_mem_usage <= 4 * 256 * 1024 + 4096);
+    }
+
+    status = fdb_commit(dbfile_idle, FDB_COMMIT_NORMAL);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    status = fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    fdb_close(dbfile_idle);
+    fdb_close(dbfile);
+
+    // all docs of the idle file should be retrieved after reopen
+    fdb_open(&dbfile_idle, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile_idle, &db_idle, &kvs_config);
+    for (i=0;i<n_idle;++i){
+        memset(keybuf, 'a' + (i % 26), 1000);
+        sprintf(keybuf + 1000, "%d", i);
+        sprintf(bodybuf, "body%d", i);
+        status = fdb_get_kv(db_idle, keybuf, strlen(keybuf),
+                            &value, &valuelen);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        TEST_CMP(value, bodybuf, valuelen);
+        free(value);
+    }
+    fdb_close(dbfile_idle);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("WAL memory budget with idle file test");
+}
+
+void bloom_filter_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int n = 1000;
+    char keybuf[256], bodybuf[256];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db, *kv1;
+    fdb_doc *doc;
+    fdb_status status;
+    fdb_bloom_filter_info info;
+
+    // remove previous dummy files
+    r = system(SHELL_DEL " dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.bloom_bits_per_key = 10;
+
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    fdb_kvs_open(dbfile, &kv1, "kv1", &kvs_config);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+        fdb_set_kv(kv1, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+    }
+    // keys are added to the filter when they are flushed into the index
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    status = fdb_get_bloom_filter_info(dbfile, &info);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(info.num_keys == (uint64_t)n * 2);
+    TEST_CHK(info.space_used > 0);
+
+    for (i=0;i<n;++i){
+        // existing keys
+        sprintf(keybuf, "key%d", i);
+        fdb_doc_create(&doc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, doc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        fdb_doc_free(doc);
+        fdb_doc_create(&doc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get_metaonly(kv1, doc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        fdb_doc_free(doc);
+
+        // missing keys
+        sprintf(keybuf, "missing%d", i);
+        fdb_doc_create(&doc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, doc);
+        TEST_CHK(status == FDB_RESULT_KEY_NOT_FOUND);
+        status = fdb_get_metaonly(kv1, doc);
+        TEST_CHK(status == FDB_RESULT_KEY_NOT_FOUND);
+        fdb_doc_free(doc);
+    }
+    status = fdb_get_bloom_filter_info(dbfile, &info);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(info.num_lookups == (uint64_t)n * 4);
+    // most missing keys do not walk the index
+    TEST_CHK(info.num_negatives > (uint64_t)n * 2 * 9 / 10);
+    TEST_CHK(info.num_negatives + info.num_false_positives ==
+             (uint64_t)n * 2);
+    fdb_close(dbfile);
+
+    // the filter is loaded on open
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    status = fdb_get_bloom_filter_info(dbfile, &info);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(info.num_keys == (uint64_t)n * 2);
+    TEST_CHK(info.num_lookups == 0);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        fdb_doc_create(&doc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, doc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        fdb_doc_free(doc);
+    }
+
+    // the filter of the new file is built during compaction
+    status = fdb_compact(dbfile, "./dummy2");
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    status = fdb_get_bloom_filter_info(dbfile, &info);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(info.num_keys == (uint64_t)n * 2);
+    TEST_CHK(info.num_lookups == 0);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        fdb_doc_create(&doc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, doc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        fdb_doc_free(doc);
+    }
+    fdb_close(dbfile);
+
+    // the filter is not used once it is disabled
+    fconfig.bloom_bits_per_key = 0;
+    fdb_open(&dbfile, "./dummy2", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    sprintf(keybuf, "missing");
+    fdb_doc_create(&doc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+    status = fdb_get(db, doc);
+    TEST_CHK(status == FDB_RESULT_KEY_NOT_FOUND);
+    fdb_doc_free(doc);
+    status = fdb_get_bloom_filter_info(dbfile, &info);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(info.num_keys == 0 && info.num_lookups == 0);
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("Bloom filter test");
+}
+
+static bool _is_missing_key(fdb_doc *doc)
+{
+    return doc->keylen > 7 && !memcmp(doc->key, "missing", 7);
+}
+
+void multi_get_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, j, r;
+    int n = 1000, nget = 300;
+    char keybuf[256], bodybuf[256];
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db, *kv1, *handles[2], *snap;
+    fdb_doc **docs;
+    fdb_status status, *statuses;
+
+    // remove previous dummy files
+    r = system(SHELL_DEL " dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    // missing keys are filtered out before walking the index
+    fconfig.bloom_bits_per_key = 10;
+
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    fdb_kvs_open(dbfile, &kv1, "kv1", &kvs_config);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "body%d", i);
+        fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+        sprintf(bodybuf, "kv1_body%d", i);
+        fdb_set_kv(kv1, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+    }
+    status = fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    // some keys are updated or removed in WAL
+    for (i=0;i<n;i+=10){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "updated%d", i);
+        fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+        sprintf(keybuf, "key%d", i+1);
+        fdb_del_kv(db, keybuf, strlen(keybuf));
+    }
+    fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+    fdb_snapshot_open(db, &snap, FDB_SNAPSHOT_INMEM);
+
+    docs = (fdb_doc **)malloc(sizeof(fdb_doc *) * nget);
+    statuses = (fdb_status *)malloc(sizeof(fdb_status) * nget);
+
+    // keys in a random order, with missing keys
+    for (i=0;i<nget;++i){
+        j = rand() % (n * 2);
+        if (j < n) {
+            sprintf(keybuf, "key%d", j);
+        } else {
+            sprintf(keybuf, "missing%d", j);
+        }
+        fdb_doc_create(&docs[i], keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+    }
+
+    handles[0] = db;
+    handles[1] = snap;
+    for (j=0;j<2;++j){
+        status = fdb_get_multi(handles[j], docs, nget, statuses);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        for (i=0;i<nget;++i){
+            // compare with a single lookup
+            fdb_doc *doc;
+            fdb_doc_create(&doc, docs[i]->key, docs[i]->keylen,
+                           NULL, 0, NULL, 0);
+            status = fdb_get(handles[j], doc);
+            TEST_CHK(statuses[i] == status);
+            if (status == FDB_RESULT_SUCCESS) {
+                TEST_CHK(docs[i]->bodylen == doc->bodylen);
+                TEST_CHK(!memcmp(docs[i]->body, doc->body, doc->bodylen));
+                TEST_CHK(docs[i]->seqnum == doc->seqnum);
+                TEST_CHK(docs[i]->offset == doc->offset);
+            }
+            fdb_doc_free(doc);
+            if (_is_missing_key(docs[i])) {
+                TEST_CHK(statuses[i] == FDB_RESULT_KEY_NOT_FOUND);
+            }
+            free(docs[i]->meta);
+            free(docs[i]->body);
+            docs[i]->meta = docs[i]->body = NULL;
+        }
+    }
+
+    // other KV store
+    status = fdb_get_multi(kv1, docs, nget, statuses);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    for (i=0;i<nget;++i){
+        if (_is_missing_key(docs[i])) {
+            TEST_CHK(statuses[i] == FDB_RESULT_KEY_NOT_FOUND);
+            continue;
+        }
+        TEST_CHK(statuses[i] == FDB_RESULT_SUCCESS);
+        sprintf(bodybuf, "kv1_body%.*s", (int)docs[i]->keylen - 3,
+                (char *)docs[i]->key + 3);
+        TEST_CHK(docs[i]->bodylen == strlen(bodybuf));
+        TEST_CHK(!memcmp(docs[i]->body, bodybuf, docs[i]->bodylen));
+    }
+
+    // invalid docs do not affect the others
+    docs[0]->keylen = 0;
+    fdb_doc_free(docs[1]);
+    docs[1] = NULL;
+    status = fdb_get_multi(kv1, docs, nget, statuses);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CHK(statuses[0] == FDB_RESULT_INVALID_ARGS);
+    TEST_CHK(statuses[1] == FDB_RESULT_INVALID_ARGS);
+    for (i=2;i<nget;++i){
+        TEST_CHK(statuses[i] == FDB_RESULT_SUCCESS ||
+                 _is_missing_key(docs[i]));
+    }
+    status = fdb_get_multi(kv1, NULL, nget, statuses);
+    TEST_CHK(status == FDB_RESULT_INVALID_ARGS);
+
+    for (i=0;i<nget;++i){
+        if (docs[i]) {
+            fdb_doc_free(docs[i]);
+        }
+    }
+    free(docs);
+    free(statuses);
+    fdb_kvs_close(snap);
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("multi get test");
+}
+
 
 int main(){
 
@@ -3038,6 +4038,16 @@ int main(){
     auto_commit_test();
     last_wal_flush_header_test();
     long_key_test();
+    group_commit_test();
+    wal_concurrent_access_test();
+    commit_async_test(FDB_DRB_NONE);
+    commit_async_test(FDB_DRB_ASYNC);
+    wal_flusher_test(false);
+    wal_flusher_test(true);
+    wal_memory_budget_test();
+    wal_memory_budget_idle_file_test();
+    bloom_filter_test();
+    multi_get_test();
 
 
     purge_logically_deleted_doc_test();
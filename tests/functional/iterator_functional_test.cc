@@ -409,6 +409,133 @@ void iterator_with_concurrent_updates_test()
     TEST_RESULT("iterator with concurrent updates test");
 }
 
+void iterator_wal_view_test()
+{
+    TEST_INIT();
+    memleak_start();
+
+    int i, r, n = 20, n_new = 5;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db1, *db2;
+    fdb_iterator *itr;
+    fdb_config fconfig;
+    fdb_kvs_config kvs_config;
+    fdb_doc *doc;
+    fdb_doc *rdoc = NULL;
+    fdb_status status;
+    char keybuf[256], bodybuf[256];
+
+    // remove previous dummy files
+    r = system(SHELL_DEL" dummy* > errorlog.txt");
+    (void)r;
+
+    fconfig = fdb_get_default_config();
+    kvs_config = fdb_get_default_kvs_config();
+    fconfig.buffercache_size = 0;
+    fconfig.wal_threshold = 1024;
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db1, &kvs_config);
+    fdb_kvs_open_default(dbfile, &db2, &kvs_config);
+
+    // all docs are in WAL
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%02d", i);
+        sprintf(bodybuf, "body%02d", i);
+        fdb_doc_create(&doc, (void*)keybuf, strlen(keybuf), NULL, 0,
+                       (void*)bodybuf, strlen(bodybuf));
+        fdb_set(db1, doc);
+        fdb_doc_free(doc);
+    }
+    fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+
+    fdb_iterator_init(db1, &itr, NULL, 0, NULL, 0, FDB_ITR_NONE);
+    status = fdb_iterator_get(itr, &rdoc);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    TEST_CMP(rdoc->key, "key00", rdoc->keylen);
+    fdb_doc_free(rdoc);
+    rdoc = NULL;
+
+    // update, delete and insert docs, and then flush WAL,
+    // while the iterator is open
+    for (i=0;i<n+n_new;++i){
+        sprintf(keybuf, "key%02d", i);
+        sprintf(bodybuf, "new_body%02d", i);
+        fdb_doc_create(&doc, (void*)keybuf, strlen(keybuf), NULL, 0,
+                       (void*)bodybuf, strlen(bodybuf));
+        fdb_set(db2, doc);
+        if (i == n/2) {
+            fdb_del(db2, doc);
+        }
+        fdb_doc_free(doc);
+    }
+    fdb_commit(dbfile, FDB_COMMIT_MANUAL_WAL_FLUSH);
+
+    // the iterator still sees the WAL as of its creation
+    r = 1;
+    while (fdb_iterator_next(itr) == FDB_RESULT_SUCCESS) {
+        status = fdb_iterator_get(itr, &rdoc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        sprintf(keybuf, "key%02d", r);
+        sprintf(bodybuf, "body%02d", r);
+        TEST_CMP(rdoc->key, keybuf, rdoc->keylen);
+        TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+        fdb_doc_free(rdoc);
+        rdoc = NULL;
+        r++;
+    }
+    TEST_CHK(r == n);
+
+    // also in reverse order, and by seek
+    r = n;
+    while (fdb_iterator_prev(itr) == FDB_RESULT_SUCCESS) {
+        status = fdb_iterator_get(itr, &rdoc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        r--;
+        sprintf(bodybuf, "body%02d", r);
+        TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+        fdb_doc_free(rdoc);
+        rdoc = NULL;
+    }
+    TEST_CHK(r == 0);
+    sprintf(keybuf, "key%02d", n/2);
+    status = fdb_iterator_seek(itr, keybuf, strlen(keybuf),
+                               FDB_ITR_SEEK_HIGHER);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    status = fdb_iterator_get(itr, &rdoc);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+    sprintf(bodybuf, "body%02d", n/2);
+    TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+    fdb_doc_free(rdoc);
+    rdoc = NULL;
+    fdb_iterator_close(itr);
+
+    // a new iterator sees the latest docs
+    fdb_iterator_init(db1, &itr, NULL, 0, NULL, 0, FDB_ITR_NO_DELETES);
+    r = 0;
+    do {
+        status = fdb_iterator_get(itr, &rdoc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        if (r == n/2) {
+            r++; // deleted
+        }
+        sprintf(keybuf, "key%02d", r);
+        sprintf(bodybuf, "new_body%02d", r);
+        TEST_CMP(rdoc->key, keybuf, rdoc->keylen);
+        TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+        fdb_doc_free(rdoc);
+        rdoc = NULL;
+        r++;
+    } while (fdb_iterator_next(itr) == FDB_RESULT_SUCCESS);
+    TEST_CHK(r == n + n_new);
+    fdb_iterator_close(itr);
+
+    fdb_close(dbfile);
+    fdb_shutdown();
+
+    memleak_end();
+    TEST_RESULT("iterator WAL view test");
+}
+
 void iterator_compact_uncommitted_db()
 {
     TEST_INIT();
@@ -2944,6 +3071,7 @@ int main(){
 
     iterator_test();
     iterator_with_concurrent_updates_test();
+    iterator_wal_view_test();
     iterator_compact_uncommitted_db();
     iterator_seek_test();
     for (i=0;i<=6;++i){
@@ -281,6 +281,128 @@ void crash_recovery_test()
     TEST_RESULT("crash recovery test");
 }
 
+// restore a large WAL region on open after an unclean shutdown,
+// and report the time taken by fdb_open()
+void crash_recovery_parallel_test(uint8_t nthreads)
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r;
+    int n = 100000;
+    int ntxn = 100;
+    int ndeleted = 0;
+    fdb_file_handle *dbfile;
+    fdb_kvs_handle *db;
+    fdb_doc *rdoc;
+    fdb_status status;
+    fdb_file_info info;
+    struct timeval ts_begin, ts_gap;
+    char keybuf[256], bodybuf[8192];
+
+    // remove previous dummy files
+    r = system(SHELL_DEL" dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    fconfig.buffercache_size = 0;
+    // keep all documents in WAL
+    fconfig.wal_threshold = n * 2;
+    fconfig.wal_memory_budget = 0;
+    fconfig.wal_memory_limit = 0;
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.compaction_threshold = 0;
+    fconfig.recovery_num_threads = nthreads;
+
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+
+    // insert documents (some of them span several blocks),
+    // and then delete some of them
+    memset(bodybuf, 'x', sizeof(bodybuf));
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%08d", i);
+        if (i % 100 == 0) {
+            sprintf(bodybuf, "body%d", i);
+            fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, 6000);
+        } else {
+            sprintf(bodybuf, "body%d", i);
+            fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+        }
+    }
+    for (i=0;i<n;i+=7){
+        sprintf(keybuf, "key%08d", i);
+        fdb_del_kv(db, keybuf, strlen(keybuf));
+        ndeleted++;
+    }
+    // transactional documents are restored through their commit marks
+    fdb_begin_transaction(dbfile, FDB_ISOLATION_READ_COMMITTED);
+    for (i=0;i<ntxn;++i){
+        sprintf(keybuf, "txn%08d", i);
+        sprintf(bodybuf, "txn_body%d", i);
+        fdb_set_kv(db, keybuf, strlen(keybuf), bodybuf, strlen(bodybuf));
+    }
+    fdb_end_transaction(dbfile, FDB_COMMIT_NORMAL);
+
+    // close without flushing WAL, and shut down to drop all cached state
+    fdb_kvs_close(db);
+    fdb_close(dbfile);
+    fdb_shutdown();
+
+    // reopen the file .. all documents in WAL are restored
+    gettimeofday(&ts_begin, NULL);
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    gettimeofday(&ts_gap, NULL);
+    ts_gap = _utime_gap(ts_begin, ts_gap);
+
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%08d", i);
+        sprintf(bodybuf, "body%d", i);
+        fdb_doc_create(&rdoc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, rdoc);
+        if (i % 7 == 0) {
+            TEST_CHK(status == FDB_RESULT_KEY_NOT_FOUND);
+        } else {
+            TEST_CHK(status == FDB_RESULT_SUCCESS);
+            TEST_CMP(rdoc->body, bodybuf, strlen(bodybuf));
+            TEST_CHK(rdoc->bodylen == ((i % 100 == 0)?(6000):
+                                                       (strlen(bodybuf))));
+        }
+        fdb_doc_free(rdoc);
+    }
+    for (i=0;i<ntxn;++i){
+        sprintf(keybuf, "txn%08d", i);
+        sprintf(bodybuf, "txn_body%d", i);
+        fdb_doc_create(&rdoc, keybuf, strlen(keybuf), NULL, 0, NULL, 0);
+        status = fdb_get(db, rdoc);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+        TEST_CMP(rdoc->body, bodybuf, rdoc->bodylen);
+        fdb_doc_free(rdoc);
+    }
+    fdb_get_file_info(dbfile, &info);
+    TEST_CHK(info.doc_count == (uint64_t)(n - ndeleted + ntxn));
+
+    fprintf(stderr, "open with %d recovery threads: %d docs in %.3f sec\n",
+            (int)nthreads, n + ndeleted + ntxn,
+            ts_gap.tv_sec + ts_gap.tv_usec / 1000000.0);
+
+    // close db file
+    fdb_kvs_close(db);
+    fdb_close(dbfile);
+
+    // free all resources
+    fdb_shutdown();
+
+    memleak_end();
+
+    sprintf(bodybuf, "crash recovery with %d parser threads test",
+            (int)nthreads);
+    TEST_RESULT(bodybuf);
+}
+
 void snapshot_test()
 {
     TEST_INIT();
@@ -2189,6 +2311,127 @@ void transaction_simple_api_test()
 }
 
 
+struct txn_reader_args {
+    fdb_kvs_handle *db;
+    int n;
+    volatile int stop;
+    int nreads;
+    int nviolations;
+};
+
+static void *_txn_reader_thread(void *voidargs)
+{
+    struct txn_reader_args *args = (struct txn_reader_args *)voidargs;
+    int i, round, prev;
+    size_t valuelen;
+    void *value;
+    char keybuf[256], bodybuf[256];
+    fdb_status status;
+
+    while (!args->stop) {
+        // each transaction updates all keys, and is committed atomically,
+        // so that a key read later never has an older value
+        prev = 0;
+        for (i=0;i<args->n;++i){
+            sprintf(keybuf, "key%d", i);
+            status = fdb_get_kv(args->db, keybuf, strlen(keybuf),
+                                &value, &valuelen);
+            if (status != FDB_RESULT_SUCCESS) {
+                args->nviolations++;
+                continue;
+            }
+            memcpy(bodybuf, value, valuelen);
+            bodybuf[valuelen] = 0;
+            free(value);
+            round = atoi(bodybuf + 1);
+            if (round < prev) {
+                args->nviolations++;
+            }
+            prev = round;
+        }
+        args->nreads++;
+    }
+    thread_exit(0);
+    return NULL;
+}
+
+void transaction_atomic_visibility_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, r, round;
+    int n = 256, nrounds = 100;
+    fdb_file_handle *dbfile, *dbfile_reader;
+    fdb_kvs_handle *db, *db_reader;
+    fdb_status status;
+    thread_t tid;
+    void *thread_ret;
+    struct txn_reader_args args;
+
+    char keybuf[256], bodybuf[256];
+
+    // remove previous dummy files
+    r = system(SHELL_DEL" dummy* > errorlog.txt");
+    (void)r;
+
+    fdb_config fconfig = fdb_get_default_config();
+    fdb_kvs_config kvs_config = fdb_get_default_kvs_config();
+    // keep all docs in the WAL
+    fconfig.wal_threshold = 65536;
+    fconfig.flags = FDB_OPEN_FLAG_CREATE;
+    fconfig.purging_interval = 0;
+    fconfig.compaction_threshold = 0;
+
+    fdb_open(&dbfile, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile, &db, &kvs_config);
+    for (i=0;i<n;++i){
+        sprintf(keybuf, "key%d", i);
+        sprintf(bodybuf, "r0");
+        status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                            bodybuf, strlen(bodybuf));
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+    status = fdb_commit(dbfile, FDB_COMMIT_NORMAL);
+    TEST_CHK(status == FDB_RESULT_SUCCESS);
+
+    fdb_open(&dbfile_reader, "./dummy1", &fconfig);
+    fdb_kvs_open_default(dbfile_reader, &db_reader, &kvs_config);
+    args.db = db_reader;
+    args.n = n;
+    args.stop = 0;
+    args.nreads = 0;
+    args.nviolations = 0;
+    thread_create(&tid, _txn_reader_thread, &args);
+
+    // keys spread over all key shards of the WAL are updated together
+    for (round=1;round<=nrounds;++round){
+        fdb_begin_transaction(dbfile, FDB_ISOLATION_READ_COMMITTED);
+        for (i=0;i<n;++i){
+            sprintf(keybuf, "key%d", i);
+            sprintf(bodybuf, "r%d", round);
+            status = fdb_set_kv(db, keybuf, strlen(keybuf),
+                                bodybuf, strlen(bodybuf));
+            TEST_CHK(status == FDB_RESULT_SUCCESS);
+        }
+        status = fdb_end_transaction(dbfile, FDB_COMMIT_NORMAL);
+        TEST_CHK(status == FDB_RESULT_SUCCESS);
+    }
+    args.stop = 1;
+    thread_join(tid, &thread_ret);
+
+    TEST_CHK(args.nreads > 0);
+    TEST_CHK(args.nviolations == 0);
+
+    fdb_close(dbfile_reader);
+    fdb_close(dbfile);
+    fdb_shutdown();
+
+    memleak_end();
+    TEST_RESULT("transaction atomic visibility test");
+}
+
 void rollback_prior_to_ops(bool walflush)
 {
 
@@ -2416,6 +2659,8 @@ int main(){
 #ifdef __CRC32
     crash_recovery_test();
 #endif
+    crash_recovery_parallel_test(0);
+    crash_recovery_parallel_test(4);
     snapshot_test();
     in_memory_snapshot_test();
     snapshot_clone_test();
@@ -2429,6 +2674,7 @@ int main(){
     rollback_ncommits();
     transaction_test();
     transaction_simple_api_test();
+    transaction_atomic_visibility_test();
     rollback_prior_to_ops(true); // wal commit
     rollback_prior_to_ops(false); // normal commit
     auto_compaction_snapshots_test(); // test snapshots with auto-compaction
@@ -0,0 +1,172 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "arena.h"
+#include "wal.h"
+
+#include "memleak.h"
+
+void basic_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    struct arena arena;
+    size_t chunksize = 4096;
+    int i, n = 1000;
+    uint8_t **ptrs = (uint8_t **)malloc(sizeof(uint8_t *) * n);
+    size_t *sizes = (size_t *)malloc(sizeof(size_t) * n);
+    uint8_t *big;
+
+    arena_init(&arena, chunksize);
+    TEST_CHK(arena_get_num_chunks(&arena) == 0);
+
+    for (i=0;i<n;++i){
+        sizes[i] = 1 + (i % 100);
+        ptrs[i] = (uint8_t *)arena_alloc(&arena, sizes[i]);
+        // 8-byte aligned, and located in a chunk
+        TEST_CHK(((size_t)ptrs[i] & 7) == 0);
+        memset(ptrs[i], i & 0xff, sizes[i]);
+    }
+    TEST_CHK(arena_get_num_chunks(&arena) > 1);
+
+    // objects should not overlap
+    for (i=0;i<n;++i){
+        TEST_CHK(ptrs[i][0] == (i & 0xff));
+        TEST_CHK(ptrs[i][sizes[i]-1] == (i & 0xff));
+    }
+
+    // a big object bypasses the arena
+    big = (uint8_t *)arena_alloc(&arena, chunksize);
+    memset(big, 0, chunksize);
+    arena_free(&arena, big, chunksize);
+
+    // free the older half .. retired chunks are released
+    for (i=0;i<n/2;++i){
+        arena_free(&arena, ptrs[i], sizes[i]);
+    }
+    TEST_CHK(arena_get_num_chunks(&arena) > 1);
+    // free the rest .. only the current chunk remains
+    for (i=n/2;i<n;++i){
+        arena_free(&arena, ptrs[i], sizes[i]);
+    }
+    TEST_CHK(arena_get_num_chunks(&arena) == 1);
+
+    // the current chunk is reused from the beginning
+    ptrs[0] = (uint8_t *)arena_alloc(&arena, 8);
+    ptrs[1] = (uint8_t *)arena_alloc(&arena, 8);
+    TEST_CHK(ptrs[1] == ptrs[0] + 8);
+    TEST_CHK(arena_get_num_chunks(&arena) == 1);
+
+    // release everything at once, including live objects
+    for (i=0;i<n;++i){
+        arena_alloc(&arena, 64);
+    }
+    arena_free_all(&arena);
+    TEST_CHK(arena_get_num_chunks(&arena) == 0);
+
+    free(ptrs);
+    free(sizes);
+
+    memleak_end();
+
+    TEST_RESULT("basic test");
+}
+
+// allocate WAL items, headers and keys for 'n' keys, and then free them in
+// the same order as WAL flushing does, for 'ngen' generations.
+void wal_alloc_bench(int n, int ngen)
+{
+    TEST_INIT();
+
+    struct arena arena;
+    struct timeval ts_begin, ts_malloc, ts_arena;
+    int i, gen, keylen;
+    void **items = (void **)malloc(sizeof(void *) * n);
+    void **headers = (void **)malloc(sizeof(void *) * n);
+    void **keys = (void **)malloc(sizeof(void *) * n);
+    uint64_t nops = (uint64_t)n * ngen * 3;
+
+    // system allocator
+    gettimeofday(&ts_begin, NULL);
+    for (gen=0;gen<ngen;++gen){
+        for (i=0;i<n;++i){
+            keylen = 16 + (i % 32);
+            headers[i] = malloc(sizeof(struct wal_item_header));
+            keys[i] = malloc(keylen);
+            items[i] = malloc(sizeof(struct wal_item));
+            memset(keys[i], i, keylen);
+        }
+        for (i=0;i<n;++i){
+            free(items[i]);
+            free(keys[i]);
+            free(headers[i]);
+        }
+    }
+    gettimeofday(&ts_malloc, NULL);
+    ts_malloc = _utime_gap(ts_begin, ts_malloc);
+
+    // WAL arena
+    arena_init(&arena, FDB_WAL_ARENA_CHUNKSIZE);
+    gettimeofday(&ts_begin, NULL);
+    for (gen=0;gen<ngen;++gen){
+        for (i=0;i<n;++i){
+            keylen = 16 + (i % 32);
+            headers[i] = arena_alloc(&arena, sizeof(struct wal_item_header));
+            keys[i] = arena_alloc(&arena, keylen);
+            items[i] = arena_alloc(&arena, sizeof(struct wal_item));
+            memset(keys[i], i, keylen);
+        }
+        for (i=0;i<n;++i){
+            keylen = 16 + (i % 32);
+            arena_free(&arena, items[i], sizeof(struct wal_item));
+            arena_free(&arena, keys[i], keylen);
+            arena_free(&arena, headers[i], sizeof(struct wal_item_header));
+        }
+        TEST_CHK(arena_get_num_chunks(&arena) == 1);
+    }
+    gettimeofday(&ts_arena, NULL);
+    ts_arena = _utime_gap(ts_begin, ts_arena);
+    arena_free_all(&arena);
+
+    fprintf(stderr, "malloc/free: %" _F64 " allocs/sec\n",
+            nops * 1000000 /
+            (uint64_t)(ts_malloc.tv_sec * 1000000 + ts_malloc.tv_usec + 1));
+    fprintf(stderr, "arena      : %" _F64 " allocs/sec\n",
+            nops * 1000000 /
+            (uint64_t)(ts_arena.tv_sec * 1000000 + ts_arena.tv_usec + 1));
+
+    free(items);
+    free(headers);
+    free(keys);
+
+    TEST_RESULT("WAL allocation benchmark");
+}
+
+int main()
+{
+    basic_test();
+    wal_alloc_bench(4096, 500);
+
+    return 0;
+}
@@ -23,6 +23,7 @@
 #include "blockcache.h"
 #include "filemgr.h"
 #include "filemgr_ops.h"
+#include "nodecache.h"
 #include "crc32.h"
 
 #include "memleak.h"
@@ -134,12 +135,13 @@ void * worker(void *voidargs)
 
     while(1) {
         bid = rand() % args->nblocks;
-        ret = bcache_read(args->file, bid, buf);
+        ret = bcache_read(args->file, bid, buf, BCACHE_HINT_NORMAL);
         if (ret <= 0) {
             ret = args->file->ops->pread(args->file->fd, buf,
                                          args->file->blocksize, bid * args->file->blocksize);
             TEST_CHK(ret == args->file->blocksize);
-            ret = bcache_write(args->file, bid, buf, BCACHE_REQ_CLEAN);
+            ret = bcache_write(args->file, bid, buf, BCACHE_REQ_CLEAN,
+                               BCACHE_HINT_NORMAL);
             TEST_CHK(ret == args->file->blocksize);
         }
         crc_file = crc32_8(buf, sizeof(uint64_t)*2, 0);
@@ -155,7 +157,8 @@ void * worker(void *voidargs)
             crc = crc32_8(buf, sizeof(uint64_t)*2, 0);
             memcpy(buf + sizeof(uint64_t)*2, &crc, sizeof(crc));
 
-            ret = bcache_write(args->file, bid, buf, BCACHE_REQ_DIRTY);
+            ret = bcache_write(args->file, bid, buf, BCACHE_REQ_DIRTY,
+                               BCACHE_HINT_NORMAL);
             TEST_CHK(ret == args->file->blocksize);
         }
 
@@ -210,7 +213,8 @@ void multi_thread_test(
         memcpy(buf + sizeof(i), &j, sizeof(j));
         crc = crc32_8(buf, sizeof(i) + sizeof(j), 0);
         memcpy(buf + sizeof(i) + sizeof(j), &crc, sizeof(crc));
-        bcache_write(file, (bid_t)i, buf, BCACHE_REQ_DIRTY);
+        bcache_write(file, (bid_t)i, buf, BCACHE_REQ_DIRTY,
+                     BCACHE_HINT_NORMAL);
     }
 
     for (i=0;i<n;++i){
@@ -236,10 +240,714 @@ void multi_thread_test(
     TEST_RESULT("multi thread test");
 }
 
+struct pin_ctx {
+    int count;
+    bool accept;
+};
+
+static bool pin_prepare(void *addr, void *voidctx)
+{
+    struct pin_ctx *ctx = (struct pin_ctx *)voidctx;
+    (void)addr;
+    ctx->count++;
+    return ctx->accept;
+}
+
+void pin_test()
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    struct pin_ctx ctx;
+    int i, r;
+    uint8_t *buf, *addr, *addr2;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+
+    memleak_start();
+
+    buf = (uint8_t *)malloc(4096);
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = 8;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    for (i=0;i<8;++i) {
+        memset(buf, i, 4096);
+        bcache_write(file, i, buf, BCACHE_REQ_CLEAN,
+                     BCACHE_HINT_NORMAL);
+    }
+
+    // PREPARE is invoked only once, and the same frame is returned
+    ctx.count = 0;
+    ctx.accept = true;
+    addr = (uint8_t *)bcache_pin(file, 1, pin_prepare, &ctx);
+    TEST_CHK(addr != NULL);
+    TEST_CHK(ctx.count == 1);
+    TEST_CHK(addr[0] == 1 && addr[1] == 1);
+    addr2 = (uint8_t *)bcache_pin(file, 1, pin_prepare, &ctx);
+    TEST_CHK(addr2 == addr);
+    TEST_CHK(ctx.count == 1);
+
+    // pinned block is still readable by others
+    r = bcache_read(file, 1, buf, BCACHE_HINT_NORMAL);
+    TEST_CHK(r == 4096);
+    TEST_CHK(buf[0] == 1 && buf[4095] == 1);
+    // and the same image written again does not change the frame
+    bcache_write(file, 1, buf, BCACHE_REQ_CLEAN, BCACHE_HINT_NORMAL);
+    TEST_CHK(bcache_pin(file, 1, pin_prepare, &ctx) == addr);
+    TEST_CHK(ctx.count == 1);
+
+    // pinned block cannot be modified
+    memset(buf, 0xff, 4096);
+    r = bcache_write(file, 1, buf, BCACHE_REQ_DIRTY, BCACHE_HINT_NORMAL);
+    TEST_CHK(r == 0);
+    r = bcache_write_partial(file, 1, buf, 0, 16);
+    TEST_CHK(r == 0);
+    TEST_CHK(addr[0] == 1);
+
+    // block declined by PREPARE is not pinned
+    ctx.count = 0;
+    ctx.accept = false;
+    addr2 = (uint8_t *)bcache_pin(file, 3, pin_prepare, &ctx);
+    TEST_CHK(addr2 == NULL);
+    TEST_CHK(ctx.count == 1);
+    addr2 = (uint8_t *)bcache_pin(file, 3, pin_prepare, &ctx);
+    TEST_CHK(addr2 == NULL);
+    TEST_CHK(ctx.count == 2);
+
+    // pinned block should not be evicted
+    for (i=100;i<132;++i) {
+        memset(buf, i, 4096);
+        bcache_write(file, i, buf, BCACHE_REQ_CLEAN,
+                     BCACHE_HINT_NORMAL);
+    }
+    ctx.accept = true;
+    addr2 = (uint8_t *)bcache_pin(file, 1, pin_prepare, &ctx);
+    TEST_CHK(addr2 == addr);
+    TEST_CHK(ctx.count == 2);
+    TEST_CHK(addr[0] == 1 && addr[4095] == 1);
+
+    // uncached block cannot be pinned
+    addr2 = (uint8_t *)bcache_pin(file, 2, NULL, NULL);
+    TEST_CHK(addr2 == NULL);
+
+    // at most half of the cache can be pinned
+    for (i=200;i<203;++i) {
+        memset(buf, i, 4096);
+        bcache_write(file, i, buf, BCACHE_REQ_CLEAN,
+                     BCACHE_HINT_NORMAL);
+        addr2 = (uint8_t *)bcache_pin(file, i, NULL, NULL);
+        TEST_CHK(addr2 != NULL);
+    }
+    memset(buf, 203, 4096);
+    bcache_write(file, 203, buf, BCACHE_REQ_CLEAN,
+                 BCACHE_HINT_NORMAL);
+    addr2 = (uint8_t *)bcache_pin(file, 203, NULL, NULL);
+    TEST_CHK(addr2 == NULL);
+
+    for (i=200;i<203;++i) {
+        bcache_unpin(file, i);
+    }
+    for (i=0;i<4;++i) {
+        bcache_unpin(file, 1);
+    }
+
+    // unpinned block can be modified again
+    memset(buf, 2, 4096);
+    r = bcache_write(file, 1, buf, BCACHE_REQ_DIRTY, BCACHE_HINT_NORMAL);
+    TEST_CHK(r == 4096);
+    memset(buf, 0, 4096);
+    r = bcache_read(file, 1, buf, BCACHE_HINT_NORMAL);
+    TEST_CHK(r == 4096);
+    TEST_CHK(buf[0] == 2);
+    bcache_remove_dirty_blocks(file);
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    free(buf);
+
+    memleak_end();
+    TEST_RESULT("pin test");
+}
+
+struct unpin_args {
+    struct filemgr *file;
+    bid_t bid;
+    volatile bool done;
+};
+
+static void * unpinner(void *voidargs)
+{
+    struct unpin_args *args = (struct unpin_args *)voidargs;
+    usleep(100000);
+    args->done = true;
+    bcache_unpin(args->file, args->bid);
+    return NULL;
+}
+
+void pin_close_test()
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    struct unpin_args args;
+    thread_t tid;
+    void *ret;
+    int i, r;
+    uint8_t *buf, *addr;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+
+    memleak_start();
+
+    buf = (uint8_t *)malloc(4096);
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = 8;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    for (i=0;i<4;++i) {
+        memset(buf, i, 4096);
+        bcache_write(file, i, buf, BCACHE_REQ_CLEAN,
+                     BCACHE_HINT_NORMAL);
+    }
+    addr = (uint8_t *)bcache_pin(file, 1, NULL, NULL);
+    TEST_CHK(addr != NULL);
+
+    // closing the file waits for the pin to be released, and then frees
+    // the block (and the unpinned one) instead of leaking it
+    args.file = file;
+    args.bid = 1;
+    args.done = false;
+    thread_create(&tid, unpinner, &args);
+    filemgr_close(file, true, NULL, NULL);
+    TEST_CHK(args.done);
+    thread_join(tid, &ret);
+
+    filemgr_shutdown();
+    free(buf);
+
+    memleak_end();
+    TEST_RESULT("pin close test");
+}
+
+// read a block through the cache, and return true if it hits
+static bool _cached_read(struct filemgr *file, bid_t bid, uint8_t *buf,
+                         bcache_hint_t hint)
+{
+    if (bcache_read(file, bid, buf, hint)) {
+        return true;
+    }
+    memset(buf, (int)bid, file->blocksize);
+    bcache_write(file, bid, buf, BCACHE_REQ_CLEAN, hint);
+    return false;
+}
+
+void scan_resistance_test()
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    int i, r, nhit;
+    int nhot = 32, ncache = 128;
+    bid_t cold;
+    uint8_t *buf;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+
+    memleak_start();
+
+    buf = (uint8_t *)malloc(4096);
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = ncache;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    // hot blocks: 0 ~ NHOT-1, cold blocks: 1000 ~
+    cold = 1000;
+    for (i=0;i<nhot;++i) {
+        _cached_read(file, i, buf, BCACHE_HINT_NORMAL);
+    }
+
+    // use-once scan larger than the cache should not evict hot blocks
+    for (i=0;i<ncache*8;++i) {
+        _cached_read(file, cold++, buf, BCACHE_HINT_ONCE);
+    }
+    nhit = 0;
+    for (i=0;i<nhot;++i) {
+        nhit += _cached_read(file, i, buf, BCACHE_HINT_NORMAL);
+    }
+    TEST_CHK(nhit == nhot);
+
+#ifdef __BCACHE_2Q
+    // fill the cache so that hot blocks are evicted from A1in ..
+    for (i=0;i<ncache;++i) {
+        _cached_read(file, cold++, buf, BCACHE_HINT_NORMAL);
+    }
+    // .. and re-reference them, so that they are promoted to Am
+    for (i=0;i<nhot;++i) {
+        _cached_read(file, i, buf, BCACHE_HINT_NORMAL);
+    }
+
+    // even a normal scan larger than the cache
+    // should not evict hot blocks
+    for (i=0;i<ncache*8;++i) {
+        _cached_read(file, cold++, buf, BCACHE_HINT_NORMAL);
+    }
+    nhit = 0;
+    for (i=0;i<nhot;++i) {
+        nhit += _cached_read(file, i, buf, BCACHE_HINT_NORMAL);
+    }
+    TEST_CHK(nhit == nhot);
+
+    // evict another set of blocks from A1in, and close the file
+    for (i=0;i<nhot;++i) {
+        _cached_read(file, 2000 + i, buf, BCACHE_HINT_NORMAL);
+    }
+    for (i=0;i<ncache;++i) {
+        _cached_read(file, cold++, buf, BCACHE_HINT_NORMAL);
+    }
+    filemgr_close(file, true, NULL, NULL);
+
+    // the blocks of the re-opened file should not be promoted to Am
+    // by the history of the closed one
+    result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+    for (i=0;i<nhot;++i) {
+        _cached_read(file, 2000 + i, buf, BCACHE_HINT_NORMAL);
+    }
+    for (i=0;i<ncache*8;++i) {
+        _cached_read(file, cold++, buf, BCACHE_HINT_NORMAL);
+    }
+    nhit = 0;
+    for (i=0;i<nhot;++i) {
+        nhit += _cached_read(file, 2000 + i, buf, BCACHE_HINT_NORMAL);
+    }
+    TEST_CHK(nhit == 0);
+#endif
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    free(buf);
+
+    memleak_end();
+    TEST_RESULT("scan resistance test");
+}
+
+void index_reservation_test()
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    struct bcache_stats stats;
+    int i, r, nhit;
+    int nindex = 16, ncache = 128;
+    uint8_t *buf;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+
+    memleak_start();
+
+    buf = (uint8_t *)malloc(4096);
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = ncache;
+    config.index_cache_ratio = 25;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    // index nodes: 0 ~ NINDEX-1
+    memset(buf, 0, 4096);
+    buf[4095] = BLK_MARKER_BNODE;
+    for (i=0;i<nindex;++i) {
+        bcache_write(file, i, buf, BCACHE_REQ_CLEAN, BCACHE_HINT_NORMAL);
+    }
+
+    // a lot of document blocks cannot evict index nodes
+    buf[4095] = BLK_MARKER_DOC;
+    for (i=1000;i<1000+ncache*8;++i) {
+        bcache_write(file, i, buf, BCACHE_REQ_CLEAN, BCACHE_HINT_NORMAL);
+    }
+    nhit = 0;
+    for (i=0;i<nindex;++i) {
+        nhit += (bcache_read(file, i, buf, BCACHE_HINT_NORMAL) > 0);
+    }
+    TEST_CHK(nhit == nindex);
+
+    bcache_get_stats(&stats);
+    TEST_CHK(stats.nblock == (uint64_t)ncache);
+    TEST_CHK(stats.index_ratio == 25);
+    TEST_CHK(stats.nindex_reserved == (uint64_t)ncache / 4);
+    TEST_CHK(stats.nindex == (uint64_t)nindex);
+    TEST_CHK(stats.ndata + stats.nindex + stats.nfree == (uint64_t)ncache);
+    TEST_CHK(stats.nindex_evict == 0);
+    TEST_CHK(stats.ndata_evict > 0);
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    free(buf);
+
+    memleak_end();
+    TEST_RESULT("index reservation test");
+}
+
+void nodecache_ratio_test()
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    struct bcache_stats stats;
+    struct nodecache_reader reader;
+    int i, r;
+    int ncache = 128;
+    uint8_t *buf;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+
+    memleak_start();
+
+    buf = (uint8_t *)malloc(4096);
+    memset(buf, 0, 4096);
+
+    // the node cache takes its share out of the buffer cache
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = ncache;
+    config.nodecache_ratio = 25;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    bcache_get_stats(&stats);
+    TEST_CHK(stats.nblock == (uint64_t)ncache * 3 / 4);
+
+    nodecache_reader_register(&reader);
+    for (i=0;i<ncache;++i) {
+        TEST_CHK(nodecache_insert(&reader, file, i, buf, NULL, NULL) != NULL);
+        nodecache_read_end(&reader);
+    }
+    TEST_CHK(nodecache_get_num_blocks() == (uint64_t)ncache / 4);
+    nodecache_reader_unregister(&reader);
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+
+    // no node cache without the buffer cache
+    config.ncacheblock = 0;
+    result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    nodecache_reader_register(&reader);
+    TEST_CHK(nodecache_insert(&reader, file, 0, buf, NULL, NULL) == NULL);
+    nodecache_reader_unregister(&reader);
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    free(buf);
+
+    memleak_end();
+    TEST_RESULT("node cache ratio test");
+}
+
+void flusher_test()
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    struct bcache_stats stats;
+    int i, r;
+    int ncache = 64, ndirty = 60;
+    uint8_t *buf;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+
+    memleak_start();
+
+    buf = (uint8_t *)malloc(4096);
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = ncache;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    for (i=0;i<ndirty;++i) {
+        memset(buf, i, 4096);
+        bcache_write(file, i, buf, BCACHE_REQ_DIRTY, BCACHE_HINT_NORMAL);
+    }
+
+#ifdef __BCACHE_FLUSHER
+    // writers are throttled above the high watermark
+    bcache_get_stats(&stats);
+    TEST_CHK(stats.ndirty <=
+             (uint64_t)ncache * BCACHE_FLUSHER_HIGH_WATERMARK / 100 + 1);
+
+    // the flusher writes back dirty blocks in the background
+    // until the low watermark is satisfied
+    for (i=0;i<100;++i) {
+        bcache_get_stats(&stats);
+        if (stats.ndirty <=
+            (uint64_t)ncache * (100 - BCACHE_FLUSHER_LOW_WATERMARK) / 100) {
+            break;
+        }
+        usleep(10000);
+    }
+    TEST_CHK(stats.ndirty <=
+             (uint64_t)ncache * (100 - BCACHE_FLUSHER_LOW_WATERMARK) / 100);
+
+    // blocks are written in BID order .. the first block is on disk
+    memset(buf, 0xff, 4096);
+    r = file->ops->pread(file->fd, buf, 4096, 0);
+    TEST_CHK(r == 4096);
+    TEST_CHK(buf[0] == 0 && buf[4095] == 0);
+#endif
+
+    bcache_flush(file);
+    bcache_get_stats(&stats);
+    TEST_CHK(stats.ndirty == 0);
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    free(buf);
+
+    memleak_end();
+    TEST_RESULT("flusher test");
+}
+
+void writeback_test()
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    struct bcache_stats stats;
+    int i, r;
+    int ncache = 64;
+    // two runs of consecutive blocks with a hole in between
+    bid_t bids[] = {0, 1, 2, 3, 4, 5, 6, 7, 12, 13, 14, 15};
+    int nbids = sizeof(bids) / sizeof(bid_t);
+    uint8_t *buf;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+
+    memleak_start();
+
+    buf = (uint8_t *)malloc(4096);
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = ncache;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    // the hole is filled with 0xff
+    memset(buf, 0xff, 4096);
+    for (i=8;i<12;++i) {
+        r = file->ops->pwrite(file->fd, buf, 4096, i * 4096);
+        TEST_CHK(r == 4096);
+    }
+
+    // write in the reverse order; blocks are flushed in BID order
+    for (i=nbids-1;i>=0;--i) {
+        memset(buf, bids[i], 4096);
+        bcache_write(file, bids[i], buf, BCACHE_REQ_DIRTY, BCACHE_HINT_NORMAL);
+    }
+    bcache_flush(file);
+    bcache_get_stats(&stats);
+    TEST_CHK(stats.ndirty == 0);
+
+    // check the on-disk image
+    for (i=0;i<nbids;++i) {
+        memset(buf, 0xff, 4096);
+        r = file->ops->pread(file->fd, buf, 4096, bids[i] * 4096);
+        TEST_CHK(r == 4096);
+        TEST_CHK(buf[0] == bids[i] && buf[4095] == bids[i]);
+    }
+    for (i=8;i<12;++i) {
+        r = file->ops->pread(file->fd, buf, 4096, i * 4096);
+        TEST_CHK(r == 4096);
+        TEST_CHK(buf[0] == 0xff && buf[4095] == 0xff);
+    }
+
+    // flushed blocks remain in the cache as clean blocks
+    r = bcache_read(file, 13, buf, BCACHE_HINT_NORMAL);
+    TEST_CHK(r == 4096);
+    TEST_CHK(buf[0] == 13);
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    free(buf);
+
+    memleak_end();
+    TEST_RESULT("writeback test");
+}
+
+struct scan_args {
+    struct filemgr *file;
+    size_t nblocks;
+    size_t time_ms;
+    uint64_t nops;
+};
+
+void * reader(void *voidargs)
+{
+    struct scan_args *args = (struct scan_args*)voidargs;
+    uint8_t *buf = (uint8_t *)malloc(args->file->blocksize);
+    struct timeval ts_begin, ts_cur, ts_gap;
+    uint32_t seed = (uint32_t)(size_t)voidargs;
+    uint64_t count = 0;
+    bid_t bid;
+    int ret;
+    TEST_INIT();
+
+    gettimeofday(&ts_begin, NULL);
+    while (1) {
+        seed = seed * 1103515245 + 12345;
+        bid = (seed >> 8) % args->nblocks;
+        ret = bcache_read(args->file, bid, buf, BCACHE_HINT_NORMAL);
+        TEST_CHK(ret == (int)args->file->blocksize);
+        count++;
+
+        if ((count & 0xff) == 0) {
+            gettimeofday(&ts_cur, NULL);
+            ts_gap = _utime_gap(ts_begin, ts_cur);
+            if ((size_t)(ts_gap.tv_sec * 1000 + ts_gap.tv_usec / 1000) >=
+                args->time_ms) {
+                break;
+            }
+        }
+    }
+    args->nops = count;
+
+    free(buf);
+    thread_exit(0);
+    return NULL;
+}
+
+void multi_thread_scaling_test(int nblocks, int time_ms, int max_threads)
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    struct bcache_stats stats;
+    int i, n, r;
+    uint64_t total, nglobal_lock;
+    uint8_t *buf;
+    char *fname = (char *) "./dummy";
+    thread_t *tid = alca(thread_t, max_threads);
+    struct scan_args *args = alca(struct scan_args, max_threads);
+    void *ret;
+
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+
+    memleak_start();
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = nblocks * 2;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+
+    // load all blocks into the cache
+    buf = (uint8_t *)malloc(4096);
+    memset(buf, 0, 4096);
+    for (i=0;i<nblocks;++i) {
+        filemgr_alloc(file, NULL);
+        memcpy(buf, &i, sizeof(i));
+        filemgr_write(file, i, buf, NULL);
+    }
+    filemgr_commit(file, NULL);
+
+    // read-only workload that always hits the cache;
+    // throughput depends on the number of cores, so it is only printed,
+    // but the readers must never take a global lock
+    bcache_get_stats(&stats);
+    nglobal_lock = stats.nglobal_lock;
+    for (n=1;n<=max_threads;n*=2) {
+        for (i=0;i<n;++i) {
+            args[i].file = file;
+            args[i].nblocks = nblocks;
+            args[i].time_ms = time_ms;
+            args[i].nops = 0;
+            thread_create(&tid[i], reader, &args[i]);
+        }
+        total = 0;
+        for (i=0;i<n;++i) {
+            thread_join(tid[i], &ret);
+            total += args[i].nops;
+        }
+        fprintf(stderr, "%2d reader thread(s): %" _F64 " reads/sec\n",
+                n, total * 1000 / time_ms);
+        TEST_CHK(total > 0);
+        bcache_get_stats(&stats);
+        TEST_CHK(stats.nglobal_lock == nglobal_lock);
+    }
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    free(buf);
+
+    memleak_end();
+    TEST_RESULT("multi thread scaling test");
+}
+
 int main()
 {
     basic_test2();
     multi_thread_test(4, 1, 32, 20, 1, 7);
+    pin_test();
+    pin_close_test();
+    scan_resistance_test();
+    index_reservation_test();
+    nodecache_ratio_test();
+    flusher_test();
+    writeback_test();
+    multi_thread_scaling_test(4096, 1000, 16);
 
     return 0;
 }
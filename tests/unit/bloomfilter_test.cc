@@ -0,0 +1,223 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "bloomfilter.h"
+
+#include "memleak.h"
+
+// images are kept in memory, and their offsets are indexes
+#define MAX_IMAGES (256)
+struct image_store {
+    void *bufs[MAX_IMAGES];
+    size_t lens[MAX_IMAGES];
+    int n;
+};
+
+static uint64_t _write_image(void *ctx, void *buf, size_t len)
+{
+    struct image_store *store = (struct image_store *)ctx;
+    if (store->n == MAX_IMAGES) {
+        return BLK_NOT_FOUND;
+    }
+    store->bufs[store->n] = malloc(len);
+    memcpy(store->bufs[store->n], buf, len);
+    store->lens[store->n] = len;
+    return store->n++;
+}
+
+static int _read_image(void *ctx, uint64_t offset, void **buf, size_t *len)
+{
+    struct image_store *store = (struct image_store *)ctx;
+    if (offset >= (uint64_t)store->n) {
+        return -1;
+    }
+    *buf = malloc(store->lens[offset]);
+    memcpy(*buf, store->bufs[offset], store->lens[offset]);
+    *len = store->lens[offset];
+    return 0;
+}
+
+static void _free_images(struct image_store *store)
+{
+    int i;
+    for (i=0;i<store->n;++i){
+        free(store->bufs[i]);
+    }
+    store->n = 0;
+}
+
+static int _make_key(char *buf, const char *prefix, int i)
+{
+    return sprintf(buf, "%s%08d", prefix, i);
+}
+
+void basic_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, len, nfp = 0;
+    int n = 100000;
+    char key[256];
+    struct bloomfilter *bf;
+
+    // the filter grows from the minimum capacity
+    bf = bloomfilter_create(10, 0);
+    for (i=0;i<n;++i){
+        len = _make_key(key, "key", i);
+        bloomfilter_add(bf, key, len);
+    }
+    TEST_CHK(bloomfilter_get_num_keys(bf) == (uint64_t)n);
+    TEST_CHK(bf->nslices > 1);
+
+    // no false negative
+    for (i=0;i<n;++i){
+        len = _make_key(key, "key", i);
+        TEST_CHK(bloomfilter_may_contain(bf, key, len));
+    }
+    for (i=0;i<n;++i){
+        len = _make_key(key, "missing", i);
+        if (bloomfilter_may_contain(bf, key, len)) {
+            nfp++;
+        }
+    }
+    // about 1% per slice with 10 bits per key
+    TEST_CHK(nfp < n / 10);
+    TEST_CHK(bf->nlookups.value.val_64 == (uint64_t)n * 2);
+    TEST_CHK(bf->nnegatives.value.val_64 == (uint64_t)(n - nfp));
+    bloomfilter_free(bf);
+
+    // a filter sized in advance has a single slice
+    nfp = 0;
+    bf = bloomfilter_create(10, n);
+    for (i=0;i<n;++i){
+        len = _make_key(key, "key", i);
+        bloomfilter_add(bf, key, len);
+    }
+    TEST_CHK(bf->nslices == 1);
+    for (i=0;i<n;++i){
+        len = _make_key(key, "missing", i);
+        if (bloomfilter_may_contain(bf, key, len)) {
+            nfp++;
+        }
+    }
+    TEST_CHK(nfp < n / 50);
+    bloomfilter_free(bf);
+
+    memleak_end();
+
+    TEST_RESULT("basic test");
+}
+
+void persist_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, j, len, nkeys = 0;
+    char key[256];
+    uint64_t offset, prev_offset;
+    struct bloomfilter *bf, *bf2;
+    struct image_store store;
+
+    store.n = 0;
+    bf = bloomfilter_create(10, 100000);
+
+    // the first image is a full one
+    offset = bloomfilter_persist(bf, _write_image, &store);
+    TEST_CHK(offset == 0);
+    // nothing to write
+    TEST_CHK(bloomfilter_persist(bf, _write_image, &store) == offset);
+    TEST_CHK(store.n == 1);
+
+    // small commits are written as the keys added since the previous ones
+    for (i=0;i<100;++i){
+        for (j=0;j<10;++j){
+            len = _make_key(key, "key", nkeys++);
+            bloomfilter_add(bf, key, len);
+        }
+        prev_offset = offset;
+        offset = bloomfilter_persist(bf, _write_image, &store);
+        TEST_CHK(offset == prev_offset + 1);
+        TEST_CHK(store.lens[offset] < 64 * 1024);
+        // images are merged, so only a few images have to be read
+        TEST_CHK(bf->nruns < 10);
+    }
+
+    bf2 = bloomfilter_load(_read_image, &store, offset);
+    TEST_CHK(bf2 != NULL);
+    TEST_CHK(bloomfilter_get_num_keys(bf2) == (uint64_t)nkeys);
+    for (i=0;i<nkeys;++i){
+        len = _make_key(key, "key", i);
+        TEST_CHK(bloomfilter_may_contain(bf2, key, len));
+    }
+
+    // the loaded filter continues from the same images
+    for (j=0;j<10;++j){
+        len = _make_key(key, "key", nkeys++);
+        bloomfilter_add(bf2, key, len);
+    }
+    offset = bloomfilter_persist(bf2, _write_image, &store);
+    bloomfilter_free(bf2);
+    bf2 = bloomfilter_load(_read_image, &store, offset);
+    TEST_CHK(bf2 != NULL);
+    for (i=0;i<nkeys;++i){
+        len = _make_key(key, "key", i);
+        TEST_CHK(bloomfilter_may_contain(bf2, key, len));
+    }
+    bloomfilter_free(bf2);
+
+    // a large number of keys makes the whole filter written again
+    for (i=0;i<50000;++i){
+        len = _make_key(key, "key", nkeys++);
+        bloomfilter_add(bf, key, len);
+    }
+    prev_offset = bloomfilter_persist(bf, _write_image, &store);
+    TEST_CHK(bf->nruns == 0);
+    TEST_CHK(bf->base_offset == prev_offset);
+    bf2 = bloomfilter_load(_read_image, &store, prev_offset);
+    TEST_CHK(bf2 != NULL);
+    TEST_CHK(bloomfilter_get_num_keys(bf2) == bloomfilter_get_num_keys(bf));
+    bloomfilter_free(bf2);
+
+    // corrupted images are not used
+    TEST_CHK(bloomfilter_load(_read_image, &store, store.n) == NULL);
+    memset(store.bufs[offset], 0xff, store.lens[offset]);
+    TEST_CHK(bloomfilter_load(_read_image, &store, offset) == NULL);
+
+    bloomfilter_free(bf);
+    _free_images(&store);
+
+    memleak_end();
+
+    TEST_RESULT("persist test");
+}
+
+int main()
+{
+    basic_test();
+    persist_test();
+
+    return 0;
+}
@@ -874,6 +874,74 @@ void kv_bid_to_value_to_bid_test(btree_kv_ops *kv_ops)
 }
 
 
+// reference: index of the largest key equal to or smaller than KEY
+idx_t _find_idx_linear(struct bnode *node, size_t kvsize, void *key)
+{
+    idx_t i;
+    for (i=0; i<node->nentry; ++i){
+        if (memcmp((uint8_t *)node->data + i * kvsize, key, 8) > 0) {
+            break;
+        }
+    }
+    return (i)?(i-1):(BTREE_IDX_NOT_FOUND);
+}
+
+/*
+ * Test: kv_find_idx_test
+ *
+ * verifies that the specialized search for 8-byte binary keys returns the
+ * same index as the linear search, for every node size and for keys before,
+ * on, between, and after the keys in the node
+ */
+void kv_find_idx_test(uint8_t vsize)
+{
+    TEST_INIT();
+    memleak_start();
+
+    btree_kv_ops *kv_ops = btree_kv_get_kb64_vb64(NULL);
+    size_t kvsize = 8 + vsize;
+    idx_t i, n, max_nentry = FDB_BLOCKSIZE / kvsize;
+    uint64_t k, q, ends[] = {0, 1, 0x7fffffffffffffffULL,
+                             0x8000000000000000ULL, (uint64_t)-1};
+    size_t j;
+    bnode *node = dummy_node(8, vsize, 1);
+    char msg[64];
+
+    TEST_CHK(kv_ops->find_idx != NULL);
+    for (n=0; n<=max_nentry; ++n){
+        node->nentry = n;
+        // sorted keys with random gaps, spanning the sign bit
+        k = 0x7fffffffffffff00ULL - n * 3;
+        for (i=0; i<n; ++i){
+            k += 2 + (rand() % 5);
+            q = _endian_encode(k);
+            memcpy((uint8_t *)node->data + i * kvsize, &q, 8);
+            memset((uint8_t *)node->data + i * kvsize + 8, 0xff, vsize);
+        }
+        for (i=0; i<n; ++i){
+            memcpy(&k, (uint8_t *)node->data + i * kvsize, 8);
+            k = _endian_decode(k);
+            for (q=k-1; q!=k+2; ++q){
+                uint64_t key = _endian_encode(q);
+                TEST_CHK(kv_ops->find_idx(node, &key) ==
+                         _find_idx_linear(node, kvsize, &key));
+            }
+        }
+        for (j=0; j<sizeof(ends)/sizeof(ends[0]); ++j){
+            uint64_t key = _endian_encode(ends[j]);
+            TEST_CHK(kv_ops->find_idx(node, &key) ==
+                     _find_idx_linear(node, kvsize, &key));
+        }
+    }
+
+    free(node);
+    free(kv_ops);
+    memleak_end();
+    sprintf(msg, "kv_find_idx_test (value size %d)", (int)vsize);
+    TEST_RESULT(msg);
+}
+
+
 int main()
 {
     int i;
@@ -917,5 +985,8 @@ int main()
         kv_bid_to_value_to_bid_test(ops[i]);
     }
 
+    kv_find_idx_test(8);
+    kv_find_idx_test(16);
+
     return 0;
 }
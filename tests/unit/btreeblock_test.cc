@@ -746,6 +746,458 @@ void btree_reverse_iterator_test()
     TEST_RESULT("btree reverse iterator test");
 }
 
+void btree_bulk_load_test()
+{
+    TEST_INIT();
+
+    int ksize = 8, vsize = 8, r, c, f;
+    int nodesize = 256;
+    int n = 10000;
+    uint8_t fill_factors[] = {100, 50};
+    struct filemgr *file;
+    struct btreeblk_handle bhandle;
+    struct btree btree;
+    struct btree_bulk bulk;
+    struct btree_iterator bi;
+    struct btree_meta meta;
+    struct filemgr_config config;
+    struct btree_kv_ops *kv_ops;
+    btree_result br;
+    filemgr_open_result fr;
+    uint64_t i;
+    uint64_t k,v;
+    char metabuf[64];
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL" dummy");
+    (void)r;
+
+    memleak_start();
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = nodesize;
+    config.options = FILEMGR_CREATE;
+    fr = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = fr.file;
+
+    btreeblk_init(&bhandle, file, nodesize);
+    kv_ops = btree_kv_get_kb64_vb64(NULL);
+
+    for (f=0;f<2;++f){
+        btree_bulk_init(&bulk, &btree, (void*)&bhandle,
+                        btreeblk_get_ops(), kv_ops,
+                        nodesize, ksize, vsize, 0x0, fill_factors[f]);
+        for (i=0;i<(uint64_t)n;++i) {
+            k = _endian_encode(i*0x10);
+            v = _endian_encode(i*0x100);
+            br = btree_bulk_add(&bulk, (void*)&k, (void*)&v);
+            TEST_CHK(br == BTREE_RESULT_SUCCESS);
+        }
+        // keys should be given in ascending order
+        k = _endian_encode((uint64_t)0x10);
+        br = btree_bulk_add(&bulk, (void*)&k, (void*)&v);
+        TEST_CHK(br == BTREE_RESULT_FAIL);
+
+        sprintf(metabuf, "bulk_meta_%d", f);
+        meta.size = strlen(metabuf) + 1;
+        meta.data = metabuf;
+        br = btree_bulk_finish(&bulk, &meta);
+        TEST_CHK(br == BTREE_RESULT_SUCCESS);
+        btreeblk_end(&bhandle);
+        TEST_CHK(btree.root_bid != BLK_NOT_FOUND);
+        TEST_CHK(btree.height > 1);
+
+        memset(metabuf, 0, sizeof(metabuf));
+        TEST_CHK(btree_read_meta(&btree, metabuf) == meta.size);
+        c = atoi(metabuf + strlen("bulk_meta_"));
+        TEST_CHK(c == f);
+
+        for (i=0;i<(uint64_t)n;++i) {
+            k = _endian_encode(i*0x10);
+            br = btree_find(&btree, (void*)&k, (void*)&v);
+            btreeblk_end(&bhandle);
+            TEST_CHK(br == BTREE_RESULT_SUCCESS);
+            TEST_CHK(_endian_decode(v) == i*0x100);
+        }
+
+        c = 0;
+        btree_iterator_init(&btree, &bi, NULL);
+        while ((br=btree_next(&bi, &k, &v)) == BTREE_RESULT_SUCCESS) {
+            btreeblk_end(&bhandle);
+            k = _endian_decode(k);
+            v = _endian_decode(v);
+            TEST_CHK(k == (uint64_t)c*0x10);
+            TEST_CHK(v == (uint64_t)c*0x100);
+            c++;
+        }
+        btreeblk_end(&bhandle);
+        btree_iterator_free(&bi);
+        TEST_CHK(c == n);
+
+        // bulk loaded tree can be modified as usual
+        for (i=0;i<(uint64_t)n;++i) {
+            k = _endian_encode(i*0x10 + 0x8);
+            v = _endian_encode(i);
+            btree_insert(&btree, (void*)&k, (void*)&v);
+            btreeblk_end(&bhandle);
+        }
+        for (i=0;i<(uint64_t)n;i+=2) {
+            k = _endian_encode(i*0x10);
+            btree_remove(&btree, (void*)&k);
+            btreeblk_end(&bhandle);
+        }
+        c = 0;
+        btree_iterator_init(&btree, &bi, NULL);
+        while ((br=btree_next(&bi, &k, &v)) == BTREE_RESULT_SUCCESS) {
+            btreeblk_end(&bhandle);
+            c++;
+        }
+        btreeblk_end(&bhandle);
+        btree_iterator_free(&bi);
+        TEST_CHK(c == n + n/2);
+    }
+
+    // empty tree
+    btree_bulk_init(&bulk, &btree, (void*)&bhandle,
+                    btreeblk_get_ops(), kv_ops,
+                    nodesize, ksize, vsize, 0x0, 100);
+    br = btree_bulk_finish(&bulk, NULL);
+    TEST_CHK(br == BTREE_RESULT_SUCCESS);
+    btreeblk_end(&bhandle);
+    k = _endian_encode((uint64_t)0x10);
+    br = btree_find(&btree, (void*)&k, (void*)&v);
+    TEST_CHK(br == BTREE_RESULT_FAIL);
+    v = k;
+    btree_insert(&btree, (void*)&k, (void*)&v);
+    btreeblk_end(&bhandle);
+    br = btree_find(&btree, (void*)&k, (void*)&v);
+    TEST_CHK(br == BTREE_RESULT_SUCCESS);
+
+    free(kv_ops);
+    btreeblk_free(&bhandle);
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+
+    memleak_end();
+
+    TEST_RESULT("btree bulk load test");
+}
+
+// convert the node headers in the file into the former big-endian format
+static int _convert_nodes_to_be(const char *fname, size_t blocksize,
+                                int *nle_out)
+{
+    FILE *fp = fopen(fname, "r+b");
+    uint8_t *buf = (uint8_t *)malloc(blocksize);
+    struct bnode *node = (struct bnode *)buf;
+    uint32_t crc;
+    long pos;
+    int nnodes = 0;
+
+    *nle_out = 0;
+    for (pos = 0; fread(buf, blocksize, 1, fp) == 1; pos += blocksize) {
+        if (buf[blocksize-1] != BLK_MARKER_BNODE) {
+            continue;
+        }
+        nnodes++;
+        if (!(buf[2] & BNODE_MASK_LE)) {
+            continue;
+        }
+        (*nle_out)++;
+        node->kvsize = _endian_encode(_endian_decode_le(node->kvsize));
+        node->flag = _endian_decode_le(node->flag) & ~BNODE_MASK_LE;
+        node->flag = _endian_encode(node->flag);
+        node->level = _endian_encode(_endian_decode_le(node->level));
+        node->nentry = _endian_encode(_endian_decode_le(node->nentry));
+        memset(buf + BTREE_CRC_OFFSET, 0xff, BTREE_CRC_FIELD_LEN);
+        crc = chksum(buf, blocksize);
+        crc = _endian_encode(crc);
+        memcpy(buf + BTREE_CRC_OFFSET, &crc, sizeof(crc));
+
+        fseek(fp, pos, SEEK_SET);
+        fwrite(buf, blocksize, 1, fp);
+        fseek(fp, pos + blocksize, SEEK_SET);
+    }
+    fclose(fp);
+    free(buf);
+    return nnodes;
+}
+
+// DB header with the root BID (and its CRC, as in fdb header)
+static void _update_header(struct filemgr *file, bid_t root_bid)
+{
+    uint8_t buf[sizeof(bid_t) + sizeof(uint32_t)];
+    uint32_t crc;
+
+    memcpy(buf, &root_bid, sizeof(bid_t));
+    crc = chksum(buf, sizeof(bid_t));
+    crc = _endian_encode(crc);
+    memcpy(buf + sizeof(bid_t), &crc, sizeof(crc));
+    filemgr_update_header(file, buf, sizeof(buf));
+}
+
+// nodes written in the former big-endian header format should be readable,
+// and the nodes rewritten by updates should use the little-endian format.
+void node_format_test()
+{
+    TEST_INIT();
+
+    int ksize = 8, vsize = 8, r, round, nnodes, nle;
+    int nodesize = 4096;
+    int n = 3000;
+    struct filemgr *file;
+    struct btreeblk_handle bhandle;
+    struct btree btree;
+    struct filemgr_config config;
+    struct btree_kv_ops *kv_ops;
+    struct btree_blk_ops blk_ops;
+    btree_result br;
+    filemgr_open_result fr;
+    bid_t root_bid;
+    uint64_t i, k, v;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL" dummy");
+    (void)r;
+
+    memleak_start();
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = nodesize;
+    config.ncacheblock = 0;
+    config.options = FILEMGR_CREATE;
+    kv_ops = btree_kv_get_kb64_vb64(NULL);
+    // a single node per block
+    blk_ops = *btreeblk_get_ops();
+    blk_ops.blk_alloc_sub = NULL;
+    blk_ops.blk_enlarge_node = NULL;
+
+    fr = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = fr.file;
+    btreeblk_init(&bhandle, file, nodesize);
+    btree_init(&btree, (void*)&bhandle, &blk_ops, kv_ops,
+               nodesize, ksize, vsize, 0x0, NULL);
+    for (i=0;i<(uint64_t)n;++i){
+        k = _endian_encode(i*2);
+        v = _endian_encode(i);
+        btree_insert(&btree, (void*)&k, (void*)&v);
+        btreeblk_end(&bhandle);
+    }
+    root_bid = btree.root_bid;
+    _update_header(file, root_bid);
+    filemgr_commit(file, NULL);
+    btreeblk_free(&bhandle);
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+
+    for (round=0;round<2;++round){
+        // all nodes are written in the little-endian format
+        nnodes = _convert_nodes_to_be(fname, nodesize, &nle);
+        TEST_CHK(nnodes > 1);
+        TEST_CHK(nle > 0);
+
+        fr = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+        file = fr.file;
+        btreeblk_init(&bhandle, file, nodesize);
+        btree_init_from_bid(&btree, (void*)&bhandle, &blk_ops, kv_ops,
+                            nodesize, root_bid);
+        TEST_CHK(btree.height > 1);
+        for (i=0;i<(uint64_t)n;++i){
+            k = _endian_encode(i*2);
+            br = btree_find(&btree, (void*)&k, (void*)&v);
+            btreeblk_end(&bhandle);
+            TEST_CHK(br == BTREE_RESULT_SUCCESS);
+            TEST_CHK(_endian_decode(v) == i + round);
+        }
+        // update all keys .. nodes are moved to new blocks
+        for (i=0;i<(uint64_t)n;++i){
+            k = _endian_encode(i*2);
+            v = _endian_encode(i + round + 1);
+            btree_insert(&btree, (void*)&k, (void*)&v);
+            btreeblk_end(&bhandle);
+        }
+        root_bid = btree.root_bid;
+        _update_header(file, root_bid);
+        filemgr_commit(file, NULL);
+        btreeblk_free(&bhandle);
+        filemgr_close(file, true, NULL, NULL);
+        filemgr_shutdown();
+    }
+
+    free(kv_ops);
+    r = system(SHELL_DEL" dummy");
+    (void)r;
+
+    memleak_end();
+
+    TEST_RESULT("node format test");
+}
+
+// insert and find random keys through the generic kv_ops (i.e., function
+// pointer calls for each entry) and through the entry operations specialized
+// for the key size, and compare their throughput.
+void btree_kv_ops_bench(int ksize, int n)
+{
+    TEST_INIT();
+
+    int r, m, j;
+    int vsize = 8;
+    int nodesize = 4096;
+    struct filemgr *file;
+    struct btreeblk_handle bhandle;
+    struct btree btree;
+    struct filemgr_config config;
+    struct btree_kv_ops *kv_ops, *kv_ops_generic, *ops;
+    struct timeval ts_begin, ts_insert, ts_find;
+    btree_cmp_args cmp_args;
+    btree_result br;
+    filemgr_open_result fr;
+    uint64_t i, v;
+    uint8_t *keys = (uint8_t *)malloc(ksize * n);
+    const char *mode[] = {"generic", "specialized"};
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL" dummy");
+    (void)r;
+
+    if (ksize == 8) {
+        kv_ops = btree_kv_get_kb64_vb64(NULL);
+    } else {
+        kv_ops = btree_kv_get_kbn_vb64(NULL);
+    }
+    // same ops without the fixed-size layout
+    kv_ops_generic = (struct btree_kv_ops *)malloc(sizeof(struct btree_kv_ops));
+    *kv_ops_generic = *kv_ops;
+    kv_ops_generic->fixed_kv = 0;
+    kv_ops_generic->find_idx = NULL;
+    cmp_args.chunksize = ksize;
+    cmp_args.aux = NULL;
+
+    for (i=0;i<(uint64_t)n;++i){
+        for (j=0;j<ksize;++j){
+            keys[i*ksize + j] = rand() & 0xff;
+        }
+    }
+
+    for (m=0;m<2;++m){
+        ops = (m == 0)?(kv_ops_generic):(kv_ops);
+
+        memset(&config, 0, sizeof(config));
+        config.blocksize = nodesize;
+        config.options = FILEMGR_CREATE;
+        fr = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+        file = fr.file;
+        btreeblk_init(&bhandle, file, nodesize);
+        btree_init(&btree, (void*)&bhandle, btreeblk_get_ops(), ops,
+                   nodesize, ksize, vsize, 0x0, NULL);
+        btree.aux = &cmp_args;
+
+        gettimeofday(&ts_begin, NULL);
+        for (i=0;i<(uint64_t)n;++i){
+            v = i;
+            btree_insert(&btree, keys + i*ksize, (void*)&v);
+            btreeblk_end(&bhandle);
+        }
+        gettimeofday(&ts_insert, NULL);
+        for (i=0;i<(uint64_t)n;++i){
+            br = btree_find(&btree, keys + i*ksize, (void*)&v);
+            btreeblk_end(&bhandle);
+            TEST_CHK(br == BTREE_RESULT_SUCCESS);
+        }
+        gettimeofday(&ts_find, NULL);
+        ts_find = _utime_gap(ts_insert, ts_find);
+        ts_insert = _utime_gap(ts_begin, ts_insert);
+
+        fprintf(stderr, "%d-byte keys, %-11s: %" _F64 " inserts/sec, "
+                "%" _F64 " finds/sec\n", ksize, mode[m],
+                (uint64_t)n * 1000000 /
+                (uint64_t)(ts_insert.tv_sec * 1000000 + ts_insert.tv_usec + 1),
+                (uint64_t)n * 1000000 /
+                (uint64_t)(ts_find.tv_sec * 1000000 + ts_find.tv_usec + 1));
+
+        btreeblk_free(&bhandle);
+        filemgr_close(file, true, NULL, NULL);
+        filemgr_shutdown();
+        r = system(SHELL_DEL" dummy");
+        (void)r;
+    }
+
+    free(keys);
+    free(kv_ops);
+    free(kv_ops_generic);
+
+    TEST_RESULT("btree kv_ops benchmark");
+}
+
+// insert 'n' random keys into a committed tree of 'n' keys, and then write
+// all the modified nodes back at once, like WAL flushing does. Every node
+// visited by the batch stays in the btreeblk lists until btreeblk_end().
+void btreeblk_flush_bench(int n)
+{
+    TEST_INIT();
+
+    int r;
+    int ksize = 8, vsize = 8;
+    int nodesize = 4096;
+    struct filemgr *file;
+    struct btreeblk_handle bhandle;
+    struct btree btree;
+    struct filemgr_config config;
+    struct btree_kv_ops *kv_ops;
+    struct timeval ts_begin, ts_flush;
+    btree_result br;
+    filemgr_open_result fr;
+    uint64_t i, k, v;
+    char *fname = (char *) "./dummy";
+
+    r = system(SHELL_DEL" dummy");
+    (void)r;
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = nodesize;
+    config.options = FILEMGR_CREATE;
+    fr = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = fr.file;
+    kv_ops = btree_kv_get_kb64_vb64(NULL);
+    btreeblk_init(&bhandle, file, nodesize);
+    btree_init(&btree, (void*)&bhandle, btreeblk_get_ops(), kv_ops,
+               nodesize, ksize, vsize, 0x0, NULL);
+
+    for (i=0;i<(uint64_t)n;++i){
+        k = ((uint64_t)rand() << 32) | rand();
+        v = i;
+        btree_insert(&btree, (void*)&k, (void*)&v);
+        btreeblk_end(&bhandle);
+    }
+    filemgr_commit(file, NULL);
+
+    gettimeofday(&ts_begin, NULL);
+    for (i=0;i<(uint64_t)n;++i){
+        k = ((uint64_t)rand() << 32) | rand();
+        v = i;
+        br = btree_insert(&btree, (void*)&k, (void*)&v);
+        TEST_CHK(br != BTREE_RESULT_FAIL);
+    }
+    btreeblk_end(&bhandle);
+    gettimeofday(&ts_flush, NULL);
+    ts_flush = _utime_gap(ts_begin, ts_flush);
+    filemgr_commit(file, NULL);
+
+    fprintf(stderr, "flush %d keys: %" _F64 " us, %" _F64 " inserts/sec\n",
+            n, (uint64_t)(ts_flush.tv_sec * 1000000 + ts_flush.tv_usec),
+            (uint64_t)n * 1000000 /
+            (uint64_t)(ts_flush.tv_sec * 1000000 + ts_flush.tv_usec + 1));
+
+    btreeblk_free(&bhandle);
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    free(kv_ops);
+    r = system(SHELL_DEL" dummy");
+    (void)r;
+
+    TEST_RESULT("btreeblk WAL flush benchmark");
+}
+
 int main()
 {
 #ifdef _MEMPOOL
@@ -758,6 +1210,12 @@ int main()
     range_test();
     subblock_test();
     btree_reverse_iterator_test();
+    btree_bulk_load_test();
+    node_format_test();
+    btree_kv_ops_bench(8, 100000);
+    btree_kv_ops_bench(16, 100000);
+    btreeblk_flush_bench(10000);
+    btreeblk_flush_bench(100000);
 
     return 0;
 }
@@ -108,6 +108,124 @@ void basic_test()
     TEST_RESULT("basic test");
 }
 
+void scan_test()
+{
+    TEST_INIT();
+
+    uint64_t offset, first, next, next_scan;
+    int i, r;
+    int n = 50;
+    int blocksize = 128;
+    uint8_t key_alloc, meta_alloc;
+    struct docio_handle handle;
+    struct filemgr *file;
+    char keybuf[1024];
+    char metabuf[1024];
+    char bodybuf[4096];
+    struct docio_object doc, rdoc, sdoc;
+    struct docio_length length;
+    struct docio_blocks blocks;
+    struct filemgr_config config;
+    char *fname = (char *) "./dummy";
+
+    handle.log_callback = NULL;
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = blocksize;
+    config.ncacheblock = 1024;
+    config.options = FILEMGR_CREATE;
+    r = system(SHELL_DEL " dummy");
+    (void)r;
+    filemgr_open_result result = filemgr_open(fname, get_filemgr_ops(), &config, NULL);
+    file = result.file;
+    docio_init(&handle, file, false);
+
+    // docs of various sizes, so that their components are split into
+    // different blocks at various positions
+    memset(&doc, 0, sizeof(doc));
+    doc.key = (void*)keybuf;
+    doc.meta = (void*)metabuf;
+    doc.body = (void*)bodybuf;
+    memset(bodybuf, 'b', sizeof(bodybuf));
+    first = BLK_NOT_FOUND;
+    for (i=0;i<n;++i){
+        memset(keybuf, 'k', 1 + (i * 7) % 200);
+        sprintf(keybuf, "key%d", i);
+        doc.length.keylen = 1 + (i * 7) % 200;
+        sprintf(metabuf, "meta%d", i);
+        doc.length.metalen = (i % 5 == 0)?(0):(strlen(metabuf));
+        doc.length.bodylen = (i * 13) % 300;
+        doc.seqnum = i;
+        offset = docio_append_doc(&handle, &doc, 0, 0);
+        if (i == 0) {
+            first = offset;
+        }
+    }
+    filemgr_commit(file, NULL);
+
+    blocks.bid = first / blocksize;
+    blocks.nblocks = filemgr_get_pos(file) / blocksize - blocks.bid;
+    blocks.buf = malloc(blocks.nblocks * blocksize);
+    r = filemgr_read_blocks(file, blocks.bid, blocks.nblocks, blocks.buf,
+                            NULL);
+    TEST_CHK(r == FDB_RESULT_SUCCESS);
+
+    // parsed docs should be the same as those read from the file
+    offset = first;
+    for (i=0;i<n;++i){
+        memset(&rdoc, 0, sizeof(rdoc));
+        next = docio_read_doc(&handle, offset, &rdoc);
+        TEST_CHK(next > offset);
+
+        next_scan = docio_scan_doc_length(&handle, &blocks, offset, &length);
+        TEST_CHK(next_scan == next);
+        TEST_CHK(length.keylen == rdoc.length.keylen);
+
+        next_scan = docio_scan_doc(&handle, &blocks, offset, &sdoc,
+                                   &key_alloc, &meta_alloc);
+        TEST_CHK(next_scan == next);
+        TEST_CHK(sdoc.length.keylen == rdoc.length.keylen);
+        TEST_CHK(sdoc.length.metalen == rdoc.length.metalen);
+        TEST_CHK(sdoc.length.bodylen == rdoc.length.bodylen);
+        TEST_CHK(sdoc.seqnum == (fdb_seqnum_t)i);
+        TEST_CHK(sdoc.body == NULL);
+        TEST_CMP(sdoc.key, rdoc.key, rdoc.length.keylen);
+        if (rdoc.length.metalen) {
+            TEST_CMP(sdoc.meta, rdoc.meta, rdoc.length.metalen);
+        }
+
+        free_docio_object(&sdoc, key_alloc, meta_alloc, 0);
+        free_docio_object(&rdoc, 1, 1, 1);
+        offset = next;
+    }
+
+    // corrupt the body of the last doc
+    bodybuf[0] = *((uint8_t *)blocks.buf +
+                   (offset - 5 - blocks.bid * blocksize));
+    *((uint8_t *)blocks.buf + (offset - 5 - blocks.bid * blocksize)) =
+        ~bodybuf[0];
+    offset = first;
+    for (i=0;i<n-1;++i){
+        offset = docio_scan_doc_length(&handle, &blocks, offset, &length);
+    }
+    next_scan = docio_scan_doc(&handle, &blocks, offset, &sdoc,
+                               &key_alloc, &meta_alloc);
+    TEST_CHK(next_scan == offset);
+    TEST_CHK(sdoc.key == NULL && !key_alloc && !meta_alloc);
+
+    // a length beyond the blocks
+    blocks.nblocks = 1;
+    next_scan = docio_scan_doc_length(&handle, &blocks, offset, &length);
+    TEST_CHK(next_scan == 0);
+
+    free(blocks.buf);
+    docio_free(&handle);
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+
+    TEST_RESULT("scan test");
+}
+
 int main()
 {
     #ifdef _MEMPOOL
@@ -116,6 +234,7 @@ int main()
 
 
     basic_test();
+    scan_test();
 
     return 0;
 }
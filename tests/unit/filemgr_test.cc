@@ -21,6 +21,7 @@
 
 #include "filemgr.h"
 #include "filemgr_ops.h"
+#include "blockcache.h"
 #include "test.h"
 
 void basic_test()
@@ -66,6 +67,113 @@ void mt_init_test()
     TEST_RESULT("multi threaded initialization test");
 }
 
+void io_backend_test(fdb_io_backend_t backend)
+{
+    TEST_INIT();
+
+    struct filemgr *file;
+    struct filemgr_config config;
+    struct filemgr_ops *ops;
+    struct filemgr_io_req reqs[32];
+    struct iovec iov[32];
+    fdb_io_backend_t selected;
+    bid_t bids[32], start_bid;
+    const char *dbheader = "dbheader";
+    void *addr;
+    uint8_t *buf, *rbuf;
+    int i, r, n = 32;
+    char msg[64];
+
+    // close files opened by the previous tests
+    filemgr_shutdown();
+    r = system(SHELL_DEL" dummy");
+    (void)r;
+
+    // use a small queue depth so that requests are split into
+    // multiple rounds of submission
+    selected = filemgr_ops_init(backend, 8);
+    TEST_CHK(backend == FDB_IO_BACKEND_IO_URING ||
+             selected == FDB_IO_BACKEND_SYNC);
+    ops = get_filemgr_ops();
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = 4096;
+    config.ncacheblock = 1024;
+    config.options = FILEMGR_CREATE | FILEMGR_SYNC;
+    filemgr_open_result result = filemgr_open((char *) "./dummy",
+                                              ops, &config, NULL);
+    file = result.file;
+    TEST_CHK(file->ops == ops);
+
+    malloc_align(addr, FDB_SECTOR_SIZE, (n+1) * 4096);
+    buf = (uint8_t *)addr;
+    rbuf = alca(uint8_t, 4096);
+
+    // gather write
+    start_bid = filemgr_alloc(file, NULL);
+    for (i=1; i<n+1; ++i) {
+        filemgr_alloc(file, NULL);
+    }
+    for (i=0; i<n; ++i) {
+        memset(buf + i*4096, i, 4096);
+        iov[i].iov_base = buf + i*4096;
+        iov[i].iov_len = 4096;
+    }
+    r = ops->pwritev(file->fd, iov, n, start_bid * 4096);
+    TEST_CHK(r == n * 4096);
+
+    // batched read (in the reverse order)
+    memset(buf, 0xff, n * 4096);
+    for (i=0; i<n; ++i) {
+        reqs[i].buf = buf + i*4096;
+        reqs[i].count = 4096;
+        reqs[i].offset = (start_bid + n - 1 - i) * 4096;
+    }
+    r = ops->pread_batch(file->fd, reqs, n);
+    TEST_CHK(r == FDB_RESULT_SUCCESS);
+    for (i=0; i<n; ++i) {
+        TEST_CHK(reqs[i].result == 4096);
+        TEST_CHK(buf[i*4096] == n - 1 - i && buf[i*4096 + 4095] == n - 1 - i);
+    }
+
+    // write & fsync
+    memset(buf + n*4096, 'x', 4096);
+    r = ops->pwrite_fsync(file->fd, buf + n*4096, 4096, (start_bid + n) * 4096);
+    TEST_CHK(r == 4096);
+    r = ops->pread(file->fd, rbuf, 4096, (start_bid + n) * 4096);
+    TEST_CHK(r == 4096 && rbuf[0] == 'x' && rbuf[4095] == 'x');
+
+    // commit (the header write is linked with fsync)
+    filemgr_update_header(file, (void*)dbheader, strlen(dbheader)+1);
+    TEST_CHK(filemgr_commit(file, NULL) == FDB_RESULT_SUCCESS);
+
+    // read committed blocks into the cache at once
+    for (i=0; i<n; ++i) {
+        bids[i] = start_bid + i;
+    }
+    TEST_CHK(filemgr_prefetch_blocks(file, bids, n, NULL) ==
+             FDB_RESULT_SUCCESS);
+    for (i=0; i<n; ++i) {
+        r = bcache_read(file, start_bid + i, rbuf, BCACHE_HINT_NORMAL);
+        TEST_CHK(r == 4096 && rbuf[0] == i && rbuf[4095] == i);
+    }
+
+    // check the header block on disk
+    r = ops->pread(file->fd, rbuf, 4096, file->header.bid * 4096);
+    TEST_CHK(r == 4096);
+    TEST_CHK(!memcmp(rbuf, dbheader, strlen(dbheader)+1));
+    TEST_CHK(rbuf[4095] == BLK_MARKER_DBHEADER);
+
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+    filemgr_ops_shutdown();
+    free_align(addr);
+
+    sprintf(msg, "I/O backend test (%s)",
+            (selected == FDB_IO_BACKEND_IO_URING)?("io_uring"):("sync"));
+    TEST_RESULT(msg);
+}
+
 int main()
 {
     int r = system(SHELL_DEL" dummy");
@@ -73,6 +181,8 @@ int main()
 
     basic_test();
     mt_init_test();
+    io_backend_test(FDB_IO_BACKEND_SYNC);
+    io_backend_test(FDB_IO_BACKEND_IO_URING);
 
     return 0;
 }
@@ -875,6 +875,422 @@ void hbtrie_partial_update_test()
     TEST_RESULT("HB+trie partial update test");
 }
 
+char **_bulk_key_ptr;
+size_t *_bulk_keylen;
+int _bulk_nkeys;
+size_t _readkey_wrap_bulk(void *handle, uint64_t offset, void *buf)
+{
+    offset = _endian_decode(offset) % _bulk_nkeys;
+    memcpy(buf, _bulk_key_ptr[offset], _bulk_keylen[offset]);
+    return _bulk_keylen[offset];
+}
+
+void hbtrie_bulk_load_test(int blocksize)
+{
+    TEST_INIT();
+
+    struct btreeblk_handle bhandle;
+    struct docio_handle dhandle;
+    struct filemgr *file;
+    struct hbtrie trie, trie_bulk;
+    struct hbtrie_bulk bulk;
+    struct hbtrie_iterator it, it_bulk;
+    struct filemgr_config config;
+    hbtrie_result hr, hr_bulk;
+    uint8_t value_buf[8];
+    char key_buf[1024], key_buf_bulk[1024];
+    char msg[64];
+    size_t keylen, keylen_bulk;
+    uint64_t offset, offset_bulk, _offset;
+    int i, n=0, rr;
+
+    memleak_start();
+
+    int nkeys = 1600;
+    char **key = alca(char *, nkeys);
+    size_t *keylens = alca(size_t, nkeys);
+    for (i=0;i<nkeys;++i){
+        key[i] = alca(char, 600);
+    }
+
+    // short keys
+    sprintf(key[n], "a"); keylens[n] = 1; n++;
+    sprintf(key[n], "ab"); keylens[n] = 2; n++;
+    // a key whose reformed key is a prefix of the next key's
+    memcpy(key[n], "12345678", 8); keylens[n] = 8; n++;
+    memcpy(key[n], "12345678\0\0\0\0\0\0\0\x08xyz", 19); keylens[n] = 19; n++;
+    // keys that share a long prefix (> HBTRIE_HEADROOM)
+    for (i=0;i<100;++i){
+        memset(key[n], 'p', 500);
+        sprintf(key[n] + 500, "%05d", i * 7);
+        keylens[n] = 505; n++;
+    }
+    // keys that diverge at different chunks
+    for (i=0;i<1000;++i){
+        sprintf(key[n], "key%06d", i * 13);
+        keylens[n] = strlen(key[n]); n++;
+    }
+    for (i=0;i<300;++i){
+        sprintf(key[n], "bbbbbbbb_bbbbbbbb_%d_suffix", i);
+        keylens[n] = strlen(key[n]); n++;
+    }
+    _bulk_key_ptr = key;
+    _bulk_keylen = keylens;
+    _bulk_nkeys = n;
+
+    rr = system(SHELL_DEL " dummy");
+    (void)rr;
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = blocksize;
+    config.ncacheblock = 0;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    config.chunksize = sizeof(uint64_t);
+
+    filemgr_open_result result = filemgr_open((char*)"./dummy",
+                                              get_filemgr_ops(), &config, NULL);
+    file = result.file;
+    docio_init(&dhandle, file, false);
+    btreeblk_init(&bhandle, file, blocksize);
+
+    // build a trie by normal insertion
+    hbtrie_init(&trie, 8, 8, blocksize, BLK_NOT_FOUND,
+        (void *)&bhandle, btreeblk_get_ops(), (void *)&dhandle,
+        _readkey_wrap_bulk);
+    for (i=0;i<n;++i){
+        offset = i;
+        _offset = _endian_encode(offset);
+        hbtrie_insert(&trie, (void *)key[i], keylens[i],
+                      (void *)&_offset, (void *)value_buf);
+        btreeblk_end(&bhandle);
+    }
+
+    // bulk load another trie in the order of the first trie
+    hbtrie_init(&trie_bulk, 8, 8, blocksize, BLK_NOT_FOUND,
+        (void *)&bhandle, btreeblk_get_ops(), (void *)&dhandle,
+        _readkey_wrap_bulk);
+    hbtrie_bulk_init(&bulk, &trie_bulk, 70);
+    hr = hbtrie_iterator_init(&trie, &it, NULL, 0);
+    i = 0;
+    while (hr == HBTRIE_RESULT_SUCCESS) {
+        hr = hbtrie_next(&it, (void*)key_buf, &keylen, (void*)&offset);
+        btreeblk_end(&bhandle);
+        if (hr != HBTRIE_RESULT_SUCCESS) break;
+        hr_bulk = hbtrie_bulk_add(&bulk, (void*)key_buf, keylen,
+                                  (void*)&offset);
+        TEST_CHK(hr_bulk == HBTRIE_RESULT_SUCCESS);
+        // duplicated or smaller key is not allowed
+        hr_bulk = hbtrie_bulk_add(&bulk, (void*)key_buf, keylen,
+                                  (void*)&offset);
+        TEST_CHK(hr_bulk == HBTRIE_RESULT_FAIL);
+        i++;
+    }
+    hbtrie_iterator_free(&it);
+    TEST_CHK(i == n);
+    hr = hbtrie_bulk_finish(&bulk);
+    TEST_CHK(hr == HBTRIE_RESULT_SUCCESS);
+    btreeblk_end(&bhandle);
+    TEST_CHK(trie_bulk.root_bid != BLK_NOT_FOUND);
+
+    // find all keys
+    for (i=0;i<n;++i){
+        hr = hbtrie_find(&trie_bulk, (void *)key[i], keylens[i],
+                         (void *)&offset);
+        btreeblk_end(&bhandle);
+        TEST_CHK(hr == HBTRIE_RESULT_SUCCESS);
+        offset = _endian_decode(offset);
+        TEST_CHK(offset == (uint64_t)i);
+    }
+
+    // both tries should return the same sequence
+    hr = hbtrie_iterator_init(&trie, &it, NULL, 0);
+    hr_bulk = hbtrie_iterator_init(&trie_bulk, &it_bulk, NULL, 0);
+    while (hr == HBTRIE_RESULT_SUCCESS) {
+        hr = hbtrie_next(&it, (void*)key_buf, &keylen, (void*)&offset);
+        hr_bulk = hbtrie_next(&it_bulk, (void*)key_buf_bulk, &keylen_bulk,
+                              (void*)&offset_bulk);
+        btreeblk_end(&bhandle);
+        TEST_CHK(hr == hr_bulk);
+        if (hr != HBTRIE_RESULT_SUCCESS) break;
+        TEST_CHK(keylen == keylen_bulk);
+        TEST_CHK(!memcmp(key_buf, key_buf_bulk, keylen));
+        TEST_CHK(offset == offset_bulk);
+    }
+    hbtrie_iterator_free(&it);
+    hbtrie_iterator_free(&it_bulk);
+
+    // the bulk loaded trie can be updated as usual
+    for (i=0;i<n;i+=3){
+        offset = n + i;
+        _offset = _endian_encode(offset);
+        hr = hbtrie_insert(&trie_bulk, (void *)key[i], keylens[i],
+                           (void *)&_offset, (void *)value_buf);
+        btreeblk_end(&bhandle);
+        TEST_CHK(hr == HBTRIE_RESULT_UPDATE);
+    }
+    for (i=0;i<n;++i){
+        hr = hbtrie_find(&trie_bulk, (void *)key[i], keylens[i],
+                         (void *)&offset);
+        btreeblk_end(&bhandle);
+        TEST_CHK(hr == HBTRIE_RESULT_SUCCESS);
+        offset = _endian_decode(offset);
+        TEST_CHK(offset == (uint64_t)((i % 3)?(i):(n + i)));
+    }
+
+    filemgr_commit(file, NULL);
+
+    hbtrie_free(&trie);
+    hbtrie_free(&trie_bulk);
+    docio_free(&dhandle);
+    btreeblk_free(&bhandle);
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+
+    memleak_end();
+
+    sprintf(msg, "HB+trie bulk load test (blocksize %d)", blocksize);
+    TEST_RESULT(msg);
+}
+
+int _batch_key_cmp(const void *a, const void *b)
+{
+    int aa = *(int*)a, bb = *(int*)b;
+    size_t keylen = MIN(_bulk_keylen[aa], _bulk_keylen[bb]);
+    int cmp = memcmp(_bulk_key_ptr[aa], _bulk_key_ptr[bb], keylen);
+    if (cmp == 0) {
+        cmp = (int)_bulk_keylen[aa] - (int)_bulk_keylen[bb];
+    }
+    return cmp;
+}
+
+// return the number of keys if both tries have the same keys and values
+int _hbtrie_cmp_tries(struct hbtrie *trie1, struct hbtrie *trie2,
+                      struct btreeblk_handle *bhandle)
+{
+    struct hbtrie_iterator it1, it2;
+    hbtrie_result hr1, hr2;
+    char key_buf1[1024], key_buf2[1024];
+    size_t keylen1, keylen2;
+    uint64_t value1, value2;
+    int n = 0;
+
+    hr1 = hbtrie_iterator_init(trie1, &it1, NULL, 0);
+    hr2 = hbtrie_iterator_init(trie2, &it2, NULL, 0);
+    while (hr1 == HBTRIE_RESULT_SUCCESS) {
+        hr1 = hbtrie_next(&it1, (void*)key_buf1, &keylen1, (void*)&value1);
+        hr2 = hbtrie_next(&it2, (void*)key_buf2, &keylen2, (void*)&value2);
+        btreeblk_end(bhandle);
+        if (hr1 != hr2) {
+            n = -1;
+            break;
+        }
+        if (hr1 != HBTRIE_RESULT_SUCCESS) break;
+        if (keylen1 != keylen2 || memcmp(key_buf1, key_buf2, keylen1) ||
+            value1 != value2) {
+            n = -1;
+            break;
+        }
+        n++;
+    }
+    hbtrie_iterator_free(&it1);
+    hbtrie_iterator_free(&it2);
+    return n;
+}
+
+void hbtrie_batch_insert_test(int blocksize)
+{
+    TEST_INIT();
+
+    struct btreeblk_handle bhandle;
+    struct docio_handle dhandle;
+    struct filemgr *file;
+    struct hbtrie trie, trie_batch;
+    struct filemgr_config config;
+    hbtrie_result hr;
+    uint8_t value_buf[8];
+    char msg[64];
+    uint64_t offset;
+    int i, n=0, m, rr;
+
+    memleak_start();
+
+    int nkeys = 1600;
+    char **key = alca(char *, nkeys);
+    size_t *keylens = alca(size_t, nkeys);
+    for (i=0;i<nkeys;++i){
+        key[i] = alca(char, 600);
+    }
+
+    // short keys
+    sprintf(key[n], "a"); keylens[n] = 1; n++;
+    sprintf(key[n], "ab"); keylens[n] = 2; n++;
+    // keys whose chunks are the same after zero padding
+    memcpy(key[n], "12345678", 8); keylens[n] = 8; n++;
+    memcpy(key[n], "12345678\0", 9); keylens[n] = 9; n++;
+    memcpy(key[n], "12345678\0\0\0\0\0\0\0\x08xyz", 19); keylens[n] = 19; n++;
+    // keys that share a long prefix (> HBTRIE_HEADROOM)
+    for (i=0;i<100;++i){
+        memset(key[n], 'p', 500);
+        sprintf(key[n] + 500, "%05d", i * 7);
+        keylens[n] = 505; n++;
+    }
+    // keys that diverge at different chunks
+    for (i=0;i<1000;++i){
+        sprintf(key[n], "key%06d", i * 13);
+        keylens[n] = strlen(key[n]); n++;
+    }
+    for (i=0;i<300;++i){
+        sprintf(key[n], "bbbbbbbb_bbbbbbbb_%d_suffix", i);
+        keylens[n] = strlen(key[n]); n++;
+    }
+    _bulk_key_ptr = key;
+    _bulk_keylen = keylens;
+    _bulk_nkeys = n;
+
+    // key indexes in sorted order
+    int *order = alca(int, n);
+    for (i=0;i<n;++i){
+        order[i] = i;
+    }
+    qsort(order, n, sizeof(int), _batch_key_cmp);
+
+    void **rawkeys = alca(void *, n);
+    int *rawkeylens = alca(int, n);
+    void **values = alca(void *, n);
+    void **old_values = alca(void *, n);
+    uint64_t *_offsets = alca(uint64_t, n);
+    uint64_t *old_offsets = alca(uint64_t, n);
+    hbtrie_result *results = alca(hbtrie_result, n);
+
+    rr = system(SHELL_DEL " dummy");
+    (void)rr;
+
+    memset(&config, 0, sizeof(config));
+    config.blocksize = blocksize;
+    config.ncacheblock = 0;
+    config.flag = 0x0;
+    config.options = FILEMGR_CREATE;
+    config.chunksize = sizeof(uint64_t);
+
+    filemgr_open_result result = filemgr_open((char*)"./dummy",
+                                              get_filemgr_ops(), &config, NULL);
+    file = result.file;
+    docio_init(&dhandle, file, false);
+    btreeblk_init(&bhandle, file, blocksize);
+
+    // the same keys are inserted into 'trie' one by one,
+    // and into 'trie_batch' by batches
+    hbtrie_init(&trie, 8, 8, blocksize, BLK_NOT_FOUND,
+        (void *)&bhandle, btreeblk_get_ops(), (void *)&dhandle,
+        _readkey_wrap_bulk);
+    hbtrie_init(&trie_batch, 8, 8, blocksize, BLK_NOT_FOUND,
+        (void *)&bhandle, btreeblk_get_ops(), (void *)&dhandle,
+        _readkey_wrap_bulk);
+
+    // 1. insert even-numbered keys in sorted order
+    for (i=0,m=0;i<n;++i){
+        if (order[i] % 2) continue;
+        rawkeys[m] = key[order[i]];
+        rawkeylens[m] = keylens[order[i]];
+        _offsets[m] = _endian_encode((uint64_t)order[i]);
+        values[m] = &_offsets[m];
+        old_values[m] = &old_offsets[m];
+        m++;
+    }
+    hr = hbtrie_insert_batch(&trie_batch, m, rawkeys, rawkeylens, values,
+                             old_values, results);
+    btreeblk_end(&bhandle);
+    TEST_CHK(hr == HBTRIE_RESULT_SUCCESS);
+    for (i=0;i<m;++i){
+        TEST_CHK(results[i] == HBTRIE_RESULT_SUCCESS);
+        hbtrie_insert(&trie, rawkeys[i], rawkeylens[i], values[i],
+                      (void *)value_buf);
+        btreeblk_end(&bhandle);
+    }
+
+    // 2. insert all keys in sorted order, in batches of different sizes
+    // (even-numbered keys are updated)
+    for (i=0;i<n;++i){
+        rawkeys[i] = key[order[i]];
+        rawkeylens[i] = keylens[order[i]];
+        _offsets[i] = _endian_encode((uint64_t)(n + order[i]));
+        values[i] = &_offsets[i];
+        old_offsets[i] = 0;
+        old_values[i] = &old_offsets[i];
+    }
+    for (i=0;i<n;i+=m){
+        m = MIN(1 + (i % 500), n - i);
+        hr = hbtrie_insert_batch(&trie_batch, m, rawkeys + i, rawkeylens + i,
+                                 values + i, old_values + i, results + i);
+        btreeblk_end(&bhandle);
+        TEST_CHK(hr == HBTRIE_RESULT_SUCCESS);
+    }
+    for (i=0;i<n;++i){
+        // the result should be the same as that of normal insertion
+        hr = hbtrie_insert(&trie, rawkeys[i], rawkeylens[i], values[i],
+                           (void *)&offset);
+        btreeblk_end(&bhandle);
+        TEST_CHK(results[i] == hr);
+        if (order[i] % 2) {
+            TEST_CHK(results[i] == HBTRIE_RESULT_SUCCESS);
+        } else if (results[i] == HBTRIE_RESULT_UPDATE) {
+            TEST_CHK(_endian_decode(old_offsets[i]) == (uint64_t)order[i]);
+            TEST_CHK(old_offsets[i] == offset);
+        }
+    }
+    TEST_CHK(_hbtrie_cmp_tries(&trie, &trie_batch, &bhandle) == n);
+
+    filemgr_commit(file, NULL);
+
+    // 3. keys in reverse order and duplicated keys are also allowed
+    for (i=0;i<n;++i){
+        rawkeys[i] = key[order[n-1-i]];
+        rawkeylens[i] = keylens[order[n-1-i]];
+        _offsets[i] = _endian_encode((uint64_t)order[n-1-i]);
+        values[i] = &_offsets[i];
+    }
+    rawkeys[1] = rawkeys[0];
+    rawkeylens[1] = rawkeylens[0];
+    _offsets[1] = _endian_encode((uint64_t)(n + order[n-1]));
+    hr = hbtrie_insert_batch(&trie_batch, n, rawkeys, rawkeylens, values,
+                             NULL, results);
+    btreeblk_end(&bhandle);
+    TEST_CHK(hr == HBTRIE_RESULT_SUCCESS);
+    for (i=0;i<n;++i){
+        hr = hbtrie_insert(&trie, rawkeys[i], rawkeylens[i], values[i],
+                           (void *)value_buf);
+        btreeblk_end(&bhandle);
+        TEST_CHK(results[i] == hr);
+    }
+    TEST_CHK(_hbtrie_cmp_tries(&trie, &trie_batch, &bhandle) == n);
+    for (i=0;i<n;++i){
+        hr = hbtrie_find(&trie_batch, (void *)key[i], keylens[i],
+                         (void *)&offset);
+        btreeblk_end(&bhandle);
+        TEST_CHK(hr == HBTRIE_RESULT_SUCCESS);
+        offset = _endian_decode(offset);
+        if (i == order[n-1] || i == order[n-2]) {
+            // overwritten by the duplicated key, or not inserted
+            TEST_CHK(offset == (uint64_t)(n + i));
+        } else {
+            TEST_CHK(offset == (uint64_t)i);
+        }
+    }
+
+    hbtrie_free(&trie);
+    hbtrie_free(&trie_batch);
+    docio_free(&dhandle);
+    btreeblk_free(&bhandle);
+    filemgr_close(file, true, NULL, NULL);
+    filemgr_shutdown();
+
+    memleak_end();
+
+    sprintf(msg, "HB+trie batch insert test (blocksize %d)", blocksize);
+    TEST_RESULT(msg);
+}
+
 int main(){
 #ifdef _MEMPOOL
     mempool_init();
@@ -885,6 +1301,12 @@ int main(){
     skew_basic_test();
     hbtrie_reverse_iterator_test();
     hbtrie_partial_update_test();
+    // long common prefix is split into a chain of b+trees
+    hbtrie_bulk_load_test(512);
+    // root nodes of sub b+trees are enlarged into larger sub-blocks
+    hbtrie_bulk_load_test(4096);
+    hbtrie_batch_insert_test(512);
+    hbtrie_batch_insert_test(4096);
     //large_test();
 
     return 0;
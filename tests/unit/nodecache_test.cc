@@ -0,0 +1,225 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "nodecache.h"
+
+#include "memleak.h"
+
+#define BLOCKSIZE (4096)
+
+// files are only used as keys
+#define FILE_PTR(i) ((struct filemgr *)(size_t)(0x1000 * ((i) + 1)))
+
+static void _fill_block(void *buf, int file_no, bid_t bid)
+{
+    uint64_t *p = (uint64_t *)buf;
+    size_t i;
+    for (i=0;i<BLOCKSIZE/sizeof(uint64_t);++i){
+        p[i] = ((uint64_t)file_no << 48) | (bid << 16) | i;
+    }
+}
+
+static int _check_block(void *buf, int file_no, bid_t bid)
+{
+    uint64_t *p = (uint64_t *)buf;
+    size_t i;
+    for (i=0;i<BLOCKSIZE/sizeof(uint64_t);++i){
+        if (p[i] != (((uint64_t)file_no << 48) | (bid << 16) | i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void _prepare(void *addr, void *ctx)
+{
+    int *count = (int *)ctx;
+    (*count)++;
+}
+
+void basic_test()
+{
+    TEST_INIT();
+
+    memleak_start();
+
+    int i, nprepare = 0;
+    uint8_t buf[BLOCKSIZE];
+    void *addr, *addr2;
+    struct nodecache_reader reader, reader2;
+
+    // readers registered before initialization do not use the cache
+    nodecache_reader_register(&reader);
+    TEST_CHK(nodecache_get(&reader, FILE_PTR(0), 0) == NULL);
+    _fill_block(buf, 0, 0);
+    TEST_CHK(nodecache_insert(&reader, FILE_PTR(0), 0, buf,
+                              NULL, NULL) == NULL);
+    nodecache_reader_unregister(&reader);
+
+    nodecache_init(16, BLOCKSIZE);
+    nodecache_reader_register(&reader);
+    nodecache_reader_register(&reader2);
+
+    for (i=0;i<8;++i){
+        _fill_block(buf, 0, i);
+        addr = nodecache_insert(&reader, FILE_PTR(0), i, buf,
+                                _prepare, &nprepare);
+        TEST_CHK(addr != NULL && addr != buf);
+        TEST_CHK(_check_block(addr, 0, i));
+    }
+    TEST_CHK(nprepare == 8);
+    TEST_CHK(nodecache_get_num_blocks() == 8);
+
+    // other readers share the same copy
+    addr = nodecache_get(&reader2, FILE_PTR(0), 3);
+    TEST_CHK(addr == nodecache_get(&reader, FILE_PTR(0), 3));
+    TEST_CHK(_check_block(addr, 0, 3));
+    TEST_CHK(nodecache_get(&reader2, FILE_PTR(1), 3) == NULL);
+
+    // inserting an existing block returns the cached one
+    _fill_block(buf, 0, 3);
+    addr2 = nodecache_insert(&reader2, FILE_PTR(0), 3, buf,
+                             _prepare, &nprepare);
+    TEST_CHK(addr2 == addr);
+    TEST_CHK(nodecache_get_num_blocks() == 8);
+
+    // the number of blocks is bounded
+    for (i=0;i<32;++i){
+        _fill_block(buf, 1, i);
+        addr2 = nodecache_insert(&reader, FILE_PTR(1), i, buf, NULL, NULL);
+        TEST_CHK(_check_block(addr2, 1, i));
+    }
+    TEST_CHK(nodecache_get_num_blocks() == 16);
+    // evicted blocks are still valid until the readers leave
+    TEST_CHK(_check_block(addr, 0, 3));
+
+    // remove all blocks of a file
+    nodecache_remove_file(FILE_PTR(1));
+    for (i=0;i<32;++i){
+        TEST_CHK(nodecache_get(&reader, FILE_PTR(1), i) == NULL);
+    }
+    TEST_CHK(_check_block(addr2, 1, 31));
+    nodecache_read_end(&reader);
+    nodecache_read_end(&reader2);
+
+    nodecache_reader_unregister(&reader);
+    nodecache_shutdown();
+    // unregistering after shutdown is harmless
+    nodecache_reader_unregister(&reader2);
+
+    memleak_end();
+
+    TEST_RESULT("basic test");
+}
+
+struct worker_args {
+    int nfiles;
+    int nbids;
+    int nops;
+    int ok;
+};
+
+void * worker(void *voidargs)
+{
+    struct worker_args *args = (struct worker_args *)voidargs;
+    struct nodecache_reader reader;
+    uint8_t *buf = (uint8_t *)malloc(BLOCKSIZE);
+    void **addrs = (void **)malloc(sizeof(void *) * 8);
+    int *files = (int *)malloc(sizeof(int) * 8);
+    bid_t *bids = (bid_t *)malloc(sizeof(bid_t) * 8);
+    int i, j, f;
+    bid_t bid;
+    void *addr;
+
+    args->ok = 1;
+    nodecache_reader_register(&reader);
+    for (i=0;i<args->nops;++i){
+        // each operation refers to several blocks at once,
+        // and checks them all before leaving
+        for (j=0;j<8;++j){
+            f = rand() % args->nfiles;
+            bid = rand() % args->nbids;
+            addr = nodecache_get(&reader, FILE_PTR(f), bid);
+            if (addr == NULL) {
+                _fill_block(buf, f, bid);
+                addr = nodecache_insert(&reader, FILE_PTR(f), bid, buf,
+                                        NULL, NULL);
+            }
+            addrs[j] = addr;
+            files[j] = f;
+            bids[j] = bid;
+        }
+        for (j=0;j<8;++j){
+            if (!_check_block(addrs[j], files[j], bids[j])) {
+                args->ok = 0;
+            }
+        }
+        nodecache_read_end(&reader);
+
+        if (i % 1000 == 0) {
+            // closing a file
+            nodecache_remove_file(FILE_PTR(rand() % args->nfiles));
+        }
+    }
+    nodecache_reader_unregister(&reader);
+
+    free(buf);
+    free(addrs);
+    free(files);
+    free(bids);
+    return NULL;
+}
+
+// readers share blocks while the others keep evicting them
+void multi_thread_test(int nthreads)
+{
+    TEST_INIT();
+
+    int i;
+    thread_t *tid = alca(thread_t, nthreads);
+    void **ret = alca(void *, nthreads);
+    struct worker_args *args = alca(struct worker_args, nthreads);
+
+    nodecache_init(64, BLOCKSIZE);
+    for (i=0;i<nthreads;++i){
+        args[i].nfiles = 4;
+        args[i].nbids = 64;
+        args[i].nops = 5000;
+        thread_create(&tid[i], worker, &args[i]);
+    }
+    for (i=0;i<nthreads;++i){
+        thread_join(tid[i], &ret[i]);
+        TEST_CHK(args[i].ok);
+    }
+    TEST_CHK(nodecache_get_num_blocks() <= 64);
+    nodecache_shutdown();
+
+    TEST_RESULT("multi thread test");
+}
+
+int main()
+{
+    basic_test();
+    multi_thread_test(8);
+
+    return 0;
+}
@@ -38,6 +38,10 @@ void usleep(unsigned int useconds);
 
 void decaying_usleep(unsigned int *sleep_time, unsigned int max_sleep_time);
 
+#if !defined(WIN32) && !defined(_WIN32)
+struct timespec convert_reltime_to_abstime(unsigned int ms);
+#endif
+
 #ifdef __cplusplus
 }
 #endif